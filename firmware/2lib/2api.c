@@ -206,3 +206,69 @@ int vb2api_get_pcr_digest(struct vb2_context *ctx,
 
 	return VB2_SUCCESS;
 }
+
+int vb2api_queue_pcr_extend(struct vb2_context *ctx,
+			    uint32_t pcr,
+			    const uint8_t *digest,
+			    uint32_t digest_size)
+{
+	struct vb2_shared_data *sd = vb2_get_sd(ctx);
+	struct vb2_pcr_extend *ext;
+
+	if (!digest_size || digest_size > VB2_PCR_EXTEND_DIGEST_SIZE)
+		return VB2_ERROR_API_PCR_QUEUE_DIGEST_SIZE;
+
+	if (sd->pcr_queue_count >= VB2_PCR_QUEUE_SIZE)
+		return VB2_ERROR_API_PCR_QUEUE_FULL;
+
+	ext = &sd->pcr_queue[sd->pcr_queue_count++];
+	ext->pcr = pcr;
+	ext->digest_size = digest_size;
+	memset(ext->digest, 0, sizeof(ext->digest));
+	memcpy(ext->digest, digest, digest_size);
+
+	return VB2_SUCCESS;
+}
+
+int vb2api_extend_pcrs(struct vb2_context *ctx)
+{
+	struct vb2_shared_data *sd = vb2_get_sd(ctx);
+	struct vb2_pcr_extend extends[2 + VB2_PCR_QUEUE_SIZE];
+	uint32_t count = 0;
+	uint32_t digest_size;
+	int i, rv;
+
+	/* Digests shorter than the buffer are padded with zeroes */
+	memset(extends, 0, sizeof(extends));
+
+	/* Boot mode and HWID go first, and only once per boot */
+	if (!(sd->status & VB2_SD_STATUS_PCRS_EXTENDED)) {
+		for (i = BOOT_MODE_PCR; i <= HWID_DIGEST_PCR; i++) {
+			digest_size = sizeof(extends[count].digest);
+			rv = vb2api_get_pcr_digest(ctx, i,
+						   extends[count].digest,
+						   &digest_size);
+			if (rv)
+				return rv;
+			extends[count].pcr = i;
+			extends[count].digest_size = digest_size;
+			count++;
+		}
+	}
+
+	memcpy(extends + count, sd->pcr_queue,
+	       sd->pcr_queue_count * sizeof(sd->pcr_queue[0]));
+	count += sd->pcr_queue_count;
+
+	if (!count)
+		return VB2_SUCCESS;
+
+	rv = vb2ex_tpm_extend_pcrs(ctx, extends, count);
+	if (rv)
+		return rv;
+
+	sd->status |= VB2_SD_STATUS_PCRS_EXTENDED;
+	sd->pcr_queue_count = 0;
+
+	return VB2_SUCCESS;
+}
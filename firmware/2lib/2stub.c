@@ -28,6 +28,14 @@ int vb2ex_tpm_clear_owner(struct vb2_context *ctx)
 	return VB2_ERROR_EX_TPM_CLEAR_OWNER_UNIMPLEMENTED;
 }
 
+__attribute__((weak))
+int vb2ex_tpm_extend_pcrs(struct vb2_context *ctx,
+			  const struct vb2_pcr_extend *extends,
+			  uint32_t count)
+{
+	return VB2_ERROR_EX_TPM_EXTEND_PCRS_UNIMPLEMENTED;
+}
+
 __attribute__((weak))
 int vb2ex_read_resource(struct vb2_context *ctx,
 			enum vb2_resource_index index,
@@ -27,6 +27,7 @@
 #include "2id.h"
 #include "2recovery_reasons.h"
 #include "2return_codes.h"
+#include "2struct.h"
 
 /*
  * Size of non-volatile data used by vboot.
@@ -580,6 +581,39 @@ int vb2api_get_pcr_digest(struct vb2_context *ctx,
 			  uint8_t *dest,
 			  uint32_t *dest_size);
 
+/**
+ * Queue a PCR extension, to be done by the next vb2api_extend_pcrs().
+ *
+ * This allows measurements taken during verification to be extended into
+ * the TPM together with the boot mode and HWID digests.
+ *
+ * @param ctx		Vboot context
+ * @param pcr		PCR to extend
+ * @param digest	Digest to extend the PCR with
+ * @param digest_size	Size of digest; at most VB2_PCR_EXTEND_DIGEST_SIZE
+ * @return VB2_SUCCESS, or error code on error
+ */
+int vb2api_queue_pcr_extend(struct vb2_context *ctx,
+			    uint32_t pcr,
+			    const uint8_t *digest,
+			    uint32_t digest_size);
+
+/**
+ * Extend all pending measurements into the TPM PCRs.
+ *
+ * The first call extends BOOT_MODE_PCR and HWID_DIGEST_PCR with their
+ * digests (see vb2api_get_pcr_digest()), followed by any extensions queued
+ * by vb2api_queue_pcr_extend().  Later calls only extend newly queued
+ * extensions.  All of them are passed to the caller in a single
+ * vb2ex_tpm_extend_pcrs() call.
+ *
+ * Should be called after vb2api_fw_phase1(), once the boot mode is known.
+ *
+ * @param ctx		Vboot context
+ * @return VB2_SUCCESS, or error code on error
+ */
+int vb2api_extend_pcrs(struct vb2_context *ctx);
+
 /**
  * Prepare for kernel verification stage.
  *
@@ -655,6 +689,21 @@ int vb2api_kernel_phase3(struct vb2_context *ctx);
  */
 int vb2ex_tpm_clear_owner(struct vb2_context *ctx);
 
+/**
+ * Extend TPM PCRs.
+ *
+ * Extensions must be done in the given order.  A TPM supporting several
+ * digests per extend command (such as TPM2_PCR_Extend) may combine them.
+ *
+ * @param ctx		Vboot context
+ * @param extends	PCR extensions to do
+ * @param count		Number of PCR extensions
+ * @return VB2_SUCCESS, or error code on error.
+ */
+int vb2ex_tpm_extend_pcrs(struct vb2_context *ctx,
+			  const struct vb2_pcr_extend *extends,
+			  uint32_t count);
+
 /**
  * Read a verified boot resource.
  *
@@ -580,6 +580,12 @@ enum vb2_return_code {
 	/* Digest buffer passed into vb2api_check_hash incorrect. */
 	VB2_ERROR_API_CHECK_DIGEST_SIZE,
 
+	/* No room left to queue a PCR extension */
+	VB2_ERROR_API_PCR_QUEUE_FULL,
+
+	/* Bad digest size passed to vb2api_queue_pcr_extend() */
+	VB2_ERROR_API_PCR_QUEUE_DIGEST_SIZE,
+
 	/**********************************************************************
 	 * Errors which may be generated by implementations of vb2ex functions.
 	 * Implementation may also return its own specific errors, which should
@@ -606,6 +612,9 @@ enum vb2_return_code {
 	/* Hardware crypto engine doesn't support this algorithm (non-fatal) */
 	VB2_ERROR_EX_HWCRYPTO_UNSUPPORTED,
 
+	/* TPM extend PCRs not implemented */
+	VB2_ERROR_EX_TPM_EXTEND_PCRS_UNIMPLEMENTED,
+
 
 	/**********************************************************************
 	 * Errors generated by host library (non-firmware) start here.
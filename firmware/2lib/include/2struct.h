@@ -23,6 +23,28 @@
 #define VB2_KEY_BLOCK_FLAG_RECOVERY_1   0x08 /* Recovery mode */
 #define VB2_GBB_HWID_DIGEST_SIZE	32
 
+/* Maximum size of a digest to extend a PCR with */
+#define VB2_PCR_EXTEND_DIGEST_SIZE	32
+
+/* Number of PCR extensions which can be queued by vb2api_queue_pcr_extend() */
+#define VB2_PCR_QUEUE_SIZE		4
+
+/* PCR extension passed to vb2ex_tpm_extend_pcrs() */
+struct vb2_pcr_extend {
+	/* PCR to extend */
+	uint32_t pcr;
+
+	/* Size of digest in bytes */
+	uint32_t digest_size;
+
+	/*
+	 * Digest to extend the PCR with.  Bytes past digest_size are zero, so
+	 * a TPM which always extends VB2_PCR_EXTEND_DIGEST_SIZE bytes gets a
+	 * zero-padded digest.
+	 */
+	uint8_t digest[VB2_PCR_EXTEND_DIGEST_SIZE];
+} __attribute__((packed));
+
 /****************************************************************************/
 
 /* Flags for vb2_shared_data.flags */
@@ -68,6 +90,9 @@ enum vb2_shared_data_status {
 
 	/* Secure data kernel version space initialized */
 	VB2_SD_STATUS_SECDATAK_INIT = (1 << 4),
+
+	/* Boot mode and HWID digests have been extended into PCRs */
+	VB2_SD_STATUS_PCRS_EXTENDED = (1 << 5),
 };
 
 /*
@@ -183,6 +208,10 @@ struct vb2_shared_data {
 	/* Amount of data we still expect to hash */
 	uint32_t hash_remaining_size;
 
+	/* PCR extensions queued until the next vb2api_extend_pcrs() */
+	uint32_t pcr_queue_count;
+	struct vb2_pcr_extend pcr_queue[VB2_PCR_QUEUE_SIZE];
+
 	/**********************************************************************
 	 * Temporary variables used during kernel verification.  These don't
 	 * really need to persist through to the OS, but there's nowhere else
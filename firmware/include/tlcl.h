@@ -45,6 +45,15 @@ uint32_t TlclSendReceive(const uint8_t *request, uint8_t *response,
  */
 int TlclPacketSize(const uint8_t *packet);
 
+/**
+ * Enable (nonzero) or disable caching of TPM state queries: permanent and
+ * ST_CLEAR flags, ownership and NVRAM space permissions.  Cached responses
+ * are dropped by any command that may change the TPM state (including raw
+ * commands sent by TlclSendReceive()), and by TlclLibInit() and
+ * TlclLibClose().  Caching is disabled by default.
+ */
+void TlclSetCaching(int enable);
+
 /* Commands */
 
 /**
@@ -203,7 +212,8 @@ uint32_t TlclGetFlags(uint8_t *disable, uint8_t *deactivated,
 uint32_t TlclSetGlobalLock(void);
 
 /**
- * Perform a TPM_Extend.
+ * Perform a TPM_Extend.  [in_digest] is TPM_PCR_DIGEST bytes long.  On TPM2,
+ * the SHA-256 bank of the PCR is extended and [out_digest] is not updated.
  */
 uint32_t TlclExtend(int pcr_num, const uint8_t *in_digest, uint8_t *out_digest);
 
@@ -33,10 +33,16 @@ extern "C" {
 #define TPM2_NV_ReadLock       ((TPM_CC)0x0000014F)
 #define TPM2_NV_ReadPublic     ((TPM_CC)0x00000169)
 #define TPM2_GetCapability     ((TPM_CC)0x0000017A)
+#define TPM2_PCR_Extend        ((TPM_CC)0x00000182)
+
+/* TPM2 response codes. */
+#define TPM_RC_INITIALIZE      ((uint32_t)0x00000100)
 
 #define HR_SHIFT               24
 #define TPM_HT_NV_INDEX        0x01
+#define TPM_HT_PCR             0x00
 #define HR_NV_INDEX           (TPM_HT_NV_INDEX <<  HR_SHIFT)
+#define HR_PCR                (TPM_HT_PCR <<  HR_SHIFT)
 #define TPM_RH_OWNER        0x40000001
 #define TPM_RH_PLATFORM     0x4000000C
 #define TPM_RS_PW           0x40000009
@@ -67,6 +73,9 @@ extern "C" {
 #define TPM_ALG_SHA256			((TPM_ALG_ID)0x000B)
 #define TPM_ALG_NULL			((TPM_ALG_ID)0x0010)
 
+/* Digest sizes. */
+#define TPM_SHA256_DIGEST_SIZE		32
+
 /* NV index attributes. */
 #define TPMA_NV_PPWRITE			((TPMA_NV)(1UL << 0))
 #define TPMA_NV_OWNERWRITE		((TPMA_NV)(1UL << 1))
@@ -114,6 +123,7 @@ typedef uint32_t TPM_CC;
 typedef uint32_t TPM_HANDLE;
 typedef TPM_HANDLE TPMI_RH_NV_INDEX;
 typedef TPM_HANDLE TPMI_RH_ENABLES;
+typedef TPM_HANDLE TPMI_DH_PCR;
 typedef uint32_t TPM_CAP;
 typedef uint32_t TPM_PT;
 typedef uint16_t TPM_SU;
@@ -161,6 +171,17 @@ typedef struct {
 	uint16_t dataSize;
 } TPMS_NV_PUBLIC;
 
+typedef struct {
+	TPMI_ALG_HASH hashAlg;
+	uint8_t digest[TPM_SHA256_DIGEST_SIZE];
+} TPMT_HA;
+
+/* Only a single digest, for the SHA-256 bank, is supported. */
+typedef struct {
+	uint32_t count;
+	TPMT_HA digests[1];
+} TPML_DIGEST_VALUES;
+
 struct tpm2_nv_define_space_cmd {
 	TPM2B auth;
 	TPMS_NV_PUBLIC publicInfo;
@@ -190,6 +211,11 @@ struct tpm2_nv_read_public_cmd {
 	TPMI_RH_NV_INDEX nvIndex;
 };
 
+struct tpm2_pcr_extend_cmd {
+	TPMI_DH_PCR pcrHandle;
+	TPML_DIGEST_VALUES digests;
+};
+
 struct tpm2_hierarchy_control_cmd {
 	TPMI_RH_ENABLES enable;
 	TPMI_YES_NO state;
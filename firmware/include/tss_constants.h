@@ -37,6 +37,7 @@
  */
 #define TPM_E_AUTHFAIL              ((uint32_t) 0x00000001)
 #define TPM_E_BADINDEX              ((uint32_t) 0x00000002)
+#define TPM_E_DISABLED_CMD          ((uint32_t) 0x00000008)
 #define TPM_E_BAD_ORDINAL           ((uint32_t) 0x0000000a)
 #define TPM_E_OWNER_SET             ((uint32_t) 0x00000014)
 #define TPM_E_BADTAG                ((uint32_t) 0x0000001e)
@@ -128,10 +128,28 @@ uint32_t RollbackKernelRead(uint32_t *version);
 uint32_t RollbackKernelWrite(uint32_t version);
 
 /**
- * Lock must be called.  Internally, it's ignored in recovery mode.
+ * Lock must be called.  Internally, it's ignored in recovery mode.  Writes
+ * deferred by RollbackDeferWrites() are committed first.
  */
 uint32_t RollbackKernelLock(int recovery_mode);
 
+/**
+ * Defer writes to the firmware and kernel spaces.  Until
+ * RollbackCommitWrites() (or RollbackKernelLock()) is called,
+ * RollbackKernelWrite() and SetVirtualDevMode() only change a copy of the
+ * space (which later reads return), so several changes in one boot cost at
+ * most one TPM write per space, and changes that don't modify the space cost
+ * none.
+ */
+void RollbackDeferWrites(void);
+
+/**
+ * Write the spaces changed since RollbackDeferWrites(), and stop deferring
+ * writes.  Both spaces are written even if one of the writes fails; the first
+ * error is returned, and pending changes are dropped.
+ */
+uint32_t RollbackCommitWrites(void);
+
 /**
  * Read and validate firmware management parameters.
  *
@@ -40,6 +40,15 @@ uint32_t RollbackKernelLock(int recovery_mode)
 	return TPM_SUCCESS;
 }
 
+void RollbackDeferWrites(void)
+{
+}
+
+uint32_t RollbackCommitWrites(void)
+{
+	return TPM_SUCCESS;
+}
+
 uint32_t RollbackFwmpRead(struct RollbackSpaceFwmp *fwmp)
 {
 	memset(fwmp, 0, sizeof(*fwmp));
@@ -143,12 +143,78 @@ uint32_t WriteSpaceFirmware(RollbackSpaceFirmware *rsf)
 	return TPM_E_CORRUPTED_STATE;
 }
 
+/*
+ * Copies of the spaces while writes are deferred (see RollbackDeferWrites),
+ * and whether they were changed since being read from the TPM.
+ */
+static struct {
+	int deferring;
+	int has_rsf, rsf_dirty;
+	int has_rsk, rsk_dirty;
+	RollbackSpaceFirmware rsf;
+	RollbackSpaceKernel rsk;
+} pending;
+
+/* Reads the firmware space, or its pending copy if writes are deferred. */
+static uint32_t ReadPendingFirmware(RollbackSpaceFirmware *rsf)
+{
+	if (!pending.deferring)
+		return ReadSpaceFirmware(rsf);
+
+	if (!pending.has_rsf) {
+		RETURN_ON_FAILURE(ReadSpaceFirmware(&pending.rsf));
+		pending.has_rsf = 1;
+	}
+	memcpy(rsf, &pending.rsf, sizeof(*rsf));
+	return TPM_SUCCESS;
+}
+
+/*
+ * Writes the firmware space, or (if writes are deferred) updates its pending
+ * copy, which must have been read by ReadPendingFirmware().
+ */
+static uint32_t WritePendingFirmware(RollbackSpaceFirmware *rsf)
+{
+	if (!pending.deferring)
+		return WriteSpaceFirmware(rsf);
+
+	if (memcmp(&pending.rsf, rsf, sizeof(*rsf))) {
+		memcpy(&pending.rsf, rsf, sizeof(*rsf));
+		pending.rsf_dirty = 1;
+	}
+	return TPM_SUCCESS;
+}
+
+void RollbackDeferWrites(void)
+{
+	pending.deferring = 1;
+}
+
+uint32_t RollbackCommitWrites(void)
+{
+	uint32_t r = TPM_SUCCESS, r2;
+
+	/* The spaces are independent, so try to write both. */
+	if (pending.rsf_dirty) {
+		VB2_DEBUG("TPM: Committing firmware space\n");
+		r = WriteSpaceFirmware(&pending.rsf);
+	}
+	if (pending.rsk_dirty) {
+		VB2_DEBUG("TPM: Committing kernel space\n");
+		r2 = WriteSpaceKernel(&pending.rsk);
+		if (r == TPM_SUCCESS)
+			r = r2;
+	}
+	memset(&pending, 0, sizeof(pending));
+	return r;
+}
+
 uint32_t SetVirtualDevMode(int val)
 {
 	RollbackSpaceFirmware rsf;
 
 	VB2_DEBUG("TPM: Entering");
-	if (TPM_SUCCESS != ReadSpaceFirmware(&rsf))
+	if (TPM_SUCCESS != ReadPendingFirmware(&rsf))
 		return VBERROR_TPM_FIRMWARE_SETUP;
 
 	VB2_DEBUG("TPM: flags were 0x%02x\n", rsf.flags);
@@ -162,7 +228,7 @@ uint32_t SetVirtualDevMode(int val)
 	 */
 	VB2_DEBUG("TPM: flags are now 0x%02x\n", rsf.flags);
 
-	if (TPM_SUCCESS != WriteSpaceFirmware(&rsf))
+	if (TPM_SUCCESS != WritePendingFirmware(&rsf))
 		return VBERROR_TPM_SET_BOOT_MODE_STATE;
 
 	VB2_DEBUG("TPM: Leaving\n");
@@ -255,7 +321,7 @@ uint32_t RollbackKernelWrite(uint32_t version)
 
 uint32_t RollbackKernelLock(int recovery_mode)
 {
-	return TPM_SUCCESS;
+	return RollbackCommitWrites();
 }
 
 uint32_t RollbackFwmpRead(struct RollbackSpaceFwmp *fwmp)
@@ -266,6 +332,33 @@ uint32_t RollbackFwmpRead(struct RollbackSpaceFwmp *fwmp)
 
 #else
 
+/* Same as ReadPendingFirmware(), for the kernel space. */
+static uint32_t ReadPendingKernel(RollbackSpaceKernel *rsk)
+{
+	if (!pending.deferring)
+		return ReadSpaceKernel(rsk);
+
+	if (!pending.has_rsk) {
+		RETURN_ON_FAILURE(ReadSpaceKernel(&pending.rsk));
+		pending.has_rsk = 1;
+	}
+	memcpy(rsk, &pending.rsk, sizeof(*rsk));
+	return TPM_SUCCESS;
+}
+
+/* Same as WritePendingFirmware(), for the kernel space. */
+static uint32_t WritePendingKernel(RollbackSpaceKernel *rsk)
+{
+	if (!pending.deferring)
+		return WriteSpaceKernel(rsk);
+
+	if (memcmp(&pending.rsk, rsk, sizeof(*rsk))) {
+		memcpy(&pending.rsk, rsk, sizeof(*rsk));
+		pending.rsk_dirty = 1;
+	}
+	return TPM_SUCCESS;
+}
+
 uint32_t RollbackKernelRead(uint32_t* version)
 {
 	RollbackSpaceKernel rsk;
@@ -278,7 +371,7 @@ uint32_t RollbackKernelRead(uint32_t* version)
 	 * (even with PP turned off) the TPM owner can remove and redefine a
 	 * PP-protected space (but not write to it).
 	 */
-	RETURN_ON_FAILURE(ReadSpaceKernel(&rsk));
+	RETURN_ON_FAILURE(ReadPendingKernel(&rsk));
 #ifndef TPM2_MODE
 	/*
 	 * TODO(vbendeb): restore this when it is defined how the kernel space
@@ -303,12 +396,12 @@ uint32_t RollbackKernelWrite(uint32_t version)
 {
 	RollbackSpaceKernel rsk;
 	uint32_t old_version;
-	RETURN_ON_FAILURE(ReadSpaceKernel(&rsk));
+	RETURN_ON_FAILURE(ReadPendingKernel(&rsk));
 	memcpy(&old_version, &rsk.kernel_versions, sizeof(old_version));
 	VB2_DEBUG("TPM: RollbackKernelWrite %x --> %x\n",
 		  (int)old_version, (int)version);
 	memcpy(&rsk.kernel_versions, &version, sizeof(version));
-	return WriteSpaceKernel(&rsk);
+	return WritePendingKernel(&rsk);
 }
 
 uint32_t RollbackKernelLock(int recovery_mode)
@@ -316,6 +409,9 @@ uint32_t RollbackKernelLock(int recovery_mode)
 	static int kernel_locked = 0;
 	uint32_t r;
 
+	/* The kernel space can't be written after locking. */
+	RETURN_ON_FAILURE(RollbackCommitWrites());
+
 	if (recovery_mode || kernel_locked)
 		return TPM_SUCCESS;
 
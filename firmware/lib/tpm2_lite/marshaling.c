@@ -10,7 +10,6 @@
 #include "tpm2_marshaling.h"
 #include "utility.h"
 
-static uint16_t tpm_tag;  /* Depends on the command type. */
 static int ph_disabled;   /* Platform hierarchy disabled. */
 
 static void write_be16(void *dest, uint16_t val)
@@ -46,422 +45,248 @@ static inline uint32_t read_be32(const void *src)
 }
 
 /*
- * Each unmarshaling function receives a pointer to the buffer pointer and a
- * pointer to the size of data still in the buffer. The function extracts data
- * from the buffer and adjusts both buffer pointer and remaining data size.
- *
- * Should there be not enough data in the buffer to unmarshal the required
- * object, the remaining data size is set to -1 to indicate the error. The
- * remaining data size is expected to be set to zero once the last data item
- * has been extracted from the buffer.
- */
-
-static uint8_t unmarshal_u8(void **buffer, int *buffer_space)
-{
-	uint8_t value;
-
-	if (*buffer_space < sizeof(value)) {
-		*buffer_space = -1; /* Indicate a failure. */
-		return 0;
-	}
-
-	value = *(uint8_t *)(*buffer);
-	*buffer = (void *) ((uintptr_t) (*buffer) + sizeof(value));
-	*buffer_space -= sizeof(value);
-
-	return value;
-}
-
-static uint16_t unmarshal_u16(void **buffer, int *buffer_space)
-{
-	uint16_t value;
-
-	if (*buffer_space < sizeof(value)) {
-		*buffer_space = -1; /* Indicate a failure. */
-		return 0;
-	}
-
-	value = read_be16(*buffer);
-	*buffer = (void *) ((uintptr_t) (*buffer) + sizeof(value));
-	*buffer_space -= sizeof(value);
-
-	return value;
-}
-
-static uint32_t unmarshal_u32(void **buffer, int *buffer_space)
-{
-	uint32_t value;
-
-	if (*buffer_space < sizeof(value)) {
-		*buffer_space = -1; /* Indicate a failure. */
-		return 0;
-	}
-
-	value = read_be32(*buffer);
-	*buffer = (void *) ((uintptr_t) (*buffer) + sizeof(value));
-	*buffer_space -= sizeof(value);
-
-	return value;
-}
-
-#define unmarshal_TPM_HANDLE(a, b) unmarshal_u32(a, b)
-#define unmarshal_ALG_ID(a, b) unmarshal_u16(a, b)
-
-static void unmarshal_TPM2B_MAX_NV_BUFFER(void **buffer,
-					  int *size,
-					  TPM2B_MAX_NV_BUFFER *nv_buffer)
-{
-	nv_buffer->t.size = unmarshal_u16(buffer, size);
-	if (nv_buffer->t.size > *size) {
-		VB2_DEBUG("size mismatch: expected %d, remaining %d\n",
-			  nv_buffer->t.size, *size);
-		return;
-	}
-
-	nv_buffer->t.buffer = *buffer;
-
-	*buffer = ((uint8_t *)(*buffer)) + nv_buffer->t.size;
-	*size -= nv_buffer->t.size;
-}
-
-static void unmarshal_authorization_section(void **buffer, int *size,
-					    char *cmd_name)
-{
-	/*
-	 * Let's ignore the authorisation section. It should be 5 bytes total,
-	 * just confirm that this is the case and report any discrepancy.
-	 */
-	if (*size != 5)
-		VB2_DEBUG("unexpected authorisation section size %d for %s\n",
-			  *size, cmd_name);
-
-	*buffer = ((uint8_t *)(*buffer)) + *size;
-	*size = 0;
-}
-
-static void unmarshal_nv_read(void **buffer, int *size,
-			      struct nv_read_response *nvr)
-{
-	/* Total size of the parameter field. */
-	nvr->params_size = unmarshal_u32(buffer, size);
-	unmarshal_TPM2B_MAX_NV_BUFFER(buffer, size, &nvr->buffer);
-
-	if (nvr->params_size !=
-	    (nvr->buffer.t.size + sizeof(nvr->buffer.t.size))) {
-		VB2_DEBUG("parameter/buffer %d/%d size mismatch",
-			  nvr->params_size, nvr->buffer.t.size);
-		return;
-	}
-
-	if (*size < 0)
-		return;
-
-	unmarshal_authorization_section(buffer, size, "NV_Read");
-}
-
-static void unmarshal_TPM2B(void **buffer,
-			    int *size,
-			    TPM2B *tpm2b)
-{
-	tpm2b->size = unmarshal_u16(buffer, size);
-	if (tpm2b->size > *size) {
-		VB2_DEBUG("size mismatch: expected %d, remaining %d\n",
-			  tpm2b->size, *size);
-		*size = -1;
-		return;
-	}
-
-	tpm2b->buffer = *buffer;
-
-	*buffer = ((uint8_t *)(*buffer)) + tpm2b->size;
-	*size -= tpm2b->size;
-}
-
-static void unmarshal_TPMS_NV_PUBLIC(void **buffer,
-				     int *size,
-				     TPMS_NV_PUBLIC *pub)
-{
-	int tpm2b_size = unmarshal_u16(buffer, size);
-	if (tpm2b_size > *size) {
-		VB2_DEBUG("size mismatch: expected %d, remaining %d\n",
-			  tpm2b_size, *size);
-		*size = -1;
-		return;
-	}
-	*size -= tpm2b_size;
-
-	pub->nvIndex = unmarshal_TPM_HANDLE(buffer, &tpm2b_size);
-	pub->nameAlg = unmarshal_ALG_ID(buffer, &tpm2b_size);
-	pub->attributes = unmarshal_u32(buffer, &tpm2b_size);
-	unmarshal_TPM2B(buffer, &tpm2b_size, &pub->authPolicy);
-	pub->dataSize = unmarshal_u16(buffer, &tpm2b_size);
-
-	if (tpm2b_size != 0) {
-		VB2_DEBUG("TPMS_NV_PUBLIC size doesn't match size field\n");
-		*size = -1;
-		return;
-	}
-}
-
-static void unmarshal_nv_read_public(void **buffer, int *size,
-				     struct nv_read_public_response *nv_pub)
-{
-	unmarshal_TPMS_NV_PUBLIC(buffer, size, &nv_pub->nvPublic);
-	unmarshal_TPM2B(buffer, size, &nv_pub->nvName);
-
-	if (*size > 0) {
-		VB2_DEBUG("extra %d bytes after nvName\n", *size);
-		*size = -1;
-		return;
-	}
-}
-
-static void unmarshal_TPML_TAGGED_TPM_PROPERTY(void **buffer, int *size,
-					       TPML_TAGGED_TPM_PROPERTY *prop)
-{
-	prop->count = unmarshal_u32(buffer, size);
-
-	if (prop->count != 1) {
-		*size = -1;
-		VB2_DEBUG("Request to unmarshal unsupported "
-			  "number of properties: %u\n",
-			  prop->count);
-		return;
-	}
-
-	prop->tpm_property[0].property = unmarshal_u32(buffer, size);
-	prop->tpm_property[0].value = unmarshal_u32(buffer, size);
-}
-
-static void unmarshal_TPMS_CAPABILITY_DATA(void **buffer, int *size,
-					   TPMS_CAPABILITY_DATA *cap_data)
-{
-	cap_data->capability = unmarshal_u32(buffer, size);
-
-	switch (cap_data->capability) {
-
-	case TPM_CAP_TPM_PROPERTIES:
-		unmarshal_TPML_TAGGED_TPM_PROPERTY(buffer, size,
-						   &cap_data->data.
-						       tpm_properties);
-		break;
-
-	default:
-		*size = -1;
-		VB2_DEBUG("Request to unmarshal unsupported capability %#x\n",
-			  cap_data->capability);
-	}
-}
-
-static void unmarshal_get_capability(void **buffer, int *size,
-				     struct get_capability_response *cap)
-{
-	/* Total size of the parameter field. */
-	cap->more_data = unmarshal_u8(buffer, size);
-	unmarshal_TPMS_CAPABILITY_DATA(buffer, size, &cap->capability_data);
-}
-
-
-/*
- * Each marshaling function receives a pointer to the buffer to marshal into,
- * a pointer to the data item to be marshaled, and a pointer to the remaining
- * room in the buffer.
+ * Commands and responses are described by tables of operations. To marshal
+ * a command, its table is run over the command struct, encoding each field
+ * directly into the command buffer; to unmarshal a response, its table is
+ * run over the response buffer, decoding each field into the response
+ * struct. The argument of an operation is the offset of a field in the
+ * struct, unless noted otherwise.
  */
+enum tpm2_op_type {
+	OP_END = 0,	/* End of the table */
+	OP_U8,
+	OP_U16,
+	OP_U32,
+	OP_TPM2B,	/* TPM2B: 16-bit size, then the data */
+	OP_SIZE16,	/* Start of a section preceded by its 16-bit size;
+			   decoded size is stored in the field, if any */
+	OP_SIZE32,	/* Same, with a 32-bit size */
+	OP_SIZE_END,	/* End of the innermost section */
+
+	/* Commands only */
+	OP_SESSION,		/* Empty password authorization session */
+	OP_AUTH_PLATFORM,	/* Platform hierarchy handle */
+	OP_AUTH_DEFINE,		/* Auth handle to define an NV index with the
+				   attributes in the field */
+	OP_AUTH_NV_READ,	/* Auth handle to read the NV index in the
+				   field */
+	OP_AUTH_NV_WRITE,	/* Auth handle to write the NV index in the
+				   field */
+	OP_SHA256,		/* SHA-256 digest */
+
+	/* Responses only */
+	OP_CHECK,	/* The last decoded value must equal the argument */
+	OP_SKIP_REST,	/* Ignore the rest (the authorization section) */
+};
+
+struct tpm2_op {
+	uint8_t type;
+	uint8_t arg;
+};
+
+/* Argument of the operations which have no field. */
+#define NO_FIELD 0xff
+
+/* Enough operations for the longest command or response. */
+#define TPM2_MAX_OPS 12
+/* Sections with a size may be nested this deep. */
+#define TPM2_MAX_SECTIONS 2
+
+struct tpm2_desc {
+	TPM_CC command;
+	struct tpm2_op ops[TPM2_MAX_OPS];
+};
+
+#define DS(field) offsetof(struct tpm2_nv_define_space_cmd, field)
+#define NVR(field) offsetof(struct tpm2_nv_read_cmd, field)
+#define NVW(field) offsetof(struct tpm2_nv_write_cmd, field)
+#define HC(field) offsetof(struct tpm2_hierarchy_control_cmd, field)
+#define GC(field) offsetof(struct tpm2_get_capability_cmd, field)
+#define PE(field) offsetof(struct tpm2_pcr_extend_cmd, field)
+
+static const struct tpm2_desc command_descs[] = {
+	{TPM2_NV_DefineSpace, {
+		{OP_AUTH_DEFINE, DS(publicInfo.attributes)},
+		{OP_SESSION},
+		{OP_TPM2B, DS(auth)},
+		{OP_SIZE16, NO_FIELD},
+		{OP_U32, DS(publicInfo.nvIndex)},
+		{OP_U16, DS(publicInfo.nameAlg)},
+		{OP_U32, DS(publicInfo.attributes)},
+		{OP_TPM2B, DS(publicInfo.authPolicy)},
+		{OP_U16, DS(publicInfo.dataSize)},
+		{OP_SIZE_END}}},
+	{TPM2_NV_Read, {
+		{OP_AUTH_NV_READ, NVR(nvIndex)},
+		{OP_U32, NVR(nvIndex)},
+		{OP_SESSION},
+		{OP_U16, NVR(size)},
+		{OP_U16, NVR(offset)}}},
+	{TPM2_NV_Write, {
+		{OP_AUTH_NV_WRITE, NVW(nvIndex)},
+		{OP_U32, NVW(nvIndex)},
+		{OP_SESSION},
+		{OP_TPM2B, NVW(data)},
+		{OP_U16, NVW(offset)}}},
+	{TPM2_NV_ReadLock, {
+		{OP_U32, offsetof(struct tpm2_nv_read_lock_cmd, nvIndex)},
+		{OP_U32, offsetof(struct tpm2_nv_read_lock_cmd, nvIndex)},
+		{OP_SESSION}}},
+	{TPM2_NV_WriteLock, {
+		{OP_AUTH_NV_WRITE,
+		 offsetof(struct tpm2_nv_write_lock_cmd, nvIndex)},
+		{OP_U32, offsetof(struct tpm2_nv_write_lock_cmd, nvIndex)},
+		{OP_SESSION}}},
+	{TPM2_NV_ReadPublic, {
+		{OP_U32, offsetof(struct tpm2_nv_read_public_cmd, nvIndex)}}},
+	{TPM2_Hierarchy_Control, {
+		{OP_AUTH_PLATFORM},
+		{OP_SESSION},
+		{OP_U32, HC(enable)},
+		{OP_U8, HC(state)}}},
+	{TPM2_GetCapability, {
+		{OP_U32, GC(capability)},
+		{OP_U32, GC(property)},
+		{OP_U32, GC(property_count)}}},
+	{TPM2_Clear, {
+		{OP_AUTH_PLATFORM},
+		{OP_SESSION}}},
+	{TPM2_PCR_Extend, {
+		{OP_U32, PE(pcrHandle)},
+		{OP_SESSION},
+		{OP_U32, PE(digests.count)},
+		{OP_U16, PE(digests.digests[0].hashAlg)},
+		{OP_SHA256, PE(digests.digests[0].digest)}}},
+	{TPM2_SelfTest, {
+		{OP_U8, offsetof(struct tpm2_self_test_cmd, full_test)}}},
+	{TPM2_Startup, {
+		{OP_U16, offsetof(struct tpm2_startup_cmd, startup_type)}}},
+	{TPM2_Shutdown, {
+		{OP_U16, offsetof(struct tpm2_shutdown_cmd, shutdown_type)}}},
+};
 
 /*
- * Marshaling an arbitrary blob requires its size in addition to common
- * parameter set.
+ * Offsets in responses are from the start of the union in struct
+ * tpm2_response, which all command-specific responses share.
  */
-static void marshal_blob(void **buffer, void *blob,
-			 size_t blob_size, int *buffer_space)
-{
-	if (*buffer_space < blob_size) {
-		*buffer_space = -1;
-		return;
+#define RSP(field) (offsetof(struct tpm2_response, field) - \
+		    offsetof(struct tpm2_response, nvr))
+
+static const struct tpm2_desc response_descs[] = {
+	{TPM2_NV_Read, {
+		{OP_SIZE32, RSP(nvr.params_size)},
+		{OP_TPM2B, RSP(nvr.buffer)},
+		{OP_SIZE_END},
+		{OP_SKIP_REST}}},
+	{TPM2_NV_ReadPublic, {
+		{OP_SIZE16, NO_FIELD},
+		{OP_U32, RSP(nv_read_public.nvPublic.nvIndex)},
+		{OP_U16, RSP(nv_read_public.nvPublic.nameAlg)},
+		{OP_U32, RSP(nv_read_public.nvPublic.attributes)},
+		{OP_TPM2B, RSP(nv_read_public.nvPublic.authPolicy)},
+		{OP_U16, RSP(nv_read_public.nvPublic.dataSize)},
+		{OP_SIZE_END},
+		{OP_TPM2B, RSP(nv_read_public.nvName)}}},
+	{TPM2_GetCapability, {
+		/* Only a single TPM property can be read. */
+		{OP_U8, RSP(cap.more_data)},
+		{OP_U32, RSP(cap.capability_data.capability)},
+		{OP_CHECK, TPM_CAP_TPM_PROPERTIES},
+		{OP_U32, RSP(cap.capability_data.data.tpm_properties.count)},
+		{OP_CHECK, 1},
+		{OP_U32, RSP(cap.capability_data.data.tpm_properties.
+			     tpm_property[0].property)},
+		{OP_U32, RSP(cap.capability_data.data.tpm_properties.
+			     tpm_property[0].value)}}},
+	/* Session data included in these responses can be safely ignored. */
+	{TPM2_Hierarchy_Control, {{OP_SKIP_REST}}},
+	{TPM2_NV_Write, {{OP_SKIP_REST}}},
+	{TPM2_NV_WriteLock, {{OP_SKIP_REST}}},
+	{TPM2_NV_ReadLock, {{OP_SKIP_REST}}},
+	{TPM2_Clear, {{OP_SKIP_REST}}},
+	{TPM2_PCR_Extend, {{OP_SKIP_REST}}},
+	{TPM2_SelfTest, {{OP_SKIP_REST}}},
+	{TPM2_Startup, {{OP_SKIP_REST}}},
+	{TPM2_Shutdown, {{OP_SKIP_REST}}},
+	{TPM2_NV_DefineSpace, {{OP_SKIP_REST}}},
+};
+
+static const struct tpm2_op *find_ops(const struct tpm2_desc *descs,
+				      int num_descs, TPM_CC command)
+{
+	int i;
+
+	for (i = 0; i < num_descs; i++) {
+		if (descs[i].command == command)
+			return descs[i].ops;
 	}
-
-	memcpy(*buffer, blob, blob_size);
-	buffer_space -= blob_size;
-	*buffer = (void *)((uintptr_t)(*buffer) + blob_size);
+	return NULL;
 }
 
-static void marshal_u8(void **buffer, uint8_t value, int *buffer_space)
+/* Fields of the (possibly packed) structs are accessed with memcpy. */
+static uint32_t load_field(const uint8_t *field, int size)
 {
-	uint8_t *bp = *buffer;
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
 
-	if (*buffer_space < sizeof(value)) {
-		*buffer_space = -1;
-		return;
+	if (size == sizeof(u8)) {
+		memcpy(&u8, field, sizeof(u8));
+		return u8;
+	} else if (size == sizeof(u16)) {
+		memcpy(&u16, field, sizeof(u16));
+		return u16;
 	}
-
-	*bp++ = value;
-	*buffer = bp;
-	*buffer_space -= sizeof(value);
+	memcpy(&u32, field, sizeof(u32));
+	return u32;
 }
 
-static void marshal_u16(void **buffer, uint16_t value, int *buffer_space)
+static void store_field(uint8_t *field, int size, uint32_t value)
 {
-	if (*buffer_space < sizeof(value)) {
-		*buffer_space = -1;
-		return;
-	}
-	write_be16(*buffer, value);
-	*buffer = (void *)((uintptr_t)(*buffer) + sizeof(value));
-	*buffer_space -= sizeof(value);
-}
-
-static void marshal_u32(void **buffer, uint32_t value, int *buffer_space)
-{
-	if (*buffer_space < sizeof(value)) {
-		*buffer_space = -1;
-		return;
-	}
-
-	write_be32(*buffer, value);
-	*buffer = (void *)((uintptr_t)(*buffer) + sizeof(value));
-	*buffer_space -= sizeof(value);
-}
+	uint8_t u8 = value;
+	uint16_t u16 = value;
 
-#define marshal_TPM_HANDLE(a, b, c) marshal_u32(a, b, c)
-#define marshal_TPM_SU(a, b, c) marshal_u16(a, b, c)
-#define marshal_ALG_ID(a, b, c) marshal_u16(a, b, c)
-
-/*
- * For TPM2B* structures the size field (16 or 32 bits) goes before the data.
- * When marshaling, we first reserve the space for the size field, then
- * marshal the data, then fill the reserved size field with the actual size
- * of the marshaled data.
- */
-typedef struct {
-	int size;
-	void *location;
-} tpm2_marshal_size_field;
-
-static void marshal_reserve_size_field(void **buffer,
-				       tpm2_marshal_size_field *field,
-				       int field_size,
-				       int *buffer_space)
-{
-	if (field_size != sizeof(uint32_t) && field_size != sizeof(uint16_t)) {
-		VB2_DEBUG("Unsupported size field size: %d\n", field_size);
-		*buffer_space = -1;
-		return;
-	}
-	if (*buffer_space < field_size) {
-		*buffer_space = -1;
-		return;
-	}
-	field->size = field_size;
-	field->location = *buffer;
-	*buffer_space -= field_size;
-	*buffer = (void *)(((uintptr_t) *buffer) + field_size);
-}
-
-static void marshal_fill_size_field(void **buffer,
-				    tpm2_marshal_size_field *field,
-				    int include_size_field,
-				    int *buffer_space)
-{
-	uintptr_t size = (uintptr_t) *buffer - (uintptr_t) field->location;
-
-	if (*buffer_space < 0)
-		return;  /* The structure did not fit. */
-
-	if (!include_size_field)
-		size -= field->size;
-	if (field->size == sizeof(uint32_t))
-		marshal_u32(&field->location, size, &field->size);
-	else /* if (field->size == sizeof(uint16_t)) */
-		marshal_u16(&field->location, size, &field->size);
-}
-
-static void marshal_session_header(void **buffer,
-				   struct tpm2_session_header *session_header,
-				   int *buffer_space)
-{
-	tpm2_marshal_size_field size_field;
-
-	/* Skip room for the session header size. */
-	marshal_reserve_size_field(buffer, &size_field,
-				   sizeof(uint32_t), buffer_space);
-
-	marshal_u32(buffer, session_header->session_handle, buffer_space);
-	marshal_u16(buffer, session_header->nonce_size, buffer_space);
-	marshal_blob(buffer, session_header->nonce,
-		     session_header->nonce_size, buffer_space);
-	marshal_u8(buffer, session_header->session_attrs, buffer_space);
-	marshal_u16(buffer, session_header->auth_size, buffer_space);
-	marshal_blob(buffer, session_header->auth,
-		     session_header->auth_size, buffer_space);
-
-	/* Paste in the session size. */
-	marshal_fill_size_field(buffer, &size_field, 0, buffer_space);
+	if (size == sizeof(u8))
+		memcpy(field, &u8, sizeof(u8));
+	else if (size == sizeof(u16))
+		memcpy(field, &u16, sizeof(u16));
+	else
+		memcpy(field, &value, sizeof(value));
 }
 
-static void marshal_TPM2B(void **buffer,
-			  TPM2B *data,
-			  int *buffer_space)
+/* Size in bytes of the integer encoded by given operation. */
+static int int_size(enum tpm2_op_type type)
 {
-	size_t total_size = data->size + sizeof(data->size);
-
-	if (total_size > *buffer_space) {
-		*buffer_space = -1;
-		return;
+	switch (type) {
+	case OP_U8:
+		return sizeof(uint8_t);
+	case OP_U16:
+	case OP_SIZE16:
+		return sizeof(uint16_t);
+	default:
+		return sizeof(uint32_t);
 	}
-	marshal_u16(buffer, data->size, buffer_space);
-	memcpy(*buffer, data->buffer, data->size);
-	*buffer = ((uint8_t *)(*buffer)) + data->size;
-	*buffer_space -= data->size;
 }
 
-static void marshal_TPMS_NV_PUBLIC(void **buffer,
-				   TPMS_NV_PUBLIC *data,
-				   int *buffer_space)
+static void encode_int(uint8_t *dest, int size, uint32_t value)
 {
-	tpm2_marshal_size_field size_field;
-
-	/* Skip room for the size. */
-	marshal_reserve_size_field(buffer, &size_field,
-				   sizeof(uint16_t), buffer_space);
-
-	marshal_TPM_HANDLE(buffer, data->nvIndex, buffer_space);
-	marshal_ALG_ID(buffer, data->nameAlg, buffer_space);
-	marshal_u32(buffer, data->attributes, buffer_space);
-	marshal_TPM2B(buffer, &data->authPolicy, buffer_space);
-	marshal_u16(buffer, data->dataSize, buffer_space);
-
-	/* Paste in the structure size. */
-	marshal_fill_size_field(buffer, &size_field, 0, buffer_space);
-}
-
-static void marshal_nv_define_space(void **buffer,
-				    struct tpm2_nv_define_space_cmd
-				        *command_body,
-				    int *buffer_space)
-{
-	struct tpm2_session_header session_header;
-
-	/* Use platform authorization if PLATFORMCREATE is set, and owner
-	 * authorization otherwise (per TPM2 Spec. Part 2. Section 31.3.1).
-	 * Owner authorization with empty password will work only until
-	 * ownership is taken. Platform authorization will work only until
-	 * platform hierarchy is disabled (i.e. in firmware or in recovery
-	 * mode).
-	 */
-	if (command_body->publicInfo.attributes & TPMA_NV_PLATFORMCREATE)
-		marshal_TPM_HANDLE(buffer, TPM_RH_PLATFORM, buffer_space);
+	if (size == sizeof(uint8_t))
+		*dest = value;
+	else if (size == sizeof(uint16_t))
+		write_be16(dest, value);
 	else
-		marshal_TPM_HANDLE(buffer, TPM_RH_OWNER, buffer_space);
-
-	memset(&session_header, 0, sizeof(session_header));
-	session_header.session_handle = TPM_RS_PW;
-	marshal_session_header(buffer, &session_header, buffer_space);
-	tpm_tag = TPM_ST_SESSIONS;
-
-	marshal_TPM2B(buffer, &command_body->auth, buffer_space);
-	marshal_TPMS_NV_PUBLIC(buffer, &command_body->publicInfo, buffer_space);
+		write_be32(dest, value);
 }
 
+/* Empty password authorization session, preceded by its size. */
+static const uint8_t pw_session[] = {
+	0x00, 0x00, 0x00, 0x09,		/* Size of the session */
+	0x40, 0x00, 0x00, 0x09,		/* TPM_RS_PW */
+	0x00, 0x00,			/* Empty nonce */
+	0x00,				/* Session attributes */
+	0x00, 0x00,			/* Empty auth value */
+};
+
 /* Determine which authorization should be used when writing or write-locking
  * an NV index.
  *
@@ -487,231 +312,264 @@ static TPM_HANDLE get_nv_index_write_auth(TPMI_RH_NV_INDEX nvIndex)
 	       TPM_RH_PLATFORM;
 }
 
-static void marshal_nv_write(void **buffer,
-			     struct tpm2_nv_write_cmd *command_body,
-			     int *buffer_space)
-{
-	struct tpm2_session_header session_header;
-
-	marshal_TPM_HANDLE(buffer,
-			   get_nv_index_write_auth(command_body->nvIndex),
-			   buffer_space);
-	marshal_TPM_HANDLE(buffer, command_body->nvIndex, buffer_space);
-	memset(&session_header, 0, sizeof(session_header));
-	session_header.session_handle = TPM_RS_PW;
-	marshal_session_header(buffer, &session_header, buffer_space);
-	tpm_tag = TPM_ST_SESSIONS;
-
-	marshal_TPM2B(buffer, &command_body->data.b, buffer_space);
-	marshal_u16(buffer, command_body->offset, buffer_space);
-}
-
-static void marshal_nv_read(void **buffer,
-			    struct tpm2_nv_read_cmd *command_body,
-			    int *buffer_space)
-{
-	struct tpm2_session_header session_header;
-
-	/* Use empty password auth if platform hierarchy is disabled */
-	if (ph_disabled)
-		marshal_TPM_HANDLE(buffer, command_body->nvIndex, buffer_space);
-	else
-		marshal_TPM_HANDLE(buffer, TPM_RH_PLATFORM, buffer_space);
-	marshal_TPM_HANDLE(buffer, command_body->nvIndex, buffer_space);
-	memset(&session_header, 0, sizeof(session_header));
-	session_header.session_handle = TPM_RS_PW;
-	marshal_session_header(buffer, &session_header, buffer_space);
-	tpm_tag = TPM_ST_SESSIONS;
-	marshal_u16(buffer, command_body->size, buffer_space);
-	marshal_u16(buffer, command_body->offset, buffer_space);
-}
-
-static void marshal_nv_read_lock(void **buffer,
-				  struct tpm2_nv_read_lock_cmd *command_body,
-				  int *buffer_space)
-{
-	struct tpm2_session_header session_header;
-
-	tpm_tag = TPM_ST_SESSIONS;
-	marshal_TPM_HANDLE(buffer, command_body->nvIndex, buffer_space);
-	marshal_TPM_HANDLE(buffer, command_body->nvIndex, buffer_space);
-	memset(&session_header, 0, sizeof(session_header));
-	session_header.session_handle = TPM_RS_PW;
-	marshal_session_header(buffer, &session_header, buffer_space);
-}
-
-static void marshal_nv_write_lock(void **buffer,
-				  struct tpm2_nv_write_lock_cmd *command_body,
-				  int *buffer_space)
-{
-	struct tpm2_session_header session_header;
-
-	tpm_tag = TPM_ST_SESSIONS;
-	marshal_TPM_HANDLE(buffer,
-			   get_nv_index_write_auth(command_body->nvIndex),
-			   buffer_space);
-	marshal_TPM_HANDLE(buffer, command_body->nvIndex, buffer_space);
-	memset(&session_header, 0, sizeof(session_header));
-	session_header.session_handle = TPM_RS_PW;
-	marshal_session_header(buffer, &session_header, buffer_space);
-}
-
-static void marshal_nv_read_public(void **buffer,
-				   struct tpm2_nv_read_public_cmd *command_body,
-				   int *buffer_space)
-{
-	tpm_tag = TPM_ST_NO_SESSIONS;
-
-	marshal_TPM_HANDLE(buffer, command_body->nvIndex, buffer_space);
-}
-
-static void marshal_hierarchy_control(void **buffer,
-				      struct tpm2_hierarchy_control_cmd
-				          *command_body,
-				      int *buffer_space)
-{
-	struct tpm2_session_header session_header;
-
-	tpm_tag = TPM_ST_SESSIONS;
-	marshal_TPM_HANDLE(buffer, TPM_RH_PLATFORM, buffer_space);
-	memset(&session_header, 0, sizeof(session_header));
-	session_header.session_handle = TPM_RS_PW;
-	marshal_session_header(buffer, &session_header, buffer_space);
-
-	marshal_TPM_HANDLE(buffer, command_body->enable, buffer_space);
-	marshal_u8(buffer, command_body->state, buffer_space);
-}
-
-static void marshal_get_capability(void **buffer,
-				   struct tpm2_get_capability_cmd
-				       *command_body,
-				   int *buffer_space)
+/*
+ * Encodes the command struct body into buffer, as described by ops. Returns
+ * the number of bytes used, or -1 if the buffer is too small. Sets *tag to
+ * TPM_ST_SESSIONS if the command has an authorization session.
+ */
+static int encode_command(const struct tpm2_op *ops, const uint8_t *body,
+			  uint8_t *buffer, int buffer_size, uint16_t *tag)
 {
-	tpm_tag = TPM_ST_NO_SESSIONS;
+	int sections[TPM2_MAX_SECTIONS];  /* Positions of the size fields */
+	int num_sections = 0;
+	int pos = 0, size, i;
+	uint32_t value;
+	TPM2B tpm2b;
+
+	for (i = 0; i < TPM2_MAX_OPS && ops[i].type != OP_END; i++) {
+		const struct tpm2_op *op = &ops[i];
+
+		switch (op->type) {
+		case OP_SESSION:
+			if (buffer_size - pos < (int)sizeof(pw_session))
+				return -1;
+			memcpy(buffer + pos, pw_session, sizeof(pw_session));
+			pos += sizeof(pw_session);
+			*tag = TPM_ST_SESSIONS;
+			continue;
+
+		case OP_SHA256:
+			if (buffer_size - pos < TPM_SHA256_DIGEST_SIZE)
+				return -1;
+			memcpy(buffer + pos, body + op->arg,
+			       TPM_SHA256_DIGEST_SIZE);
+			pos += TPM_SHA256_DIGEST_SIZE;
+			continue;
+
+		case OP_TPM2B:
+			memcpy(&tpm2b, body + op->arg, sizeof(tpm2b));
+			if (buffer_size - pos < (int)sizeof(uint16_t) +
+			    tpm2b.size)
+				return -1;
+			write_be16(buffer + pos, tpm2b.size);
+			pos += sizeof(uint16_t);
+			memcpy(buffer + pos, tpm2b.buffer, tpm2b.size);
+			pos += tpm2b.size;
+			continue;
+
+		case OP_SIZE_END:
+			/* Paste in the size of the section. */
+			if (!num_sections)
+				return -1;
+			size = sections[--num_sections];
+			encode_int(buffer + size, sizeof(uint16_t),
+				   pos - size - sizeof(uint16_t));
+			continue;
+
+		case OP_SIZE16:
+			/* Leave room for the size, filled in at the end. */
+			if (num_sections == TPM2_MAX_SECTIONS)
+				return -1;
+			sections[num_sections++] = pos;
+			value = 0;
+			break;
+
+		case OP_AUTH_PLATFORM:
+			value = TPM_RH_PLATFORM;
+			break;
+
+		case OP_AUTH_DEFINE:
+			/*
+			 * Use platform authorization if PLATFORMCREATE is
+			 * set, and owner authorization otherwise (per TPM2
+			 * Spec. Part 2. Section 31.3.1). Owner authorization
+			 * with empty password will work only until ownership
+			 * is taken. Platform authorization will work only
+			 * until platform hierarchy is disabled (i.e. in
+			 * firmware or in recovery mode).
+			 */
+			value = load_field(body + op->arg, sizeof(TPMA_NV)) &
+				TPMA_NV_PLATFORMCREATE ?
+				TPM_RH_PLATFORM : TPM_RH_OWNER;
+			break;
+
+		case OP_AUTH_NV_READ:
+			/* Use empty password auth if platform hierarchy is
+			 * disabled */
+			value = ph_disabled ?
+				load_field(body + op->arg, sizeof(TPM_HANDLE)) :
+				TPM_RH_PLATFORM;
+			break;
+
+		case OP_AUTH_NV_WRITE:
+			value = get_nv_index_write_auth(
+				load_field(body + op->arg, sizeof(TPM_HANDLE)));
+			break;
+
+		case OP_U8:
+		case OP_U16:
+		case OP_U32:
+			value = load_field(body + op->arg, int_size(op->type));
+			break;
+
+		default:
+			VB2_DEBUG("Unsupported command operation %d\n",
+				  op->type);
+			return -1;
+		}
 
-	marshal_u32(buffer, command_body->capability, buffer_space);
-	marshal_u32(buffer, command_body->property, buffer_space);
-	marshal_u32(buffer, command_body->property_count, buffer_space);
-}
+		size = int_size(op->type);
+		if (buffer_size - pos < size)
+			return -1;
+		encode_int(buffer + pos, size, value);
+		pos += size;
+	}
 
-static void marshal_clear(void **buffer,
-			  void *command_body,
-			  int *buffer_space)
-{
-	struct tpm2_session_header session_header;
+	if (num_sections)
+		return -1;
 
-	tpm_tag = TPM_ST_SESSIONS;
-	marshal_TPM_HANDLE(buffer, TPM_RH_PLATFORM, buffer_space);
-	memset(&session_header, 0, sizeof(session_header));
-	session_header.session_handle = TPM_RS_PW;
-	marshal_session_header(buffer, &session_header, buffer_space);
+	return pos;
 }
 
-static void marshal_self_test(void **buffer,
-			      struct tpm2_self_test_cmd *command_body,
-			      int *buffer_space)
-{
-	tpm_tag = TPM_ST_NO_SESSIONS;
+/*
+ * Decodes the response parameters in buffer into the response struct body,
+ * as described by ops. Returns 0 if the entire buffer has been parsed, or -1
+ * on error.
+ */
+static int decode_response(const struct tpm2_op *ops, const uint8_t *buffer,
+			   int buffer_size, uint8_t *body)
+{
+	int ends[TPM2_MAX_SECTIONS];  /* Positions of the section ends */
+	int num_sections = 0;
+	int pos = 0, limit, size, i;
+	uint32_t value = 0;
+	TPM2B tpm2b;
+
+	for (i = 0; i < TPM2_MAX_OPS && ops[i].type != OP_END; i++) {
+		const struct tpm2_op *op = &ops[i];
+
+		/* Fields must not run past the end of their section. */
+		limit = num_sections ? ends[num_sections - 1] : buffer_size;
+
+		switch (op->type) {
+		case OP_U8:
+		case OP_U16:
+		case OP_U32:
+		case OP_SIZE16:
+		case OP_SIZE32:
+			size = int_size(op->type);
+			if (limit - pos < size) {
+				VB2_DEBUG("response too short at %d\n", pos);
+				return -1;
+			}
+			if (size == sizeof(uint8_t))
+				value = buffer[pos];
+			else if (size == sizeof(uint16_t))
+				value = read_be16(buffer + pos);
+			else
+				value = read_be32(buffer + pos);
+			pos += size;
+
+			if (op->type == OP_SIZE16 || op->type == OP_SIZE32) {
+				if (value > (uint32_t)(limit - pos) ||
+				    num_sections == TPM2_MAX_SECTIONS) {
+					VB2_DEBUG("size mismatch: expected %d,"
+						  " remaining %d\n",
+						  value, limit - pos);
+					return -1;
+				}
+				ends[num_sections++] = pos + value;
+				if (op->arg == NO_FIELD)
+					break;
+			}
+			store_field(body + op->arg, size, value);
+			break;
+
+		case OP_TPM2B:
+			if (limit - pos < (int)sizeof(uint16_t))
+				return -1;
+			tpm2b.size = read_be16(buffer + pos);
+			pos += sizeof(uint16_t);
+			if (tpm2b.size > limit - pos) {
+				VB2_DEBUG("size mismatch: expected %d,"
+					  " remaining %d\n",
+					  tpm2b.size, limit - pos);
+				return -1;
+			}
+			/* The data is left in the buffer. */
+			tpm2b.buffer = (uint8_t *)buffer + pos;
+			pos += tpm2b.size;
+			memcpy(body + op->arg + offsetof(TPM2B, size),
+			       &tpm2b.size, sizeof(tpm2b.size));
+			memcpy(body + op->arg + offsetof(TPM2B, buffer),
+			       &tpm2b.buffer, sizeof(tpm2b.buffer));
+			break;
+
+		case OP_SIZE_END:
+			if (!num_sections || pos != ends[--num_sections]) {
+				VB2_DEBUG("section size doesn't match"
+					  " size field\n");
+				return -1;
+			}
+			break;
 
-	marshal_u8(buffer, command_body->full_test, buffer_space);
-}
+		case OP_CHECK:
+			if (value != op->arg) {
+				VB2_DEBUG("Request to unmarshal unsupported"
+					  " value %#x\n", value);
+				return -1;
+			}
+			break;
 
-static void marshal_startup(void **buffer,
-			    struct tpm2_startup_cmd *command_body,
-			    int *buffer_space)
-{
-	tpm_tag = TPM_ST_NO_SESSIONS;
+		case OP_SKIP_REST:
+			/* The authorization section is ignored. */
+			pos = buffer_size;
+			break;
 
-	marshal_TPM_SU(buffer, command_body->startup_type, buffer_space);
-}
+		default:
+			VB2_DEBUG("Unsupported response operation %d\n",
+				  op->type);
+			return -1;
+		}
+	}
 
-static void marshal_shutdown(void **buffer,
-			     struct tpm2_shutdown_cmd *command_body,
-			     int *buffer_space)
-{
-	tpm_tag = TPM_ST_NO_SESSIONS;
+	if (pos != buffer_size) {
+		VB2_DEBUG("extra %d bytes in response\n", buffer_size - pos);
+		return -1;
+	}
 
-	marshal_TPM_SU(buffer, command_body->shutdown_type, buffer_space);
+	return 0;
 }
 
 int tpm_marshal_command(TPM_CC command, void *tpm_command_body,
 			void *buffer, int buffer_size)
 {
-	void *cmd_body = (uint8_t *)buffer + sizeof(struct tpm_header);
-	int max_body_size = buffer_size - sizeof(struct tpm_header);
-	int body_size = max_body_size;
-
-	/* Will be modified when marshaling some commands. */
-	tpm_tag = TPM_ST_NO_SESSIONS;
+	const struct tpm2_op *ops = find_ops(command_descs,
+					     ARRAY_SIZE(command_descs),
+					     command);
+	uint16_t tag = TPM_ST_NO_SESSIONS;
+	int body_size;
 
-	switch (command) {
-
-	case TPM2_NV_DefineSpace:
-		marshal_nv_define_space(&cmd_body, tpm_command_body, &body_size);
-		break;
-
-	case TPM2_NV_Read:
-		marshal_nv_read(&cmd_body, tpm_command_body, &body_size);
-		break;
-
-	case TPM2_NV_Write:
-		marshal_nv_write(&cmd_body, tpm_command_body, &body_size);
-		break;
-
-	case TPM2_NV_ReadLock:
-		marshal_nv_read_lock(&cmd_body, tpm_command_body, &body_size);
-		break;
-
-	case TPM2_NV_WriteLock:
-		marshal_nv_write_lock(&cmd_body, tpm_command_body, &body_size);
-		break;
-
-	case TPM2_NV_ReadPublic:
-		marshal_nv_read_public(&cmd_body, tpm_command_body, &body_size);
-		break;
-
-	case TPM2_Hierarchy_Control:
-		marshal_hierarchy_control(&cmd_body,
-					  tpm_command_body, &body_size);
-		break;
-
-	case TPM2_GetCapability:
-		marshal_get_capability(&cmd_body, tpm_command_body, &body_size);
-		break;
-
-	case TPM2_Clear:
-		marshal_clear(&cmd_body, tpm_command_body, &body_size);
-		break;
-
-	case TPM2_SelfTest:
-		marshal_self_test(&cmd_body, tpm_command_body, &body_size);
-		break;
-
-	case TPM2_Startup:
-		marshal_startup(&cmd_body, tpm_command_body, &body_size);
-		break;
-
-	case TPM2_Shutdown:
-		marshal_shutdown(&cmd_body, tpm_command_body, &body_size);
-		break;
-
-	default:
-		body_size = -1;
+	if (!ops) {
 		VB2_DEBUG("Request to marshal unsupported command %#x\n",
 			  command);
+		return -1;
 	}
 
-	if (body_size > 0) {
+	if (buffer_size < (int)sizeof(struct tpm_header))
+		return -1;
 
-		/* See how much room was taken by marshaling. */
-		body_size = max_body_size - body_size;
+	body_size = encode_command(ops, tpm_command_body,
+				   (uint8_t *)buffer + sizeof(struct tpm_header),
+				   buffer_size - sizeof(struct tpm_header),
+				   &tag);
+	if (body_size < 0)
+		return -1;
 
-		body_size += sizeof(struct tpm_header);
-
-		marshal_u16(&buffer, tpm_tag, &max_body_size);
-		marshal_u32(&buffer, body_size, &max_body_size);
-		marshal_u32(&buffer, command, &max_body_size);
-	}
+	body_size += sizeof(struct tpm_header);
+	write_be16(buffer, tag);
+	write_be32((uint8_t *)buffer + 2, body_size);
+	write_be32((uint8_t *)buffer + 6, command);
 
 	return body_size;
 }
@@ -721,12 +579,17 @@ int tpm_unmarshal_response(TPM_CC command,
 			   int cr_size,
 			   struct tpm2_response *response)
 {
-	if (cr_size < sizeof(struct tpm_header))
+	const uint8_t *params = (uint8_t *)response_body +
+		sizeof(struct tpm_header);
+	const struct tpm2_op *ops;
+
+	if (cr_size < (int)sizeof(struct tpm_header))
 		return -1;
 
-	response->hdr.tpm_tag = unmarshal_u16(&response_body, &cr_size);
-	response->hdr.tpm_size = unmarshal_u32(&response_body, &cr_size);
-	response->hdr.tpm_code = unmarshal_u32(&response_body, &cr_size);
+	response->hdr.tpm_tag = read_be16(response_body);
+	response->hdr.tpm_size = tpm_get_packet_size(response_body);
+	response->hdr.tpm_code = tpm_get_packet_response_code(response_body);
+	cr_size -= sizeof(struct tpm_header);
 
 	if (!cr_size) {
 		if (response->hdr.tpm_size != sizeof(response->hdr))
@@ -735,60 +598,28 @@ int tpm_unmarshal_response(TPM_CC command,
 		return 0;
 	}
 
-	switch (command) {
-	case TPM2_NV_Read:
-		unmarshal_nv_read(&response_body, &cr_size,
-				  &response->nvr);
-		break;
-
-	case TPM2_NV_ReadPublic:
-		unmarshal_nv_read_public(&response_body, &cr_size,
-				         &response->nv_read_public);
-		break;
-
-	case TPM2_GetCapability:
-		unmarshal_get_capability(&response_body, &cr_size,
-					 &response->cap);
-		break;
-
-	case TPM2_Hierarchy_Control:
-	case TPM2_NV_Write:
-	case TPM2_NV_WriteLock:
-	case TPM2_NV_ReadLock:
-	case TPM2_Clear:
-	case TPM2_SelfTest:
-	case TPM2_Startup:
-	case TPM2_Shutdown:
-	case TPM2_NV_DefineSpace:
-		/* Session data included in response can be safely ignored. */
-		cr_size = 0;
-		break;
+	ops = find_ops(response_descs, ARRAY_SIZE(response_descs), command);
+	if (!ops) {
+		int i;
 
-	default:
-		{
-			int i;
-
-			VB2_DEBUG("Request to unmarshal unexpected command %#x,"
-				  " code %#x",
-				  command,
-				  response->hdr.tpm_code);
-
-			for (i = 0; i < cr_size; i++) {
-				if (!(i % 16))
-					VB2_DEBUG_RAW("\n");
-				VB2_DEBUG_RAW("%2.2x ",
-					      ((uint8_t *)response_body)[i]);
-			}
+		VB2_DEBUG("Request to unmarshal unexpected command %#x,"
+			  " code %#x",
+			  command,
+			  response->hdr.tpm_code);
+
+		for (i = 0; i < cr_size; i++) {
+			if (!(i % 16))
+				VB2_DEBUG_RAW("\n");
+			VB2_DEBUG_RAW("%2.2x ", params[i]);
 		}
 		VB2_DEBUG("\n");
 		return -1;
 	}
 
-	if (cr_size) {
+	if (decode_response(ops, params, cr_size, (uint8_t *)&response->nvr)) {
 		VB2_DEBUG("got %d bytes back in response to %#x,"
-			  " failed to parse (%d)\n",
-			  response->hdr.tpm_size,
-			  command, cr_size);
+			  " failed to parse\n",
+			  response->hdr.tpm_size, command);
 		return -1;
 	}
 
@@ -18,6 +18,47 @@
 /* Global buffer for deserialized responses. */
 struct tpm2_response tpm2_resp;
 
+/* Maximum number of NV indexes with cached permissions. */
+#define TLCL_CACHE_SPACES 4
+
+/* Responses of TPM property and NV public area queries, see TlclSetCaching. */
+static struct {
+	int enabled;
+	int has_pflags, has_vflags;
+	TPM_PERMANENT_FLAGS pflags;
+	TPM_STCLEAR_FLAGS vflags;
+	int num_spaces;
+	struct {
+		uint32_t index;
+		uint32_t permissions;
+	} spaces[TLCL_CACHE_SPACES];
+} tlcl_cache;
+
+static void tlcl_invalidate_cache(void)
+{
+	int enabled = tlcl_cache.enabled;
+
+	memset(&tlcl_cache, 0, sizeof(tlcl_cache));
+	tlcl_cache.enabled = enabled;
+}
+
+/*
+ * Returns 1 if the command may change TPM properties or NV attributes, for
+ * example, hierarchy control or NV read/write locks.
+ */
+static int tlcl_changes_cached_state(TPM_CC command)
+{
+	switch (command) {
+	case TPM2_GetCapability:
+	case TPM2_NV_Read:
+	case TPM2_NV_ReadPublic:
+	case TPM2_PCR_Extend:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
 /*
  * Serializes and sends the command, gets back the response and
  * parses it into the provided buffer.
@@ -38,7 +79,11 @@ static uint32_t tpm_get_response(TPM_CC command,
 {
 	/* Command/response buffer. */
 	static uint8_t cr_buffer[TPM_BUFFER_SIZE];
-	uint32_t out_size, in_size, res;
+	int out_size;
+	uint32_t in_size, res;
+
+	if (tlcl_changes_cached_state(command))
+		tlcl_invalidate_cache();
 
 	out_size = tpm_marshal_command(command, command_body,
 				       cr_buffer, sizeof(cr_buffer));
@@ -100,6 +145,11 @@ static uint32_t tlcl_read_ph_disabled(void)
 	TPM_STCLEAR_FLAGS flags;
 
 	rv = TlclGetSTClearFlags(&flags);
+	if (rv == TPM_RC_INITIALIZE) {
+		/* Not started yet; Startup will enable the platform hierarchy. */
+		tpm_set_ph_disabled(0);
+		return TPM_SUCCESS;
+	}
 	if (rv == TPM_SUCCESS)
 		tpm_set_ph_disabled(!flags.phEnable);
 
@@ -110,6 +160,7 @@ uint32_t TlclLibInit(void)
 {
 	uint32_t rv;
 
+	tlcl_invalidate_cache();
 	rv = VbExTpmInit();
 	if (rv != TPM_SUCCESS)
 		return rv;
@@ -123,14 +174,23 @@ uint32_t TlclLibInit(void)
 
 uint32_t TlclLibClose(void)
 {
+	tlcl_invalidate_cache();
 	return VbExTpmClose();
 }
 
+void TlclSetCaching(int enable)
+{
+	tlcl_cache.enabled = enable;
+	tlcl_invalidate_cache();
+}
+
 uint32_t TlclSendReceive(const uint8_t *request, uint8_t *response,
 			 int max_length)
 {
 	uint32_t rv, resp_size;
 
+	/* Raw commands are not parsed, so assume they change the state. */
+	tlcl_invalidate_cache();
 	resp_size = max_length;
 	rv = VbExTpmSendReceive(request, tpm_get_packet_size(request),
 				response, &resp_size);
@@ -276,8 +336,15 @@ int TlclIsOwned(void)
 
 uint32_t TlclExtend(int pcr_num, const uint8_t *in_digest, uint8_t *out_digest)
 {
-	VB2_DEBUG("NOT YET IMPLEMENTED\n");
-	return TPM_SUCCESS;
+	struct tpm2_pcr_extend_cmd pcr_ext_cmd;
+
+	pcr_ext_cmd.pcrHandle = HR_PCR + pcr_num;
+	pcr_ext_cmd.digests.count = 1;
+	pcr_ext_cmd.digests.digests[0].hashAlg = TPM_ALG_SHA256;
+	memcpy(pcr_ext_cmd.digests.digests[0].digest, in_digest,
+	       sizeof(pcr_ext_cmd.digests.digests[0].digest));
+
+	return tpm_get_response_code(TPM2_PCR_Extend, &pcr_ext_cmd);
 }
 
 
@@ -305,12 +372,26 @@ uint32_t TlclGetPermissions(uint32_t index, uint32_t *permissions)
 {
 	uint32_t rv;
 	struct nv_read_public_response *resp;
+	int i;
+
+	for (i = 0; i < tlcl_cache.num_spaces; i++) {
+		if (tlcl_cache.spaces[i].index == index) {
+			*permissions = tlcl_cache.spaces[i].permissions;
+			return TPM_SUCCESS;
+		}
+	}
 
 	rv = tlcl_nv_read_public(index, &resp);
-	if (rv == TPM_SUCCESS)
-		*permissions = resp->nvPublic.attributes;
+	if (rv != TPM_SUCCESS)
+		return rv;
 
-	return rv;
+	*permissions = resp->nvPublic.attributes;
+	if (tlcl_cache.enabled && tlcl_cache.num_spaces < TLCL_CACHE_SPACES) {
+		i = tlcl_cache.num_spaces++;
+		tlcl_cache.spaces[i].index = index;
+		tlcl_cache.spaces[i].permissions = *permissions;
+	}
+	return TPM_SUCCESS;
 }
 
 uint32_t TlclGetSpaceInfo(uint32_t index, uint32_t *attributes, uint32_t *size,
@@ -379,14 +460,36 @@ static uint32_t tlcl_get_tpm_property(TPM_PT property, uint32_t *pvalue)
 
 uint32_t TlclGetPermanentFlags(TPM_PERMANENT_FLAGS *pflags)
 {
-	return tlcl_get_tpm_property(TPM_PT_PERMANENT,
-				     (uint32_t *)pflags);
+	uint32_t rv;
+
+	if (tlcl_cache.has_pflags) {
+		*pflags = tlcl_cache.pflags;
+		return TPM_SUCCESS;
+	}
+
+	rv = tlcl_get_tpm_property(TPM_PT_PERMANENT, (uint32_t *)pflags);
+	if (rv == TPM_SUCCESS && tlcl_cache.enabled) {
+		tlcl_cache.pflags = *pflags;
+		tlcl_cache.has_pflags = 1;
+	}
+	return rv;
 }
 
 uint32_t TlclGetSTClearFlags(TPM_STCLEAR_FLAGS *pflags)
 {
-	return tlcl_get_tpm_property(TPM_PT_STARTUP_CLEAR,
-				     (uint32_t *)pflags);
+	uint32_t rv;
+
+	if (tlcl_cache.has_vflags) {
+		*pflags = tlcl_cache.vflags;
+		return TPM_SUCCESS;
+	}
+
+	rv = tlcl_get_tpm_property(TPM_PT_STARTUP_CLEAR, (uint32_t *)pflags);
+	if (rv == TPM_SUCCESS && tlcl_cache.enabled) {
+		tlcl_cache.vflags = *pflags;
+		tlcl_cache.has_vflags = 1;
+	}
+	return rv;
 }
 
 uint32_t TlclGetOwnership(uint8_t *owned)
@@ -0,0 +1,41 @@
+/* Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * In-process TPM simulator for the host TPM stub. It speaks TPM 2.0 when built
+ * with TPM2_MODE (tpm2_simulator.c), and TPM 1.2 otherwise (tpm_simulator.c).
+ */
+
+#ifndef TPM_SIMULATOR_H_
+#define TPM_SIMULATOR_H_
+
+#include <stdint.h>
+
+/*
+ * Opens the simulated TPM, keeping its state in given file. The file is
+ * created (as a freshly manufactured TPM) if it does not exist.
+ *
+ * The simulator is further configured by environment variables:
+ *   TPM_SIMULATOR_RESET=1       power-cycle the TPM, so it needs a Startup
+ *   TPM_SIMULATOR_LATENCY=<bus> add per-command delays of a real part on
+ *                               given bus ("lpc", "spi" or "i2c")
+ *   TPM_SIMULATOR_STATS=1       print command counts when the process exits
+ *
+ * Returns TPM_SUCCESS or an error code.
+ */
+uint32_t tpm_simulator_open(const char *path);
+
+/* Closes the simulated TPM. */
+void tpm_simulator_close(void);
+
+/*
+ * Executes a TPM command. On entry *response_length is the size of the
+ * response buffer; on success it is set to the size of the response.
+ *
+ * Returns TPM_SUCCESS if a response (possibly carrying a TPM error) was
+ * produced, or an error code if the command could not be executed.
+ */
+uint32_t tpm_simulator_execute(const uint8_t *request, uint32_t request_length,
+			       uint8_t *response, uint32_t *response_length);
+
+#endif  /* TPM_SIMULATOR_H_ */
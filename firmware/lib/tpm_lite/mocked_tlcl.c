@@ -107,6 +107,10 @@ uint32_t TlclSetNvLocked(void)
 	return TPM_SUCCESS;
 }
 
+void TlclSetCaching(int enable)
+{
+}
+
 int TlclIsOwned(void)
 {
 	return 0;
@@ -61,6 +61,51 @@ static inline int TpmReturnCode(const uint8_t* buffer)
 	return TpmCommandCode(buffer);
 }
 
+/* Maximum number of NVRAM spaces with cached permissions. */
+#define TLCL_CACHE_SPACES 4
+
+/* Responses of TPM state queries, kept while caching is enabled. */
+static struct {
+	int enabled;
+	int has_pflags, has_vflags, has_owned;
+	TPM_PERMANENT_FLAGS pflags;
+	TPM_STCLEAR_FLAGS vflags;
+	int owned;
+	int num_spaces;
+	struct {
+		uint32_t index;
+		uint32_t permissions;
+	} spaces[TLCL_CACHE_SPACES];
+} tlcl_cache;
+
+/* Drops all cached responses. */
+static void InvalidateCache(void)
+{
+	int enabled = tlcl_cache.enabled;
+
+	memset(&tlcl_cache, 0, sizeof(tlcl_cache));
+	tlcl_cache.enabled = enabled;
+}
+
+/* Returns 1 if a command with given ordinal may change the cached state. */
+static int ChangesCachedState(uint32_t ordinal)
+{
+	switch (ordinal) {
+	case TPM_ORD_Delegate_ReadTable:
+	case TPM_ORD_Extend:
+	case TPM_ORD_GetCapability:
+	case TPM_ORD_GetRandom:
+	case TPM_ORD_NV_ReadValue:
+	case TPM_ORD_OIAP:
+	case TPM_ORD_OSAP:
+	case TPM_ORD_PcrRead:
+	case TPM_ORD_ReadPubek:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
 /* Like TlclSendReceive below, but do not retry if NEEDS_SELFTEST or
  * DOING_SELFTEST errors are returned.
  */
@@ -78,6 +123,10 @@ static uint32_t TlclSendReceiveNoRetry(const uint8_t* request,
 		  request[6], request[7], request[8], request[9]);
 #endif
 
+	/* The command may change the state even if it fails. */
+	if (ChangesCachedState(TpmCommandCode(request)))
+		InvalidateCache();
+
 	result = VbExTpmSendReceive(request, TpmCommandSize(request),
 				    response, &response_length);
 	if (0 != result) {
@@ -392,14 +441,22 @@ uint32_t CheckResponseAuthBlock(struct auth_session* auth_session,
 
 uint32_t TlclLibInit(void)
 {
+	InvalidateCache();
 	return VbExTpmInit();
 }
 
 uint32_t TlclLibClose(void)
 {
+	InvalidateCache();
 	return VbExTpmClose();
 }
 
+void TlclSetCaching(int enable)
+{
+	tlcl_cache.enabled = enable;
+	InvalidateCache();
+}
+
 uint32_t TlclStartup(void)
 {
 	VB2_DEBUG("TPM: Startup\n");
@@ -716,8 +773,18 @@ int TlclIsOwned(void)
 {
 	uint8_t response[TPM_LARGE_ENOUGH_COMMAND_SIZE + TPM_PUBEK_SIZE];
 	uint32_t result;
+
+	if (tlcl_cache.has_owned)
+		return tlcl_cache.owned;
 	result = TlclSendReceive(tpm_readpubek_cmd.buffer,
 				 response, sizeof(response));
+	/* ReadPubek is disabled once the TPM is owned; other errors may be
+	 * transient, so only these two answers are cached. */
+	if (tlcl_cache.enabled &&
+	    (result == TPM_SUCCESS || result == TPM_E_DISABLED_CMD)) {
+		tlcl_cache.owned = (result != TPM_SUCCESS);
+		tlcl_cache.has_owned = 1;
+	}
 	return (result != TPM_SUCCESS);
 }
 
@@ -752,8 +819,14 @@ uint32_t TlclGetPermanentFlags(TPM_PERMANENT_FLAGS* pflags)
 {
 	uint8_t response[TPM_LARGE_ENOUGH_COMMAND_SIZE];
 	uint32_t size;
-	uint32_t result = TlclSendReceive(tpm_getflags_cmd.buffer, response,
-					  sizeof(response));
+	uint32_t result;
+
+	if (tlcl_cache.has_pflags) {
+		memcpy(pflags, &tlcl_cache.pflags, sizeof(*pflags));
+		return TPM_SUCCESS;
+	}
+	result = TlclSendReceive(tpm_getflags_cmd.buffer, response,
+				 sizeof(response));
 	if (result != TPM_SUCCESS)
 		return result;
 	FromTpmUint32(response + kTpmResponseHeaderLength, &size);
@@ -763,6 +836,10 @@ uint32_t TlclGetPermanentFlags(TPM_PERMANENT_FLAGS* pflags)
 	memcpy(pflags,
 	       response + kTpmResponseHeaderLength + sizeof(size),
 	       sizeof(TPM_PERMANENT_FLAGS));
+	if (tlcl_cache.enabled) {
+		memcpy(&tlcl_cache.pflags, pflags, sizeof(*pflags));
+		tlcl_cache.has_pflags = 1;
+	}
 	return result;
 }
 
@@ -770,8 +847,14 @@ uint32_t TlclGetSTClearFlags(TPM_STCLEAR_FLAGS* vflags)
 {
 	uint8_t response[TPM_LARGE_ENOUGH_COMMAND_SIZE];
 	uint32_t size;
-	uint32_t result = TlclSendReceive(tpm_getstclearflags_cmd.buffer,
-					  response, sizeof(response));
+	uint32_t result;
+
+	if (tlcl_cache.has_vflags) {
+		memcpy(vflags, &tlcl_cache.vflags, sizeof(*vflags));
+		return TPM_SUCCESS;
+	}
+	result = TlclSendReceive(tpm_getstclearflags_cmd.buffer,
+				 response, sizeof(response));
 	if (result != TPM_SUCCESS)
 		return result;
 	FromTpmUint32(response + kTpmResponseHeaderLength, &size);
@@ -782,6 +865,10 @@ uint32_t TlclGetSTClearFlags(TPM_STCLEAR_FLAGS* vflags)
 	memcpy(vflags,
 	       response + kTpmResponseHeaderLength + sizeof(size),
 	       sizeof(TPM_STCLEAR_FLAGS));
+	if (tlcl_cache.enabled) {
+		memcpy(&tlcl_cache.vflags, vflags, sizeof(*vflags));
+		tlcl_cache.has_vflags = 1;
+	}
 	return result;
 }
 
@@ -837,9 +924,24 @@ uint32_t TlclGetPermissions(uint32_t index, uint32_t* permissions)
 	uint32_t dummy_attributes;
 	TPM_NV_AUTH_POLICY dummy_policy;
 	uint32_t dummy_policy_size = sizeof(dummy_policy);
+	uint32_t result;
+	int i;
 
-	return TlclGetSpaceInfo(index, permissions, &dummy_attributes,
-				&dummy_policy, &dummy_policy_size);
+	for (i = 0; i < tlcl_cache.num_spaces; i++) {
+		if (tlcl_cache.spaces[i].index == index) {
+			*permissions = tlcl_cache.spaces[i].permissions;
+			return TPM_SUCCESS;
+		}
+	}
+	result = TlclGetSpaceInfo(index, permissions, &dummy_attributes,
+				  &dummy_policy, &dummy_policy_size);
+	if (result == TPM_SUCCESS && tlcl_cache.enabled &&
+	    tlcl_cache.num_spaces < TLCL_CACHE_SPACES) {
+		i = tlcl_cache.num_spaces++;
+		tlcl_cache.spaces[i].index = index;
+		tlcl_cache.spaces[i].permissions = *permissions;
+	}
+	return result;
 }
 
 static int DecodePCRInfo(const uint8_t** cursor,
@@ -352,6 +352,26 @@ static VbError_t vb2_kernel_setup(VbCommonParams *cparams,
 	return VBERROR_SUCCESS;
 }
 
+/*
+ * Write the TPM spaces changed during kernel selection.  In recovery mode only
+ * the firmware space (virtual dev switch) can have changed; otherwise only
+ * the kernel space (kernel versions) can.
+ */
+static VbError_t vb2_kernel_commit_rollback(VbError_t retval)
+{
+	if (TPM_SUCCESS == RollbackCommitWrites())
+		return retval;
+
+	if (ctx.flags & VB2_CONTEXT_RECOVERY_MODE) {
+		VB2_DEBUG("Error writing boot mode to TPM.\n");
+		return VBERROR_TPM_SET_BOOT_MODE_STATE;
+	}
+
+	VB2_DEBUG("Error writing kernel versions to TPM.\n");
+	VbSetRecoveryRequest(&ctx, VB2_RECOVERY_RW_TPM_W_ERROR);
+	return VBERROR_TPM_WRITE_KERNEL;
+}
+
 static VbError_t vb2_kernel_phase4(VbSelectAndLoadKernelParams *kparams)
 {
 	struct vb2_shared_data *sd = vb2_get_sd(&ctx);
@@ -409,7 +429,15 @@ static void vb2_kernel_cleanup(struct vb2_context *ctx, VbCommonParams *cparams)
 VbError_t VbSelectAndLoadKernel(VbCommonParams *cparams,
 				VbSelectAndLoadKernelParams *kparams)
 {
-	VbError_t retval = vb2_kernel_setup(cparams, kparams);
+	VbError_t retval;
+
+	/*
+	 * Collect changes to the TPM spaces, so each space is read once and
+	 * written at most once, below.
+	 */
+	RollbackDeferWrites();
+
+	retval = vb2_kernel_setup(cparams, kparams);
 	if (retval)
 		goto VbSelectAndLoadKernel_exit;
 
@@ -446,6 +474,9 @@ VbError_t VbSelectAndLoadKernel(VbCommonParams *cparams,
 
  VbSelectAndLoadKernel_exit:
 
+	/* The kernel space can only be written before it is locked. */
+	retval = vb2_kernel_commit_rollback(retval);
+
 	if (VBERROR_SUCCESS == retval)
 		retval = vb2_kernel_phase4(kparams);
 
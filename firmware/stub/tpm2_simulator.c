@@ -0,0 +1,1073 @@
+/* Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * In-process TPM 2.0 simulator for the host TPM stub.
+ *
+ * The simulator understands the TPM 2.0 commands sent by the tpm2_lite tlcl
+ * library, with the access rules vboot depends on: platform, owner and
+ * index authorization of NV spaces, the platform hierarchy being disabled
+ * until the next Startup, and NV read and write locks. NV spaces, PCRs and
+ * the hierarchy state are kept in a file, so a sequence of processes (for
+ * example tpmc invocations) sees the same TPM. Only empty-nonce password
+ * sessions are supported, all hierarchies have empty auth values, and NV
+ * space policies are recorded but not enforced. Only the SHA-256 PCR bank
+ * is kept.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "2sysincludes.h"
+#include "2common.h"
+#include "2sha.h"
+
+#include "tlcl.h"
+#include "tlcl_internal.h"
+#include "tpm_simulator.h"
+#include "vboot_api.h"
+
+/* TPM 2.0 response codes not used by the rest of vboot. */
+#define SIM_RC_BAD_TAG		((uint32_t) 0x0000001e)
+#define SIM_RC_AUTH_MISSING	((uint32_t) 0x00000125)
+#define SIM_RC_AUTH_UNAVAILABLE	((uint32_t) 0x0000012f)
+#define SIM_RC_COMMAND_CODE	((uint32_t) 0x00000143)
+#define SIM_RC_AUTHSIZE		((uint32_t) 0x00000144)
+#define SIM_RC_AUTH_CONTEXT	((uint32_t) 0x00000145)
+#define SIM_RC_NV_RANGE		((uint32_t) 0x00000146)
+#define SIM_RC_NV_LOCKED	((uint32_t) 0x00000148)
+#define SIM_RC_NV_AUTHORIZATION	((uint32_t) 0x00000149)
+#define SIM_RC_NV_UNINITIALIZED	((uint32_t) 0x0000014a)
+#define SIM_RC_NV_SPACE		((uint32_t) 0x0000014b)
+#define SIM_RC_NV_DEFINED	((uint32_t) 0x0000014c)
+/* These are reported with the number of the handle, parameter or session */
+#define SIM_RC_ATTRIBUTES	((uint32_t) 0x00000082)
+#define SIM_RC_HASH		((uint32_t) 0x00000083)
+#define SIM_RC_VALUE		((uint32_t) 0x00000084)
+#define SIM_RC_HIERARCHY	((uint32_t) 0x00000085)
+#define SIM_RC_HANDLE		((uint32_t) 0x0000008b)
+#define SIM_RC_SIZE		((uint32_t) 0x00000095)
+#define SIM_RC_INSUFFICIENT	((uint32_t) 0x0000009a)
+#define SIM_RC_BAD_AUTH		((uint32_t) 0x000000a2)
+#define SIM_RC_HANDLE_N(rc, n)	((rc) + ((n) << 8))
+#define SIM_RC_PARAM_N(rc, n)	((rc) + 0x040 + ((n) << 8))
+#define SIM_RC_SESSION_N(rc, n)	((rc) + 0x800 + ((n) << 8))
+
+/* Bits of the TPM_PT_PERMANENT and TPM_PT_STARTUP_CLEAR properties. */
+#define SIM_PERMANENT_TPM_GENERATED_EPS	(1 << 10)
+#define SIM_STARTUP_CLEAR_PH_ENABLE	(1 << 0)
+#define SIM_STARTUP_CLEAR_SH_ENABLE	(1 << 1)
+#define SIM_STARTUP_CLEAR_EH_ENABLE	(1 << 2)
+#define SIM_STARTUP_CLEAR_PH_ENABLE_NV	(1 << 3)
+#define SIM_STARTUP_CLEAR_ORDERLY	(1UL << 31)
+
+#define SIM_MAGIC		0x324d5354  /* "TSM2" */
+#define SIM_VERSION		1
+#define SIM_HEADER_SIZE		10
+#define SIM_MAX_BODY_SIZE	(TPM_MAX_COMMAND_SIZE - SIM_HEADER_SIZE)
+#define SIM_MAX_HANDLES		2
+#define SIM_NUM_PCRS		24
+#define SIM_MAX_SPACES		32
+#define SIM_MAX_SPACE_SIZE	2048
+/* Size of the empty password session in a response */
+#define SIM_SESSION_RESPONSE_SIZE	5
+
+struct sim_space {
+	uint8_t used;
+	uint32_t index;		/* NV index handle */
+	uint16_t name_alg;
+	uint32_t attributes;	/* TPMA_NV, with the lock and written bits */
+	uint16_t size;
+	uint16_t auth_size;
+	uint8_t auth[TPM_SHA256_DIGEST_SIZE];
+	uint16_t policy_size;
+	uint8_t policy[TPM_SHA256_DIGEST_SIZE];
+	uint8_t data[SIM_MAX_SPACE_SIZE];
+};
+
+/* Everything in this struct is saved to the state file. */
+struct sim_state {
+	uint32_t magic;
+	uint32_t version;
+
+	/* Non-volatile state */
+	struct sim_space spaces[SIM_MAX_SPACES];
+	uint8_t shut_down;	/* Shutdown received since the last Startup */
+
+	/* Volatile state, reset by Startup(CLEAR) */
+	uint8_t started;
+	uint8_t orderly;
+	uint8_t ph_enable;
+	uint8_t pcrs[SIM_NUM_PCRS][TPM_SHA256_DIGEST_SIZE];
+
+	/* Volatile state saved by Shutdown(STATE) for Startup(STATE) */
+	uint8_t has_saved_state;
+	uint8_t saved_pcrs[SIM_NUM_PCRS][TPM_SHA256_DIGEST_SIZE];
+};
+
+/* Parameters of a command, read front to back. */
+struct sim_params {
+	const uint8_t *data;
+	uint32_t size;
+	int short_read;
+};
+
+/* A command, with its handles and authorization split out. */
+struct sim_request {
+	uint32_t handles[SIM_MAX_HANDLES];
+	/* Password of the authorization session, if the command has one */
+	const uint8_t *password;
+	uint16_t password_size;
+	uint8_t session_attributes;
+	struct sim_params params;
+};
+
+/* Kinds of work a command does, for the latency model. */
+enum sim_cost {
+	SIM_COST_NONE,
+	SIM_COST_EXTEND,
+	SIM_COST_SELFTEST,
+};
+
+/*
+ * Delays (in microseconds) of real TPMs: the round trip of any command on
+ * the bus, programming NV memory, and the work of some commands. These are
+ * rough figures for typical parts, good enough to compare boot paths.
+ */
+struct sim_latency {
+	const char *bus;
+	uint32_t round_trip;
+	uint32_t nv_write;
+	uint32_t extend;
+	uint32_t self_test;
+};
+
+static const struct sim_latency sim_latencies[] = {
+	{"lpc", 100, 10000, 1000, 40000},
+	{"spi", 300, 6000, 1000, 20000},
+	{"i2c", 1500, 6000, 1000, 20000},
+};
+
+struct sim_command {
+	TPM_CC code;
+	const char *name;
+	enum sim_cost cost;
+	int num_handles;	/* Handles before the parameters */
+	int needs_auth;		/* If the first handle needs authorization */
+	uint32_t (*handler)(struct sim_request *req,
+			    uint8_t *body, uint32_t *body_size);
+	int count;
+};
+
+static struct sim_state state;
+static char *state_path;
+static const struct sim_latency *latency;
+static int stats_requested;
+/* Set by commands that change the state file or program NV memory. */
+static int state_changed, nv_programmed;
+static int num_commands, num_nv_writes;
+static uint64_t simulated_usecs;
+
+static uint8_t read_u8(struct sim_params *p)
+{
+	uint8_t value;
+
+	if (p->size < sizeof(value)) {
+		p->short_read = 1;
+		return 0;
+	}
+	value = p->data[0];
+	p->data += sizeof(value);
+	p->size -= sizeof(value);
+	return value;
+}
+
+static uint16_t read_u16(struct sim_params *p)
+{
+	uint16_t value;
+
+	if (p->size < sizeof(value)) {
+		p->short_read = 1;
+		return 0;
+	}
+	value = ReadTpmUint16(&p->data);
+	p->size -= sizeof(value);
+	return value;
+}
+
+static uint32_t read_u32(struct sim_params *p)
+{
+	uint32_t value;
+
+	if (p->size < sizeof(value)) {
+		p->short_read = 1;
+		return 0;
+	}
+	value = ReadTpmUint32(&p->data);
+	p->size -= sizeof(value);
+	return value;
+}
+
+/* Returns the next size bytes, or NULL if there are not that many. */
+static const uint8_t *read_bytes(struct sim_params *p, uint32_t size)
+{
+	const uint8_t *data = p->data;
+
+	if (p->size < size) {
+		p->short_read = 1;
+		return NULL;
+	}
+	p->data += size;
+	p->size -= size;
+	return data;
+}
+
+/* Reads a TPM2B, returning its data and setting *size. */
+static const uint8_t *read_tpm2b(struct sim_params *p, uint16_t *size)
+{
+	*size = read_u16(p);
+	return read_bytes(p, *size);
+}
+
+/* Checks that the parameters were read exactly, before acting on them. */
+static uint32_t end_params(const struct sim_params *p)
+{
+	if (p->short_read)
+		return SIM_RC_INSUFFICIENT;
+	if (p->size)
+		return SIM_RC_SIZE;
+	return TPM_SUCCESS;
+}
+
+static struct sim_space *find_space(uint32_t index)
+{
+	int i;
+
+	for (i = 0; i < SIM_MAX_SPACES; i++) {
+		if (state.spaces[i].used && state.spaces[i].index == index)
+			return &state.spaces[i];
+	}
+	return NULL;
+}
+
+/* Marks the state as changed and (unless volatile) as written to NV. */
+static void mark_changed(int volatile_only)
+{
+	state_changed = 1;
+	if (!volatile_only)
+		nv_programmed = 1;
+}
+
+/* Checks the password of the authorization session against given value. */
+static uint32_t check_password(const struct sim_request *req,
+			       const uint8_t *auth, uint16_t auth_size)
+{
+	if (req->password_size != auth_size ||
+	    memcmp(req->password, auth, auth_size))
+		return SIM_RC_SESSION_N(SIM_RC_BAD_AUTH, 1);
+	return TPM_SUCCESS;
+}
+
+/* Checks authorization with the platform or owner hierarchy. */
+static uint32_t check_hierarchy_auth(const struct sim_request *req)
+{
+	switch (req->handles[0]) {
+	case TPM_RH_PLATFORM:
+		if (!state.ph_enable)
+			return SIM_RC_HANDLE_N(SIM_RC_HIERARCHY, 1);
+		break;
+	case TPM_RH_OWNER:
+		break;
+	default:
+		return SIM_RC_HANDLE_N(SIM_RC_VALUE, 1);
+	}
+	return check_password(req, NULL, 0);
+}
+
+/*
+ * Finds the space of an NV command (its second handle), and checks the
+ * authorization (its first handle) to read or write it.
+ */
+static uint32_t check_nv_auth(const struct sim_request *req, int write,
+			      struct sim_space **space)
+{
+	uint32_t needed;
+
+	*space = find_space(req->handles[1]);
+	if (!*space)
+		return SIM_RC_HANDLE_N(SIM_RC_HANDLE, 2);
+
+	if (req->handles[0] == TPM_RH_PLATFORM) {
+		if (!state.ph_enable)
+			return SIM_RC_HANDLE_N(SIM_RC_HIERARCHY, 1);
+		needed = write ? TPMA_NV_PPWRITE : TPMA_NV_PPREAD;
+	} else if (req->handles[0] == TPM_RH_OWNER) {
+		needed = write ? TPMA_NV_OWNERWRITE : TPMA_NV_OWNERREAD;
+	} else if (req->handles[0] == (*space)->index) {
+		needed = write ? TPMA_NV_AUTHWRITE : TPMA_NV_AUTHREAD;
+	} else {
+		return SIM_RC_HANDLE_N(SIM_RC_VALUE, 1);
+	}
+	if (!((*space)->attributes & needed))
+		return SIM_RC_NV_AUTHORIZATION;
+
+	if (req->handles[0] == (*space)->index)
+		return check_password(req, (*space)->auth,
+				      (*space)->auth_size);
+	return check_password(req, NULL, 0);
+}
+
+/* Resets the volatile state, as Startup(CLEAR) does. */
+static void clear_volatile_state(void)
+{
+	struct sim_space *space;
+	int i;
+
+	memset(state.pcrs, 0, sizeof(state.pcrs));
+	for (i = 0; i < SIM_MAX_SPACES; i++) {
+		space = &state.spaces[i];
+		if (space->attributes & TPMA_NV_READ_STCLEAR)
+			space->attributes &= ~TPMA_NV_READLOCKED;
+		if ((space->attributes & TPMA_NV_WRITE_STCLEAR) &&
+		    !(space->attributes & TPMA_NV_WRITEDEFINE))
+			space->attributes &= ~TPMA_NV_WRITELOCKED;
+	}
+}
+
+/*
+ * Initializes the state of a newly manufactured TPM: no NV spaces, no
+ * owner, and all hierarchies with empty auth values.
+ */
+static uint32_t manufacture(void)
+{
+	memset(&state, 0, sizeof(state));
+	state.magic = SIM_MAGIC;
+	state.version = SIM_VERSION;
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t load_state(void)
+{
+	FILE *fp = fopen(state_path, "rb");
+	size_t got;
+
+	if (!fp) {
+		if (errno != ENOENT) {
+			fprintf(stderr, "TPM simulator: cannot open %s: %s\n",
+				state_path, strerror(errno));
+			return TPM_E_NO_DEVICE;
+		}
+		return manufacture();
+	}
+	got = fread(&state, 1, sizeof(state), fp);
+	fclose(fp);
+	if (got != sizeof(state) || state.magic != SIM_MAGIC ||
+	    state.version != SIM_VERSION) {
+		fprintf(stderr, "TPM simulator: invalid state file %s\n",
+			state_path);
+		return TPM_E_CORRUPTED_STATE;
+	}
+	return TPM_SUCCESS;
+}
+
+static uint32_t save_state(void)
+{
+	FILE *fp = fopen(state_path, "wb");
+	int ok;
+
+	if (!fp) {
+		fprintf(stderr, "TPM simulator: cannot write %s: %s\n",
+			state_path, strerror(errno));
+		return TPM_E_WRITE_FAILURE;
+	}
+	ok = fwrite(&state, sizeof(state), 1, fp) == 1;
+	if (fclose(fp) || !ok) {
+		fprintf(stderr, "TPM simulator: failed to write %s\n",
+			state_path);
+		return TPM_E_WRITE_FAILURE;
+	}
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_startup(struct sim_request *req,
+			   uint8_t *body, uint32_t *body_size)
+{
+	uint16_t type = read_u16(&req->params);
+	uint32_t rv = end_params(&req->params);
+
+	if (rv != TPM_SUCCESS)
+		return rv;
+	if (state.started)
+		return TPM_RC_INITIALIZE;
+
+	switch (type) {
+	case TPM_SU_CLEAR:
+		clear_volatile_state();
+		break;
+	case TPM_SU_STATE:
+		if (!state.has_saved_state)
+			return SIM_RC_PARAM_N(SIM_RC_VALUE, 1);
+		memcpy(state.pcrs, state.saved_pcrs, sizeof(state.pcrs));
+		break;
+	default:
+		return SIM_RC_PARAM_N(SIM_RC_VALUE, 1);
+	}
+	state.started = 1;
+	state.orderly = state.shut_down;
+	state.shut_down = 0;
+	state.has_saved_state = 0;
+	state.ph_enable = 1;
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_shutdown(struct sim_request *req,
+			    uint8_t *body, uint32_t *body_size)
+{
+	uint16_t type = read_u16(&req->params);
+	uint32_t rv = end_params(&req->params);
+
+	if (rv != TPM_SUCCESS)
+		return rv;
+
+	switch (type) {
+	case TPM_SU_CLEAR:
+		state.has_saved_state = 0;
+		break;
+	case TPM_SU_STATE:
+		memcpy(state.saved_pcrs, state.pcrs, sizeof(state.pcrs));
+		state.has_saved_state = 1;
+		break;
+	default:
+		return SIM_RC_PARAM_N(SIM_RC_VALUE, 1);
+	}
+	state.shut_down = 1;
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_self_test(struct sim_request *req,
+			     uint8_t *body, uint32_t *body_size)
+{
+	read_u8(&req->params);  /* fullTest */
+	return end_params(&req->params);
+}
+
+/* Returns the value of a TPM property, or 0 if there is no such property. */
+static int get_property(uint32_t property, uint32_t *value)
+{
+	switch (property) {
+	case TPM_PT_MANUFACTURER:
+		*value = 0x53494d00;  /* "SIM" */
+		return 1;
+	case TPM_PT_VENDOR_STRING_1:
+		*value = 0x76626f00;  /* "vbo" */
+		return 1;
+	case TPM_PT_FIRMWARE_VERSION_1:
+	case TPM_PT_FIRMWARE_VERSION_2:
+		*value = property == TPM_PT_FIRMWARE_VERSION_2;
+		return 1;
+	case TPM_PT_PERMANENT:
+		/* Never owned, and clearing is never disabled. */
+		*value = SIM_PERMANENT_TPM_GENERATED_EPS;
+		return 1;
+	case TPM_PT_STARTUP_CLEAR:
+		*value = SIM_STARTUP_CLEAR_SH_ENABLE |
+			SIM_STARTUP_CLEAR_EH_ENABLE |
+			SIM_STARTUP_CLEAR_PH_ENABLE_NV;
+		if (state.ph_enable)
+			*value |= SIM_STARTUP_CLEAR_PH_ENABLE;
+		if (state.orderly)
+			*value |= SIM_STARTUP_CLEAR_ORDERLY;
+		return 1;
+	}
+	return 0;
+}
+
+static uint32_t do_get_capability(struct sim_request *req,
+				  uint8_t *body, uint32_t *body_size)
+{
+	uint32_t capability = read_u32(&req->params);
+	uint32_t property = read_u32(&req->params);
+	uint32_t count = read_u32(&req->params);
+	uint32_t rv = end_params(&req->params);
+	uint32_t value, last = TPM_PT_STARTUP_CLEAR;
+	uint8_t *p = body + 1 + 2 * sizeof(uint32_t);
+	uint32_t found = 0;
+
+	if (rv != TPM_SUCCESS)
+		return rv;
+	if (capability != TPM_CAP_TPM_PROPERTIES)
+		return SIM_RC_PARAM_N(SIM_RC_VALUE, 1);
+
+	/* Like real TPMs, report the properties from the one requested on. */
+	for (; property <= last && found < count; property++) {
+		if (!get_property(property, &value))
+			continue;
+		ToTpmUint32(p, property);
+		ToTpmUint32(p + 4, value);
+		p += 8;
+		found++;
+	}
+	body[0] = property <= last;  /* moreData */
+	ToTpmUint32(body + 1, capability);
+	ToTpmUint32(body + 5, found);
+	*body_size = p - body;
+	return TPM_SUCCESS;
+}
+
+/* Encodes the TPMS_NV_PUBLIC of a space, returns its size. */
+static uint32_t encode_nv_public(const struct sim_space *space, uint8_t *buf)
+{
+	uint8_t *p = buf;
+
+	ToTpmUint32(p, space->index);
+	ToTpmUint16(p + 4, space->name_alg);
+	ToTpmUint32(p + 6, space->attributes);
+	ToTpmUint16(p + 10, space->policy_size);
+	p += 12;
+	memcpy(p, space->policy, space->policy_size);
+	p += space->policy_size;
+	ToTpmUint16(p, space->size);
+	p += 2;
+	return p - buf;
+}
+
+static uint32_t do_nv_define_space(struct sim_request *req,
+				   uint8_t *body, uint32_t *body_size)
+{
+	const uint32_t unsupported = TPMA_NV_COUNTER | TPMA_NV_BITS |
+		TPMA_NV_EXTEND | TPMA_NV_WRITELOCKED | TPMA_NV_READLOCKED |
+		TPMA_NV_WRITTEN;
+	struct sim_params *params = &req->params;
+	struct sim_params public_area;
+	struct sim_space *space;
+	const uint8_t *auth, *policy;
+	uint16_t auth_size, policy_size, public_size;
+	uint32_t index, attributes, rv;
+	uint16_t name_alg, size;
+	int i;
+
+	auth = read_tpm2b(params, &auth_size);
+	public_area.data = read_tpm2b(params, &public_size);
+	public_area.size = public_size;
+	public_area.short_read = 0;
+	rv = end_params(params);
+	if (rv != TPM_SUCCESS)
+		return rv;
+
+	index = read_u32(&public_area);
+	name_alg = read_u16(&public_area);
+	attributes = read_u32(&public_area);
+	policy = read_tpm2b(&public_area, &policy_size);
+	size = read_u16(&public_area);
+	if (end_params(&public_area) != TPM_SUCCESS)
+		return SIM_RC_PARAM_N(SIM_RC_SIZE, 2);
+
+	rv = check_hierarchy_auth(req);
+	if (rv != TPM_SUCCESS)
+		return rv;
+
+	if (auth_size > sizeof(space->auth))
+		return SIM_RC_PARAM_N(SIM_RC_SIZE, 1);
+	if ((index >> HR_SHIFT) != TPM_HT_NV_INDEX)
+		return SIM_RC_PARAM_N(SIM_RC_VALUE, 2);
+	if (name_alg != TPM_ALG_SHA256)
+		return SIM_RC_PARAM_N(SIM_RC_HASH, 2);
+	if (policy_size > sizeof(space->policy) || size > SIM_MAX_SPACE_SIZE)
+		return SIM_RC_PARAM_N(SIM_RC_SIZE, 2);
+	/* Platform spaces need platform authorization, and the other way. */
+	if ((attributes & unsupported) ||
+	    !(attributes & TPMA_NV_MASK_READ) ||
+	    !(attributes & TPMA_NV_MASK_WRITE) ||
+	    !(attributes & TPMA_NV_PLATFORMCREATE) !=
+	    (req->handles[0] != TPM_RH_PLATFORM))
+		return SIM_RC_PARAM_N(SIM_RC_ATTRIBUTES, 2);
+	if (find_space(index))
+		return SIM_RC_NV_DEFINED;
+
+	for (i = 0; i < SIM_MAX_SPACES && state.spaces[i].used; i++)
+		;
+	if (i == SIM_MAX_SPACES)
+		return SIM_RC_NV_SPACE;
+	space = &state.spaces[i];
+	memset(space, 0, sizeof(*space));
+	space->used = 1;
+	space->index = index;
+	space->name_alg = name_alg;
+	space->attributes = attributes;
+	space->size = size;
+	space->auth_size = auth_size;
+	memcpy(space->auth, auth, auth_size);
+	space->policy_size = policy_size;
+	memcpy(space->policy, policy, policy_size);
+	memset(space->data, 0xff, size);
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_nv_write(struct sim_request *req,
+			    uint8_t *body, uint32_t *body_size)
+{
+	struct sim_space *space;
+	const uint8_t *data;
+	uint16_t size, offset;
+	uint32_t rv;
+
+	data = read_tpm2b(&req->params, &size);
+	offset = read_u16(&req->params);
+	rv = end_params(&req->params);
+	if (rv == TPM_SUCCESS)
+		rv = check_nv_auth(req, 1, &space);
+	if (rv != TPM_SUCCESS)
+		return rv;
+
+	if (space->attributes & TPMA_NV_WRITELOCKED)
+		return SIM_RC_NV_LOCKED;
+	if (offset > space->size || size > space->size - offset)
+		return SIM_RC_NV_RANGE;
+	if ((space->attributes & TPMA_NV_WRITEALL) && size != space->size)
+		return SIM_RC_NV_RANGE;
+
+	memcpy(space->data + offset, data, size);
+	space->attributes |= TPMA_NV_WRITTEN;
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_nv_read(struct sim_request *req,
+			   uint8_t *body, uint32_t *body_size)
+{
+	struct sim_space *space;
+	uint16_t size, offset;
+	uint32_t rv;
+
+	size = read_u16(&req->params);
+	offset = read_u16(&req->params);
+	rv = end_params(&req->params);
+	if (rv == TPM_SUCCESS)
+		rv = check_nv_auth(req, 0, &space);
+	if (rv != TPM_SUCCESS)
+		return rv;
+
+	if (space->attributes & TPMA_NV_READLOCKED)
+		return SIM_RC_NV_LOCKED;
+	if (!(space->attributes & TPMA_NV_WRITTEN))
+		return SIM_RC_NV_UNINITIALIZED;
+	if (offset > space->size || size > space->size - offset)
+		return SIM_RC_NV_RANGE;
+
+	ToTpmUint16(body, size);
+	memcpy(body + sizeof(uint16_t), space->data + offset, size);
+	*body_size = sizeof(uint16_t) + size;
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_nv_read_lock(struct sim_request *req,
+				uint8_t *body, uint32_t *body_size)
+{
+	struct sim_space *space;
+	uint32_t rv = end_params(&req->params);
+
+	if (rv == TPM_SUCCESS)
+		rv = check_nv_auth(req, 0, &space);
+	if (rv != TPM_SUCCESS)
+		return rv;
+
+	if (!(space->attributes & TPMA_NV_READ_STCLEAR))
+		return SIM_RC_HANDLE_N(SIM_RC_ATTRIBUTES, 2);
+	space->attributes |= TPMA_NV_READLOCKED;
+	mark_changed(1);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_nv_write_lock(struct sim_request *req,
+				 uint8_t *body, uint32_t *body_size)
+{
+	struct sim_space *space;
+	uint32_t rv = end_params(&req->params);
+
+	if (rv == TPM_SUCCESS)
+		rv = check_nv_auth(req, 1, &space);
+	if (rv != TPM_SUCCESS)
+		return rv;
+
+	if (!(space->attributes &
+	      (TPMA_NV_WRITEDEFINE | TPMA_NV_WRITE_STCLEAR)))
+		return SIM_RC_HANDLE_N(SIM_RC_ATTRIBUTES, 2);
+	space->attributes |= TPMA_NV_WRITELOCKED;
+	/* A lock which lasts until the space is redefined programs NV. */
+	mark_changed(!(space->attributes & TPMA_NV_WRITEDEFINE));
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_nv_read_public(struct sim_request *req,
+				  uint8_t *body, uint32_t *body_size)
+{
+	struct vb2_sha256_context ctx;
+	const struct sim_space *space;
+	uint32_t rv = end_params(&req->params);
+	uint32_t size;
+	uint8_t *p = body;
+
+	if (rv != TPM_SUCCESS)
+		return rv;
+	space = find_space(req->handles[0]);
+	if (!space)
+		return SIM_RC_HANDLE_N(SIM_RC_HANDLE, 1);
+
+	/* TPM2B_NV_PUBLIC */
+	size = encode_nv_public(space, p + 2);
+	ToTpmUint16(p, size);
+	p += 2;
+
+	/* The name is the hash of the public area, with its algorithm. */
+	ToTpmUint16(p + size, 2 + TPM_SHA256_DIGEST_SIZE);
+	ToTpmUint16(p + size + 2, space->name_alg);
+	vb2_sha256_init(&ctx);
+	vb2_sha256_update(&ctx, p, size);
+	vb2_sha256_finalize(&ctx, p + size + 4);
+	p += size + 4 + TPM_SHA256_DIGEST_SIZE;
+
+	*body_size = p - body;
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_hierarchy_control(struct sim_request *req,
+				     uint8_t *body, uint32_t *body_size)
+{
+	uint32_t enable = read_u32(&req->params);
+	uint8_t enable_state = read_u8(&req->params);
+	uint32_t rv = end_params(&req->params);
+
+	if (rv != TPM_SUCCESS)
+		return rv;
+	if (req->handles[0] != TPM_RH_PLATFORM)
+		return SIM_RC_HANDLE_N(SIM_RC_VALUE, 1);
+	rv = check_hierarchy_auth(req);
+	if (rv != TPM_SUCCESS)
+		return rv;
+
+	/* Only the platform hierarchy can be disabled, until Startup. */
+	if (enable != TPM_RH_PLATFORM)
+		return SIM_RC_PARAM_N(SIM_RC_VALUE, 1);
+	if (!enable_state) {
+		state.ph_enable = 0;
+		mark_changed(1);
+	}
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_clear(struct sim_request *req,
+			 uint8_t *body, uint32_t *body_size)
+{
+	uint32_t rv = end_params(&req->params);
+	int i;
+
+	if (rv != TPM_SUCCESS)
+		return rv;
+	if (req->handles[0] != TPM_RH_PLATFORM)
+		return SIM_RC_HANDLE_N(SIM_RC_VALUE, 1);
+	rv = check_hierarchy_auth(req);
+	if (rv != TPM_SUCCESS)
+		return rv;
+
+	/* Spaces that belong to the owner go away with it. */
+	for (i = 0; i < SIM_MAX_SPACES; i++) {
+		if (!(state.spaces[i].attributes & TPMA_NV_PLATFORMCREATE))
+			memset(&state.spaces[i], 0, sizeof(state.spaces[i]));
+	}
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_pcr_extend(struct sim_request *req,
+			      uint8_t *body, uint32_t *body_size)
+{
+	struct vb2_sha256_context ctx;
+	const uint8_t *digest = NULL;
+	uint32_t pcr = req->handles[0];
+	uint32_t count, rv, i;
+	uint16_t alg;
+
+	count = read_u32(&req->params);
+	for (i = 0; i < count && !req->params.short_read; i++) {
+		alg = read_u16(&req->params);
+		if (alg == TPM_ALG_SHA256) {
+			digest = read_bytes(&req->params,
+					    TPM_SHA256_DIGEST_SIZE);
+		} else if (alg == TPM_ALG_SHA1) {
+			/* Banks which are not allocated are ignored. */
+			read_bytes(&req->params, VB2_SHA1_DIGEST_SIZE);
+		} else {
+			return SIM_RC_PARAM_N(SIM_RC_HASH, 1);
+		}
+	}
+	rv = end_params(&req->params);
+	if (rv != TPM_SUCCESS)
+		return rv;
+	if (pcr >= SIM_NUM_PCRS)
+		return SIM_RC_HANDLE_N(SIM_RC_VALUE, 1);
+	rv = check_password(req, NULL, 0);
+	if (rv != TPM_SUCCESS || !digest)
+		return rv;
+
+	vb2_sha256_init(&ctx);
+	vb2_sha256_update(&ctx, state.pcrs[pcr], TPM_SHA256_DIGEST_SIZE);
+	vb2_sha256_update(&ctx, digest, TPM_SHA256_DIGEST_SIZE);
+	vb2_sha256_finalize(&ctx, state.pcrs[pcr]);
+	mark_changed(1);
+	return TPM_SUCCESS;
+}
+
+static struct sim_command sim_commands[] = {
+	{TPM2_Startup, "Startup", SIM_COST_NONE, 0, 0, do_startup},
+	{TPM2_Shutdown, "Shutdown", SIM_COST_NONE, 0, 0, do_shutdown},
+	{TPM2_SelfTest, "SelfTest", SIM_COST_SELFTEST, 0, 0, do_self_test},
+	{TPM2_GetCapability, "GetCapability", SIM_COST_NONE, 0, 0,
+	 do_get_capability},
+	{TPM2_NV_DefineSpace, "NV_DefineSpace", SIM_COST_NONE, 1, 1,
+	 do_nv_define_space},
+	{TPM2_NV_Write, "NV_Write", SIM_COST_NONE, 2, 1, do_nv_write},
+	{TPM2_NV_Read, "NV_Read", SIM_COST_NONE, 2, 1, do_nv_read},
+	{TPM2_NV_ReadLock, "NV_ReadLock", SIM_COST_NONE, 2, 1,
+	 do_nv_read_lock},
+	{TPM2_NV_WriteLock, "NV_WriteLock", SIM_COST_NONE, 2, 1,
+	 do_nv_write_lock},
+	{TPM2_NV_ReadPublic, "NV_ReadPublic", SIM_COST_NONE, 1, 0,
+	 do_nv_read_public},
+	{TPM2_Hierarchy_Control, "Hierarchy_Control", SIM_COST_NONE, 1, 1,
+	 do_hierarchy_control},
+	{TPM2_Clear, "Clear", SIM_COST_NONE, 1, 1, do_clear},
+	{TPM2_PCR_Extend, "PCR_Extend", SIM_COST_EXTEND, 1, 1,
+	 do_pcr_extend},
+};
+
+/*
+ * Splits the handles and the authorization session off the command
+ * parameters.
+ */
+static uint32_t parse_request(const struct sim_command *command,
+			      uint16_t tag, const uint8_t *data,
+			      uint32_t size, struct sim_request *req)
+{
+	struct sim_params *params = &req->params;
+	struct sim_params session;
+	uint32_t session_size;
+	int i;
+
+	params->data = data;
+	params->size = size;
+	for (i = 0; i < command->num_handles; i++)
+		req->handles[i] = read_u32(params);
+	if (params->short_read)
+		return SIM_RC_INSUFFICIENT;
+
+	if (!command->needs_auth)
+		return tag == TPM_ST_SESSIONS ? SIM_RC_AUTH_CONTEXT :
+			TPM_SUCCESS;
+	if (tag != TPM_ST_SESSIONS)
+		return SIM_RC_AUTH_MISSING;
+
+	/* Exactly one password session, with an empty nonce. */
+	session_size = read_u32(params);
+	session.data = read_bytes(params, session_size);
+	session.size = session_size;
+	session.short_read = 0;
+	if (params->short_read)
+		return SIM_RC_AUTHSIZE;
+	if (read_u32(&session) != TPM_RS_PW)
+		return SIM_RC_SESSION_N(SIM_RC_AUTH_UNAVAILABLE, 1);
+	if (read_u16(&session) != 0)
+		return SIM_RC_SESSION_N(SIM_RC_SIZE, 1);
+	req->session_attributes = read_u8(&session);
+	req->password = read_tpm2b(&session, &req->password_size);
+	if (end_params(&session) != TPM_SUCCESS)
+		return SIM_RC_AUTHSIZE;
+	return TPM_SUCCESS;
+}
+
+/* Sleeps for the simulated latency of a command, and accounts for it. */
+static void simulate_latency(enum sim_cost cost)
+{
+	struct timespec delay;
+	uint32_t usecs;
+
+	if (!latency)
+		return;
+	usecs = latency->round_trip;
+	if (nv_programmed)
+		usecs += latency->nv_write;
+	if (cost == SIM_COST_EXTEND)
+		usecs += latency->extend;
+	else if (cost == SIM_COST_SELFTEST)
+		usecs += latency->self_test;
+	simulated_usecs += usecs;
+
+	delay.tv_sec = usecs / 1000000;
+	delay.tv_nsec = (usecs % 1000000) * 1000;
+	nanosleep(&delay, NULL);
+}
+
+uint32_t tpm_simulator_execute(const uint8_t *request, uint32_t request_length,
+			       uint8_t *response, uint32_t *response_length)
+{
+	uint8_t body[SIM_MAX_BODY_SIZE];
+	struct sim_command *command = NULL;
+	struct sim_request req;
+	uint32_t size, code, result, body_size = 0, response_size;
+	uint16_t tag;
+	uint8_t *p;
+	int i;
+
+	if (!state_path)
+		return TPM_E_NO_DEVICE;
+	if (request_length < SIM_HEADER_SIZE)
+		return TPM_E_INPUT_TOO_SMALL;
+	FromTpmUint16(request, &tag);
+	FromTpmUint32(request + 2, &size);
+	FromTpmUint32(request + 6, &code);
+	if (size != request_length)
+		return TPM_E_INPUT_TOO_SMALL;
+
+	for (i = 0; i < ARRAY_SIZE(sim_commands); i++) {
+		if (sim_commands[i].code == code) {
+			command = &sim_commands[i];
+			break;
+		}
+	}
+
+	num_commands++;
+	state_changed = nv_programmed = 0;
+	memset(&req, 0, sizeof(req));
+	if (tag != TPM_ST_NO_SESSIONS && tag != TPM_ST_SESSIONS) {
+		result = SIM_RC_BAD_TAG;
+	} else if (!command) {
+		result = SIM_RC_COMMAND_CODE;
+	} else if (!state.started && code != TPM2_Startup) {
+		result = TPM_RC_INITIALIZE;
+	} else {
+		command->count++;
+		result = parse_request(command, tag, request + SIM_HEADER_SIZE,
+				       size - SIM_HEADER_SIZE, &req);
+		if (result == TPM_SUCCESS)
+			result = command->handler(&req, body, &body_size);
+	}
+	if (nv_programmed)
+		num_nv_writes++;
+	simulate_latency(command ? command->cost : SIM_COST_NONE);
+
+	if (state_changed) {
+		uint32_t rv = save_state();
+		if (rv != TPM_SUCCESS)
+			return rv;
+	}
+
+	/*
+	 * Failed commands get a bare header. Responses with sessions have the
+	 * size of their parameters first, and the password session last.
+	 */
+	if (result != TPM_SUCCESS) {
+		tag = TPM_ST_NO_SESSIONS;
+		body_size = 0;
+	}
+	response_size = SIM_HEADER_SIZE + body_size;
+	if (tag == TPM_ST_SESSIONS)
+		response_size += sizeof(uint32_t) + SIM_SESSION_RESPONSE_SIZE;
+	if (response_size > *response_length)
+		return TPM_E_RESPONSE_TOO_LARGE;
+
+	ToTpmUint16(response, tag);
+	ToTpmUint32(response + 2, response_size);
+	ToTpmUint32(response + 6, result);
+	p = response + SIM_HEADER_SIZE;
+	if (tag == TPM_ST_SESSIONS) {
+		ToTpmUint32(p, body_size);
+		p += sizeof(uint32_t);
+	}
+	memcpy(p, body, body_size);
+	p += body_size;
+	if (tag == TPM_ST_SESSIONS) {
+		/* Empty nonce, the continueSession attribute and empty HMAC */
+		ToTpmUint16(p, 0);
+		p[2] = req.session_attributes & 1;
+		ToTpmUint16(p + 3, 0);
+	}
+	*response_length = response_size;
+	return TPM_SUCCESS;
+}
+
+/* Prints the command counts of the process, at exit. */
+static void print_stats(void)
+{
+	int i;
+
+	fprintf(stderr, "TPM simulator: %d commands, %d NV writes, "
+		"%d.%03d ms simulated latency\n", num_commands, num_nv_writes,
+		(int)(simulated_usecs / 1000), (int)(simulated_usecs % 1000));
+	for (i = 0; i < ARRAY_SIZE(sim_commands); i++) {
+		if (sim_commands[i].count)
+			fprintf(stderr, "  %-24s %d\n", sim_commands[i].name,
+				sim_commands[i].count);
+	}
+}
+
+uint32_t tpm_simulator_open(const char *path)
+{
+	const char *value;
+	uint32_t result;
+	int i;
+
+	if (state_path)
+		return TPM_SUCCESS;  /* Already open */
+
+	state_path = strdup(path);
+	state_changed = nv_programmed = 0;
+	result = load_state();
+	if (result != TPM_SUCCESS)
+		goto fail;
+
+	value = getenv("TPM_SIMULATOR_RESET");
+	if (value && atoi(value)) {
+		state.started = 0;
+		state.ph_enable = 0;
+		state_changed = 1;
+	}
+	if (state_changed) {
+		result = save_state();
+		if (result != TPM_SUCCESS)
+			goto fail;
+	}
+
+	latency = NULL;
+	value = getenv("TPM_SIMULATOR_LATENCY");
+	for (i = 0; value && i < ARRAY_SIZE(sim_latencies); i++) {
+		if (!strcmp(value, sim_latencies[i].bus))
+			latency = &sim_latencies[i];
+	}
+	if (value && !latency)
+		fprintf(stderr, "TPM simulator: unknown bus %s, no latency\n",
+			value);
+
+	value = getenv("TPM_SIMULATOR_STATS");
+	if (value && atoi(value) && !stats_requested) {
+		atexit(print_stats);
+		stats_requested = 1;
+	}
+	return TPM_SUCCESS;
+
+fail:
+	free(state_path);
+	state_path = NULL;
+	return result;
+}
+
+void tpm_simulator_close(void)
+{
+	free(state_path);
+	state_path = NULL;
+}
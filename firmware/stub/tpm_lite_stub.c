@@ -13,6 +13,7 @@
 
 #include "tlcl.h"
 #include "tlcl_internal.h"
+#include "tpm_simulator.h"
 #include "utility.h"
 #include "vboot_api.h"
 
@@ -46,6 +47,9 @@ static int tpm_fd = -1;
 /* If the library should exit during an OS-level TPM failure.
  */
 static int exit_on_failure = 1;
+/* If commands go to the TPM simulator instead of the device.
+ */
+static int use_simulator;
 
 /* Similar to VbExError, only handle the non-exit case.
  */
@@ -82,6 +86,14 @@ static VbError_t TpmExecute(const uint8_t *in, const uint32_t in_len,
 			    uint8_t *out, uint32_t *pout_len)
 {
 	uint8_t response[TPM_MAX_COMMAND_SIZE];
+	if (use_simulator) {
+		uint32_t result = tpm_simulator_execute(in, in_len,
+							out, pout_len);
+		if (result != TPM_SUCCESS)
+			return DoError(result, "TPM simulator failure 0x%x\n",
+				       result);
+		return VBERROR_SUCCESS;
+	}
 	if (in_len <= 0) {
 		return DoError(TPM_E_INPUT_TOO_SMALL,
 			       "invalid command length %d for command 0x%x\n",
@@ -186,6 +198,10 @@ VbError_t VbExTpmInit(void)
 
 VbError_t VbExTpmClose(void)
 {
+	if (use_simulator) {
+		tpm_simulator_close();
+		use_simulator = 0;
+	}
 	if (tpm_fd != -1) {
 		close(tpm_fd);
 		tpm_fd = -1;
@@ -199,9 +215,20 @@ VbError_t VbExTpmOpen(void)
 	struct timespec delay;
 	int retries, saved_errno;
 
-	if (tpm_fd >= 0)
+	if (tpm_fd >= 0 || use_simulator)
 		return VBERROR_SUCCESS;  /* Already open */
 
+	/* TPM_SIMULATOR names the state file of a simulated TPM to use. */
+	device_path = getenv("TPM_SIMULATOR");
+	if (device_path) {
+		uint32_t result = tpm_simulator_open(device_path);
+		if (result != TPM_SUCCESS)
+			return DoError(result, "TPM: Cannot open TPM simulator "
+				       "%s\n", device_path);
+		use_simulator = 1;
+		return VBERROR_SUCCESS;
+	}
+
 	device_path = getenv("TPM_DEVICE_PATH");
 	if (device_path == NULL) {
 		device_path = TPM_DEVICE_PATH;
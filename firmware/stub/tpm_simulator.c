@@ -0,0 +1,957 @@
+/* Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * In-process TPM 1.2 simulator for the host TPM stub.
+ *
+ * The simulator understands the subset of TPM 1.2 commands sent by the tlcl
+ * library, with the access rules vboot depends on: physical presence, the
+ * NV lock, global and per-space locks and the limit on NV writes without an
+ * owner. NV spaces, PCRs and flags are kept in a file, so a sequence of
+ * processes (for example tpmc invocations) sees the same TPM. The simulated
+ * TPM never has an owner and does not support authorized (OIAP/OSAP)
+ * commands; PCR policies of NV spaces are recorded but not enforced.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "2sysincludes.h"
+#include "2common.h"
+#include "2sha.h"
+
+#include "tlcl.h"
+#include "tlcl_internal.h"
+#include "tpm_simulator.h"
+#include "vboot_api.h"
+
+/* TPM 1.2 result codes not used by the rest of vboot. */
+#define SIM_E_BAD_PARAMETER	((uint32_t) 0x00000003)
+#define SIM_E_CLEAR_DISABLED	((uint32_t) 0x00000005)
+#define SIM_E_DISABLED		((uint32_t) 0x00000007)
+#define SIM_E_FAIL		((uint32_t) 0x00000009)
+#define SIM_E_NOSPACE		((uint32_t) 0x00000011)
+#define SIM_E_BAD_PARAM_SIZE	((uint32_t) 0x00000019)
+
+#define SIM_MAGIC		0x4d495354  /* "TSIM" */
+#define SIM_VERSION		1
+#define SIM_HEADER_SIZE		10
+#define SIM_MAX_BODY_SIZE	(TPM_MAX_COMMAND_SIZE - SIM_HEADER_SIZE)
+#define SIM_NUM_PCRS		24
+#define SIM_MAX_SPACES		32
+#define SIM_MAX_SPACE_SIZE	2048
+#define SIM_MAX_NV_WRITES	64
+/* A TPM_PCR_INFO_SHORT with a 3-byte PCR selection. */
+#define SIM_PCR_INFO_SIZE	26
+
+struct sim_space {
+	uint8_t used;
+	uint32_t index;
+	uint32_t attributes;
+	uint32_t size;
+	uint8_t pcr_info_read[SIM_PCR_INFO_SIZE];
+	uint8_t pcr_info_write[SIM_PCR_INFO_SIZE];
+	uint8_t read_locked;	/* bReadSTClear */
+	uint8_t write_locked;	/* bWriteSTClear */
+	uint8_t write_defined;	/* bWriteDefine */
+	uint8_t data[SIM_MAX_SPACE_SIZE];
+};
+
+/* Everything in this struct is saved to the state file. */
+struct sim_state {
+	uint32_t magic;
+	uint32_t version;
+
+	/* Non-volatile state */
+	TPM_PERMANENT_FLAGS pflags;
+	uint32_t nv_writes;
+	uint8_t ek_modulus[TPM_RSA_2048_LEN];
+	struct sim_space spaces[SIM_MAX_SPACES];
+
+	/* Volatile state, reset by TPM_Startup(ST_CLEAR) */
+	uint8_t started;
+	TPM_STCLEAR_FLAGS vflags;
+	uint8_t pcrs[SIM_NUM_PCRS][TPM_SHA1_160_HASH_LEN];
+
+	/* Volatile state saved by TPM_SaveState for TPM_Startup(ST_STATE) */
+	uint8_t has_saved_state;
+	TPM_STCLEAR_FLAGS saved_vflags;
+	uint8_t saved_pcrs[SIM_NUM_PCRS][TPM_SHA1_160_HASH_LEN];
+};
+
+/* Kinds of work a command does, for the latency model. */
+enum sim_cost {
+	SIM_COST_NONE,
+	SIM_COST_EXTEND,
+	SIM_COST_CRYPTO,
+	SIM_COST_SELFTEST,
+};
+
+/*
+ * Delays (in microseconds) of real TPMs: the round trip of any command on
+ * the bus, programming NV memory, and the work of some commands. These are
+ * rough figures for typical parts, good enough to compare boot paths.
+ */
+struct sim_latency {
+	const char *bus;
+	uint32_t round_trip;
+	uint32_t nv_write;
+	uint32_t extend;
+	uint32_t crypto;
+	uint32_t self_test;
+};
+
+static const struct sim_latency sim_latencies[] = {
+	{"lpc", 100, 10000, 1000, 2000, 40000},
+	{"spi", 300, 6000, 1000, 2000, 20000},
+	{"i2c", 1500, 6000, 1000, 2000, 20000},
+};
+
+struct sim_command {
+	uint32_t ordinal;
+	const char *name;
+	enum sim_cost cost;
+	uint32_t (*handler)(const uint8_t *params, uint32_t params_size,
+			    uint8_t *body, uint32_t *body_size);
+	int count;
+};
+
+static struct sim_state state;
+static char *state_path;
+static const struct sim_latency *latency;
+static int stats_requested;
+/* Set by commands that change the state file or program NV memory. */
+static int state_changed, nv_programmed;
+static int num_commands, num_nv_writes;
+static uint64_t simulated_usecs;
+
+static struct sim_space *find_space(uint32_t index)
+{
+	int i;
+
+	for (i = 0; i < SIM_MAX_SPACES; i++) {
+		if (state.spaces[i].used && state.spaces[i].index == index)
+			return &state.spaces[i];
+	}
+	return NULL;
+}
+
+/* Marks the state as changed and (unless volatile) as written to NV. */
+static void mark_changed(int volatile_only)
+{
+	state_changed = 1;
+	if (!volatile_only)
+		nv_programmed = 1;
+}
+
+/* Resets the volatile state, as TPM_Startup(ST_CLEAR) does. */
+static void clear_volatile_state(void)
+{
+	int i;
+
+	memset(&state.vflags, 0, sizeof(state.vflags));
+	state.vflags.tag = 0x0003;
+	state.vflags.deactivated = state.pflags.deactivated;
+	memset(state.pcrs, 0, sizeof(state.pcrs));
+	for (i = 0; i < SIM_MAX_SPACES; i++) {
+		state.spaces[i].read_locked = 0;
+		state.spaces[i].write_locked = 0;
+	}
+}
+
+/*
+ * Initializes the state of a newly manufactured TPM: enabled, activated,
+ * unowned, with physical presence finalized and the NV memory locked, like
+ * a TPM in a shipping device before its first boot.
+ */
+static uint32_t manufacture(void)
+{
+	memset(&state, 0, sizeof(state));
+	state.magic = SIM_MAGIC;
+	state.version = SIM_VERSION;
+	state.pflags.tag = 0x001f;
+	state.pflags.ownership = 1;
+	state.pflags.readPubek = 1;
+	state.pflags.physicalPresenceLifetimeLock = 1;
+	state.pflags.physicalPresenceCMDEnable = 1;
+	state.pflags.nvLocked = 1;
+	clear_volatile_state();
+	if (VbExTpmGetRandom(state.ek_modulus, sizeof(state.ek_modulus)))
+		return TPM_E_INTERNAL_ERROR;
+	state.ek_modulus[0] |= 0x80;
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t load_state(void)
+{
+	FILE *fp = fopen(state_path, "rb");
+	size_t got;
+
+	if (!fp) {
+		if (errno != ENOENT) {
+			fprintf(stderr, "TPM simulator: cannot open %s: %s\n",
+				state_path, strerror(errno));
+			return TPM_E_NO_DEVICE;
+		}
+		return manufacture();
+	}
+	got = fread(&state, 1, sizeof(state), fp);
+	fclose(fp);
+	if (got != sizeof(state) || state.magic != SIM_MAGIC ||
+	    state.version != SIM_VERSION) {
+		fprintf(stderr, "TPM simulator: invalid state file %s\n",
+			state_path);
+		return TPM_E_CORRUPTED_STATE;
+	}
+	return TPM_SUCCESS;
+}
+
+static uint32_t save_state(void)
+{
+	FILE *fp = fopen(state_path, "wb");
+	int ok;
+
+	if (!fp) {
+		fprintf(stderr, "TPM simulator: cannot write %s: %s\n",
+			state_path, strerror(errno));
+		return TPM_E_WRITE_FAILURE;
+	}
+	ok = fwrite(&state, sizeof(state), 1, fp) == 1;
+	if (fclose(fp) || !ok) {
+		fprintf(stderr, "TPM simulator: failed to write %s\n",
+			state_path);
+		return TPM_E_WRITE_FAILURE;
+	}
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_startup(const uint8_t *params, uint32_t params_size,
+			   uint8_t *body, uint32_t *body_size)
+{
+	uint16_t type;
+
+	if (params_size != sizeof(type))
+		return SIM_E_BAD_PARAM_SIZE;
+	FromTpmUint16(params, &type);
+	if (state.started)
+		return TPM_E_INVALID_POSTINIT;
+
+	switch (type) {
+	case TPM_ST_CLEAR:
+		clear_volatile_state();
+		break;
+	case TPM_ST_STATE:
+		if (!state.has_saved_state)
+			return SIM_E_FAIL;
+		memcpy(&state.vflags, &state.saved_vflags,
+		       sizeof(state.vflags));
+		memcpy(state.pcrs, state.saved_pcrs, sizeof(state.pcrs));
+		break;
+	case TPM_ST_DEACTIVATED:
+		clear_volatile_state();
+		state.vflags.deactivated = 1;
+		break;
+	default:
+		return SIM_E_BAD_PARAMETER;
+	}
+	state.started = 1;
+	state.has_saved_state = 0;
+	mark_changed(1);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_save_state(const uint8_t *params, uint32_t params_size,
+			      uint8_t *body, uint32_t *body_size)
+{
+	memcpy(&state.saved_vflags, &state.vflags, sizeof(state.vflags));
+	memcpy(state.saved_pcrs, state.pcrs, sizeof(state.pcrs));
+	state.has_saved_state = 1;
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_self_test(const uint8_t *params, uint32_t params_size,
+			     uint8_t *body, uint32_t *body_size)
+{
+	return TPM_SUCCESS;
+}
+
+/* Encodes a TPM_NV_DATA_PUBLIC for given space, returns its size. */
+static uint32_t encode_space_info(const struct sim_space *space, uint8_t *buf)
+{
+	uint8_t *p = buf;
+
+	ToTpmUint16(p, TPM_TAG_NV_DATA_PUBLIC);
+	ToTpmUint32(p + 2, space->index);
+	p += 6;
+	memcpy(p, space->pcr_info_read, SIM_PCR_INFO_SIZE);
+	p += SIM_PCR_INFO_SIZE;
+	memcpy(p, space->pcr_info_write, SIM_PCR_INFO_SIZE);
+	p += SIM_PCR_INFO_SIZE;
+	ToTpmUint16(p, TPM_TAG_NV_ATTRIBUTES);
+	ToTpmUint32(p + 2, space->attributes);
+	p += 6;
+	*p++ = space->read_locked;
+	*p++ = space->write_locked;
+	*p++ = space->write_defined;
+	ToTpmUint32(p, space->size);
+	p += 4;
+	return p - buf;
+}
+
+static uint32_t do_get_capability(const uint8_t *params, uint32_t params_size,
+				  uint8_t *body, uint32_t *body_size)
+{
+	const struct sim_space *space;
+	uint32_t area, sub_size, sub = 0;
+	uint8_t *data = body + sizeof(uint32_t);
+	uint32_t size;
+
+	if (params_size < 2 * sizeof(uint32_t))
+		return SIM_E_BAD_PARAM_SIZE;
+	area = ReadTpmUint32(&params);
+	sub_size = ReadTpmUint32(&params);
+	if (sub_size != params_size - 2 * sizeof(uint32_t))
+		return SIM_E_BAD_PARAM_SIZE;
+	if (sub_size == sizeof(uint32_t))
+		sub = ReadTpmUint32(&params);
+	else if (sub_size != 0)
+		return SIM_E_BAD_PARAMETER;
+
+	if (area == TPM_CAP_FLAG && sub == TPM_CAP_FLAG_PERMANENT) {
+		/* The tag, then one byte per flag. */
+		ToTpmUint16(data, state.pflags.tag);
+		size = offsetof(TPM_PERMANENT_FLAGS, disableFullDALogicInfo) +
+			1 - offsetof(TPM_PERMANENT_FLAGS, disable);
+		memcpy(data + 2, &state.pflags.disable, size);
+		size += 2;
+	} else if (area == TPM_CAP_FLAG && sub == TPM_CAP_FLAG_VOLATILE) {
+		ToTpmUint16(data, state.vflags.tag);
+		size = offsetof(TPM_STCLEAR_FLAGS, bGlobalLock) + 1 -
+			offsetof(TPM_STCLEAR_FLAGS, deactivated);
+		memcpy(data + 2, &state.vflags.deactivated, size);
+		size += 2;
+	} else if (area == TPM_CAP_PROPERTY && sub == TPM_CAP_PROP_OWNER) {
+		data[0] = 0;  /* Never owned */
+		size = 1;
+	} else if (area == TPM_CAP_NV_INDEX && sub_size == sizeof(uint32_t)) {
+		space = find_space(sub);
+		if (!space)
+			return TPM_E_BADINDEX;
+		size = encode_space_info(space, data);
+	} else if (area == TPM_CAP_GET_VERSION_VAL) {
+		/* TPM_CAP_VERSION_INFO for a 1.2 TPM, firmware 0.1 */
+		static const uint8_t version_info[] = {
+			0x00, 0x30, 1, 2, 0, 1, 0x00, 0x02, 3,
+			'S', 'I', 'M', ' ', 0x00, 0x00,
+		};
+		memcpy(data, version_info, sizeof(version_info));
+		size = sizeof(version_info);
+	} else {
+		return SIM_E_BAD_PARAMETER;
+	}
+	ToTpmUint32(body, size);
+	*body_size = sizeof(uint32_t) + size;
+	return TPM_SUCCESS;
+}
+
+/*
+ * Copies a TPM_PCR_INFO_SHORT with a PCR selection of up to 3 bytes, which
+ * is stored (with a 3-byte selection) in buf. Returns its encoded size, or 0
+ * if it is invalid.
+ */
+static uint32_t read_pcr_info(const uint8_t *params, uint32_t params_size,
+			      uint8_t *buf)
+{
+	uint16_t select_size;
+	uint32_t size;
+
+	if (params_size < sizeof(select_size))
+		return 0;
+	FromTpmUint16(params, &select_size);
+	size = SIM_PCR_INFO_SIZE - 3 + select_size;
+	if (select_size > 3 || params_size < size)
+		return 0;
+	memset(buf, 0, SIM_PCR_INFO_SIZE);
+	ToTpmUint16(buf, 3);
+	memcpy(buf + 2, params + 2, select_size);
+	memcpy(buf + 5, params + 2 + select_size, 1 + TPM_SHA1_160_HASH_LEN);
+	return size;
+}
+
+static uint32_t do_define_space(const uint8_t *params, uint32_t params_size,
+				uint8_t *body, uint32_t *body_size)
+{
+	uint8_t pcr_info_read[SIM_PCR_INFO_SIZE];
+	uint8_t pcr_info_write[SIM_PCR_INFO_SIZE];
+	const uint8_t *end = params + params_size;
+	struct sim_space *space;
+	uint32_t index, attributes, size, used;
+	int i;
+
+	/* TPM_NV_DATA_PUBLIC, then the encrypted auth value. */
+	if (params_size < 6)
+		return SIM_E_BAD_PARAM_SIZE;
+	FromTpmUint32(params + 2, &index);
+	params += 6;
+	used = read_pcr_info(params, end - params, pcr_info_read);
+	if (!used)
+		return SIM_E_BAD_PARAMETER;
+	params += used;
+	used = read_pcr_info(params, end - params, pcr_info_write);
+	if (!used)
+		return SIM_E_BAD_PARAMETER;
+	params += used;
+	if (end - params < 6 + 3 + 4 + TPM_SHA1_160_HASH_LEN)
+		return SIM_E_BAD_PARAM_SIZE;
+	FromTpmUint32(params + 2, &attributes);
+	FromTpmUint32(params + 9, &size);
+
+	/* Without an owner, physical presence is needed once NV is locked. */
+	if (state.pflags.nvLocked && !state.vflags.physicalPresence)
+		return TPM_E_BAD_PRESENCE;
+
+	if (index == TPM_NV_INDEX_LOCK) {
+		state.pflags.nvLocked = 1;
+		mark_changed(0);
+		return TPM_SUCCESS;
+	}
+
+	space = find_space(index);
+	if (space) {
+		if (((space->attributes & TPM_NV_PER_GLOBALLOCK) &&
+		     state.vflags.bGlobalLock) ||
+		    ((space->attributes & TPM_NV_PER_WRITE_STCLEAR) &&
+		     space->write_locked))
+			return TPM_E_AREA_LOCKED;
+		memset(space, 0, sizeof(*space));
+		mark_changed(0);
+		if (size == 0)
+			return TPM_SUCCESS;
+	} else if (size == 0) {
+		return TPM_E_BADINDEX;
+	}
+
+	if (size > SIM_MAX_SPACE_SIZE)
+		return SIM_E_NOSPACE;
+	for (i = 0; i < SIM_MAX_SPACES && state.spaces[i].used; i++)
+		;
+	if (i == SIM_MAX_SPACES)
+		return SIM_E_NOSPACE;
+	space = &state.spaces[i];
+	space->used = 1;
+	space->index = index;
+	space->attributes = attributes;
+	space->size = size;
+	memcpy(space->pcr_info_read, pcr_info_read, SIM_PCR_INFO_SIZE);
+	memcpy(space->pcr_info_write, pcr_info_write, SIM_PCR_INFO_SIZE);
+	memset(space->data, 0xff, size);
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_nv_write(const uint8_t *params, uint32_t params_size,
+			    uint8_t *body, uint32_t *body_size)
+{
+	struct sim_space *space;
+	uint32_t index, offset, size;
+
+	if (params_size < 3 * sizeof(uint32_t))
+		return SIM_E_BAD_PARAM_SIZE;
+	index = ReadTpmUint32(&params);
+	offset = ReadTpmUint32(&params);
+	size = ReadTpmUint32(&params);
+	if (size != params_size - 3 * sizeof(uint32_t))
+		return SIM_E_BAD_PARAM_SIZE;
+
+	/* A zero-sized write to index 0 sets the global lock. */
+	if (index == TPM_NV_INDEX0 && size == 0) {
+		state.vflags.bGlobalLock = 1;
+		mark_changed(1);
+		return TPM_SUCCESS;
+	}
+
+	space = find_space(index);
+	if (!space)
+		return TPM_E_BADINDEX;
+
+	if (state.pflags.nvLocked) {
+		if (space->attributes &
+		    (TPM_NV_PER_OWNERWRITE | TPM_NV_PER_AUTHWRITE))
+			return TPM_E_AUTHFAIL;
+		if ((space->attributes & TPM_NV_PER_PPWRITE) &&
+		    !state.vflags.physicalPresence)
+			return TPM_E_BAD_PRESENCE;
+		if (((space->attributes & TPM_NV_PER_GLOBALLOCK) &&
+		     state.vflags.bGlobalLock) ||
+		    ((space->attributes & TPM_NV_PER_WRITE_STCLEAR) &&
+		     space->write_locked) ||
+		    ((space->attributes & TPM_NV_PER_WRITEDEFINE) &&
+		     space->write_defined))
+			return TPM_E_AREA_LOCKED;
+	}
+
+	/* A zero-sized write locks the space. */
+	if (size == 0) {
+		if (space->attributes & TPM_NV_PER_WRITEDEFINE) {
+			space->write_defined = 1;
+			mark_changed(0);
+		}
+		if (space->attributes & TPM_NV_PER_WRITE_STCLEAR) {
+			space->write_locked = 1;
+			mark_changed(1);
+		}
+		return TPM_SUCCESS;
+	}
+
+	if (offset > space->size || size > space->size - offset)
+		return SIM_E_NOSPACE;
+	if ((space->attributes & TPM_NV_PER_WRITEALL) && size != space->size)
+		return SIM_E_NOSPACE;
+	if (state.pflags.nvLocked) {
+		if (state.nv_writes >= SIM_MAX_NV_WRITES)
+			return TPM_E_MAXNVWRITES;
+		state.nv_writes++;
+	}
+	memcpy(space->data + offset, params, size);
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_nv_read(const uint8_t *params, uint32_t params_size,
+			   uint8_t *body, uint32_t *body_size)
+{
+	struct sim_space *space;
+	uint32_t index, offset, size;
+
+	if (params_size != 3 * sizeof(uint32_t))
+		return SIM_E_BAD_PARAM_SIZE;
+	index = ReadTpmUint32(&params);
+	offset = ReadTpmUint32(&params);
+	size = ReadTpmUint32(&params);
+
+	space = find_space(index);
+	if (!space)
+		return TPM_E_BADINDEX;
+
+	if (state.pflags.nvLocked) {
+		if (space->attributes &
+		    (TPM_NV_PER_OWNERREAD | TPM_NV_PER_AUTHREAD))
+			return TPM_E_AUTHFAIL;
+		if ((space->attributes & TPM_NV_PER_PPREAD) &&
+		    !state.vflags.physicalPresence)
+			return TPM_E_BAD_PRESENCE;
+		if ((space->attributes & TPM_NV_PER_READ_STCLEAR) &&
+		    space->read_locked)
+			return SIM_E_DISABLED;
+	}
+
+	/* A zero-sized read locks the space for reading. */
+	if (size == 0) {
+		if (space->attributes & TPM_NV_PER_READ_STCLEAR) {
+			space->read_locked = 1;
+			mark_changed(1);
+		}
+		ToTpmUint32(body, 0);
+		*body_size = sizeof(uint32_t);
+		return TPM_SUCCESS;
+	}
+
+	if (offset > space->size || size > space->size - offset)
+		return SIM_E_NOSPACE;
+	ToTpmUint32(body, size);
+	memcpy(body + sizeof(uint32_t), space->data + offset, size);
+	*body_size = sizeof(uint32_t) + size;
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_extend(const uint8_t *params, uint32_t params_size,
+			  uint8_t *body, uint32_t *body_size)
+{
+	struct vb2_sha1_context ctx;
+	uint32_t pcr;
+
+	if (params_size != sizeof(pcr) + TPM_SHA1_160_HASH_LEN)
+		return SIM_E_BAD_PARAM_SIZE;
+	pcr = ReadTpmUint32(&params);
+	if (pcr >= SIM_NUM_PCRS)
+		return TPM_E_BADINDEX;
+	if (state.pflags.disable)
+		return SIM_E_DISABLED;
+
+	vb2_sha1_init(&ctx);
+	vb2_sha1_update(&ctx, state.pcrs[pcr], TPM_SHA1_160_HASH_LEN);
+	vb2_sha1_update(&ctx, params, TPM_SHA1_160_HASH_LEN);
+	vb2_sha1_finalize(&ctx, state.pcrs[pcr]);
+	mark_changed(1);
+
+	memcpy(body, state.pcrs[pcr], TPM_SHA1_160_HASH_LEN);
+	*body_size = TPM_SHA1_160_HASH_LEN;
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_pcr_read(const uint8_t *params, uint32_t params_size,
+			    uint8_t *body, uint32_t *body_size)
+{
+	uint32_t pcr;
+
+	if (params_size != sizeof(pcr))
+		return SIM_E_BAD_PARAM_SIZE;
+	pcr = ReadTpmUint32(&params);
+	if (pcr >= SIM_NUM_PCRS)
+		return TPM_E_BADINDEX;
+
+	memcpy(body, state.pcrs[pcr], TPM_SHA1_160_HASH_LEN);
+	*body_size = TPM_SHA1_160_HASH_LEN;
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_physical_presence(const uint8_t *params,
+				     uint32_t params_size,
+				     uint8_t *body, uint32_t *body_size)
+{
+	const uint16_t lifetime_flags = TPM_PHYSICAL_PRESENCE_CMD_ENABLE |
+		TPM_PHYSICAL_PRESENCE_CMD_DISABLE |
+		TPM_PHYSICAL_PRESENCE_HW_ENABLE |
+		TPM_PHYSICAL_PRESENCE_HW_DISABLE |
+		TPM_PHYSICAL_PRESENCE_LIFETIME_LOCK;
+	uint16_t flags;
+
+	if (params_size != sizeof(flags))
+		return SIM_E_BAD_PARAM_SIZE;
+	FromTpmUint16(params, &flags);
+
+	if (flags & lifetime_flags) {
+		if ((flags & ~lifetime_flags) ||
+		    state.pflags.physicalPresenceLifetimeLock)
+			return SIM_E_BAD_PARAMETER;
+		if (flags & TPM_PHYSICAL_PRESENCE_CMD_ENABLE)
+			state.pflags.physicalPresenceCMDEnable = 1;
+		if (flags & TPM_PHYSICAL_PRESENCE_CMD_DISABLE)
+			state.pflags.physicalPresenceCMDEnable = 0;
+		if (flags & TPM_PHYSICAL_PRESENCE_HW_ENABLE)
+			state.pflags.physicalPresenceHWEnable = 1;
+		if (flags & TPM_PHYSICAL_PRESENCE_HW_DISABLE)
+			state.pflags.physicalPresenceHWEnable = 0;
+		if (flags & TPM_PHYSICAL_PRESENCE_LIFETIME_LOCK)
+			state.pflags.physicalPresenceLifetimeLock = 1;
+		mark_changed(0);
+		return TPM_SUCCESS;
+	}
+
+	if (!state.pflags.physicalPresenceCMDEnable ||
+	    state.vflags.physicalPresenceLock)
+		return SIM_E_BAD_PARAMETER;
+	if ((flags & TPM_PHYSICAL_PRESENCE_PRESENT) &&
+	    (flags & TPM_PHYSICAL_PRESENCE_NOTPRESENT))
+		return SIM_E_BAD_PARAMETER;
+	if (flags & TPM_PHYSICAL_PRESENCE_PRESENT)
+		state.vflags.physicalPresence = 1;
+	if (flags & TPM_PHYSICAL_PRESENCE_NOTPRESENT)
+		state.vflags.physicalPresence = 0;
+	if (flags & TPM_PHYSICAL_PRESENCE_LOCK) {
+		state.vflags.physicalPresence = 0;
+		state.vflags.physicalPresenceLock = 1;
+	}
+	mark_changed(1);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_force_clear(const uint8_t *params, uint32_t params_size,
+			       uint8_t *body, uint32_t *body_size)
+{
+	int i;
+
+	if (!state.vflags.physicalPresence)
+		return TPM_E_BAD_PRESENCE;
+	if (state.vflags.disableForceClear)
+		return SIM_E_CLEAR_DISABLED;
+
+	/* Spaces that belong to the owner go away with it. */
+	for (i = 0; i < SIM_MAX_SPACES; i++) {
+		if (state.spaces[i].attributes &
+		    (TPM_NV_PER_OWNERREAD | TPM_NV_PER_OWNERWRITE))
+			memset(&state.spaces[i], 0, sizeof(state.spaces[i]));
+	}
+	state.pflags.disable = 1;
+	state.pflags.deactivated = 1;
+	state.nv_writes = 0;
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_physical_enable(const uint8_t *params, uint32_t params_size,
+				   uint8_t *body, uint32_t *body_size)
+{
+	if (!state.vflags.physicalPresence)
+		return TPM_E_BAD_PRESENCE;
+	state.pflags.disable = 0;
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_physical_disable(const uint8_t *params,
+				    uint32_t params_size,
+				    uint8_t *body, uint32_t *body_size)
+{
+	if (!state.vflags.physicalPresence)
+		return TPM_E_BAD_PRESENCE;
+	state.pflags.disable = 1;
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_set_deactivated(const uint8_t *params,
+				   uint32_t params_size,
+				   uint8_t *body, uint32_t *body_size)
+{
+	if (params_size != 1)
+		return SIM_E_BAD_PARAM_SIZE;
+	if (!state.vflags.physicalPresence)
+		return TPM_E_BAD_PRESENCE;
+	state.pflags.deactivated = params[0] ? 1 : 0;
+	mark_changed(0);
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_get_random(const uint8_t *params, uint32_t params_size,
+			      uint8_t *body, uint32_t *body_size)
+{
+	uint32_t size;
+
+	if (params_size != sizeof(size))
+		return SIM_E_BAD_PARAM_SIZE;
+	size = ReadTpmUint32(&params);
+	if (state.pflags.disable)
+		return SIM_E_DISABLED;
+	/* Like real TPMs, return fewer bytes than requested if needed. */
+	if (size > SIM_MAX_BODY_SIZE - sizeof(uint32_t))
+		size = SIM_MAX_BODY_SIZE - sizeof(uint32_t);
+	if (VbExTpmGetRandom(body + sizeof(uint32_t), size))
+		return SIM_E_FAIL;
+	ToTpmUint32(body, size);
+	*body_size = sizeof(uint32_t) + size;
+	return TPM_SUCCESS;
+}
+
+static uint32_t do_read_pubek(const uint8_t *params, uint32_t params_size,
+			      uint8_t *body, uint32_t *body_size)
+{
+	struct vb2_sha1_context ctx;
+	uint8_t *p = body;
+
+	if (params_size != TPM_SHA1BASED_NONCE_LEN)
+		return SIM_E_BAD_PARAM_SIZE;
+	if (state.pflags.disable)
+		return SIM_E_DISABLED;
+
+	/* TPM_PUBKEY of a 2048-bit RSA key with the default exponent. */
+	ToTpmUint32(p, TPM_ALG_RSA);
+	ToTpmUint16(p + 4, TPM_ES_RSAESOAEP_SHA1_MGF1);
+	ToTpmUint16(p + 6, TPM_SS_NONE);
+	ToTpmUint32(p + 8, 12);
+	ToTpmUint32(p + 12, 2048);
+	ToTpmUint32(p + 16, 2);
+	ToTpmUint32(p + 20, 0);
+	ToTpmUint32(p + 24, TPM_RSA_2048_LEN);
+	memcpy(p + 28, state.ek_modulus, TPM_RSA_2048_LEN);
+	p += 28 + TPM_RSA_2048_LEN;
+
+	/* The checksum covers the key and the anti-replay nonce. */
+	vb2_sha1_init(&ctx);
+	vb2_sha1_update(&ctx, body, p - body);
+	vb2_sha1_update(&ctx, params, TPM_SHA1BASED_NONCE_LEN);
+	vb2_sha1_finalize(&ctx, p);
+	p += TPM_SHA1_160_HASH_LEN;
+	*body_size = p - body;
+	return TPM_SUCCESS;
+}
+
+static struct sim_command sim_commands[] = {
+	{TPM_ORD_Startup, "Startup", SIM_COST_NONE, do_startup},
+	{TPM_ORD_SaveState, "SaveState", SIM_COST_NONE, do_save_state},
+	{TPM_ORD_SelfTestFull, "SelfTestFull", SIM_COST_SELFTEST,
+	 do_self_test},
+	{TPM_ORD_ContinueSelfTest, "ContinueSelfTest", SIM_COST_SELFTEST,
+	 do_self_test},
+	{TPM_ORD_GetCapability, "GetCapability", SIM_COST_NONE,
+	 do_get_capability},
+	{TPM_ORD_NV_DefineSpace, "NV_DefineSpace", SIM_COST_NONE,
+	 do_define_space},
+	{TPM_ORD_NV_WriteValue, "NV_WriteValue", SIM_COST_NONE, do_nv_write},
+	{TPM_ORD_NV_ReadValue, "NV_ReadValue", SIM_COST_NONE, do_nv_read},
+	{TPM_ORD_Extend, "Extend", SIM_COST_EXTEND, do_extend},
+	{TPM_ORD_PcrRead, "PcrRead", SIM_COST_NONE, do_pcr_read},
+	{TSC_ORD_PhysicalPresence, "PhysicalPresence", SIM_COST_NONE,
+	 do_physical_presence},
+	{TPM_ORD_ForceClear, "ForceClear", SIM_COST_NONE, do_force_clear},
+	{TPM_ORD_PhysicalEnable, "PhysicalEnable", SIM_COST_NONE,
+	 do_physical_enable},
+	{TPM_ORD_PhysicalDisable, "PhysicalDisable", SIM_COST_NONE,
+	 do_physical_disable},
+	{TPM_ORD_PhysicalSetDeactivated, "PhysicalSetDeactivated",
+	 SIM_COST_NONE, do_set_deactivated},
+	{TPM_ORD_GetRandom, "GetRandom", SIM_COST_CRYPTO, do_get_random},
+	{TPM_ORD_ReadPubek, "ReadPubek", SIM_COST_CRYPTO, do_read_pubek},
+};
+
+/* Sleeps for the simulated latency of a command, and accounts for it. */
+static void simulate_latency(enum sim_cost cost)
+{
+	struct timespec delay;
+	uint32_t usecs;
+
+	if (!latency)
+		return;
+	usecs = latency->round_trip;
+	if (nv_programmed)
+		usecs += latency->nv_write;
+	if (cost == SIM_COST_EXTEND)
+		usecs += latency->extend;
+	else if (cost == SIM_COST_CRYPTO)
+		usecs += latency->crypto;
+	else if (cost == SIM_COST_SELFTEST)
+		usecs += latency->self_test;
+	simulated_usecs += usecs;
+
+	delay.tv_sec = usecs / 1000000;
+	delay.tv_nsec = (usecs % 1000000) * 1000;
+	nanosleep(&delay, NULL);
+}
+
+uint32_t tpm_simulator_execute(const uint8_t *request, uint32_t request_length,
+			       uint8_t *response, uint32_t *response_length)
+{
+	uint8_t body[SIM_MAX_BODY_SIZE];
+	struct sim_command *command = NULL;
+	uint32_t size, ordinal, result, body_size = 0;
+	uint16_t tag;
+	int i;
+
+	if (!state_path)
+		return TPM_E_NO_DEVICE;
+	if (request_length < SIM_HEADER_SIZE)
+		return TPM_E_INPUT_TOO_SMALL;
+	FromTpmUint16(request, &tag);
+	FromTpmUint32(request + 2, &size);
+	FromTpmUint32(request + 6, &ordinal);
+	if (size != request_length)
+		return TPM_E_INPUT_TOO_SMALL;
+
+	for (i = 0; i < ARRAY_SIZE(sim_commands); i++) {
+		if (sim_commands[i].ordinal == ordinal) {
+			command = &sim_commands[i];
+			break;
+		}
+	}
+
+	num_commands++;
+	state_changed = nv_programmed = 0;
+	if (tag != TPM_TAG_RQU_COMMAND) {
+		result = TPM_E_AUTHFAIL;
+	} else if (!command) {
+		result = TPM_E_BAD_ORDINAL;
+	} else if (!state.started && ordinal != TPM_ORD_Startup) {
+		result = TPM_E_INVALID_POSTINIT;
+	} else {
+		command->count++;
+		result = command->handler(request + SIM_HEADER_SIZE,
+					  size - SIM_HEADER_SIZE,
+					  body, &body_size);
+		if (result != TPM_SUCCESS)
+			body_size = 0;
+	}
+	if (nv_programmed)
+		num_nv_writes++;
+	simulate_latency(command ? command->cost : SIM_COST_NONE);
+
+	if (state_changed) {
+		uint32_t rv = save_state();
+		if (rv != TPM_SUCCESS)
+			return rv;
+	}
+
+	if (SIM_HEADER_SIZE + body_size > *response_length)
+		return TPM_E_RESPONSE_TOO_LARGE;
+	/* Responses to authorized commands have matching tags. */
+	ToTpmUint16(response, tag + TPM_TAG_RSP_COMMAND - TPM_TAG_RQU_COMMAND);
+	ToTpmUint32(response + 2, SIM_HEADER_SIZE + body_size);
+	ToTpmUint32(response + 6, result);
+	memcpy(response + SIM_HEADER_SIZE, body, body_size);
+	*response_length = SIM_HEADER_SIZE + body_size;
+	return TPM_SUCCESS;
+}
+
+/* Prints the command counts of the process, at exit. */
+static void print_stats(void)
+{
+	int i;
+
+	fprintf(stderr, "TPM simulator: %d commands, %d NV writes, "
+		"%d.%03d ms simulated latency\n", num_commands, num_nv_writes,
+		(int)(simulated_usecs / 1000), (int)(simulated_usecs % 1000));
+	for (i = 0; i < ARRAY_SIZE(sim_commands); i++) {
+		if (sim_commands[i].count)
+			fprintf(stderr, "  %-24s %d\n", sim_commands[i].name,
+				sim_commands[i].count);
+	}
+}
+
+uint32_t tpm_simulator_open(const char *path)
+{
+	const char *value;
+	uint32_t result;
+	int i;
+
+	if (state_path)
+		return TPM_SUCCESS;  /* Already open */
+
+	state_path = strdup(path);
+	state_changed = nv_programmed = 0;
+	result = load_state();
+	if (result != TPM_SUCCESS)
+		goto fail;
+
+	value = getenv("TPM_SIMULATOR_RESET");
+	if (value && atoi(value)) {
+		state.started = 0;
+		state_changed = 1;
+	}
+	if (state_changed) {
+		result = save_state();
+		if (result != TPM_SUCCESS)
+			goto fail;
+	}
+
+	latency = NULL;
+	value = getenv("TPM_SIMULATOR_LATENCY");
+	for (i = 0; value && i < ARRAY_SIZE(sim_latencies); i++) {
+		if (!strcmp(value, sim_latencies[i].bus))
+			latency = &sim_latencies[i];
+	}
+	if (value && !latency)
+		fprintf(stderr, "TPM simulator: unknown bus %s, no latency\n",
+			value);
+
+	value = getenv("TPM_SIMULATOR_STATS");
+	if (value && atoi(value) && !stats_requested) {
+		atexit(print_stats);
+		stats_requested = 1;
+	}
+	return TPM_SUCCESS;
+
+fail:
+	free(state_path);
+	state_path = NULL;
+	return result;
+}
+
+void tpm_simulator_close(void)
+{
+	free(state_path);
+	state_path = NULL;
+}
@@ -590,16 +590,24 @@ static int do_show(int argc, char *argv[])
 			continue;
 		}
 
-		if (0 != futil_map_file(ifd, MAP_RO, &buf, &len)) {
+		/* Allow the user to override the type */
+		if (type_override)
+			type = show_option.type;
+		else if (futil_file_type_fd(ifd, &type)) {
 			errorcnt++;
 			goto boo;
 		}
 
-		/* Allow the user to override the type */
-		if (type_override)
-			type = show_option.type;
-		else
-			type = futil_file_type_buf(buf, len);
+		/* Disk images can be huge, so they're read piecemeal */
+		if (type == FILE_TYPE_CHROMIUMOS_DISK) {
+			errorcnt += ft_show_disk_image(infile, ifd);
+			goto boo;
+		}
+
+		if (0 != futil_map_file(ifd, MAP_RO, &buf, &len)) {
+			errorcnt++;
+			goto boo;
+		}
 
 		errorcnt += futil_file_type_show(type, infile, buf, len);
 
@@ -7,6 +7,7 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <libgen.h>
 #include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -249,34 +250,36 @@ int ft_sign_kern_preamble(const char *name, uint8_t *buf, uint32_t len,
 }
 
 
-int ft_sign_raw_firmware(const char *name, uint8_t *buf, uint32_t len,
-			 void *data)
+/* Sign a raw firmware body with one set of keys and write the vblock. */
+static int sign_raw_firmware_with(struct vb2_body_digest *body,
+				  const char *outfile,
+				  struct vb2_private_key *signprivate,
+				  struct vb2_keyblock *keyblock,
+				  struct vb2_packed_key *kernel_subkey)
 {
 	struct vb2_signature *body_sig;
 	struct vb2_fw_preamble *preamble;
 	int rv;
 
-	body_sig = vb2_calculate_signature(buf, len, sign_option.signprivate);
+	body_sig = vb2_calculate_body_signature(body, signprivate);
 	if (!body_sig) {
 		fprintf(stderr, "Error calculating body signature\n");
 		return 1;
 	}
 
-	preamble = vb2_create_fw_preamble(
-			sign_option.version,
-			(struct vb2_packed_key *)sign_option.kernel_subkey,
-			body_sig,
-			sign_option.signprivate,
-			sign_option.flags);
+	preamble = vb2_create_fw_preamble(sign_option.version,
+					  kernel_subkey,
+					  body_sig,
+					  signprivate,
+					  sign_option.flags);
 	if (!preamble) {
 		fprintf(stderr, "Error creating firmware preamble.\n");
 		free(body_sig);
 		return 1;
 	}
 
-	rv = WriteSomeParts(sign_option.outfile,
-			    sign_option.keyblock,
-			    sign_option.keyblock->keyblock_size,
+	rv = WriteSomeParts(outfile,
+			    keyblock, keyblock->keyblock_size,
 			    preamble, preamble->preamble_size);
 
 	free(preamble);
@@ -285,6 +288,40 @@ int ft_sign_raw_firmware(const char *name, uint8_t *buf, uint32_t len,
 	return rv;
 }
 
+int ft_sign_raw_firmware(const char *name, uint8_t *buf, uint32_t len,
+			 void *data)
+{
+	struct vb2_body_digest body;
+	char filename[PATH_MAX];
+	int i, rv;
+
+	/* The body is hashed once, however many keysets sign it. */
+	vb2_init_body_digest(&body, buf, len);
+
+	rv = sign_raw_firmware_with(&body, sign_option.outfile,
+				    sign_option.signprivate,
+				    sign_option.keyblock,
+				    sign_option.kernel_subkey);
+
+	for (i = 0; i < sign_option.num_keysets; i++) {
+		struct sign_keyset_s *ks = &sign_option.keysets[i];
+
+		if (snprintf(filename, sizeof(filename), "%s.%s",
+			     sign_option.outfile, ks->name) >=
+		    sizeof(filename)) {
+			fprintf(stderr, "Keyset %s produces bogus filename\n",
+				ks->name);
+			rv |= 1;
+			continue;
+		}
+		rv |= sign_raw_firmware_with(&body, filename,
+					     ks->signprivate, ks->keyblock,
+					     ks->kernel_subkey);
+	}
+
+	return rv;
+}
+
 static const char usage_pubkey[] = "\n"
 	"To sign a public key / create a new keyblock:\n"
 	"\n"
@@ -306,6 +343,9 @@ static const char usage_pubkey[] = "\n"
 	"  --pem_external   PROGRAM"
 	"         External program to compute the signature\n"
 	"                                     (requires a PEM signing key)\n"
+	"  --pem_persistent"
+	"                 Keep the external program running and send\n"
+	"                                     it length-prefixed requests\n"
 	"\n";
 static void print_help_pubkey(int argc, char *argv[])
 {
@@ -313,6 +353,14 @@ static void print_help_pubkey(int argc, char *argv[])
 }
 
 
+#define KEYSET_HELP \
+	"A keyset DIR holds firmware_data_key.vbprivk, firmware.keyblock and\n" \
+	"kernel_subkey.vbpubk, plus dev_firmware_data_key.vbprivk and\n" \
+	"dev_firmware.keyblock if A and B differ. With an ID, the firmware\n" \
+	"keys are named firmware_data_key.ID.vbprivk, firmware.ID.keyblock\n" \
+	"and so on, as for LOEM keys. The firmware body is hashed only once\n" \
+	"no matter how many keysets are used.\n"
+
 static const char usage_fw_main[] = "\n"
 	"To sign a raw firmware blob (FW_MAIN_A/B):\n"
 	"\n"
@@ -329,6 +377,11 @@ static const char usage_fw_main[] = "\n"
 	"Optional PARAMS:\n"
 	"  -f|--flags       NUM             The preamble flags value"
 	" (default is 0)\n"
+	"  --keyset         DIR[:ID]        Also sign with this keyset,"
+	" writing\n"
+	"                                     OUTFILE.ID (may be repeated)\n"
+	"\n"
+	KEYSET_HELP
 	"\n";
 static void print_help_raw_firmware(int argc, char *argv[])
 {
@@ -359,7 +412,14 @@ static const char usage_bios[] = "\n"
 	"                                     unchanged, or 0 if unknown)\n"
 	"  -d|--loemdir     DIR             Local OEM output vblock directory\n"
 	"  -l|--loemid      STRING          Local OEM vblock suffix\n"
+	"  --keyset         DIR[:ID]        Also sign with this keyset,"
+	" writing\n"
+	"                                     vblock_A.ID and vblock_B.ID to\n"
+	"                                     the LOEM directory (may be\n"
+	"                                     repeated)\n"
 	"  [--outfile]      OUTFILE         Output firmware image\n"
+	"\n"
+	KEYSET_HELP
 	"\n";
 static void print_help_bios_image(int argc, char *argv[])
 {
@@ -423,6 +483,32 @@ static void print_help_kern_preamble(int argc, char *argv[])
 	printf(usage_old_kpart, sign_option.padding);
 }
 
+static const char usage_disk[] = "\n"
+	"To resign the kernels in a Chromium OS disk image (/dev/sda):\n"
+	"\n"
+	"Required PARAMS:\n"
+	"  -s|--signprivate FILE.vbprivk"
+	"    The private key to sign the kernel blobs\n"
+	"  [--infile]       INFILE          Input disk image (modified\n"
+	"                                     in place if no OUTFILE given)\n"
+	"\n"
+	"Optional PARAMS:\n"
+	"  -b|--keyblock    FILE.keyblock   Keyblock containing the public\n"
+	"                                     key to verify the kernel blobs\n"
+	"  -v|--version     NUM             The kernel version number\n"
+	"  --config         FILE            The kernel commandline file\n"
+	"  --pad            NUM             The vblock padding size in bytes\n"
+	"                                     (default 0x%x)\n"
+	"  [--outfile]      OUTFILE         Output disk image\n"
+	"  -f|--flags       NUM             The preamble flags value\n"
+	"\n"
+	"Every Chromium OS kernel partition holding a keyblock is resigned.\n"
+	"\n";
+static void print_help_disk(int argc, char *argv[])
+{
+	printf(usage_disk, sign_option.padding);
+}
+
 static void print_help_usbpd1(int argc, char *argv[])
 {
 	const struct vb2_text_vs_enum *entry;
@@ -525,6 +611,7 @@ static void (*help_type[NUM_FILE_TYPES])(int argc, char *argv[]) = {
 	[FILE_TYPE_KERN_PREAMBLE] = &print_help_kern_preamble,
 	[FILE_TYPE_USBPD1] = &print_help_usbpd1,
 	[FILE_TYPE_RWSIG] = &print_help_rwsig,
+	[FILE_TYPE_CHROMIUMOS_DISK] = &print_help_disk,
 };
 
 static const char usage_default[] = "\n"
@@ -538,6 +625,7 @@ static const char usage_default[] = "\n"
 	"  full firmware image (bios.bin)      same, or signed in-place\n"
 	"  raw linux kernel (vmlinuz)          kernel partition image\n"
 	"  kernel partition (/dev/sda2)        same, or signed in-place\n"
+	"  disk image (/dev/sda)               same, or signed in-place\n"
 	"  usbpd1 firmware image               same, or signed in-place\n"
 	"  RW device image                     same, or signed in-place\n"
 	"\n"
@@ -588,6 +676,7 @@ enum no_short_opts {
 	OPT_DATA_SIZE,
 	OPT_SIG_SIZE,
 	OPT_PRIKEY,
+	OPT_KEYSET,
 	OPT_HELP,
 };
 
@@ -616,6 +705,7 @@ static const struct option long_opts[] = {
 	{"pem",          1, NULL, OPT_PEM_SIGNPRIV}, /* alias */
 	{"pem_algo",     1, NULL, OPT_PEM_ALGO},
 	{"pem_external", 1, NULL, OPT_PEM_EXTERNAL},
+	{"pem_persistent", 0, &sign_option.pem_persistent, 1},
 	{"type",         1, NULL, OPT_TYPE},
 	{"vblockonly",   0, &sign_option.vblockonly, 1},
 	{"hash_alg",     1, NULL, OPT_HASH_ALG},
@@ -627,6 +717,7 @@ static const struct option long_opts[] = {
 	{"sig_size",     1, NULL, OPT_SIG_SIZE},
 	{"prikey",       1, NULL, OPT_PRIKEY},
 	{"privkey",      1, NULL, OPT_PRIKEY},	/* alias */
+	{"keyset",       1, NULL, OPT_KEYSET},
 	{"help",         0, NULL, OPT_HELP},
 	{NULL,           0, NULL, 0},
 };
@@ -645,6 +736,72 @@ static int parse_number_opt(const char *arg, const char *name, uint32_t *dest)
 	return 0;
 }
 
+/* Build the name of one file in a keyset, with the optional ID. */
+static void keyset_path(char *buf, size_t size, const char *dir,
+			const char *base, const char *id, const char *ext)
+{
+	if (id)
+		snprintf(buf, size, "%s/%s.%s.%s", dir, base, id, ext);
+	else
+		snprintf(buf, size, "%s/%s.%s", dir, base, ext);
+}
+
+/* Parse a --keyset DIR[:ID] arg and read its keys. Returns num errors. */
+static int add_keyset(const char *arg)
+{
+	struct sign_keyset_s *ks;
+	char path[PATH_MAX];
+	char *dir, *id;
+
+	ks = realloc(sign_option.keysets,
+		     (sign_option.num_keysets + 1) * sizeof(*ks));
+	if (!ks) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	sign_option.keysets = ks;
+	ks += sign_option.num_keysets;
+	memset(ks, 0, sizeof(*ks));
+
+	dir = strdup(arg);
+	if (!dir) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	id = strchr(dir, ':');
+	if (id)
+		*id++ = '\0';
+	ks->name = strdup(id ? id : basename(dir));
+
+	keyset_path(path, sizeof(path), dir, "firmware_data_key", id,
+		    "vbprivk");
+	ks->signprivate = vb2_read_private_key(path);
+	keyset_path(path, sizeof(path), dir, "firmware", id, "keyblock");
+	ks->keyblock = vb2_read_keyblock(path);
+	/* LOEM keysets share the kernel subkey */
+	snprintf(path, sizeof(path), "%s/kernel_subkey.vbpubk", dir);
+	ks->kernel_subkey = vb2_read_packed_key(path);
+
+	keyset_path(path, sizeof(path), dir, "dev_firmware_data_key", id,
+		    "vbprivk");
+	if (!access(path, R_OK))
+		ks->devsignprivate = vb2_read_private_key(path);
+	keyset_path(path, sizeof(path), dir, "dev_firmware", id, "keyblock");
+	if (!access(path, R_OK))
+		ks->devkeyblock = vb2_read_keyblock(path);
+
+	free(dir);
+
+	if (!ks->name || !ks->signprivate || !ks->keyblock ||
+	    !ks->kernel_subkey) {
+		fprintf(stderr, "Error reading keyset %s\n", arg);
+		return 1;
+	}
+
+	sign_option.num_keysets++;
+	return 0;
+}
+
 static int do_sign(int argc, char *argv[])
 {
 	char *infile = 0;
@@ -842,6 +999,9 @@ static int do_sign(int argc, char *argv[])
 				errorcnt++;
 			}
 			break;
+		case OPT_KEYSET:
+			errorcnt += add_keyset(optarg);
+			break;
 		case OPT_HELP:
 			helpind = optind - 1;
 			break;
@@ -936,6 +1096,12 @@ static int do_sign(int argc, char *argv[])
 				" --pem_signpriv\n");
 			errorcnt++;
 		}
+		if (sign_option.pem_persistent && !sign_option.pem_external) {
+			fprintf(stderr, "--pem_persistent must be used with"
+				" --pem_external\n");
+			errorcnt++;
+		}
+		vb2_external_signer_set_persistent(sign_option.pem_persistent);
 		/* We'll wait to read the PEM file, since the external signer
 		 * may want to read it instead. */
 		break;
@@ -950,6 +1116,15 @@ static int do_sign(int argc, char *argv[])
 		if (sign_option.vblockonly || sign_option.inout_file_count > 1)
 			sign_option.create_new_outfile = 1;
 		break;
+	case FILE_TYPE_CHROMIUMOS_DISK:
+		/* The kernel partitions are always re-signed in place */
+		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
+		if (sign_option.vblockonly) {
+			fprintf(stderr,
+				"--vblockonly doesn't apply to disk images\n");
+			errorcnt++;
+		}
+		break;
 	case FILE_TYPE_RAW_FIRMWARE:
 		sign_option.create_new_outfile = 1;
 		errorcnt += no_opt_if(!sign_option.signprivate, "signprivate");
@@ -985,6 +1160,14 @@ static int do_sign(int argc, char *argv[])
 		break;
 	}
 
+	if (sign_option.num_keysets &&
+	    sign_option.type != FILE_TYPE_RAW_FIRMWARE &&
+	    sign_option.type != FILE_TYPE_BIOS_IMAGE &&
+	    sign_option.type != FILE_TYPE_OLD_BIOS_IMAGE) {
+		fprintf(stderr, "--keyset only applies to firmware\n");
+		errorcnt++;
+	}
+
 	Debug("infile=%s\n", infile);
 	Debug("sign_option.inout_file_count=%d\n", sign_option.inout_file_count);
 	Debug("sign_option.create_new_outfile=%d\n",
@@ -1038,6 +1221,12 @@ static int do_sign(int argc, char *argv[])
 		}
 	}
 
+	/* Disk images can be huge, so they're signed piecemeal */
+	if (sign_option.type == FILE_TYPE_CHROMIUMOS_DISK) {
+		errorcnt += ft_sign_disk_image(infile, ifd);
+		goto done;
+	}
+
 	if (0 != futil_map_file(ifd, mapping, &buf, &buf_len)) {
 		errorcnt++;
 		goto done;
@@ -33,6 +33,10 @@ static struct option const long_opts[] = {
 	{"wp", 1, NULL, 'W'},
 	{"emulate", 1, NULL, 'E'},
 	{"sys_props", 1, NULL, 'S'},
+	{"sparse_read", 0, NULL, 'R'},
+	{"cache_dir", 1, NULL, 'C'},
+	{"timing", 0, NULL, 'T'},
+	{"json", 1, NULL, 'J'},
 	{"debug", 0, NULL, 'd'},
 	{"verbose", 0, NULL, 'v'},
 	{"help", 0, NULL, 'h'},
@@ -55,6 +59,10 @@ static void print_help(int argc, char *argv[])
 		"-p, --programmer=PRG\tChange AP (host) flashrom programmer\n"
 		"    --quirks=LIST   \tSpecify the quirks to apply\n"
 		"    --list-quirks   \tPrint all available quirks\n"
+		"    --sparse_read   \tOnly read the flash sections needed\n"
+		"    --cache_dir=DIR \tCache outcome of key verification in DIR\n"
+		"    --timing        \tPrint time and I/O of each stage\n"
+		"    --json=FILE     \tWrite the --timing report in JSON to FILE\n"
 		"\n"
 		"Legacy and compatibility options:\n"
 		"-m, --mode=MODE     \tRun updater in given mode\n"
@@ -75,7 +83,10 @@ static int do_update(int argc, char *argv[])
 {
 	struct updater_config *cfg;
 	struct updater_config_arguments args = {0};
-	int i, errorcnt = 0;
+	int i, errorcnt = 0, timing = 0;
+	const char *json_file = NULL;
+	FILE *fp;
+	uint64_t begin;
 
 	fprintf(stderr, ">> Firmware updater started.\n");
 	cfg = updater_new_config();
@@ -129,6 +140,18 @@ static int do_update(int argc, char *argv[])
 		case 'S':
 			args.sys_props = optarg;
 			break;
+		case 'R':
+			args.sparse_read = 1;
+			break;
+		case 'C':
+			args.cache_dir = optarg;
+			break;
+		case 'T':
+			timing = 1;
+			break;
+		case 'J':
+			json_file = optarg;
+			break;
 		case 'v':
 			args.verbosity++;
 			break;
@@ -159,10 +182,17 @@ static int do_update(int argc, char *argv[])
 		errorcnt++;
 		Error("Unexpected arguments.\n");
 	}
-	if (!errorcnt)
+	if (!errorcnt) {
+		begin = updater_stat_begin();
 		errorcnt += updater_setup_config(cfg, &args);
+		updater_stat_end(STAT_SETUP, begin, 0);
+	}
 	if (!errorcnt && !args.do_manifest) {
-		int r = update_firmware(cfg);
+		int r;
+
+		begin = updater_stat_begin();
+		r = update_firmware(cfg);
+		updater_stat_end(STAT_UPDATE, begin, 0);
 		if (r != UPDATE_ERR_DONE) {
 			r = Min(r, UPDATE_ERR_UNKNOWN);
 			Error("%s\n", updater_error_messages[r]);
@@ -174,6 +204,18 @@ static int do_update(int argc, char *argv[])
 		errorcnt ? "stopped due to error" : "exited successfully");
 
 	updater_delete_config(cfg);
+	if (timing)
+		updater_print_stats(stdout, 0);
+	if (json_file) {
+		fp = fopen(json_file, "w");
+		if (fp) {
+			updater_print_stats(fp, 1);
+			fclose(fp);
+		} else {
+			Error("Cannot write timing report to %s\n", json_file);
+			errorcnt++;
+		}
+	}
 	return !!errorcnt;
 }
 
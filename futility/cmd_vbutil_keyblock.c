@@ -32,6 +32,7 @@ enum {
 	OPT_SIGNPRIVATE_PEM,
 	OPT_PEM_ALGORITHM,
 	OPT_EXTERNAL_SIGNER,
+	OPT_EXTERNAL_SIGNER_PERSISTENT,
 	OPT_FLAGS,
 	OPT_HELP,
 };
@@ -45,6 +46,7 @@ static const struct option long_opts[] = {
 	{"signprivate_pem", 1, 0, OPT_SIGNPRIVATE_PEM},
 	{"pem_algorithm", 1, 0, OPT_PEM_ALGORITHM},
 	{"externalsigner", 1, 0, OPT_EXTERNAL_SIGNER},
+	{"externalsigner_persistent", 0, 0, OPT_EXTERNAL_SIGNER_PERSISTENT},
 	{"flags", 1, 0, OPT_FLAGS},
 	{"help", 0, 0, OPT_HELP},
 	{NULL, 0, 0, 0}
@@ -70,6 +72,9 @@ static const char usage[] =
 	"  --flags <number>            Specifies allowed use conditions.\n"
 	"  --externalsigner \"cmd\""
 	"        Use an external program cmd to calculate the signatures.\n"
+	"  --externalsigner_persistent\n"
+	"                              Keep the external program running and\n"
+	"                                send it length-prefixed requests.\n"
 	"\n"
 	"For '--unpack <file>', optional OPTIONS are:\n"
 	"  --signpubkey <file>"
@@ -251,6 +256,7 @@ static int do_vbutil_keyblock(int argc, char *argv[])
 	char *signprivate = NULL;
 	char *signprivate_pem = NULL;
 	char *external_signer = NULL;
+	int external_signer_persistent = 0;
 	uint64_t flags = 0;
 	uint64_t pem_algorithm = 0;
 	int is_pem_algorithm = 0;
@@ -306,6 +312,10 @@ static int do_vbutil_keyblock(int argc, char *argv[])
 			external_signer = optarg;
 			break;
 
+		case OPT_EXTERNAL_SIGNER_PERSISTENT:
+			external_signer_persistent = 1;
+			break;
+
 		case OPT_FLAGS:
 			flags = strtoul(optarg, &e, 0);
 			if (!*optarg || (e && *e)) {
@@ -337,11 +347,20 @@ static int do_vbutil_keyblock(int argc, char *argv[])
 		parse_error = 1;
 	}
 
+	if (external_signer_persistent && !external_signer) {
+		fprintf(stderr,
+			"--externalsigner_persistent must be used with"
+			" --externalsigner\n");
+		parse_error = 1;
+	}
+
 	if (parse_error) {
 		print_help(argc, argv);
 		return 1;
 	}
 
+	vb2_external_signer_set_persistent(external_signer_persistent);
+
 	switch (mode) {
 	case OPT_MODE_PACK:
 		return Pack(filename, datapubkey, signprivate,
@@ -15,8 +15,10 @@
 #include <unistd.h>
 
 #include "file_type.h"
+#include "fmap.h"
 #include "futility.h"
 #include "gbb_header.h"
+#include "gpt.h"
 
 /* Description and functions to handle each file type */
 struct futil_file_type_s {
@@ -81,12 +83,49 @@ void print_file_types_and_exit(int retval)
 	exit(retval);
 }
 
+/*
+ * Magic numbers found at fixed offsets. When one of these matches, we go
+ * straight to the recognizer that handles it instead of asking every
+ * recognizer in turn, some of which search the whole buffer. Anything that
+ * doesn't match here (or isn't confirmed by its recognizer) still gets the
+ * full search below.
+ */
+static const struct {
+	uint32_t offset;
+	const char *magic;
+	uint32_t size;
+	enum futil_file_type (*recognize)(uint8_t *buf, uint32_t len);
+} magic_table[] = {
+	{0, KEY_BLOCK_MAGIC, KEY_BLOCK_MAGIC_SIZE, ft_recognize_vblock1},
+	{0, GBB_SIGNATURE, GBB_SIGNATURE_SIZE, ft_recognize_gbb},
+	{0, FMAP_SIGNATURE, FMAP_SIGNATURE_SIZE, ft_recognize_bios_image},
+	{0, "-----BEGIN ", 11, ft_recognize_pem},
+	{0, "Vb2P", 4, ft_recognize_vb21_key},	/* VB21_MAGIC_PACKED_KEY */
+	{0, "Vb2I", 4, ft_recognize_vb21_key},	/* ..._PACKED_PRIVATE_KEY */
+	{0, "Vb2S", 4, ft_recognize_rwsig},	/* VB21_MAGIC_SIGNATURE */
+	/* GPT header is in sector 1 */
+	{512, GPT_HEADER_SIGNATURE, GPT_HEADER_SIGNATURE_SIZE,
+	 ft_recognize_gpt},
+	{512, GPT_HEADER_SIGNATURE2, GPT_HEADER_SIGNATURE_SIZE,
+	 ft_recognize_gpt},
+};
+
 /* Try to figure out what we're looking at */
 enum futil_file_type futil_file_type_buf(uint8_t *buf, uint32_t len)
 {
 	enum futil_file_type type;
 	int i;
 
+	for (i = 0; i < ARRAY_SIZE(magic_table); i++) {
+		if (magic_table[i].offset + magic_table[i].size > len ||
+		    memcmp(buf + magic_table[i].offset, magic_table[i].magic,
+			   magic_table[i].size))
+			continue;
+		type = magic_table[i].recognize(buf, len);
+		if (type != FILE_TYPE_UNKNOWN)
+			return type;
+	}
+
 	for (i = 0; i < NUM_FILE_TYPES; i++) {
 		if (futil_file_types[i].recognize) {
 			type = futil_file_types[i].recognize(buf, len);
@@ -98,12 +137,45 @@ enum futil_file_type futil_file_type_buf(uint8_t *buf, uint32_t len)
 	return FILE_TYPE_UNKNOWN;
 }
 
+/*
+ * Anything too big to map in one piece can only sensibly be a disk image, and
+ * the first few sectors are enough to recognize that.
+ */
+#define PROBE_WINDOW_SIZE (64 * 1024)
+
+enum futil_file_err futil_file_type_fd(int fd, enum futil_file_type *type)
+{
+	struct futil_window win;
+	uint8_t *buf;
+	uint32_t buf_len;
+	uint64_t size;
+	enum futil_file_err err;
+
+	*type = FILE_TYPE_UNKNOWN;
+
+	err = futil_file_size(fd, &size);
+	if (err)
+		return err;
+
+	if (size <= UINT32_MAX) {
+		err = futil_map_file(fd, MAP_RO, &buf, &buf_len);
+		if (err)
+			return err;
+		*type = futil_file_type_buf(buf, buf_len);
+		return futil_unmap_file(fd, MAP_RO, buf, buf_len);
+	}
+
+	err = futil_map_window(fd, MAP_RO, 0, PROBE_WINDOW_SIZE, &win);
+	if (err)
+		return err;
+	*type = futil_file_type_buf(win.buf, win.len);
+	return futil_unmap_window(&win);
+}
+
 enum futil_file_err futil_file_type(const char *filename,
 				    enum futil_file_type *type)
 {
 	int ifd;
-	uint8_t *buf;
-	uint32_t buf_len;
 	struct stat sb;
 	enum futil_file_err err = FILE_ERR_NONE;
 
@@ -124,15 +196,7 @@ enum futil_file_err futil_file_type(const char *filename,
 	}
 
 	if (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode)) {
-		err = futil_map_file(ifd, MAP_RO, &buf, &buf_len);
-		if (err) {
-			close(ifd);
-			return err;
-		}
-
-		*type = futil_file_type_buf(buf, buf_len);
-
-		err = futil_unmap_file(ifd, MAP_RO, buf, buf_len);
+		err = futil_file_type_fd(ifd, type);
 		if (err) {
 			close(ifd);
 			return err;
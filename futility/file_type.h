@@ -39,6 +39,9 @@ enum futil_file_type futil_file_type_buf(uint8_t *buf, uint32_t len);
 enum futil_file_err futil_file_type(const char *filename,
 				    enum futil_file_type *type);
 
+/* Same thing, for a file that's already open. It may be larger than 4GiB. */
+enum futil_file_err futil_file_type_fd(int fd, enum futil_file_type *type);
+
 /*
  * Call the show() method on a buffer containing a specific file type.
  * Returns zero on success. It's up to the caller to ensure that only valid
@@ -57,6 +60,14 @@ int futil_file_type_sign(enum futil_file_type type,
 			 const char *filename,
 			 uint8_t *buf, uint32_t len);
 
+/*
+ * Disk images may be too large to map, so instead of a buffer these take the
+ * open file and look at the GPT and each kernel partition through windows.
+ * Signing modifies the kernel partitions in place.
+ */
+int ft_show_disk_image(const char *name, int fd);
+int ft_sign_disk_image(const char *name, int fd);
+
 /* Declare the file_type functions. */
 #define R_(FOO) \
 	enum futil_file_type FOO(uint8_t *buf, uint32_t len);
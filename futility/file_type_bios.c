@@ -5,8 +5,10 @@
  */
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "bmpblk_header.h"
@@ -326,24 +328,25 @@ whatever:
 }
 
 static int write_new_preamble(struct bios_area_s *vblock,
-			      struct bios_area_s *fw_body,
+			      struct vb2_body_digest *fw_body,
 			      struct vb2_private_key *signkey,
-			      struct vb2_keyblock *keyblock)
+			      struct vb2_keyblock *keyblock,
+			      struct vb2_packed_key *kernel_subkey)
 {
 	struct vb2_signature *body_sig;
 	struct vb2_fw_preamble *preamble;
 
-	body_sig = vb2_calculate_signature(fw_body->buf, fw_body->len, signkey);
+	body_sig = vb2_calculate_body_signature(fw_body, signkey);
 	if (!body_sig) {
 		fprintf(stderr, "Error calculating body signature\n");
 		return 1;
 	}
 
 	preamble = vb2_create_fw_preamble(sign_option.version,
-			(struct vb2_packed_key *)sign_option.kernel_subkey,
-			body_sig,
-			signkey,
-			sign_option.flags);
+					  kernel_subkey,
+					  body_sig,
+					  signkey,
+					  sign_option.flags);
 	if (!preamble) {
 		fprintf(stderr, "Error creating firmware preamble.\n");
 		free(body_sig);
@@ -362,13 +365,14 @@ static int write_new_preamble(struct bios_area_s *vblock,
 	return 0;
 }
 
-static int write_loem(const char *ab, struct bios_area_s *vblock)
+static int write_loem(const char *ab, const char *id,
+		      struct bios_area_s *vblock)
 {
 	char filename[PATH_MAX];
 	int n;
 	n = snprintf(filename, sizeof(filename), "%s/vblock_%s.%s",
 		     sign_option.loemdir ? sign_option.loemdir : ".",
-		     ab, sign_option.loemid);
+		     ab, id);
 	if (n >= sizeof(filename)) {
 		fprintf(stderr, "LOEM args produce bogus filename\n");
 		return 1;
@@ -396,6 +400,81 @@ static int write_loem(const char *ab, struct bios_area_s *vblock)
 	return 0;
 }
 
+/*
+ * Sign both slots with an additional keyset and write the results as LOEM
+ * vblocks, leaving the image itself alone.
+ */
+static int sign_keyset(struct sign_keyset_s *ks, int differ,
+		       struct bios_area_s *vblock_a,
+		       struct bios_area_s *vblock_b,
+		       struct vb2_body_digest *body_a,
+		       struct vb2_body_digest *body_b)
+{
+	struct bios_area_s new_a = *vblock_a;
+	struct bios_area_s new_b = *vblock_b;
+	int retval = 0;
+
+	if (differ && (!ks->devsignprivate || !ks->devkeyblock)) {
+		fprintf(stderr, "FW A & B differ. DEV keys are required"
+			" in keyset %s.\n", ks->name);
+		return 1;
+	}
+
+	new_a.buf = malloc(vblock_a->len);
+	new_b.buf = malloc(vblock_b->len);
+	if (!new_a.buf || !new_b.buf) {
+		fprintf(stderr, "Out of memory\n");
+		retval = 1;
+		goto done;
+	}
+	memcpy(new_a.buf, vblock_a->buf, vblock_a->len);
+	memcpy(new_b.buf, vblock_b->buf, vblock_b->len);
+
+	if (differ)
+		retval |= write_new_preamble(&new_a, body_a,
+					     ks->devsignprivate,
+					     ks->devkeyblock,
+					     ks->kernel_subkey);
+	else
+		retval |= write_new_preamble(&new_a, body_a,
+					     ks->signprivate,
+					     ks->keyblock,
+					     ks->kernel_subkey);
+	retval |= write_new_preamble(&new_b, body_b,
+				     ks->signprivate,
+				     ks->keyblock,
+				     ks->kernel_subkey);
+
+	if (!retval) {
+		retval |= write_loem("A", ks->name, &new_a);
+		retval |= write_loem("B", ks->name, &new_b);
+	}
+
+done:
+	free(new_a.buf);
+	free(new_b.buf);
+	return retval;
+}
+
+/* One firmware slot to sign, possibly on its own thread. */
+struct sign_slot_s {
+	struct bios_area_s *vblock;
+	struct vb2_body_digest *body;
+	struct vb2_private_key *signkey;
+	struct vb2_keyblock *keyblock;
+	int retval;
+};
+
+static void *sign_slot_thread(void *arg)
+{
+	struct sign_slot_s *slot = (struct sign_slot_s *)arg;
+
+	slot->retval = write_new_preamble(slot->vblock, slot->body,
+					  slot->signkey, slot->keyblock,
+					  sign_option.kernel_subkey);
+	return NULL;
+}
+
 /* This signs a full BIOS image after it's been traversed. */
 static int sign_bios_at_end(struct bios_state_s *state)
 {
@@ -403,7 +482,11 @@ static int sign_bios_at_end(struct bios_state_s *state)
 	struct bios_area_s *vblock_b = &state->area[BIOS_FMAP_VBLOCK_B];
 	struct bios_area_s *fw_a = &state->area[BIOS_FMAP_FW_MAIN_A];
 	struct bios_area_s *fw_b = &state->area[BIOS_FMAP_FW_MAIN_B];
+	struct vb2_body_digest body_a, body_b;
+	struct vb2_body_digest *body_b_ptr = &body_b;
+	int differ;
 	int retval = 0;
+	int i;
 
 	if (!vblock_a->is_valid || !vblock_b->is_valid ||
 	    !fw_a->is_valid || !fw_b->is_valid) {
@@ -412,36 +495,68 @@ static int sign_bios_at_end(struct bios_state_s *state)
 	}
 
 	/* Do A & B differ ? */
-	if (fw_a->len != fw_b->len ||
-	    memcmp(fw_a->buf, fw_b->buf, fw_a->len)) {
+	differ = (fw_a->len != fw_b->len ||
+		  memcmp(fw_a->buf, fw_b->buf, fw_a->len));
+
+	/*
+	 * Each body is hashed at most once, however many keysets we use. When
+	 * A & B are identical (the usual case), B just reuses A's digests.
+	 */
+	vb2_init_body_digest(&body_a, fw_a->buf, fw_a->len);
+	if (differ)
+		vb2_init_body_digest(&body_b, fw_b->buf, fw_b->len);
+	else
+		body_b_ptr = &body_a;
+
+	/* FW B is always normal keys */
+	struct sign_slot_s slot_b = {
+		vblock_b, body_b_ptr,
+		sign_option.signprivate, sign_option.keyblock,
+	};
+
+	if (differ) {
 		/* Yes, must use DEV keys for A */
 		if (!sign_option.devsignprivate || !sign_option.devkeyblock) {
 			fprintf(stderr,
 				"FW A & B differ. DEV keys are required.\n");
 			return 1;
 		}
-		retval |= write_new_preamble(vblock_a, fw_a,
-					     sign_option.devsignprivate,
-					     sign_option.devkeyblock);
+		struct sign_slot_s slot_a = {
+			vblock_a, &body_a,
+			sign_option.devsignprivate, sign_option.devkeyblock,
+		};
+		pthread_t thread_a;
+
+		/* Nothing is shared, so hash and sign A & B in parallel. */
+		if (pthread_create(&thread_a, NULL, sign_slot_thread,
+				   &slot_a)) {
+			Debug("%s: can't create thread, signing serially\n",
+			      __func__);
+			sign_slot_thread(&slot_a);
+			sign_slot_thread(&slot_b);
+		} else {
+			sign_slot_thread(&slot_b);
+			pthread_join(thread_a, NULL);
+		}
+		retval |= slot_a.retval;
 	} else {
-		retval |= write_new_preamble(vblock_a, fw_a,
+		retval |= write_new_preamble(vblock_a, &body_a,
 					     sign_option.signprivate,
-					     sign_option.keyblock);
+					     sign_option.keyblock,
+					     sign_option.kernel_subkey);
+		sign_slot_thread(&slot_b);
 	}
-
-	/* FW B is always normal keys */
-	retval |= write_new_preamble(vblock_b, fw_b,
-				     sign_option.signprivate,
-				     sign_option.keyblock);
-
-
-
+	retval |= slot_b.retval;
 
 	if (sign_option.loemid) {
-		retval |= write_loem("A", vblock_a);
-		retval |= write_loem("B", vblock_b);
+		retval |= write_loem("A", sign_option.loemid, vblock_a);
+		retval |= write_loem("B", sign_option.loemid, vblock_b);
 	}
 
+	for (i = 0; i < sign_option.num_keysets; i++)
+		retval |= sign_keyset(&sign_option.keysets[i], differ,
+				      vblock_a, vblock_b, &body_a, body_b_ptr);
+
 	return retval;
 }
 
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Chromium OS disk images are routinely larger than 4GiB, so unlike the other
+ * file types we never map them in one piece. We map the GPT header, then the
+ * partition entries, then each kernel partition in turn.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cgptlib_internal.h"
+#include "crc32.h"
+#include "file_type.h"
+#include "futility.h"
+#include "futility_options.h"
+#include "gpt.h"
+#include "vboot_struct.h"
+
+#define DISK_SECTOR_SIZE 512
+
+typedef int (*kernel_fn)(const char *name, uint8_t *buf, uint32_t len,
+			 void *data);
+
+/* Call fn() on a window onto each kernel partition that holds a keyblock */
+static int for_each_kernel(const char *name, int fd, int writeable,
+			   kernel_fn fn, int *count)
+{
+	struct futil_window win;
+	GptHeader header;
+	GptEntry *e;
+	uint64_t size, start, len;
+	uint32_t entries_size, i;
+	char partname[256];
+	int retval = 0;
+
+	*count = 0;
+
+	if (futil_file_size(fd, &size))
+		return 1;
+
+	/* The header is in sector 1, so we need the first two sectors */
+	if (futil_map_window(fd, MAP_RO, 0, 2 * DISK_SECTOR_SIZE, &win))
+		return 1;
+	if (ft_recognize_gpt(win.buf, win.len) != FILE_TYPE_CHROMIUMOS_DISK) {
+		fprintf(stderr, "%s: no valid GPT header\n", name);
+		futil_unmap_window(&win);
+		return 1;
+	}
+	memcpy(&header, win.buf + DISK_SECTOR_SIZE, sizeof(header));
+	if (futil_unmap_window(&win))
+		return 1;
+
+	if (header.number_of_entries > MAX_NUMBER_OF_ENTRIES ||
+	    header.size_of_entry < MIN_SIZE_OF_ENTRY ||
+	    header.size_of_entry > MAX_SIZE_OF_ENTRY) {
+		fprintf(stderr, "%s: bad GPT entry table\n", name);
+		return 1;
+	}
+	entries_size = header.number_of_entries * header.size_of_entry;
+
+	if (futil_map_window(fd, MAP_RO, header.entries_lba * DISK_SECTOR_SIZE,
+			     entries_size, &win))
+		return 1;
+	if (Crc32(win.buf, entries_size) != header.entries_crc32) {
+		fprintf(stderr, "%s: GPT entries are corrupt\n", name);
+		futil_unmap_window(&win);
+		return 1;
+	}
+
+	for (i = 0; i < header.number_of_entries; i++) {
+		struct futil_window kwin;
+
+		e = (GptEntry *)(win.buf + i * header.size_of_entry);
+		if (!IsKernelEntry(e) || e->ending_lba < e->starting_lba)
+			continue;
+
+		start = e->starting_lba * DISK_SECTOR_SIZE;
+		len = (e->ending_lba - e->starting_lba + 1) * DISK_SECTOR_SIZE;
+		if (start >= size)
+			continue;
+		if (len > size - start)
+			len = size - start;
+		/* The vblock and kernel live at the start of the partition */
+		if (len > UINT32_MAX)
+			len = UINT32_MAX;
+
+		if (futil_map_window(fd, writeable, start, len, &kwin)) {
+			retval++;
+			continue;
+		}
+
+		/* Empty partitions are normal; just skip them */
+		if (kwin.len >= KEY_BLOCK_MAGIC_SIZE &&
+		    !memcmp(kwin.buf, KEY_BLOCK_MAGIC, KEY_BLOCK_MAGIC_SIZE)) {
+			snprintf(partname, sizeof(partname), "%s partition %u",
+				 name, i + 1);
+			Debug("%s at 0x%" PRIx64 "\n", partname, start);
+			retval += fn(partname, kwin.buf, kwin.len, NULL);
+			(*count)++;
+		} else {
+			Debug("%s partition %u has no keyblock\n", name, i + 1);
+		}
+
+		retval += futil_unmap_window(&kwin);
+	}
+
+	retval += futil_unmap_window(&win);
+	return retval;
+}
+
+int ft_show_disk_image(const char *name, int fd)
+{
+	int count, retval;
+
+	printf("Disk image:              %s\n", name);
+	retval = for_each_kernel(name, fd, MAP_RO,
+				 ft_show_kernel_preamble, &count);
+	if (!retval && !count)
+		printf("No kernel partitions found\n");
+	return retval;
+}
+
+int ft_sign_disk_image(const char *name, int fd)
+{
+	int count, retval;
+
+	retval = for_each_kernel(name, fd, MAP_RW,
+				 ft_sign_kern_preamble, &count);
+	if (!retval && !count) {
+		fprintf(stderr, "%s: no kernel partitions to sign\n", name);
+		retval = 1;
+	}
+	return retval;
+}
@@ -151,6 +151,27 @@ enum futil_file_err futil_map_file(int fd, int writeable,
 enum futil_file_err futil_unmap_file(int fd, int writeable,
 				     uint8_t *buf, uint32_t len);
 
+/* Size of a regular file or block device, which may well exceed 4GiB. */
+enum futil_file_err futil_file_size(int fd, uint64_t *size);
+
+/*
+ * Files that are too large to map in one piece (disk images, mostly) are
+ * looked at through windows instead. The offset may be anywhere in the file;
+ * buf points at that offset within a page-aligned mapping.
+ */
+struct futil_window {
+	uint8_t *buf;
+	uint32_t len;
+	uint64_t offset;
+	void *map;
+	size_t map_len;
+	int writeable;
+};
+enum futil_file_err futil_map_window(int fd, int writeable,
+				     uint64_t offset, uint32_t len,
+				     struct futil_window *win);
+enum futil_file_err futil_unmap_window(struct futil_window *win);
+
 /* The CPU architecture is occasionally important */
 enum arch_t {
 	ARCH_UNSPECIFIED,
@@ -32,6 +32,16 @@ struct show_option_s {
 };
 extern struct show_option_s show_option;
 
+/* Additional firmware keyset to sign with (see --keyset) */
+struct sign_keyset_s {
+	char *name;
+	struct vb2_private_key *signprivate;
+	struct vb2_keyblock *keyblock;
+	struct vb2_packed_key *kernel_subkey;
+	struct vb2_private_key *devsignprivate;	/* optional */
+	struct vb2_keyblock *devkeyblock;	/* optional */
+};
+
 struct sign_option_s {
 	struct vb2_private_key *signprivate;
 	struct vb2_keyblock *keyblock;
@@ -60,12 +70,15 @@ struct sign_option_s {
 	int pem_algo_specified;
 	uint32_t pem_algo;
 	char *pem_external;
+	int pem_persistent;
 	enum futil_file_type type;
 	enum vb2_hash_algorithm hash_alg;
 	uint32_t ro_size, rw_size;
 	uint32_t ro_offset, rw_offset;
 	uint32_t data_size, sig_size;
 	struct vb2_private_key *prikey;
+	struct sign_keyset_s *keysets;
+	int num_keysets;
 };
 extern struct sign_option_s sign_option;
 
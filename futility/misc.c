@@ -5,6 +5,7 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #ifndef HAVE_MACOS
 #include <linux/fs.h>		/* For BLKGETSIZE64 */
 #endif
@@ -236,12 +237,9 @@ void futil_copy_file_or_die(const char *infile, const char *outfile)
 }
 
 
-enum futil_file_err futil_map_file(int fd, int writeable,
-				   uint8_t **buf, uint32_t *len)
+enum futil_file_err futil_file_size(int fd, uint64_t *size)
 {
 	struct stat sb;
-	void *mmap_ptr;
-	uint32_t reasonable_len;
 
 	if (0 != fstat(fd, &sb)) {
 		fprintf(stderr, "Can't stat input file: %s\n",
@@ -254,18 +252,37 @@ enum futil_file_err futil_map_file(int fd, int writeable,
 		ioctl(fd, BLKGETSIZE64, &sb.st_size);
 #endif
 
+	if (sb.st_size < 0) {
+		fprintf(stderr, "Image size is unreasonable\n");
+		return FILE_ERR_SIZE;
+	}
+
+	*size = (uint64_t)sb.st_size;
+	return FILE_ERR_NONE;
+}
+
+enum futil_file_err futil_map_file(int fd, int writeable,
+				   uint8_t **buf, uint32_t *len)
+{
+	void *mmap_ptr;
+	uint64_t size;
+	enum futil_file_err err;
+
+	err = futil_file_size(fd, &size);
+	if (err)
+		return err;
+
 	/* If the image is larger than 2^32 bytes, it's wrong. */
-	if (sb.st_size < 0 || sb.st_size > UINT32_MAX) {
+	if (size > UINT32_MAX) {
 		fprintf(stderr, "Image size is unreasonable\n");
 		return FILE_ERR_SIZE;
 	}
-	reasonable_len = (uint32_t)sb.st_size;
 
 	if (writeable)
-		mmap_ptr = mmap(0, sb.st_size,
+		mmap_ptr = mmap(0, size,
 				PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
 	else
-		mmap_ptr = mmap(0, sb.st_size,
+		mmap_ptr = mmap(0, size,
 				PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
 
 	if (mmap_ptr == (void *)-1) {
@@ -276,7 +293,7 @@ enum futil_file_err futil_map_file(int fd, int writeable,
 	}
 
 	*buf = (uint8_t *)mmap_ptr;
-	*len = reasonable_len;
+	*len = (uint32_t)size;
 	return FILE_ERR_NONE;
 }
 
@@ -302,6 +319,73 @@ enum futil_file_err futil_unmap_file(int fd, int writeable,
 	return err;
 }
 
+enum futil_file_err futil_map_window(int fd, int writeable,
+				     uint64_t offset, uint32_t len,
+				     struct futil_window *win)
+{
+	uint64_t size, start;
+	long pagesize = sysconf(_SC_PAGESIZE);
+	void *mmap_ptr;
+	enum futil_file_err err;
+
+	memset(win, 0, sizeof(*win));
+
+	err = futil_file_size(fd, &size);
+	if (err)
+		return err;
+
+	if (len == 0 || offset > size || len > size - offset) {
+		fprintf(stderr, "Window 0x%" PRIx64 "+0x%x is outside the "
+			"file (0x%" PRIx64 " bytes)\n", offset, len, size);
+		return FILE_ERR_SIZE;
+	}
+
+	/* mmap() wants a page-aligned offset, so map a little extra */
+	start = offset & ~(uint64_t)(pagesize - 1);
+	win->map_len = (size_t)(offset - start) + len;
+
+	mmap_ptr = mmap(0, win->map_len, PROT_READ|PROT_WRITE,
+			writeable ? MAP_SHARED : MAP_PRIVATE, fd, (off_t)start);
+	if (mmap_ptr == (void *)-1) {
+		fprintf(stderr, "Can't mmap %s file at 0x%" PRIx64 ": %s\n",
+			writeable ? "output" : "input", start,
+			strerror(errno));
+		return FILE_ERR_MMAP;
+	}
+
+	Debug("%s: 0x%" PRIx64 "+0x%x\n", __func__, offset, len);
+	win->map = mmap_ptr;
+	win->buf = (uint8_t *)mmap_ptr + (offset - start);
+	win->len = len;
+	win->offset = offset;
+	win->writeable = writeable;
+	return FILE_ERR_NONE;
+}
+
+enum futil_file_err futil_unmap_window(struct futil_window *win)
+{
+	enum futil_file_err err = FILE_ERR_NONE;
+
+	if (!win->map)
+		return FILE_ERR_NONE;
+
+	if (win->writeable &&
+	    (0 != msync(win->map, win->map_len, MS_SYNC|MS_INVALIDATE))) {
+		fprintf(stderr, "msync failed: %s\n", strerror(errno));
+		err = FILE_ERR_MSYNC;
+	}
+
+	if (0 != munmap(win->map, win->map_len)) {
+		fprintf(stderr, "Can't munmap pointer: %s\n",
+			strerror(errno));
+		if (err == FILE_ERR_NONE)
+			err = FILE_ERR_MUNMAP;
+	}
+
+	memset(win, 0, sizeof(*win));
+	return err;
+}
+
 
 #define DISK_SECTOR_SIZE 512
 enum futil_file_type ft_recognize_gpt(uint8_t *buf, uint32_t len)
@@ -8,12 +8,14 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "2rsa.h"
+#include "cbfs.h"
 #include "crossystem.h"
 #include "futility.h"
 #include "host_misc.h"
@@ -25,27 +27,22 @@
 
 #define COMMAND_BUFFER_SIZE 256
 #define RETURN_ON_FAILURE(x) do {int r = (x); if (r) return r;} while (0);
-#define FLASHROM_OUTPUT_WP_PATTERN "write protect is "
+
+/* Max number of ranges to pass to flashrom as layout regions in one write. */
+#define FLASH_MAX_DELTA_RANGES 32
 
 /* System environment values. */
 static const char * const FWACT_A = "A",
 		  * const FWACT_B = "B",
 		  * const STR_REV = "rev",
-		  * const FLASHROM_OUTPUT_WP_ENABLED =
-			  FLASHROM_OUTPUT_WP_PATTERN "enabled",
-		  * const FLASHROM_OUTPUT_WP_DISABLED =
-			  FLASHROM_OUTPUT_WP_PATTERN "disabled";
+		  * const PATH_DMI_PRODUCT_VERSION =
+			  "/sys/class/dmi/id/product_version";
 
 /* flashrom programmers. */
 static const char * const PROG_HOST = "host",
 		  * const PROG_EC = "ec",
 		  * const PROG_PD = "ec:dev=1";
 
-enum wp_state {
-	WP_DISABLED,
-	WP_ENABLED,
-};
-
 enum target_type {
 	TARGET_SELF,
 	TARGET_UPDATE,
@@ -57,12 +54,41 @@ enum active_slot {
 	SLOT_B,
 };
 
-enum flashrom_ops {
-	FLASHROM_READ,
-	FLASHROM_WRITE,
-	FLASHROM_WP_STATUS,
+/* The erase blocks that really changed between system and target images. */
+struct flash_delta {
+	int num_ranges;
+	struct flash_range ranges[FLASH_MAX_DELTA_RANGES];
+	uint32_t bytes_written;
+	uint32_t bytes_skipped;
+};
+
+/*
+ * Sections of the system firmware that the updater may need to look at when
+ * reading only parts of the flash (--sparse_read).
+ */
+static const char * const sparse_read_sections[] = {
+	FMAP_RO_FRID,
+	FMAP_RO_GBB,
+	FMAP_RO_VPD,
+	FMAP_RO_PRESERVE,
+	"RO_FSG",
+	FMAP_RW_FWID,
+	FMAP_RW_FWID_A,
+	FMAP_RW_FWID_B,
+	FMAP_RW_VBLOCK_A,
+	FMAP_RW_VBLOCK_B,
+	FMAP_RW_VPD,
+	FMAP_RW_PRESERVE,
+	FMAP_RW_NVRAM,
+	FMAP_RW_ELOG,
+	FMAP_RW_SMMSTORE,
+	FMAP_RW_LEGACY,
+	FMAP_SI_DESC,
+	FMAP_SI_ME,
 };
 
+static int is_write_protection_enabled(struct updater_config *cfg);
+
 
 /*
  * Helper function to create a new temporary file.
@@ -208,12 +234,29 @@ static int host_get_fw_vboot2()
 	return VbGetSystemPropertyInt("fw_vboot2");
 }
 
-/* A help function to get $(mosys platform version). */
+/*
+ * A help function to get $(mosys platform version).
+ * On x86, mosys reports the SMBIOS system version, which the kernel exports
+ * in sysfs; read that directly and only run mosys if it is not available.
+ */
 static int host_get_platform_version()
 {
-	char *result = host_shell("mosys platform version");
+	char buf[COMMAND_BUFFER_SIZE] = "";
+	char *result = NULL;
+	FILE *fp = fopen(PATH_DMI_PRODUCT_VERSION, "r");
 	int rev = -1;
 
+	if (fp) {
+		if (fgets(buf, sizeof(buf), fp)) {
+			strip(buf);
+			if (*buf)
+				result = strdup(buf);
+		}
+		fclose(fp);
+	}
+	if (!result)
+		result = host_shell("mosys platform version");
+
 	/* Result should be 'revN' */
 	if (strncmp(result, STR_REV, strlen(STR_REV)) == 0)
 		rev = strtol(result + strlen(STR_REV), NULL, 0);
@@ -223,100 +266,19 @@ static int host_get_platform_version()
 	return rev;
 }
 
-/*
- * A helper function to invoke flashrom(8) command.
- * Returns 0 if success, non-zero if error.
- */
-static int host_flashrom(enum flashrom_ops op, const char *image_path,
-			 const char *programmer, int verbose,
-			 const char *section_name)
+/* Helper function to return software write protection switch status. */
+static int host_get_wp_sw()
 {
-	char *command, *result;
-	const char *op_cmd, *dash_i = "-i", *postfix = "", *ignore_lock = "";
+	struct flash_programmer *flash = flash_open(PROG_HOST, NULL, 0);
 	int r;
 
-	switch (verbose) {
-	case 0:
-		postfix = " >/dev/null 2>&1";
-		break;
-	case 1:
-		break;
-	case 2:
-		postfix = "-V";
-		break;
-	case 3:
-		postfix = "-V -V";
-		break;
-	default:
-		postfix = "-V -V -V";
-		break;
-	}
-
-	if (!section_name || !*section_name) {
-		dash_i = "";
-		section_name = "";
-	}
-
-	switch (op) {
-	case FLASHROM_READ:
-		op_cmd = "-r";
-		assert(image_path);
-		break;
-
-	case FLASHROM_WRITE:
-		op_cmd = "-w";
-		assert(image_path);
-		break;
-
-	case FLASHROM_WP_STATUS:
-		op_cmd = "--wp-status";
-		assert(image_path == NULL);
-		image_path = "";
-		/* grep is needed because host_shell only returns 1 line. */
-		postfix = " 2>/dev/null | grep \"" \
-			   FLASHROM_OUTPUT_WP_PATTERN "\"";
-		break;
-
-	default:
-		assert(0);
+	if (!flash)
 		return -1;
-	}
-
-	/* TODO(hungte) In future we should link with flashrom directly. */
-	ASPRINTF(&command, "flashrom %s %s -p %s %s %s %s %s", op_cmd,
-		 image_path, programmer, dash_i, section_name, ignore_lock,
-		 postfix);
-
-	if (verbose)
-		printf("Executing: %s\n", command);
-
-	if (op != FLASHROM_WP_STATUS) {
-		r = system(command);
-		free(command);
-		return r;
-	}
-
-	result = host_shell(command);
-	strip(result);
-	free(command);
-	DEBUG("wp-status: %s", result);
-
-	if (strstr(result, FLASHROM_OUTPUT_WP_ENABLED))
-		r = WP_ENABLED;
-	else if (strstr(result, FLASHROM_OUTPUT_WP_DISABLED))
-		r = WP_DISABLED;
-	else
-		r = -1;
-	free(result);
+	r = flash_get_wp_status(flash);
+	flash_close(flash);
 	return r;
 }
 
-/* Helper function to return software write protection switch status. */
-static int host_get_wp_sw()
-{
-	return host_flashrom(FLASHROM_WP_STATUS, NULL, PROG_HOST, 0, NULL);
-}
-
 /*
  * Gets the system property by given type.
  * If the property was not loaded yet, invoke the property getter function
@@ -502,6 +464,28 @@ static int setup_config_quirks(const char *quirks, struct updater_config *cfg)
 	return r;
 }
 
+/*
+ * Returns true if the given range of a (possibly sparse) image holds data that
+ * was really read from flash.
+ */
+static int image_range_is_valid(const struct firmware_image *image,
+				const uint8_t *start, size_t size)
+{
+	const struct firmware_section *section;
+	int i;
+
+	if (!image->valid_sections)
+		return 1;
+
+	for (i = 0; i < image->num_valid_sections; i++) {
+		section = &image->valid_sections[i];
+		if (start >= section->data &&
+		    start + size <= section->data + section->size)
+			return 1;
+	}
+	return 0;
+}
+
 /*
  * Finds a firmware section by given name in the firmware image.
  * If successful, return zero and *section argument contains the address and
@@ -521,6 +505,12 @@ int find_firmware_section(struct firmware_section *section,
 			section_name, &fah);
 	if (!ptr)
 		return -1;
+	/* Sections we didn't read from a sparse image don't exist. */
+	if (!image_range_is_valid(image, ptr, fah->area_size)) {
+		DEBUG("Section %s was not read from %s.", section_name,
+		      image->file_name);
+		return -1;
+	}
 	section->data = (uint8_t *)ptr;
 	section->size = fah->area_size;
 	return 0;
@@ -576,29 +566,15 @@ static int load_firmware_version(struct firmware_image *image,
 }
 
 /*
- * Loads a firmware image from file.
- * If archive is provided and file_name is a relative path, read the file from
- * archive.
+ * Parses the FMAP and versions of a firmware image already in memory.
  * Returns 0 on success, otherwise failure.
  */
-int load_firmware_image(struct firmware_image *image, const char *file_name,
-			struct archive *archive)
+static int parse_firmware_image(struct firmware_image *image)
 {
-	DEBUG("Load image file from %s...", file_name);
-
-	if (!archive_has_entry(archive, file_name)) {
-		ERROR("Does not exist: %s", file_name);
-		return -1;
-	}
-	if (archive_read_file(archive, file_name, &image->data, &image->size) !=
-	    VB2_SUCCESS) {
-		ERROR("Failed to load %s", file_name);
-		return -1;
-	}
+	const char *file_name = image->file_name;
 
 	DEBUG("Image size: %d", image->size);
 	assert(image->data);
-	image->file_name = strdup(file_name);
 
 	image->fmap_header = fmap_find(image->data, image->size);
 	if (!image->fmap_header) {
@@ -626,20 +602,229 @@ int load_firmware_image(struct firmware_image *image, const char *file_name,
 	return 0;
 }
 
+/*
+ * Loads a firmware image from file.
+ * If archive is provided and file_name is a relative path, read the file from
+ * archive.
+ * Returns 0 on success, otherwise failure.
+ */
+int load_firmware_image(struct firmware_image *image, const char *file_name,
+			struct archive *archive)
+{
+	uint64_t begin = updater_stat_begin();
+	int r;
+
+	DEBUG("Load image file from %s...", file_name);
+
+	if (!archive_has_entry(archive, file_name)) {
+		ERROR("Does not exist: %s", file_name);
+		return -1;
+	}
+	if (archive_read_file(archive, file_name, &image->data, &image->size) !=
+	    VB2_SUCCESS) {
+		ERROR("Failed to load %s", file_name);
+		return -1;
+	}
+
+	image->file_name = strdup(file_name);
+	r = parse_firmware_image(image);
+	updater_stat_end(STAT_LOAD_IMAGE, begin, image->size);
+	return r;
+}
+
+/*
+ * Returns the flash session for given programmer, opening a new one if needed.
+ * The session is kept in cfg (and closed by updater_delete_config) so an
+ * emulated flash is only mapped once for all reads and writes.
+ * Returns NULL on error.
+ */
+static struct flash_programmer *updater_get_flash(struct updater_config *cfg,
+						  const char *programmer)
+{
+	const char *name = cfg->emulation ? cfg->emulation : programmer;
+
+	if (cfg->flash && strcmp(flash_name(cfg->flash), name) == 0)
+		return cfg->flash;
+	flash_close(cfg->flash);
+	cfg->flash = flash_open(programmer, cfg->emulation, cfg->verbosity);
+	return cfg->flash;
+}
+
+/*
+ * Reads the given FMAP sections (or the whole flash if count is zero) of the
+ * system firmware behind given programmer into image. If only some sections
+ * were read, contents outside them are undefined.
+ * Returns 0 if success, non-zero if error.
+ */
+static int read_system_sections(struct updater_config *cfg,
+				struct firmware_image *image,
+				const char * const *names, int count)
+{
+	struct flash_programmer *flash;
+	const char *programmer = image->programmer;
+	int r;
+
+	flash = updater_get_flash(cfg, programmer);
+	if (!flash)
+		return -1;
+	r = flash_read(flash, names, count, &image->data, &image->size);
+	if (!r) {
+		image->file_name = strdup(flash_name(flash));
+		r = parse_firmware_image(image);
+	}
+	return r;
+}
+
+/*
+ * Loads only the parts of the system firmware that the updater looks at (see
+ * sparse_read_sections), using the FMAP in flash to find out which of them
+ * exist. The rest of the image is not valid.
+ * Returns 0 if success, non-zero if error.
+ */
+static int load_system_sections(struct updater_config *cfg,
+				struct firmware_image *image)
+{
+	const char *names[ARRAY_SIZE(sparse_read_sections) + 4];
+	const char *extra[3];
+	struct flash_programmer *flash;
+	struct firmware_section *valid;
+	FmapAreaHeader *fah;
+	FmapHeader *fmap;
+	uint8_t *data;
+	uint32_t size;
+	int i, r, count = 0, num_extra = 0;
+
+	/* Find out which sections this flash has. */
+	names[count++] = FMAP_RO_FMAP;
+	flash = updater_get_flash(cfg, image->programmer);
+	if (!flash)
+		return -1;
+	r = flash_read(flash, names, count, &data, &size);
+	if (r)
+		return -1;
+	fmap = fmap_find(data, size);
+	if (!fmap) {
+		free(data);
+		return -1;
+	}
+
+	/* Try-RW compares the whole RW (and, if not protected, RO) section. */
+	if (cfg->try_update) {
+		extra[num_extra++] = FMAP_RW_SECTION_A;
+		extra[num_extra++] = FMAP_RW_SECTION_B;
+		if (!is_write_protection_enabled(cfg))
+			extra[num_extra++] = FMAP_RO_SECTION;
+	} else if (get_config_quirk(QUIRK_DAISY_SNOW_DUAL_MODEL, cfg)) {
+		extra[num_extra++] = FMAP_RO_SECTION;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(sparse_read_sections); i++)
+		if (fmap_find_by_name(data, size, fmap,
+				      sparse_read_sections[i], &fah))
+			names[count++] = sparse_read_sections[i];
+	for (i = 0; i < num_extra; i++)
+		if (fmap_find_by_name(data, size, fmap, extra[i], &fah))
+			names[count++] = extra[i];
+	free(data);
+
+	DEBUG("Reading %d sections from system firmware.", count);
+	if (read_system_sections(cfg, image, names, count))
+		return -1;
+
+	valid = (struct firmware_section *)calloc(count, sizeof(*valid));
+	if (!valid)
+		return -1;
+	for (i = 0; i < count; i++)
+		find_firmware_section(&valid[i], image, names[i]);
+	image->valid_sections = valid;
+	image->num_valid_sections = count;
+	return 0;
+}
+
 /*
  * Loads the active system firmware image (usually from SPI flash chip).
  * Returns 0 if success, non-zero if error.
  */
 int load_system_firmware(struct updater_config *cfg, struct firmware_image *image)
 {
-	const char *tmp_file = updater_create_temp_file(cfg);
+	const char *programmer = image->programmer;
 
-	if (!tmp_file)
-		return -1;
-	RETURN_ON_FAILURE(host_flashrom(
-			FLASHROM_READ, tmp_file, image->programmer,
-			cfg->verbosity, NULL));
-	return load_firmware_image(image, tmp_file, NULL);
+	if (cfg->sparse_read) {
+		if (load_system_sections(cfg, image) == 0)
+			return 0;
+		printf("WARNING: Cannot read sections from flash separately, "
+		       "reading whole flash instead.\n");
+		free_firmware_image(image);
+		image->programmer = programmer;
+	}
+
+	return read_system_sections(cfg, image, NULL, 0);
+}
+
+/*
+ * Reading the system firmware and the WP state is slow, so it is done by a
+ * worker thread while the images are loaded from the archive.
+ */
+struct system_loader {
+	pthread_t thread;
+	struct updater_config *cfg;
+	int load_image;
+};
+
+static void *system_loader_thread(void *arg)
+{
+	struct system_loader *loader = (struct system_loader *)arg;
+	struct updater_config *cfg = loader->cfg;
+	struct firmware_image *image = &cfg->image_current;
+	const char *programmer = image->programmer;
+
+	get_system_property(SYS_PROP_WP_HW, cfg);
+	get_system_property(SYS_PROP_WP_SW, cfg);
+
+	/* On failure, update_firmware will try again and report errors. */
+	if (loader->load_image && load_system_firmware(cfg, image)) {
+		free_firmware_image(image);
+		image->programmer = programmer;
+	}
+	return NULL;
+}
+
+/*
+ * Starts loading the WP state and (if load_image is set) the system firmware
+ * in the background. Nothing is started if threads are not available; the
+ * values are then loaded on demand as usual.
+ */
+static void start_system_loader(struct updater_config *cfg, int load_image)
+{
+	struct system_loader *loader;
+
+	loader = (struct system_loader *)calloc(1, sizeof(*loader));
+	if (!loader)
+		return;
+	loader->cfg = cfg;
+	loader->load_image = load_image;
+	if (pthread_create(&loader->thread, NULL, system_loader_thread,
+			   loader)) {
+		DEBUG("Cannot create thread, will load system firmware later.");
+		free(loader);
+		return;
+	}
+	cfg->system_loader = loader;
+}
+
+/*
+ * Waits for the background loader (if any) to finish. Must be called before
+ * looking at the system properties or the current system firmware.
+ */
+static void join_system_loader(struct updater_config *cfg)
+{
+	struct system_loader *loader = cfg->system_loader;
+
+	if (!loader)
+		return;
+	pthread_join(loader->thread, NULL);
+	free(loader);
+	cfg->system_loader = NULL;
 }
 
 /*
@@ -652,6 +837,7 @@ void free_firmware_image(struct firmware_image *image)
 	free(image->ro_version);
 	free(image->rw_version_a);
 	free(image->rw_version_b);
+	free(image->valid_sections);
 	memset(image, 0, sizeof(*image));
 }
 
@@ -727,97 +913,116 @@ static int set_try_cookies(struct updater_config *cfg, const char *target,
 }
 
 /*
- * Emulates writing to firmware.
- * Returns 0 if success, non-zero if error.
+ * Finds the erase blocks in the given range that differ between the current
+ * system firmware and the image to write, merging neighbours into ranges.
+ * Returns 0 if delta is ready, or non-zero if the range must be written in
+ * full (for example, there is no system image to compare with).
  */
-static int emulate_write_firmware(const char *filename,
-				  const struct firmware_image *image,
-				  const char *section_name)
+static int compute_flash_delta(const struct firmware_image *image_from,
+			       const struct firmware_image *image_to,
+			       uint32_t offset, uint32_t size,
+			       struct flash_delta *delta)
 {
-	struct firmware_image to_image = {0};
-	struct firmware_section from, to;
-	int errorcnt = 0;
+	uint32_t start, end, block_end, end_of_range = 0;
+	int n = 0;
 
-	from.data = image->data;
-	from.size = image->size;
-
-	if (load_firmware_image(&to_image, filename, NULL)) {
-		ERROR("Cannot load image from %s.", filename);
+	memset(delta, 0, sizeof(*delta));
+	if (!image_from->data || image_from->size != image_to->size ||
+	    offset > image_to->size || size > image_to->size - offset)
 		return -1;
-	}
 
-	if (section_name) {
-		find_firmware_section(&from, image, section_name);
-		if (!from.data) {
-			ERROR("No section %s in source image %s.",
-			      section_name, image->file_name);
-			errorcnt++;
-		}
-		find_firmware_section(&to, &to_image, section_name);
-		if (!to.data) {
-			ERROR("No section %s in destination image %s.",
-			      section_name, filename);
-			errorcnt++;
+	end = offset + size;
+	for (start = offset; start < end; start = block_end) {
+		/* Blocks are aligned to the flash, not to the section. */
+		block_end = (start / FLASH_ERASE_BLOCK_SIZE + 1) *
+			    FLASH_ERASE_BLOCK_SIZE;
+		block_end = Min(block_end, end);
+
+		if (image_range_is_valid(image_from, image_from->data + start,
+					 block_end - start) &&
+		    memcmp(image_from->data + start, image_to->data + start,
+			   block_end - start) == 0) {
+			delta->bytes_skipped += block_end - start;
+			continue;
 		}
-	} else if (image->size != to_image.size) {
-		ERROR("Image size is different (%s:%d != %s:%d)",
-		      image->file_name, image->size, to_image.file_name,
-		      to_image.size);
-		errorcnt++;
-	} else {
-		to.data = to_image.data;
-		to.size = to_image.size;
-	}
+		delta->bytes_written += block_end - start;
 
-	if (!errorcnt) {
-		size_t to_write = Min(to.size, from.size);
-
-		assert(from.data && to.data);
-		DEBUG("Writing %zu bytes", to_write);
-		memcpy(to.data, from.data, to_write);
-	}
-
-	if (!errorcnt && vb2_write_file(
-			filename, to_image.data, to_image.size)) {
-		ERROR("Failed writing to file: %s", filename);
-		errorcnt++;
+		/*
+		 * Extend the previous range if this block follows it, or if we
+		 * have run out of ranges (in which case the clean blocks in
+		 * between are rewritten too).
+		 */
+		if (n && (end_of_range == start ||
+			  n == FLASH_MAX_DELTA_RANGES)) {
+			if (end_of_range != start)
+				delta->bytes_skipped -= start - end_of_range;
+			delta->bytes_written += start - end_of_range;
+			delta->ranges[n - 1].size = block_end -
+						    delta->ranges[n - 1].offset;
+		} else {
+			delta->ranges[n].offset = start;
+			delta->ranges[n].size = block_end - start;
+			n++;
+		}
+		end_of_range = block_end;
 	}
-
-	free_firmware_image(&to_image);
-	return errorcnt;
+	delta->num_ranges = n;
+	return 0;
 }
 
 /*
  * Writes a section from given firmware image to system firmware.
  * If section_name is NULL, write whole image.
+ * When the current system firmware is known, only the erase blocks that
+ * differ are written.
  * Returns 0 if success, non-zero if error.
  */
 static int write_firmware(struct updater_config *cfg,
 			  const struct firmware_image *image,
 			  const char *section_name)
 {
-	const char *tmp_file = updater_create_temp_file(cfg);
+	struct firmware_image *image_from = &cfg->image_current;
+	struct firmware_section section = {image->data, image->size};
+	struct flash_delta delta = {0};
+	struct flash_programmer *flash;
 	const char *programmer = image->programmer;
-
-	if (!tmp_file)
-		return -1;
+	int i, r;
+
+	if (section_name)
+		find_firmware_section(&section, image, section_name);
+
+	/* We only know the contents of the flash behind the host programmer. */
+	if (image != image_from && section.data &&
+	    strcmp(programmer, image_from->programmer) == 0 &&
+	    compute_flash_delta(image_from, image, section.data - image->data,
+				section.size, &delta) == 0) {
+		printf("%s: %u bytes changed in %d range(s), %u bytes "
+		       "unchanged.\n", section_name ? section_name :
+		       "whole image", delta.bytes_written, delta.num_ranges,
+		       delta.bytes_skipped);
+		if (!delta.num_ranges)
+			return 0;
+	}
 
 	if (cfg->emulation) {
 		printf("%s: (emulation) Writing %s from %s to %s (emu=%s).\n",
 		       __FUNCTION__,
 		       section_name ? section_name : "whole image",
 		       image->file_name, programmer, cfg->emulation);
-
-		return emulate_write_firmware(
-				cfg->emulation, image, section_name);
-
 	}
-	if (vb2_write_file(tmp_file, image->data, image->size) != VB2_SUCCESS) {
-		ERROR("Cannot write temporary file for output: %s", tmp_file);
+
+	flash = updater_get_flash(cfg, programmer);
+	if (!flash)
 		return -1;
-	}
-	return host_flashrom(FLASHROM_WRITE, tmp_file, programmer,
-			     cfg->verbosity + 1, section_name);
+	r = flash_write(flash, image->data, image->size, section_name,
+			delta.ranges, delta.num_ranges);
+
+	/* Keep our copy of the flash contents in sync for the next write. */
+	for (i = 0; !r && i < delta.num_ranges; i++)
+		memcpy(image_from->data + delta.ranges[i].offset,
+		       image->data + delta.ranges[i].offset,
+		       delta.ranges[i].size);
+	return r;
 }
 
 /*
@@ -962,6 +1167,7 @@ static int preserve_management_engine(struct updater_config *cfg,
  */
 static int preserve_images(struct updater_config *cfg)
 {
+	uint64_t begin = updater_stat_begin();
 	int errcnt = 0, i;
 	struct firmware_image *from = &cfg->image_current, *to = &cfg->image;
 	const char * const optional_sections[] = {
@@ -987,6 +1193,7 @@ static int preserve_images(struct updater_config *cfg)
 		errcnt += preserve_firmware_section(
 				from, to, optional_sections[i]);
 	}
+	updater_stat_end(STAT_PRESERVE, begin, 0);
 	return errcnt;
 }
 
@@ -1179,16 +1386,71 @@ static int get_key_versions(const struct firmware_image *image,
 	return 0;
 }
 
+/*
+ * Returns the path of a verification cache entry for given root key and
+ * VBLOCK_A section, named by the SHA-256 digest of their contents, so any
+ * change in the contents will lead to a different entry.
+ * The caller must free the returned path. Returns NULL on failure.
+ */
+static char *get_verify_cache_path(const char *cache_dir,
+				   const struct vb2_packed_key *rootkey,
+				   const struct firmware_section *vblock)
+{
+	static const char tag[] = "updater_verify_v1";
+	struct vb2_digest_context ctx;
+	uint8_t digest[VB2_SHA256_DIGEST_SIZE];
+	char hex[sizeof(digest) * 2 + 1];
+	char *path = NULL;
+	size_t i;
+
+	if (vb2_digest_init(&ctx, VB2_HASH_SHA256) ||
+	    vb2_digest_extend(&ctx, (const uint8_t *)tag, sizeof(tag)) ||
+	    vb2_digest_extend(&ctx, (const uint8_t *)rootkey,
+			      rootkey->key_offset + rootkey->key_size) ||
+	    vb2_digest_extend(&ctx, vblock->data, vblock->size) ||
+	    vb2_digest_finalize(&ctx, digest, sizeof(digest)))
+		return NULL;
+
+	for (i = 0; i < sizeof(digest); i++)
+		sprintf(hex + i * 2, "%02x", digest[i]);
+	ASPRINTF(&path, "%s/%s", cache_dir, hex);
+	return path;
+}
+
+/*
+ * Records a successful verification in the cache, by creating the entry
+ * atomically (so a concurrent run never sees a partial entry).
+ */
+static void save_verify_cache(const char *path)
+{
+	static const char content[] = "verified\n";
+	char *temp_path = NULL;
+
+	ASPRINTF(&temp_path, "%s.%d", path, (int)getpid());
+	if (vb2_write_file(temp_path, content, strlen(content)) !=
+	    VB2_SUCCESS || rename(temp_path, path) != 0) {
+		DEBUG("Failed to save verification cache: %s", path);
+		unlink(temp_path);
+	}
+	free(temp_path);
+}
+
 /*
  * Checks if the root key in ro_image can verify vblocks in rw_image.
+ * If cache_dir is not NULL, outcome of verifying the same contents before
+ * is looked up (and saved) there.
  * Returns 0 for success, otherwise failure.
  */
-static int check_compatible_root_key(const struct firmware_image *ro_image,
-				     const struct firmware_image *rw_image)
+static int do_check_compatible_root_key(
+		const char *cache_dir,
+		const struct firmware_image *ro_image,
+		const struct firmware_image *rw_image)
 {
 	const struct vb2_gbb_header *gbb = find_gbb(ro_image);
 	const struct vb2_packed_key *rootkey;
 	const struct vb2_keyblock *keyblock;
+	struct firmware_section vblock;
+	char *cache_path = NULL;
 
 	if (!gbb)
 		return -1;
@@ -1202,6 +1464,16 @@ static int check_compatible_root_key(const struct firmware_image *ro_image,
 	if (!keyblock)
 		return -1;
 
+	if (cache_dir) {
+		find_firmware_section(&vblock, rw_image, FMAP_RW_VBLOCK_A);
+		cache_path = get_verify_cache_path(cache_dir, rootkey, &vblock);
+		if (cache_path && access(cache_path, F_OK) == 0) {
+			DEBUG("Root key verified before: %s", cache_path);
+			free(cache_path);
+			return 0;
+		}
+	}
+
 	if (verify_keyblock(keyblock, rootkey) != 0) {
 		const struct vb2_gbb_header *gbb_rw = find_gbb(rw_image);
 		const struct vb2_packed_key *rootkey_rw = NULL;
@@ -1229,28 +1501,68 @@ static int check_compatible_root_key(const struct firmware_image *ro_image,
 			printf("target (RW) image is signed with rootkey %s.\n",
 			       rootkey_rw ? packed_key_sha1_string(rootkey_rw) :
 			       "<invalid>");
+		free(cache_path);
 		return -1;
 	}
+	if (cache_path)
+		save_verify_cache(cache_path);
+	free(cache_path);
+	return 0;
+}
+
+/*
+ * Wrapper for do_check_compatible_root_key, accounting the time spent.
+ * Returns 0 for success, otherwise failure.
+ */
+static int check_compatible_root_key(struct updater_config *cfg,
+				     const struct firmware_image *ro_image,
+				     const struct firmware_image *rw_image)
+{
+	uint64_t begin = updater_stat_begin();
+	int r = do_check_compatible_root_key(cfg->cache_dir, ro_image,
+					     rw_image);
+
+	updater_stat_end(STAT_CHECK_ROOT_KEY, begin, 0);
+	return r;
+}
+
+/*
+ * Finds a file (cbfs_entry_name) inside a particular CBFS section of an image
+ * and fills its contents in file.
+ * Returns 0 if success, non-zero if not found.
+ */
+int find_cbfs_file(struct firmware_section *file,
+		   const struct firmware_image *image,
+		   const char *section_name,
+		   const char *cbfs_entry_name)
+{
+	struct firmware_section section;
+	uint32_t size;
+
+	memset(file, 0, sizeof(*file));
+	find_firmware_section(&section, image, section_name);
+	if (!section.data)
+		return -1;
+	file->data = cbfs_find_file(section.data, section.size,
+				    cbfs_entry_name, &size);
+	if (!file->data)
+		return -1;
+	file->size = size;
 	return 0;
 }
 
 /*
  * Returns 1 if a given file (cbfs_entry_name) exists inside a particular CBFS
- * section of an image file, otherwise 0.
+ * section of an image, otherwise 0.
  */
-static int cbfs_file_exists(const char *image_file,
+static int cbfs_file_exists(const struct firmware_image *image,
 			    const char *section_name,
 			    const char *cbfs_entry_name)
 {
-	char *cmd;
-	int r;
+	struct firmware_section file;
 
-	ASPRINTF(&cmd,
-		 "cbfstool '%s' print -r %s 2>/dev/null | grep -q '^%s '",
-		 image_file, section_name, cbfs_entry_name);
-	r = system(cmd);
-	free(cmd);
-	return !r;
+	return find_cbfs_file(&file, image, section_name,
+			      cbfs_entry_name) == 0;
 }
 
 /*
@@ -1261,17 +1573,11 @@ static int legacy_needs_update(struct updater_config *cfg)
 	int has_from, has_to;
 	const char * const tag = "cros_allow_auto_update";
 	const char *section = FMAP_RW_LEGACY;
-	const char *tmp_path = updater_create_temp_file(cfg);
 
 	DEBUG("Checking %s contents...", FMAP_RW_LEGACY);
-	if (!tmp_path ||
-	    vb2_write_file(tmp_path, cfg->image.data, cfg->image.size)) {
-		ERROR("Failed to create temporary file for image contents.");
-		return 0;
-	}
 
-	has_to = cbfs_file_exists(tmp_path, section, tag);
-	has_from = cbfs_file_exists(tmp_path, section, tag);
+	has_to = cbfs_file_exists(&cfg->image, section, tag);
+	has_from = cbfs_file_exists(&cfg->image_current, section, tag);
 
 	if (!has_from || !has_to) {
 		DEBUG("Current legacy firmware has%s updater tag (%s) "
@@ -1334,7 +1640,10 @@ static int do_check_compatible_tpm_keys(struct updater_config *cfg,
 static int check_compatible_tpm_keys(struct updater_config *cfg,
 				     const struct firmware_image *rw_image)
 {
+	uint64_t begin = updater_stat_begin();
 	int r = do_check_compatible_tpm_keys(cfg, rw_image);
+
+	updater_stat_end(STAT_CHECK_TPM_KEYS, begin, 0);
 	if (!r)
 		return r;
 	if (!cfg->force_update) {
@@ -1382,7 +1691,7 @@ static enum updater_error_codes update_try_rw_firmware(
 		return UPDATE_ERR_NEED_RO_UPDATE;
 
 	printf("Checking compatibility...\n");
-	if (check_compatible_root_key(image_from, image_to))
+	if (check_compatible_root_key(cfg, image_from, image_to))
 		return UPDATE_ERR_ROOT_KEY;
 	if (check_compatible_tpm_keys(cfg, image_to))
 		return UPDATE_ERR_TPM_ROLLBACK;
@@ -1446,7 +1755,7 @@ static enum updater_error_codes update_rw_firmrware(
 	       FMAP_RW_LEGACY);
 
 	printf("Checking compatibility...\n");
-	if (check_compatible_root_key(image_from, image_to))
+	if (check_compatible_root_key(cfg, image_from, image_to))
 		return UPDATE_ERR_ROOT_KEY;
 	if (check_compatible_tpm_keys(cfg, image_to))
 		return UPDATE_ERR_TPM_ROLLBACK;
@@ -1518,6 +1827,8 @@ enum updater_error_codes update_firmware(struct updater_config *cfg)
 	int wp_enabled;
 	struct firmware_image *image_from = &cfg->image_current,
 			      *image_to = &cfg->image;
+
+	join_system_loader(cfg);
 	if (!image_to->data)
 		return UPDATE_ERR_NO_IMAGE;
 
@@ -1532,10 +1843,6 @@ enum updater_error_codes update_firmware(struct updater_config *cfg)
 		return UPDATE_ERR_PLATFORM;
 
 	if (!image_from->data) {
-		/*
-		 * TODO(hungte) Read only RO_SECTION, VBLOCK_A, VBLOCK_B,
-		 * RO_VPD, RW_VPD, RW_NVRAM, RW_LEGACY.
-		 */
 		printf("Loading current system firmware...\n");
 		if (load_system_firmware(cfg, image_from) != 0)
 			return UPDATE_ERR_SYSTEM_IMAGE;
@@ -1677,6 +1984,8 @@ int updater_setup_config(struct updater_config *cfg,
 
 	/* Setup values that may change output or decision of other argument. */
 	cfg->verbosity = arg->verbosity;
+	cfg->sparse_read = arg->sparse_read;
+	cfg->cache_dir = arg->cache_dir;
 	if (arg->force_update)
 		cfg->force_update = 1;
 
@@ -1732,9 +2041,15 @@ int updater_setup_config(struct updater_config *cfg,
 		check_single_image = 1;
 		cfg->emulation = arg->emulation;
 		DEBUG("Using file %s for emulation.", arg->emulation);
-		errorcnt += !!load_firmware_image(
-				&cfg->image_current, arg->emulation, NULL);
 	}
+
+	/*
+	 * The sections to read with --sparse_read depend on quirks, so in that
+	 * case update_firmware will read the system firmware itself.
+	 */
+	if (!arg->do_manifest)
+		start_system_loader(cfg, !cfg->sparse_read);
+
 	if (!archive_path)
 		archive_path = ".";
 	cfg->archive = archive_open(archive_path);
@@ -1772,9 +2087,12 @@ int updater_setup_config(struct updater_config *cfg,
 		errorcnt++;
 		ERROR("EC/PD images are not supported in current mode.");
 	}
-	if (check_wp_disabled && is_write_protection_enabled(cfg)) {
-		errorcnt++;
-		ERROR("Factory mode needs WP disabled.");
+	if (check_wp_disabled) {
+		join_system_loader(cfg);
+		if (is_write_protection_enabled(cfg)) {
+			errorcnt++;
+			ERROR("Factory mode needs WP disabled.");
+		}
 	}
 	if (manifest)
 		delete_manifest(manifest);
@@ -1787,6 +2105,8 @@ int updater_setup_config(struct updater_config *cfg,
 void updater_delete_config(struct updater_config *cfg)
 {
 	assert(cfg);
+	join_system_loader(cfg);
+	flash_close(cfg->flash);
 	free_firmware_image(&cfg->image);
 	free_firmware_image(&cfg->image_current);
 	free_firmware_image(&cfg->ec_image);
@@ -21,13 +21,15 @@ extern int debugging_enabled;
 	ERROR("Failed to allocate memory, abort."); exit(1); } while (0)
 
 /* FMAP section names. */
-static const char * const FMAP_RO_FRID = "RO_FRID",
+static const char * const FMAP_RO_FMAP = "FMAP",
+		  * const FMAP_RO_FRID = "RO_FRID",
 		  * const FMAP_RO_SECTION = "RO_SECTION",
 		  * const FMAP_RO_GBB = "GBB",
 		  * const FMAP_RO_PRESERVE = "RO_PRESERVE",
 		  * const FMAP_RO_VPD = "RO_VPD",
 		  * const FMAP_RW_VPD = "RW_VPD",
 		  * const FMAP_RW_VBLOCK_A = "VBLOCK_A",
+		  * const FMAP_RW_VBLOCK_B = "VBLOCK_B",
 		  * const FMAP_RW_SECTION_A = "RW_SECTION_A",
 		  * const FMAP_RW_SECTION_B = "RW_SECTION_B",
 		  * const FMAP_RW_FWID = "RW_FWID",
@@ -42,6 +44,16 @@ static const char * const FMAP_RO_FRID = "RO_FRID",
 		  * const FMAP_SI_DESC = "SI_DESC",
 		  * const FMAP_SI_ME = "SI_ME";
 
+struct firmware_section {
+	uint8_t *data;
+	size_t size;
+};
+
+enum wp_state {
+	WP_DISABLED,
+	WP_ENABLED,
+};
+
 struct firmware_image {
 	const char *programmer;
 	uint32_t size;
@@ -49,11 +61,12 @@ struct firmware_image {
 	char *file_name;
 	char *ro_version, *rw_version_a, *rw_version_b;
 	FmapHeader *fmap_header;
-};
-
-struct firmware_section {
-	uint8_t *data;
-	size_t size;
+	/*
+	 * For images read partially from flash, the sections that hold real
+	 * data. NULL if the whole image is valid.
+	 */
+	struct firmware_section *valid_sections;
+	int num_valid_sections;
 };
 
 struct system_property {
@@ -95,18 +108,24 @@ struct tempfile {
 };
 
 struct archive;
+struct flash_programmer;
+struct system_loader;
 struct updater_config {
 	struct firmware_image image, image_current;
 	struct firmware_image ec_image, pd_image;
 	struct system_property system_properties[SYS_PROP_MAX];
 	struct quirk_entry quirks[QUIRK_MAX];
 	struct archive *archive;
+	struct flash_programmer *flash;
+	struct system_loader *system_loader;
 	struct tempfile *tempfiles;
 	int try_update;
 	int force_update;
 	int legacy_update;
+	int sparse_read;
 	int verbosity;
 	const char *emulation;
+	const char *cache_dir;
 };
 
 struct updater_config_arguments {
@@ -114,7 +133,9 @@ struct updater_config_arguments {
 	char *archive, *quirks, *mode;
 	char *programmer, *model;
 	char *emulation, *sys_props, *write_protection;
+	char *cache_dir;
 	int is_factory, try_update, force_update, do_manifest;
+	int sparse_read;
 	int verbosity;
 };
 
@@ -199,6 +220,16 @@ int find_firmware_section(struct firmware_section *section,
 			  const struct firmware_image *image,
 			  const char *section_name);
 
+/*
+ * Finds a file (cbfs_entry_name) inside a particular CBFS section of an image
+ * and fills its contents in file.
+ * Returns 0 if success, non-zero if not found.
+ */
+int find_cbfs_file(struct firmware_section *file,
+		   const struct firmware_image *image,
+		   const char *section_name,
+		   const char *cbfs_entry_name);
+
 /*
  * Preserves (copies) the given section (by name) from image_from to image_to.
  * The offset may be different, and the section data will be directly copied.
@@ -288,6 +319,102 @@ struct manifest *new_manifest_from_archive(struct archive *archive);
 /* Releases all resources allocated by given manifest object. */
 void delete_manifest(struct manifest *manifest);
 
+/* Functions from updater_stats.c */
+
+enum updater_stat_type {
+	STAT_SETUP,
+	STAT_UPDATE,
+	STAT_ARCHIVE_READ,
+	STAT_LOAD_IMAGE,
+	STAT_FLASH_READ,
+	STAT_FLASH_WRITE,
+	STAT_FLASH_WP,
+	STAT_PRESERVE,
+	STAT_CHECK_ROOT_KEY,
+	STAT_CHECK_TPM_KEYS,
+	STAT_MAX
+};
+
+/* Returns the current (monotonic) time in microseconds. */
+uint64_t updater_stat_begin(void);
+
+/*
+ * Adds the time since begin (from updater_stat_begin) and given bytes of I/O
+ * to a stage.
+ */
+void updater_stat_end(enum updater_stat_type type, uint64_t begin,
+		      uint64_t bytes);
+
+/*
+ * Prints the time and I/O of all stages that have run, as a table or (if
+ * json is set) a JSON object.
+ */
+void updater_print_stats(FILE *fp, int json);
+
+/* Functions from updater_flash.c */
+
+/*
+ * Smallest erase unit of the SPI flash parts we support (larger parts also
+ * erase in 64K blocks, but all of them can do 4K sectors).
+ */
+#define FLASH_ERASE_BLOCK_SIZE 4096
+
+struct flash_programmer;
+struct flash_range {
+	uint32_t offset;
+	uint32_t size;
+};
+
+/*
+ * Opens a session to the flash behind given programmer.
+ * If emulation is not NULL, the given file is used as flash contents instead.
+ * Returns a pointer to reference to flash (must be released by flash_close
+ * when not used), otherwise NULL on error.
+ */
+struct flash_programmer *flash_open(const char *programmer,
+				    const char *emulation, int verbosity);
+
+/*
+ * Closes a flash session.
+ * Returns 0 on success, otherwise non-zero as failure.
+ */
+int flash_close(struct flash_programmer *flash);
+
+/* Returns the name of the flash (programmer or emulation file). */
+const char *flash_name(const struct flash_programmer *flash);
+
+/*
+ * Reads the flash contents. If count is zero, the whole flash is read;
+ * otherwise only the given FMAP sections are valid in the returned buffer.
+ * Returns 0 on success (data and size reflects the contents, caller must
+ * free data), otherwise non-zero as failure.
+ */
+int flash_read(struct flash_programmer *flash,
+	       const char * const *sections, int count,
+	       uint8_t **data, uint32_t *size);
+
+/*
+ * Writes data (a whole firmware image) to the flash. If num_ranges is not
+ * zero, only the given ranges are written; otherwise if section_name is not
+ * NULL, only that FMAP section; otherwise everything.
+ * Returns 0 on success, otherwise non-zero as failure.
+ */
+int flash_write(struct flash_programmer *flash,
+		const uint8_t *data, uint32_t size, const char *section_name,
+		const struct flash_range *ranges, int num_ranges);
+
+/*
+ * Prints what has been written in the flash session: sections, bytes and
+ * erase blocks. Emulation sessions print this to stdout when closed.
+ */
+void flash_print_write_log(const struct flash_programmer *flash, FILE *fp);
+
+/*
+ * Gets the (software) write protection status of the flash.
+ * Returns WP_ENABLED, WP_DISABLED, or -1 if unknown.
+ */
+int flash_get_wp_status(struct flash_programmer *flash);
+
 /* Prints the information of objects in manifest (models and images) in JSON. */
 void print_json_manifest(const struct manifest *manifest);
 
@@ -8,6 +8,7 @@
 
 #include <assert.h>
 #include <fts.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -66,8 +67,30 @@ static const char * const SETVARS_IMAGE_MAIN = "IMAGE_MAIN",
 		  * const PATH_STARTSWITH_KEYSET = "keyset/",
 		  * const PATH_ENDSWITH_SERVARS = "/setvars.sh";
 
+/* Max total size of unpacked entries kept in memory for each archive. */
+#define ARCHIVE_CACHE_MAX_SIZE (256 * 1024 * 1024)
+/* Max number of threads to unpack entries in parallel. */
+#define ARCHIVE_MAX_THREADS 8
+
+/*
+ * An entry already read from archive. Unified builds share a few images
+ * between many models, so keep them instead of unpacking them again.
+ */
+struct archive_cache_entry {
+	char *name;
+	uint8_t *data;
+	uint32_t size;
+	struct archive_cache_entry *next;
+};
+
 struct archive {
 	void *handle;
+	char *path;
+
+	/* Only archives that are expensive to read (i.e., packed) are cached. */
+	int use_cache;
+	struct archive_cache_entry *cache;
+	uint32_t cache_size;
 
 	void * (*open)(const char *name);
 	int (*close)(void *handle);
@@ -265,7 +288,7 @@ struct archive *archive_open(const char *path)
 		return NULL;
 	}
 
-	ar = (struct archive *)malloc(sizeof(*ar));
+	ar = (struct archive *)calloc(1, sizeof(*ar));
 	if (!ar) {
 		ERROR("Internal error: allocation failure.");
 		return NULL;
@@ -287,6 +310,7 @@ struct archive *archive_open(const char *path)
 		ar->walk = archive_zip_walk;
 		ar->has_entry = archive_zip_has_entry;
 		ar->read_file = archive_zip_read_file;
+		ar->use_cache = 1;
 #else
 		ERROR("Found file, but no drivers were enabled: %s", path);
 		free(ar);
@@ -299,6 +323,7 @@ struct archive *archive_open(const char *path)
 		free(ar);
 		return NULL;
 	}
+	ar->path = strdup(path);
 	return ar;
 }
 
@@ -308,11 +333,62 @@ struct archive *archive_open(const char *path)
  */
 int archive_close(struct archive *ar)
 {
+	struct archive_cache_entry *entry, *next;
 	int r = ar->close(ar->handle);
+
+	for (entry = ar->cache; entry; entry = next) {
+		next = entry->next;
+		free(entry->name);
+		free(entry->data);
+		free(entry);
+	}
+	free(ar->path);
 	free(ar);
 	return r;
 }
 
+/* Returns the cached entry of given name, or NULL if not cached. */
+static struct archive_cache_entry *archive_cache_find(struct archive *ar,
+						      const char *name)
+{
+	struct archive_cache_entry *entry;
+
+	for (entry = ar->cache; entry; entry = entry->next)
+		if (strcmp(entry->name, name) == 0)
+			return entry;
+	return NULL;
+}
+
+/*
+ * Keeps the data read from entry of given name in the cache.
+ * Returns the new cache entry owning data, or NULL if data was not cached
+ * (and still belongs to the caller).
+ */
+static struct archive_cache_entry *archive_cache_add(
+		struct archive *ar, const char *name,
+		uint8_t *data, uint32_t size)
+{
+	struct archive_cache_entry *entry;
+
+	if (size > ARCHIVE_CACHE_MAX_SIZE - ar->cache_size)
+		return NULL;
+	entry = (struct archive_cache_entry *)malloc(sizeof(*entry));
+	if (!entry)
+		return NULL;
+	entry->name = strdup(name);
+	if (!entry->name) {
+		free(entry);
+		return NULL;
+	}
+	entry->data = data;
+	entry->size = size;
+	entry->next = ar->cache;
+	ar->cache = entry;
+	ar->cache_size += size;
+	DEBUG("Cached %s (%u bytes, %u in total)", name, size, ar->cache_size);
+	return entry;
+}
+
 /*
  * Checks if an entry (either file or directory) exists in archive.
  * If entry name (fname) is an absolute path (/file), always check
@@ -343,6 +419,37 @@ int archive_walk(
 	return ar->walk(ar->handle, arg, callback);
 }
 
+/*
+ * Reads a file from archive through the cache of entries.
+ * Returns 0 on success (data and size reflects the file content),
+ * otherwise non-zero as failure.
+ */
+static int archive_read_file_cached(struct archive *ar, const char *fname,
+				    uint8_t **data, uint32_t *size)
+{
+	struct archive_cache_entry *entry;
+
+	entry = archive_cache_find(ar, fname);
+	if (!entry) {
+		if (ar->read_file(ar->handle, fname, data, size))
+			return 1;
+		entry = archive_cache_add(ar, fname, *data, *size);
+		if (!entry)
+			return 0;
+	}
+
+	/* Callers own (and may change) the data, so give them a copy. */
+	*data = (uint8_t *)malloc(entry->size);
+	if (!*data) {
+		ERROR("Internal error: allocation failure.");
+		*size = 0;
+		return 1;
+	}
+	memcpy(*data, entry->data, entry->size);
+	*size = entry->size;
+	return 0;
+}
+
 /*
  * Reads a file from archive.
  * If entry name (fname) is an absolute path (/file), always read
@@ -353,9 +460,133 @@ int archive_walk(
 int archive_read_file(struct archive *ar, const char *fname,
 		      uint8_t **data, uint32_t *size)
 {
+	uint64_t begin = updater_stat_begin();
+	int r;
+
 	if (!ar || *fname == '/')
-		return archive_fallback_read_file(NULL, fname, data, size);
-	return ar->read_file(ar->handle, fname, data, size);
+		r = archive_fallback_read_file(NULL, fname, data, size);
+	else if (!ar->use_cache)
+		r = ar->read_file(ar->handle, fname, data, size);
+	else
+		r = archive_read_file_cached(ar, fname, data, size);
+	updater_stat_end(STAT_ARCHIVE_READ, begin, r ? 0 : *size);
+	return r;
+}
+
+/* Entries to be read by archive_prefetch workers. */
+struct archive_prefetch_job {
+	struct archive *ar;
+	const char **names;
+	uint8_t **data;
+	uint32_t *sizes;
+	int count;
+	int next;
+	uint32_t total_size;
+	pthread_mutex_t lock;
+};
+
+/* Reads entries from the job, using its own archive handle. */
+static void *archive_prefetch_worker(void *arg)
+{
+	struct archive_prefetch_job *job = (struct archive_prefetch_job *)arg;
+	struct archive *ar = job->ar;
+	void *handle = ar->open(ar->path);
+	int i;
+
+	if (!handle)
+		return NULL;
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (i >= job->count)
+			break;
+		if (ar->read_file(handle, job->names[i], &job->data[i],
+				  &job->sizes[i])) {
+			job->data[i] = NULL;
+			continue;
+		}
+
+		/* Do not keep more than the cache could take. */
+		pthread_mutex_lock(&job->lock);
+		if (job->sizes[i] > ARCHIVE_CACHE_MAX_SIZE - job->total_size) {
+			free(job->data[i]);
+			job->data[i] = NULL;
+		} else {
+			job->total_size += job->sizes[i];
+		}
+		pthread_mutex_unlock(&job->lock);
+	}
+	ar->close(handle);
+	return NULL;
+}
+
+/*
+ * Reads the given entries into cache in parallel, so that later calls to
+ * archive_read_file do not have to unpack them one by one. Entries that do
+ * not exist or can't be cached are skipped and will be read when needed.
+ */
+static void archive_prefetch(struct archive *ar,
+			     const char * const *names, int count)
+{
+	struct archive_prefetch_job job = {ar};
+	pthread_t threads[ARCHIVE_MAX_THREADS];
+	int i, j, num_threads = 0;
+	long cpus;
+
+	if (!ar || !ar->use_cache || !count)
+		return;
+
+	job.names = (const char **)calloc(count, sizeof(*job.names));
+	job.data = (uint8_t **)calloc(count, sizeof(*job.data));
+	job.sizes = (uint32_t *)calloc(count, sizeof(*job.sizes));
+	if (!job.names || !job.data || !job.sizes)
+		goto done;
+
+	/* Skip duplicated, missing and already cached entries. */
+	for (i = 0; i < count; i++) {
+		if (!names[i] || *names[i] == '/' ||
+		    archive_cache_find(ar, names[i]) ||
+		    !ar->has_entry(ar->handle, names[i]))
+			continue;
+		for (j = 0; j < job.count; j++)
+			if (strcmp(job.names[j], names[i]) == 0)
+				break;
+		if (j == job.count)
+			job.names[job.count++] = names[i];
+	}
+	if (!job.count)
+		goto done;
+
+	job.total_size = ar->cache_size;
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > ARCHIVE_MAX_THREADS)
+		cpus = ARCHIVE_MAX_THREADS;
+	if (cpus > job.count)
+		cpus = job.count;
+	if (cpus < 1)
+		cpus = 1;
+	pthread_mutex_init(&job.lock, NULL);
+	for (i = 0; i < cpus; i++) {
+		if (pthread_create(&threads[num_threads], NULL,
+				   archive_prefetch_worker, &job))
+			break;
+		num_threads++;
+	}
+	DEBUG("Reading %d entries with %d threads.", job.count, num_threads);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&job.lock);
+
+	for (i = 0; i < job.count; i++) {
+		if (job.data[i] && !archive_cache_add(ar, job.names[i],
+						      job.data[i], job.sizes[i]))
+			free(job.data[i]);
+	}
+done:
+	free(job.names);
+	free(job.data);
+	free(job.sizes);
 }
 
 /*
@@ -572,6 +803,19 @@ void print_json_manifest(const struct manifest *manifest)
 {
 	int i, indent;
 	struct archive *ar = manifest->archive;
+	const char **names;
+
+	/* Unpack all images at once; many models may share the same ones. */
+	names = (const char **)calloc(manifest->num * 3, sizeof(*names));
+	if (names) {
+		for (i = 0; i < manifest->num; i++) {
+			names[i * 3] = manifest->models[i].image;
+			names[i * 3 + 1] = manifest->models[i].ec_image;
+			names[i * 3 + 2] = manifest->models[i].pd_image;
+		}
+		archive_prefetch(ar, names, manifest->num * 3);
+		free(names);
+	}
 
 	printf("{\n");
 	for (i = 0, indent = 2; i < manifest->num; i++) {
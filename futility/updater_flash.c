@@ -0,0 +1,656 @@
+/*
+ * Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Accessing the system firmware (flash) for the firmware updater.
+ */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "futility.h"
+#include "host_misc.h"
+#include "updater.h"
+#include "vb2_common.h"
+
+#define FLASHROM_OUTPUT_WP_PATTERN "write protect is "
+
+static const char * const FLASHROM_OUTPUT_WP_ENABLED =
+			  FLASHROM_OUTPUT_WP_PATTERN "enabled",
+		  * const FLASHROM_OUTPUT_WP_DISABLED =
+			  FLASHROM_OUTPUT_WP_PATTERN "disabled";
+
+enum flashrom_ops {
+	FLASHROM_READ,
+	FLASHROM_WRITE,
+	FLASHROM_WP_STATUS,
+};
+
+/* A record of one write to the flash. */
+struct flash_write_record {
+	char *name;
+	uint32_t bytes;
+	uint32_t blocks;
+};
+
+/*
+ * A flash programmer session. Data is always exchanged as memory buffers;
+ * how it gets to and from the flash is up to the driver.
+ */
+struct flash_programmer {
+	void *handle;
+	const char *name;
+	const char *programmer;
+	int verbosity;
+	int is_emulation;
+
+	/* Writes done in this session, reported when it is closed. */
+	struct flash_write_record *write_log;
+	int num_writes;
+
+	void * (*open)(const char *name);
+	int (*close)(void *handle);
+
+	int (*read)(struct flash_programmer *flash,
+		    const char * const *sections, int count,
+		    uint8_t **data, uint32_t *size);
+	int (*write)(struct flash_programmer *flash,
+		     const uint8_t *data, uint32_t size,
+		     const char *section_name,
+		     const struct flash_range *ranges, int num_ranges);
+	int (*get_wp_status)(struct flash_programmer *flash);
+};
+
+/*
+ * -- Begin of flash drivers --
+ */
+
+/*
+ * Creates a temporary file for the flashrom driver, which is removed by the
+ * caller when done. Returns 0 on success, otherwise failure.
+ */
+static int flashrom_temp_file(char *path, size_t size)
+{
+	int fd;
+
+	snprintf(path, size, P_tmpdir "/fwupdater.XXXXXX");
+	fd = mkstemp(path);
+	if (fd < 0) {
+		ERROR("Failed to create new temp file in %s", path);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+/*
+ * A helper function to invoke flashrom(8) command.
+ * The regions argument is a list of "-i" (and "-l") arguments, or NULL.
+ * Returns 0 if success, non-zero if error. For FLASHROM_WP_STATUS, returns
+ * the write protection state or -1 if unknown.
+ */
+static int host_flashrom(enum flashrom_ops op, const char *image_path,
+			 const char *programmer, int verbose,
+			 const char *regions)
+{
+	char *command, *result;
+	const char *op_cmd, *postfix = "", *ignore_lock = "";
+	int r;
+
+	switch (verbose) {
+	case 0:
+		postfix = " >/dev/null 2>&1";
+		break;
+	case 1:
+		break;
+	case 2:
+		postfix = "-V";
+		break;
+	case 3:
+		postfix = "-V -V";
+		break;
+	default:
+		postfix = "-V -V -V";
+		break;
+	}
+
+	if (!regions)
+		regions = "";
+
+	switch (op) {
+	case FLASHROM_READ:
+		op_cmd = "-r";
+		assert(image_path);
+		break;
+
+	case FLASHROM_WRITE:
+		op_cmd = "-w";
+		assert(image_path);
+		break;
+
+	case FLASHROM_WP_STATUS:
+		op_cmd = "--wp-status";
+		assert(image_path == NULL);
+		image_path = "";
+		/* grep is needed because host_shell only returns 1 line. */
+		postfix = " 2>/dev/null | grep \"" \
+			   FLASHROM_OUTPUT_WP_PATTERN "\"";
+		break;
+
+	default:
+		assert(0);
+		return -1;
+	}
+
+	ASPRINTF(&command, "flashrom %s %s -p %s %s %s %s", op_cmd,
+		 image_path, programmer, regions, ignore_lock, postfix);
+
+	if (verbose)
+		printf("Executing: %s\n", command);
+
+	if (op != FLASHROM_WP_STATUS) {
+		r = system(command);
+		free(command);
+		return r;
+	}
+
+	result = host_shell(command);
+	free(command);
+	DEBUG("wp-status: %s", result);
+
+	if (strstr(result, FLASHROM_OUTPUT_WP_ENABLED))
+		r = WP_ENABLED;
+	else if (strstr(result, FLASHROM_OUTPUT_WP_DISABLED))
+		r = WP_DISABLED;
+	else
+		r = -1;
+	free(result);
+	return r;
+}
+
+/* Callback for flash_open on the flashrom(8) driver. */
+static void *flash_flashrom_open(const char *name)
+{
+	return strdup(name);
+}
+
+/* Callback for flash_close on the flashrom(8) driver. */
+static int flash_flashrom_close(void *handle)
+{
+	free(handle);
+	return 0;
+}
+
+/* Callback for flash_read on the flashrom(8) driver. */
+static int flash_flashrom_read(struct flash_programmer *flash,
+			       const char * const *sections, int count,
+			       uint8_t **data, uint32_t *size)
+{
+	char path[] = P_tmpdir "/fwupdater.XXXXXX";
+	char *regions = NULL, *more;
+	int i, r;
+
+	for (i = 0; i < count; i++) {
+		ASPRINTF(&more, "%s -i %s", regions ? regions : "",
+			 sections[i]);
+		free(regions);
+		regions = more;
+	}
+
+	r = flashrom_temp_file(path, sizeof(path));
+	if (!r)
+		r = host_flashrom(FLASHROM_READ, path, flash->programmer,
+				  flash->verbosity, regions);
+	if (!r && vb2_read_file(path, data, size) != VB2_SUCCESS)
+		r = -1;
+	remove(path);
+	free(regions);
+	return r;
+}
+
+/*
+ * Writes a flashrom layout file describing the given ranges.
+ * Returns 0 if success, non-zero if error.
+ */
+static int write_range_layout(const char *path,
+			      const struct flash_range *ranges, int num_ranges)
+{
+	FILE *fp = fopen(path, "w");
+	int i;
+
+	if (!fp)
+		return -1;
+	for (i = 0; i < num_ranges; i++)
+		fprintf(fp, "%08x:%08x delta%d\n", ranges[i].offset,
+			ranges[i].offset + ranges[i].size - 1, i);
+	return fclose(fp);
+}
+
+/* Callback for flash_write on the flashrom(8) driver. */
+static int flash_flashrom_write(struct flash_programmer *flash,
+				const uint8_t *data, uint32_t size,
+				const char *section_name,
+				const struct flash_range *ranges,
+				int num_ranges)
+{
+	char path[] = P_tmpdir "/fwupdater.XXXXXX";
+	char layout[] = P_tmpdir "/fwupdater.XXXXXX";
+	char *regions = NULL, *more;
+	int i, r;
+
+	if (flashrom_temp_file(path, sizeof(path)))
+		return -1;
+
+	if (num_ranges) {
+		/* Only write the given ranges, described by a layout file. */
+		r = flashrom_temp_file(layout, sizeof(layout));
+		if (!r)
+			r = write_range_layout(layout, ranges, num_ranges);
+		if (r) {
+			ERROR("Cannot write flashrom layout file.");
+			remove(path);
+			return -1;
+		}
+		ASPRINTF(&regions, "-l %s", layout);
+		for (i = 0; i < num_ranges; i++) {
+			ASPRINTF(&more, "%s -i delta%d", regions, i);
+			free(regions);
+			regions = more;
+		}
+	} else if (section_name) {
+		ASPRINTF(&regions, "-i %s", section_name);
+	}
+
+	r = vb2_write_file(path, data, size);
+	if (r)
+		ERROR("Cannot write temporary file for output: %s", path);
+	else
+		r = host_flashrom(FLASHROM_WRITE, path, flash->programmer,
+				  flash->verbosity + 1, regions);
+
+	remove(path);
+	if (num_ranges)
+		remove(layout);
+	free(regions);
+	return r;
+}
+
+/* Callback for flash_get_wp_status on the flashrom(8) driver. */
+static int flash_flashrom_get_wp_status(struct flash_programmer *flash)
+{
+	return host_flashrom(FLASHROM_WP_STATUS, NULL, flash->programmer, 0,
+			     NULL);
+}
+
+/*
+ * The emulation driver runs in process, using a file as the flash contents.
+ * The file is mapped once when the session is opened; writes go directly to
+ * the mapping and are flushed to the file when the session is closed.
+ */
+struct emulation {
+	int fd;
+	uint8_t *data;
+	uint32_t size;
+};
+
+/* Callback for flash_open on the emulation driver. */
+static void *flash_emulation_open(const char *name)
+{
+	struct emulation *emu;
+
+	emu = (struct emulation *)calloc(1, sizeof(*emu));
+	if (!emu)
+		return NULL;
+	emu->fd = open(name, O_RDWR);
+	if (emu->fd < 0) {
+		ERROR("Cannot open emulation file: %s", name);
+		free(emu);
+		return NULL;
+	}
+	if (futil_map_file(emu->fd, MAP_RW, &emu->data, &emu->size) !=
+	    FILE_ERR_NONE) {
+		ERROR("Cannot map emulation file: %s", name);
+		close(emu->fd);
+		free(emu);
+		return NULL;
+	}
+	return emu;
+}
+
+/* Callback for flash_close on the emulation driver. */
+static int flash_emulation_close(void *handle)
+{
+	struct emulation *emu = (struct emulation *)handle;
+	int r = 0;
+
+	if (futil_unmap_file(emu->fd, MAP_RW, emu->data, emu->size) !=
+	    FILE_ERR_NONE)
+		r++;
+	if (close(emu->fd))
+		r++;
+	free(emu);
+	return r;
+}
+
+/*
+ * Finds an FMAP section in a buffer holding a firmware image.
+ * Returns a pointer to the section and fills *section_size, or NULL if the
+ * section can't be found.
+ */
+static uint8_t *find_section(uint8_t *data, uint32_t size, const char *name,
+			     uint32_t *section_size)
+{
+	FmapHeader *fmap = fmap_find(data, size);
+	FmapAreaHeader *fah;
+	uint8_t *ptr;
+
+	if (!fmap)
+		return NULL;
+	ptr = fmap_find_by_name(data, size, fmap, name, &fah);
+	if (ptr)
+		*section_size = fah->area_size;
+	return ptr;
+}
+
+/* Callback for flash_read on the emulation driver. */
+static int flash_emulation_read(struct flash_programmer *flash,
+				const char * const *sections, int count,
+				uint8_t **data, uint32_t *size)
+{
+	struct emulation *emu = (struct emulation *)flash->handle;
+	uint8_t *out, *ptr;
+	uint32_t section_size;
+	int i;
+
+	out = (uint8_t *)malloc(emu->size);
+	if (!out)
+		return -1;
+	if (!count) {
+		memcpy(out, emu->data, emu->size);
+	} else {
+		/* Only the requested sections are valid; fill the rest. */
+		memset(out, 0xff, emu->size);
+		for (i = 0; i < count; i++) {
+			ptr = find_section(emu->data, emu->size, sections[i],
+					   &section_size);
+			if (!ptr) {
+				ERROR("No section %s in %s.", sections[i],
+				      flash->name);
+				free(out);
+				return -1;
+			}
+			memcpy(out + (ptr - emu->data), ptr, section_size);
+		}
+	}
+	*data = out;
+	*size = emu->size;
+	return 0;
+}
+
+/* Callback for flash_write on the emulation driver. */
+static int flash_emulation_write(struct flash_programmer *flash,
+				 const uint8_t *data, uint32_t size,
+				 const char *section_name,
+				 const struct flash_range *ranges,
+				 int num_ranges)
+{
+	struct emulation *emu = (struct emulation *)flash->handle;
+	uint8_t *from, *to;
+	uint32_t from_size, to_size;
+	int i, errorcnt = 0;
+
+	if (num_ranges) {
+		if (size != emu->size) {
+			ERROR("Image size is different (%d != %s:%d)",
+			      size, flash->name, emu->size);
+			return -1;
+		}
+		for (i = 0; i < num_ranges; i++)
+			memcpy(emu->data + ranges[i].offset,
+			       data + ranges[i].offset, ranges[i].size);
+	} else if (section_name) {
+		/* The source and emulated FMAPs may be different. */
+		from = find_section((uint8_t *)data, size, section_name,
+				    &from_size);
+		if (!from) {
+			ERROR("No section %s in source image.", section_name);
+			errorcnt++;
+		}
+		to = find_section(emu->data, emu->size, section_name,
+				  &to_size);
+		if (!to) {
+			ERROR("No section %s in destination image %s.",
+			      section_name, flash->name);
+			errorcnt++;
+		}
+		if (errorcnt)
+			return errorcnt;
+		DEBUG("Writing %u bytes", Min(from_size, to_size));
+		memcpy(to, from, Min(from_size, to_size));
+	} else if (size != emu->size) {
+		ERROR("Image size is different (%d != %s:%d)",
+		      size, flash->name, emu->size);
+		return -1;
+	} else {
+		DEBUG("Writing %u bytes", size);
+		memcpy(emu->data, data, size);
+	}
+	return 0;
+}
+
+/* Callback for flash_get_wp_status on the emulation driver. */
+static int flash_emulation_get_wp_status(struct flash_programmer *flash)
+{
+	/* An emulated flash can always be written. */
+	return WP_DISABLED;
+}
+
+/*
+ * -- End of flash drivers --
+ */
+
+/*
+ * Opens a session to the flash behind given programmer.
+ * If emulation is not NULL, the given file is used as flash contents instead.
+ * Returns a session (must be released by flash_close), or NULL on error.
+ */
+struct flash_programmer *flash_open(const char *programmer,
+				    const char *emulation, int verbosity)
+{
+	struct flash_programmer *flash;
+
+	flash = (struct flash_programmer *)calloc(1, sizeof(*flash));
+	if (!flash) {
+		ERROR("Internal error: allocation failure.");
+		return NULL;
+	}
+	flash->programmer = programmer;
+	flash->verbosity = verbosity;
+
+	if (emulation) {
+		DEBUG("Using emulation driver: %s", emulation);
+		flash->name = emulation;
+		flash->is_emulation = 1;
+		flash->open = flash_emulation_open;
+		flash->close = flash_emulation_close;
+		flash->read = flash_emulation_read;
+		flash->write = flash_emulation_write;
+		flash->get_wp_status = flash_emulation_get_wp_status;
+	} else {
+		DEBUG("Using flashrom driver: %s", programmer);
+		flash->name = programmer;
+		flash->open = flash_flashrom_open;
+		flash->close = flash_flashrom_close;
+		flash->read = flash_flashrom_read;
+		flash->write = flash_flashrom_write;
+		flash->get_wp_status = flash_flashrom_get_wp_status;
+	}
+	flash->handle = flash->open(flash->name);
+	if (!flash->handle) {
+		ERROR("Failed to open flash: %s", flash->name);
+		free(flash);
+		return NULL;
+	}
+	return flash;
+}
+
+/*
+ * Closes a flash session.
+ * Returns 0 on success, otherwise non-zero as failure.
+ */
+int flash_close(struct flash_programmer *flash)
+{
+	int i, r;
+
+	if (!flash)
+		return 0;
+	r = flash->close(flash->handle);
+	if (flash->is_emulation || debugging_enabled)
+		flash_print_write_log(flash, flash->is_emulation ? stdout :
+				      stderr);
+	for (i = 0; i < flash->num_writes; i++)
+		free(flash->write_log[i].name);
+	free(flash->write_log);
+	free(flash);
+	return r;
+}
+
+/* Returns the number of erase blocks the given range spans. */
+static uint32_t count_erase_blocks(uint32_t offset, uint32_t size)
+{
+	if (!size)
+		return 0;
+	return (offset + size - 1) / FLASH_ERASE_BLOCK_SIZE -
+		offset / FLASH_ERASE_BLOCK_SIZE + 1;
+}
+
+/*
+ * Adds a successful write to the log of flash session.
+ * Returns the number of bytes written.
+ */
+static uint32_t flash_log_write(struct flash_programmer *flash,
+			    const uint8_t *data, uint32_t size,
+			    const char *section_name,
+			    const struct flash_range *ranges, int num_ranges)
+{
+	struct flash_write_record *log, record = {0};
+	uint32_t section_size;
+	uint8_t *section;
+	int i;
+
+	if (num_ranges) {
+		for (i = 0; i < num_ranges; i++) {
+			record.bytes += ranges[i].size;
+			record.blocks += count_erase_blocks(ranges[i].offset,
+							    ranges[i].size);
+		}
+	} else if (section_name) {
+		section = find_section((uint8_t *)data, size, section_name,
+				       &section_size);
+		if (section) {
+			record.bytes = section_size;
+			record.blocks = count_erase_blocks(section - data,
+							   section_size);
+		}
+	} else {
+		record.bytes = size;
+		record.blocks = count_erase_blocks(0, size);
+	}
+
+	log = (struct flash_write_record *)realloc(
+			flash->write_log,
+			(flash->num_writes + 1) * sizeof(*log));
+	if (!log)
+		return record.bytes;
+	record.name = strdup(section_name ? section_name : "whole image");
+	log[flash->num_writes++] = record;
+	flash->write_log = log;
+	return record.bytes;
+}
+
+/*
+ * Prints what has been written in the flash session: sections, bytes and
+ * erase blocks, which is what the time to write a real flash depends on.
+ */
+void flash_print_write_log(const struct flash_programmer *flash, FILE *fp)
+{
+	uint32_t bytes = 0, blocks = 0;
+	int i;
+
+	if (!flash->num_writes)
+		return;
+	fprintf(fp, "Flash write log for %s:\n", flash->name);
+	for (i = 0; i < flash->num_writes; i++) {
+		const struct flash_write_record *record = &flash->write_log[i];
+
+		fprintf(fp, "  %s: %u bytes in %u erase block(s)\n",
+			record->name, record->bytes, record->blocks);
+		bytes += record->bytes;
+		blocks += record->blocks;
+	}
+	fprintf(fp, "  Total: %d write(s), %u bytes in %u erase block(s)\n",
+		flash->num_writes, bytes, blocks);
+}
+
+/* Returns the name of the flash (programmer or emulation file). */
+const char *flash_name(const struct flash_programmer *flash)
+{
+	return flash->name;
+}
+
+/*
+ * Reads the flash contents. If count is zero, the whole flash is read;
+ * otherwise only the given FMAP sections are valid in the returned buffer.
+ * Returns 0 on success (data and size reflects the contents, caller must
+ * free data), otherwise non-zero as failure.
+ */
+int flash_read(struct flash_programmer *flash,
+	       const char * const *sections, int count,
+	       uint8_t **data, uint32_t *size)
+{
+	uint64_t begin = updater_stat_begin();
+	int r = flash->read(flash, sections, count, data, size);
+
+	updater_stat_end(STAT_FLASH_READ, begin, r ? 0 : *size);
+	return r;
+}
+
+/*
+ * Writes data (a whole firmware image) to the flash. If num_ranges is not
+ * zero, only the given ranges are written; otherwise if section_name is not
+ * NULL, only that FMAP section; otherwise everything.
+ * Returns 0 on success, otherwise non-zero as failure.
+ */
+int flash_write(struct flash_programmer *flash,
+		const uint8_t *data, uint32_t size, const char *section_name,
+		const struct flash_range *ranges, int num_ranges)
+{
+	uint64_t begin = updater_stat_begin();
+	uint32_t bytes = 0;
+	int r = flash->write(flash, data, size, section_name, ranges,
+			     num_ranges);
+
+	if (!r)
+		bytes = flash_log_write(flash, data, size, section_name,
+					ranges, num_ranges);
+	updater_stat_end(STAT_FLASH_WRITE, begin, bytes);
+	return r;
+}
+
+/*
+ * Gets the (software) write protection status of the flash.
+ * Returns WP_ENABLED, WP_DISABLED, or -1 if unknown.
+ */
+int flash_get_wp_status(struct flash_programmer *flash)
+{
+	uint64_t begin = updater_stat_begin();
+	int r = flash->get_wp_status(flash);
+
+	updater_stat_end(STAT_FLASH_WP, begin, 0);
+	return r;
+}
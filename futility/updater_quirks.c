@@ -226,28 +226,22 @@ static int quirk_daisy_snow_dual_model(struct updater_config *cfg)
 }
 
 /*
- * Extracts files from a CBFS on given region (section) of image_file.
+ * Extracts a file from a CBFS on given region (section) of image.
  * Returns the path to a temporary file on success, otherwise NULL.
  */
 static const char *extract_cbfs_file(struct updater_config *cfg,
-				     const char *image_file,
+				     const struct firmware_image *image,
 				     const char *cbfs_region,
 				     const char *cbfs_name)
 {
-	const char *output = updater_create_temp_file(cfg);
-	char *command, *result;
+	struct firmware_section file;
+	const char *output;
 
-	ASPRINTF(&command, "cbfstool \"%s\" extract -r %s -n \"%s\" "
-		 "-f \"%s\" 2>&1", image_file, cbfs_region,
-		 cbfs_name, output);
-
-	result = host_shell(command);
-	free(command);
-
-	if (!*result)
-		output = NULL;
-
-	free(result);
+	if (find_cbfs_file(&file, image, cbfs_region, cbfs_name))
+		return NULL;
+	output = updater_create_temp_file(cfg);
+	if (!output || vb2_write_file(output, file.data, file.size))
+		return NULL;
 	return output;
 }
 
@@ -255,40 +249,56 @@ static const char *extract_cbfs_file(struct updater_config *cfg,
  * Quirk to help preserving SMM store on devices without a dedicated "SMMSTORE"
  * FMAP section. These devices will store "smm store" file in same CBFS where
  * the legacy boot loader lives (i.e, FMAP RW_LEGACY).
- * Note this currently has dependency on external program "cbstool".
+ * If the new image has a store of the same size at the fixed offset, it is
+ * replaced in place; otherwise the external program "cbfstool" is needed to
+ * move it.
  * Returns 0 if the SMM store is properly preserved, or if the system is not
  * available to do that (problem in cbfstool, or no "smm store" in current
  * system firmware). Otherwise non-zero as failure.
  */
 static int quirk_eve_smm_store(struct updater_config *cfg)
 {
+	/* crosreview.com/1165109: The offset is fixed at 0x1bf000. */
+	const size_t smm_store_offset = 0x1bf000;
 	const char *smm_store_name = "smm store";
-	const char *temp_image = updater_create_temp_file(cfg);
-	const char *old_store;
+	struct firmware_section old_store, new_store, legacy_section;
+	const char *temp_image, *old_store_path;
 	char *command;
 
-	if (write_image(temp_image, &cfg->image_current) != VBERROR_SUCCESS)
-		return -1;
+	if (find_cbfs_file(&old_store, &cfg->image_current, FMAP_RW_LEGACY,
+			   smm_store_name)) {
+		DEBUG("SMM store not available. Don't preserve.");
+		return 0;
+	}
 
-	old_store = extract_cbfs_file(cfg, temp_image, FMAP_RW_LEGACY,
-				      smm_store_name);
-	if (!old_store) {
-		DEBUG("cbfstool failure or SMM store not available. "
-		      "Don't preserve.");
+	if (find_cbfs_file(&new_store, &cfg->image, FMAP_RW_LEGACY,
+			   smm_store_name) == 0 &&
+	    new_store.size == old_store.size &&
+	    find_firmware_section(&legacy_section, &cfg->image,
+				  FMAP_RW_LEGACY) == 0 &&
+	    new_store.data - legacy_section.data == smm_store_offset) {
+		DEBUG("Replacing SMM store in place.");
+		memcpy(new_store.data, old_store.data, old_store.size);
 		return 0;
 	}
 
-	/* Reuse temp_image. */
-	if (write_image(temp_image, &cfg->image) != VBERROR_SUCCESS)
+	old_store_path = extract_cbfs_file(cfg, &cfg->image_current,
+					   FMAP_RW_LEGACY, smm_store_name);
+	if (!old_store_path) {
+		DEBUG("Failed to extract SMM store. Don't preserve.");
+		return 0;
+	}
+	temp_image = updater_create_temp_file(cfg);
+	if (!temp_image ||
+	    write_image(temp_image, &cfg->image) != VBERROR_SUCCESS)
 		return -1;
 
-	/* crosreview.com/1165109: The offset is fixed at 0x1bf000. */
 	ASPRINTF(&command,
 		 "cbfstool \"%s\" remove -r %s -n \"%s\" 2>/dev/null; "
 		 "cbfstool \"%s\" add -r %s -n \"%s\" -f \"%s\" "
-		 " -t raw -b 0x1bf000", temp_image, FMAP_RW_LEGACY,
+		 " -t raw -b %#zx", temp_image, FMAP_RW_LEGACY,
 		 smm_store_name, temp_image, FMAP_RW_LEGACY,
-		 smm_store_name, old_store);
+		 smm_store_name, old_store_path, smm_store_offset);
 	host_shell(command);
 	free(command);
 
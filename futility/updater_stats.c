@@ -0,0 +1,99 @@
+/*
+ * Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Time and I/O accounting for the firmware updater.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "updater.h"
+
+struct updater_stat {
+	const char *name;
+	const char *desc;
+	int count;
+	uint64_t usecs;
+	uint64_t bytes;
+};
+
+/* Stages may run in the system loader thread, so updates are locked. */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct updater_stat stats[STAT_MAX] = {
+	[STAT_SETUP] = {"setup", "Set up config (incl. loading images)"},
+	[STAT_UPDATE] = {"update", "Update firmware (incl. system read)"},
+	[STAT_ARCHIVE_READ] = {"archive_read", "Read entries from archive"},
+	[STAT_LOAD_IMAGE] = {"load_image", "Load and parse firmware images"},
+	[STAT_FLASH_READ] = {"flash_read", "Read system firmware"},
+	[STAT_FLASH_WRITE] = {"flash_write", "Write system firmware"},
+	[STAT_FLASH_WP] = {"flash_wp", "Get write protection status"},
+	[STAT_PRESERVE] = {"preserve", "Preserve sections from system"},
+	[STAT_CHECK_ROOT_KEY] = {"check_root_key", "Verify keys against root"},
+	[STAT_CHECK_TPM_KEYS] = {"check_tpm_keys", "Check TPM key versions"},
+};
+
+/* Returns the current (monotonic) time in microseconds. */
+uint64_t updater_stat_begin(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Adds the time since begin (from updater_stat_begin) and given bytes of I/O
+ * to a stage.
+ */
+void updater_stat_end(enum updater_stat_type type, uint64_t begin,
+		      uint64_t bytes)
+{
+	uint64_t usecs = updater_stat_begin() - begin;
+
+	pthread_mutex_lock(&stats_lock);
+	stats[type].count++;
+	stats[type].usecs += usecs;
+	stats[type].bytes += bytes;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Prints the time and I/O of all stages that have run, as a table or (if
+ * json is set) a JSON object.
+ */
+void updater_print_stats(FILE *fp, int json)
+{
+	const struct updater_stat *stat;
+	int i, printed = 0;
+
+	pthread_mutex_lock(&stats_lock);
+	if (json)
+		fprintf(fp, "{\n");
+	else
+		fprintf(fp, "%-16s %6s %12s %12s  %s\n", "Stage", "Count",
+			"Time (ms)", "Bytes", "Description");
+	for (i = 0; i < STAT_MAX; i++) {
+		stat = &stats[i];
+		if (!stat->count)
+			continue;
+		if (json)
+			fprintf(fp, "%s  \"%s\": { \"count\": %d, "
+				"\"usecs\": %" PRIu64 ", \"bytes\": %" PRIu64
+				" }", printed ? ",\n" : "", stat->name,
+				stat->count, stat->usecs, stat->bytes);
+		else
+			fprintf(fp, "%-16s %6d %8" PRIu64 ".%03" PRIu64
+				" %12" PRIu64 "  %s\n", stat->name,
+				stat->count, stat->usecs / 1000,
+				stat->usecs % 1000, stat->bytes, stat->desc);
+		printed++;
+	}
+	if (json)
+		fprintf(fp, "%s}\n", printed ? "\n" : "");
+	pthread_mutex_unlock(&stats_lock);
+}
@@ -33,6 +33,8 @@
 #define PLATFORM_DEV_PATH "/sys/devices/platform/chromeos_arm"
 /* Device for NVCTX write */
 #define NVCTX_PATH "/dev/mmcblk%d"
+/* Device of the EC, if it holds NV storage */
+#define CROS_EC_DEV_PATH "/dev/cros_ec"
 /* Base name for GPIO files */
 #define GPIO_BASE_PATH "/sys/class/gpio"
 #define GPIO_EXPORT_PATH GPIO_BASE_PATH "/export"
@@ -41,7 +43,6 @@
 /* Errors */
 #define E_FAIL      -1
 #define E_FILEOP    -2
-#define E_MEM       -3
 /* Common constants */
 #define FNAME_SIZE  80
 #define SECTOR_SIZE 512
@@ -68,21 +69,23 @@ static int FindEmmcDev(void)
 static int ReadFdtValue(const char *property, int *value)
 {
 	char filename[FNAME_SIZE];
-	FILE *file;
+	void *block;
+	size_t size;
 	int data = 0;
 
 	snprintf(filename, sizeof(filename), FDT_BASE_PATH "/%s", property);
-	file = fopen(filename, "rb");
-	if (!file) {
+	if (VbReadPropertyFile(filename, &block, &size)) {
 		fprintf(stderr, "Unable to open FDT property %s\n", property);
 		return E_FILEOP;
 	}
 
-	if (fread(&data, 1, sizeof(data), file) != sizeof(data)) {
+	if (size < sizeof(data)) {
 		fprintf(stderr, "Unable to read FDT property %s\n", property);
+		free(block);
 		return E_FILEOP;
 	}
-	fclose(file);
+	memcpy(&data, block, sizeof(data));
+	free(block);
 
 	if (value)
 		*value = ntohl(data); /* FDT is network byte order */
@@ -121,43 +124,16 @@ static int FdtPropertyExist(const char *property)
 static int ReadFdtBlock(const char *property, void **block, size_t *size)
 {
 	char filename[FNAME_SIZE];
-	FILE *file;
-	size_t property_size;
-	char *data;
 
 	if (!block)
 		return E_FAIL;
 
 	GetFdtPropertyPath(property, filename, sizeof(filename));
-	file = fopen(filename, "rb");
-	if (!file) {
-		fprintf(stderr, "Unable to open FDT property %s\n", property);
-		return E_FILEOP;
-	}
-
-	fseek(file, 0, SEEK_END);
-	property_size = ftell(file);
-	rewind(file);
-
-	data = malloc(property_size +1);
-	if (!data) {
-		fclose(file);
-		return E_MEM;
-	}
-	data[property_size] = 0;
-
-	if (1 != fread(data, property_size, 1, file)) {
-		fprintf(stderr, "Unable to read from property %s\n", property);
-		fclose(file);
-		free(data);
+	if (VbReadPropertyFile(filename, block, size)) {
+		fprintf(stderr, "Unable to read FDT property %s\n", property);
 		return E_FILEOP;
 	}
 
-	fclose(file);
-	*block = data;
-	if (size)
-		*size = property_size;
-
 	return 0;
 }
 
@@ -359,8 +335,13 @@ int vb2_read_nv_storage(struct vb2_context *ctx)
 	media = ReadFdtString(FDT_NVSTORAGE_TYPE_PROP);
 	if (!strcmp(media, "disk"))
 		return vb2_read_nv_storage_disk(ctx);
-	if (!strcmp(media, "cros-ec") || !strcmp(media, "mkbp") ||
-	    !strcmp(media, "flash"))
+	if (!strcmp(media, "cros-ec") || !strcmp(media, "mkbp")) {
+		/* Ask the EC directly; older kernels need mosys for that */
+		if (!vb2_read_nv_storage_direct(ctx, CROS_EC_DEV_PATH))
+			return 0;
+		return vb2_read_nv_storage_mosys(ctx);
+	}
+	if (!strcmp(media, "flash"))
 		return vb2_read_nv_storage_mosys(ctx);
 	return -1;
 }
@@ -375,8 +356,13 @@ int vb2_write_nv_storage(struct vb2_context *ctx)
 	media = ReadFdtString(FDT_NVSTORAGE_TYPE_PROP);
 	if (!strcmp(media, "disk"))
 		return vb2_write_nv_storage_disk(ctx);
-	if (!strcmp(media, "cros-ec") || !strcmp(media, "mkbp") ||
-	    !strcmp(media, "flash"))
+	if (!strcmp(media, "cros-ec") || !strcmp(media, "mkbp")) {
+		/* Ask the EC directly; older kernels need mosys for that */
+		if (!vb2_write_nv_storage_direct(ctx, CROS_EC_DEV_PATH))
+			return 0;
+		return vb2_write_nv_storage_mosys(ctx);
+	}
+	if (!strcmp(media, "flash"))
 		return vb2_write_nv_storage_mosys(ctx);
 	return -1;
 }
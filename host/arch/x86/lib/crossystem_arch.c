@@ -161,9 +161,9 @@ int vb2_read_nv_storage(struct vb2_context *ctx)
 	unsigned expectsz = vb2_nv_get_size(ctx);
 
 	/* Get the byte offset from VBNV */
-	if (ReadFileInt(ACPI_VBNV_PATH ".0", &offs) < 0)
+	if (VbReadPropertyInt(ACPI_VBNV_PATH ".0", &offs) < 0)
 		return -1;
-	if (ReadFileInt(ACPI_VBNV_PATH ".1", &blksz) < 0)
+	if (VbReadPropertyInt(ACPI_VBNV_PATH ".1", &blksz) < 0)
 		return -1;
 	if (expectsz > blksz)
 		return -1;  /* NV storage block is too small */
@@ -184,9 +184,9 @@ int vb2_write_nv_storage(struct vb2_context *ctx)
 		return 0;  /* Nothing changed, so no need to write */
 
 	/* Get the byte offset from VBNV */
-	if (ReadFileInt(ACPI_VBNV_PATH ".0", &offs) < 0)
+	if (VbReadPropertyInt(ACPI_VBNV_PATH ".0", &offs) < 0)
 		return -1;
-	if (ReadFileInt(ACPI_VBNV_PATH ".1", &blksz) < 0)
+	if (VbReadPropertyInt(ACPI_VBNV_PATH ".1", &blksz) < 0)
 		return -1;
 	if (expectsz > blksz)
 		return -1;  /* NV storage block is too small */
@@ -347,7 +347,7 @@ static int VbGetCmosRebootField(uint8_t mask)
 	uint8_t nvbyte;
 
 	/* Get the byte offset from CHNV */
-	if (ReadFileInt(ACPI_CHNV_PATH, &chnv) < 0)
+	if (VbReadPropertyInt(ACPI_CHNV_PATH, &chnv) < 0)
 		return -1;
 
 	if (0 != VbCmosRead(chnv, 1, &nvbyte))
@@ -368,7 +368,7 @@ static int VbSetCmosRebootField(uint8_t mask, int value)
 	uint8_t nvbyte;
 
 	/* Get the byte offset from CHNV */
-	if (ReadFileInt(ACPI_CHNV_PATH, &chnv) < 0)
+	if (VbReadPropertyInt(ACPI_CHNV_PATH, &chnv) < 0)
 		return -1;
 
 	if (0 != VbCmosRead(chnv, 1, &nvbyte))
@@ -397,7 +397,7 @@ static const char* VbReadMainFwType(char* dest, int size)
 	unsigned value;
 
 	/* Try reading type from BINF.3 */
-	if (ReadFileInt(ACPI_BINF_PATH ".3", &value) == 0) {
+	if (VbReadPropertyInt(ACPI_BINF_PATH ".3", &value) == 0) {
 		switch(value) {
 			case BINF3_LEGACY:
 				return StrCopy(dest, "legacy", size);
@@ -415,7 +415,7 @@ static const char* VbReadMainFwType(char* dest, int size)
 	}
 
 	/* Fall back to BINF.0 for legacy systems like Mario. */
-	if (ReadFileInt(ACPI_BINF_PATH ".0", &value) < 0)
+	if (VbReadPropertyInt(ACPI_BINF_PATH ".0", &value) < 0)
 		/* Both BINF.0 and BINF.3 are missing, so this isn't Chrome OS
 		 * firmware. */
 		return StrCopy(dest, "nonchrome", size);
@@ -447,11 +447,11 @@ static int VbGetRecoveryReason(void)
 	unsigned value;
 
 	/* Try reading type from BINF.4 */
-	if (ReadFileInt(ACPI_BINF_PATH ".4", &value) == 0)
+	if (VbReadPropertyInt(ACPI_BINF_PATH ".4", &value) == 0)
 		return value;
 
 	/* Fall back to BINF.0 for legacy systems like Mario. */
-	if (ReadFileInt(ACPI_BINF_PATH ".0", &value) < 0)
+	if (VbReadPropertyInt(ACPI_BINF_PATH ".0", &value) < 0)
 		return -1;
 	switch(value) {
 		case BINF0_NORMAL:
@@ -532,8 +532,8 @@ static int FindGpioChipOffsetByLabel(unsigned *gpio_num, unsigned *offset,
 			snprintf(filename, sizeof(filename),
 				 "%s/gpiochip%u/label",
 				 GPIO_BASE_PATH, controller_offset);
-			if (ReadFileString(chiplabel, sizeof(chiplabel),
-					   filename)) {
+			if (VbReadPropertyString(chiplabel, sizeof(chiplabel),
+						 filename)) {
 				if (!strncasecmp(chiplabel, name,
 						 strlen(name))) {
 					/*
@@ -591,7 +591,7 @@ static int FindGpioChipOffsetByNumber(unsigned *gpio_num, unsigned *offset,
 			snprintf(uid_file, sizeof(uid_file),
 				 "%s/gpiochip%u/device/firmware_node/uid",
 				 GPIO_BASE_PATH, *offset);
-			if (ReadFileInt(uid_file, &uid_value) < 0)
+			if (VbReadPropertyInt(uid_file, &uid_value) < 0)
 				continue;
 			if (data->uid == uid_value) {
 				match++;
@@ -715,7 +715,7 @@ static int ReadGpio(unsigned signal_type)
 	for (index = 0; ; index++) {
 		snprintf(name, sizeof(name), "%s.%d/GPIO.0", ACPI_GPIO_PATH,
 			 index);
-		if (ReadFileInt(name, &gpio_type) < 0)
+		if (VbReadPropertyInt(name, &gpio_type) < 0)
 			return -1; /* Ran out of GPIOs before finding a match */
 		if (gpio_type == signal_type)
 			break;
@@ -723,10 +723,10 @@ static int ReadGpio(unsigned signal_type)
 
 	/* Read attributes and controller info for the GPIO */
 	snprintf(name, sizeof(name), "%s.%d/GPIO.1", ACPI_GPIO_PATH, index);
-	if (ReadFileInt(name, &active_high) < 0)
+	if (VbReadPropertyInt(name, &active_high) < 0)
 		return -1;
 	snprintf(name, sizeof(name), "%s.%d/GPIO.2", ACPI_GPIO_PATH, index);
-	if (ReadFileInt(name, &controller_num) < 0)
+	if (VbReadPropertyInt(name, &controller_num) < 0)
 		return -1;
 	/* Do not attempt to read GPIO that is set to -1 in ACPI */
 	if (controller_num == 0xFFFFFFFF)
@@ -734,7 +734,8 @@ static int ReadGpio(unsigned signal_type)
 
 	/* Check for chipsets we recognize. */
 	snprintf(name, sizeof(name), "%s.%d/GPIO.3", ACPI_GPIO_PATH, index);
-	if (!ReadFileString(controller_name, sizeof(controller_name), name))
+	if (!VbReadPropertyString(controller_name, sizeof(controller_name),
+				  name))
 		return -1;
 	chipset = FindChipset(controller_name);
 	if (chipset == NULL)
@@ -780,7 +781,7 @@ int VbGetArchPropertyInt(const char* name)
 	/* Values from ACPI */
 	if (!strcasecmp(name,"fmap_base")) {
 		unsigned fmap_base;
-		if (ReadFileInt(ACPI_FMAP_PATH, &fmap_base) < 0)
+		if (VbReadPropertyInt(ACPI_FMAP_PATH, &fmap_base) < 0)
 			return -1;
 		else
 			value = (int)fmap_base;
@@ -802,7 +803,8 @@ int VbGetArchPropertyInt(const char* name)
 		if (-1 != value && FwidStartsWith("Mario."))
 			value = 1 - value;  /* Mario reports this backwards */
 	} else if (!strcasecmp(name,"recoverysw_ec_boot")) {
-		value = ReadFileBit(ACPI_CHSW_PATH, CHSW_RECOVERY_EC_BOOT);
+		value = VbReadPropertyBit(ACPI_CHSW_PATH,
+					  CHSW_RECOVERY_EC_BOOT);
 	} else if (!strcasecmp(name,"phase_enforcement")) {
 		value = ReadGpio(GPIO_SIGNAL_TYPE_PHASE_ENFORCEMENT);
 	}
@@ -812,11 +814,13 @@ int VbGetArchPropertyInt(const char* name)
 		if (!strcasecmp(name,"recovery_reason")) {
 			value = VbGetRecoveryReason();
 		} else if (!strcasecmp(name,"devsw_boot")) {
-			value = ReadFileBit(ACPI_CHSW_PATH, CHSW_DEV_BOOT);
+			value = VbReadPropertyBit(ACPI_CHSW_PATH,
+						  CHSW_DEV_BOOT);
 		} else if (!strcasecmp(name,"recoverysw_boot")) {
-			value = ReadFileBit(ACPI_CHSW_PATH, CHSW_RECOVERY_BOOT);
+			value = VbReadPropertyBit(ACPI_CHSW_PATH,
+						  CHSW_RECOVERY_BOOT);
 		} else if (!strcasecmp(name,"wpsw_boot")) {
-			value = ReadFileBit(ACPI_CHSW_PATH, CHSW_WP_BOOT);
+			value = VbReadPropertyBit(ACPI_CHSW_PATH, CHSW_WP_BOOT);
 			if (-1 != value && FwidStartsWith("Mario."))
 				value = 1 - value;  /* Mario reports this
 						     * backwards */
@@ -867,13 +871,13 @@ const char* VbGetArchPropertyString(const char* name, char* dest,
 	if (!strcasecmp(name,"arch")) {
 		return StrCopy(dest, "x86", size);
 	} else if (!strcasecmp(name,"hwid")) {
-		return ReadFileString(dest, size, ACPI_BASE_PATH "/HWID");
+		return VbReadPropertyString(dest, size, ACPI_BASE_PATH "/HWID");
 	} else if (!strcasecmp(name,"fwid")) {
-		return ReadFileString(dest, size, ACPI_BASE_PATH "/FWID");
+		return VbReadPropertyString(dest, size, ACPI_BASE_PATH "/FWID");
 	} else if (!strcasecmp(name,"ro_fwid")) {
-		return ReadFileString(dest, size, ACPI_BASE_PATH "/FRID");
+		return VbReadPropertyString(dest, size, ACPI_BASE_PATH "/FRID");
 	} else if (!strcasecmp(name,"mainfw_act")) {
-		if (ReadFileInt(ACPI_BINF_PATH ".1", &value) < 0)
+		if (VbReadPropertyInt(ACPI_BINF_PATH ".1", &value) < 0)
 			return NULL;
 		switch(value) {
 			case 0:
@@ -888,7 +892,7 @@ const char* VbGetArchPropertyString(const char* name, char* dest,
 	} else if (!strcasecmp(name,"mainfw_type")) {
 		return VbReadMainFwType(dest, size);
 	} else if (!strcasecmp(name,"ecfw_act")) {
-		if (ReadFileInt(ACPI_BINF_PATH ".2", &value) < 0)
+		if (VbReadPropertyInt(ACPI_BINF_PATH ".2", &value) < 0)
 			return NULL;
 		switch(value) {
 			case 0:
@@ -906,18 +910,20 @@ const char* VbGetArchPropertyString(const char* name, char* dest,
 
 int VbSetArchPropertyInt(const char* name, int value)
 {
-	/* NV storage values.  If unable to get from NV storage, fall back to
-	 * the CMOS reboot field used by older BIOS. */
+	/* NV storage values.  If unable to write NV storage, fall back to
+	 * the CMOS reboot field used by older BIOS.  These are written right
+	 * away rather than at VbSetSystemPropertiesCommit(), so a failure is
+	 * seen here. */
 	if (!strcasecmp(name,"recovery_request")) {
-		if (0 == vb2_set_nv_storage(VB2_NV_RECOVERY_REQUEST, value))
+		if (0 == vb2_set_nv_storage_now(VB2_NV_RECOVERY_REQUEST, value))
 			return 0;
 		return VbSetCmosRebootField(CMOSRF_RECOVERY, value);
 	} else if (!strcasecmp(name,"dbg_reset")) {
-		if (0 == vb2_set_nv_storage(VB2_NV_DEBUG_RESET_MODE, value))
+		if (0 == vb2_set_nv_storage_now(VB2_NV_DEBUG_RESET_MODE, value))
 			return 0;
 		return  VbSetCmosRebootField(CMOSRF_DEBUG_RESET, value);
 	} else if (!strcasecmp(name,"fwb_tries")) {
-		if (0 == vb2_set_nv_storage(VB2_NV_TRY_COUNT, value))
+		if (0 == vb2_set_nv_storage_now(VB2_NV_TRY_COUNT, value))
 			return 0;
 		return VbSetCmosRebootField(CMOSRF_TRY_B, value);
 	}
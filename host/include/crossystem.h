@@ -45,6 +45,34 @@ int VbSetSystemPropertyInt(const char* name, int value);
  * Returns 0 if success, -1 if error. */
 int VbSetSystemPropertyString(const char* name, const char* value);
 
+/* Start setting several system properties at once.
+ *
+ * NV storage is read at most once, and values set by
+ * VbSetSystemPropertyInt() and VbSetSystemPropertyString() are kept in
+ * memory until VbSetSystemPropertiesCommit() writes them all back together.
+ * Reads in between see the values already set.  Calls may be nested; only
+ * the outermost commit writes. */
+void VbSetSystemPropertiesBegin(void);
+
+/* Finish setting system properties started by VbSetSystemPropertiesBegin(),
+ * writing NV storage if anything changed.
+ *
+ * Returns 0 if success, -1 if error. */
+int VbSetSystemPropertiesCommit(void);
+
+/* Start reading many system properties at once.
+ *
+ * Until VbSystemPropertiesSnapshotEnd(), every file the properties come from
+ * (ACPI tables, sysfs, device tree, kernel command line) is read at most once
+ * and later reads are answered from memory, so the properties are consistent
+ * with each other.  VbSharedData and NV storage are always read only once per
+ * process.  Values changed while a snapshot is active may not be seen until
+ * it ends. */
+void VbSystemPropertiesSnapshotBegin(void);
+
+/* Drop the snapshot started by VbSystemPropertiesSnapshotBegin(). */
+void VbSystemPropertiesSnapshotEnd(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,6 +28,26 @@ int vb2_read_nv_storage_mosys(struct vb2_context *ctx);
  */
 int vb2_write_nv_storage_mosys(struct vb2_context* ctx);
 
+/**
+ * Attempt to read non-volatile storage directly from the device at path,
+ * without running mosys.
+ *
+ * The device is normally the cros_ec device, which is asked for the vboot
+ * context through the EC_CMD_VBNV_CONTEXT host command.  It may also be a
+ * regular file holding the NV data, for tests.
+ *
+ * Returns 0 if success, non-zero if error.
+ */
+int vb2_read_nv_storage_direct(struct vb2_context *ctx, const char *path);
+
+/**
+ * Attempt to write non-volatile storage directly to the device at path, as
+ * for vb2_read_nv_storage_direct().
+ *
+ * Returns 0 if success, non-zero if error.
+ */
+int vb2_write_nv_storage_direct(struct vb2_context *ctx, const char *path);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cbfs.h"
+
+static uint32_t read_be32(const void *ptr)
+{
+	const uint8_t *p = (const uint8_t *)ptr;
+
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | p[3];
+}
+
+/* Returns 1 if the file at given header is compressed, otherwise 0. */
+static int is_compressed(const uint8_t *file, uint32_t attr_offset,
+			 uint32_t data_offset)
+{
+	const CbfsFileAttribute *attr;
+	uint32_t tag, len;
+
+	while (attr_offset + sizeof(*attr) <= data_offset) {
+		attr = (const CbfsFileAttribute *)(file + attr_offset);
+		tag = read_be32(&attr->tag);
+		len = read_be32(&attr->len);
+		if (tag == CBFS_FILE_ATTR_TAG_UNUSED ||
+		    tag == CBFS_FILE_ATTR_TAG_UNUSED2)
+			break;
+		if (tag == CBFS_FILE_ATTR_TAG_COMPRESSION &&
+		    len >= sizeof(*attr) + sizeof(uint32_t))
+			return read_be32(attr + 1) != CBFS_COMPRESS_NONE;
+		if (len < sizeof(*attr) || len > data_offset - attr_offset)
+			break;
+		attr_offset += len;
+	}
+	return 0;
+}
+
+/* Search for a file by name in the CBFS region */
+uint8_t *cbfs_find_file(uint8_t *ptr, size_t size, const char *name,
+			uint32_t *file_size)
+{
+	const CbfsFileHeader *header;
+	const char *file_name;
+	size_t pos, name_end;
+	uint32_t offset, len, attr_offset;
+
+	for (pos = 0; size >= sizeof(*header) &&
+	     pos <= size - sizeof(*header); ) {
+		header = (const CbfsFileHeader *)(ptr + pos);
+		if (memcmp(header->magic, CBFS_FILE_MAGIC,
+			   CBFS_FILE_MAGIC_SIZE) != 0) {
+			pos += CBFS_ALIGNMENT;
+			continue;
+		}
+
+		offset = read_be32(&header->offset);
+		len = read_be32(&header->len);
+		attr_offset = read_be32(&header->attributes_offset);
+		if (offset < sizeof(*header) || offset > size - pos ||
+		    len > size - pos - offset) {
+			fprintf(stderr, "Corrupted CBFS file at 0x%zx\n", pos);
+			return NULL;
+		}
+
+		/* The name ends at the attributes, or the data. */
+		name_end = offset;
+		if (attr_offset >= sizeof(*header) && attr_offset < offset)
+			name_end = attr_offset;
+		file_name = (const char *)(header + 1);
+		if (strnlen(file_name, name_end - sizeof(*header)) ==
+		    strlen(name) && strncmp(file_name, name,
+					    name_end - sizeof(*header)) == 0) {
+			if (attr_offset >= sizeof(*header) &&
+			    is_compressed(ptr + pos, attr_offset, offset)) {
+				fprintf(stderr,
+					"CBFS file %s is compressed\n", name);
+				return NULL;
+			}
+			*file_size = len;
+			return ptr + pos + offset;
+		}
+
+		/* Next file starts on the alignment after this one. */
+		pos += offset + len;
+		pos = (pos + CBFS_ALIGNMENT - 1) / CBFS_ALIGNMENT *
+		      CBFS_ALIGNMENT;
+	}
+	return NULL;
+}
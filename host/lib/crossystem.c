@@ -13,6 +13,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -35,6 +36,29 @@
 #define MOSYS_CROS_PATH "/usr/sbin/mosys"
 #define MOSYS_ANDROID_PATH "/system/bin/mosys"
 
+/*
+ * Command interface of the cros_ec character device (see
+ * include/uapi/linux/mfd/cros_ec_dev.h in the kernel).
+ */
+struct cros_ec_command {
+	uint32_t version;
+	uint32_t command;
+	uint32_t outsize;
+	uint32_t insize;
+	uint32_t result;
+	uint8_t data[0];
+};
+
+#define CROS_EC_DEV_IOCXCMD _IOWR(0xec, 0, struct cros_ec_command)
+
+/* EC host command holding the vboot context (see ec_commands.h in the EC) */
+#define EC_CMD_VBNV_CONTEXT 0x0017
+#define EC_VER_VBNV_CONTEXT 1
+#define EC_VBNV_BLOCK_SIZE 16
+#define EC_VBNV_CONTEXT_OP_READ 0
+#define EC_VBNV_CONTEXT_OP_WRITE 1
+#define EC_RES_SUCCESS 0
+
 /* Fields that GetVdatString() can get */
 typedef enum VdatStringField {
 	VDAT_STRING_TIMERS = 0,           /* Timer values */
@@ -85,6 +109,188 @@ static const char *default_boot[] = {"disk", "usb", "legacy"};
  * makes it too easy to accidentally corrupt other sub-fields. */
 #define KERN_NV_CURRENTLY_UNUSED    0xFFC0
 
+/*
+ * Return the VbSharedData, or NULL if error. It is written by firmware at boot
+ * time and never changes after that, so it is only read once per process. The
+ * caller must not free it.
+ */
+static VbSharedDataHeader *VbSharedDataGet(void)
+{
+	static VbSharedDataHeader *cached_sh;
+	static int sh_read;
+
+	if (!sh_read) {
+		cached_sh = VbSharedDataRead();
+		sh_read = 1;
+	}
+	return cached_sh;
+}
+
+/* A property source file read during a snapshot */
+struct snapshot_file {
+	struct snapshot_file *next;
+	char *filename;
+	char *data;		/* NULL if the file could not be read */
+	size_t size;
+};
+
+/* Files read since VbSystemPropertiesSnapshotBegin() */
+static struct snapshot_file *snapshot_files;
+static int snapshot_active;
+
+/*
+ * Read a whole file into a newly allocated, 0-terminated buffer.  Does not
+ * trust the file size, which sysfs and procfs do not report.
+ *
+ * Returns the buffer, or NULL if error.
+ */
+static char *ReadWholeFile(const char *filename, size_t *size)
+{
+	FILE *f;
+	char *data = NULL, *newdata;
+	size_t len = 0, alloc = 0, got;
+
+	f = fopen(filename, "rb");
+	if (!f)
+		return NULL;
+
+	do {
+		if (len + 1 >= alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			newdata = realloc(data, alloc);
+			if (!newdata) {
+				free(data);
+				fclose(f);
+				return NULL;
+			}
+			data = newdata;
+		}
+		got = fread(data + len, 1, alloc - len - 1, f);
+		len += got;
+	} while (got);
+
+	if (ferror(f)) {
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+
+	data[len] = 0;
+	*size = len;
+	return data;
+}
+
+int VbReadPropertyFile(const char *filename, void **data, size_t *size)
+{
+	struct snapshot_file *sf;
+	size_t len;
+	char *buf;
+
+	if (!snapshot_active) {
+		buf = ReadWholeFile(filename, &len);
+		if (!buf)
+			return -1;
+	} else {
+		for (sf = snapshot_files; sf; sf = sf->next) {
+			if (!strcmp(sf->filename, filename))
+				break;
+		}
+		if (!sf) {
+			sf = calloc(1, sizeof(*sf));
+			if (!sf)
+				return -1;
+			sf->filename = strdup(filename);
+			if (!sf->filename) {
+				free(sf);
+				return -1;
+			}
+			sf->data = ReadWholeFile(filename, &sf->size);
+			sf->next = snapshot_files;
+			snapshot_files = sf;
+		}
+		if (!sf->data)
+			return -1;
+
+		len = sf->size;
+		buf = malloc(len + 1);
+		if (!buf)
+			return -1;
+		memcpy(buf, sf->data, len + 1);
+	}
+
+	*data = buf;
+	if (size)
+		*size = len;
+	return 0;
+}
+
+char *VbReadPropertyString(char *dest, int size, const char *filename)
+{
+	char *data, *end;
+	size_t len;
+
+	if (size < 1 || 0 != VbReadPropertyFile(filename, (void **)&data, &len))
+		return NULL;
+
+	/* Same as fgets(): the first line, including its newline */
+	end = memchr(data, '\n', len);
+	if (end)
+		len = end - data + 1;
+	if (len > size - 1)
+		len = size - 1;
+	memcpy(dest, data, len);
+	dest[len] = 0;
+	free(data);
+
+	return len ? dest : NULL;
+}
+
+int VbReadPropertyInt(const char *filename, unsigned *value)
+{
+	char buf[64];
+	char *e = NULL;
+
+	if (!VbReadPropertyString(buf, sizeof(buf), filename))
+		return -1;
+
+	/* Convert to integer.  Allow characters after the int ("123 blah"). */
+	*value = (unsigned)strtoul(buf, &e, 0);
+	if (e == buf)
+		return -1;  /* No characters consumed, so conversion failed */
+
+	return 0;
+}
+
+int VbReadPropertyBit(const char *filename, int bitmask)
+{
+	unsigned value;
+
+	if (VbReadPropertyInt(filename, &value) < 0)
+		return -1;
+	return value & bitmask ? 1 : 0;
+}
+
+void VbSystemPropertiesSnapshotBegin(void)
+{
+	VbSystemPropertiesSnapshotEnd();
+	snapshot_active = 1;
+}
+
+void VbSystemPropertiesSnapshotEnd(void)
+{
+	struct snapshot_file *sf;
+
+	while (snapshot_files) {
+		sf = snapshot_files;
+		snapshot_files = sf->next;
+		free(sf->filename);
+		free(sf->data);
+		free(sf);
+	}
+	snapshot_active = 0;
+}
+
 /* Return true if the FWID starts with the specified string. */
 int FwidStartsWith(const char *start)
 {
@@ -95,52 +301,99 @@ int FwidStartsWith(const char *start)
 	return 0 == strncmp(fwid, start, strlen(start));
 }
 
-static int vnc_read;
+/* NV storage context, valid if nv_loaded */
+static struct vb2_context nv_ctx;
+static int nv_loaded;
 
-int vb2_get_nv_storage(enum vb2_nv_param param)
+/* Depth of VbSetSystemPropertiesBegin() calls; NV writes wait until 0 */
+static int nv_transaction;
+
+/*
+ * Read NV storage into nv_ctx, unless that has already been done.
+ *
+ * Returns 0 if success, -1 if error.
+ */
+static int vb2_load_nv_storage(void)
 {
-	VbSharedDataHeader* sh = VbSharedDataRead();
-	static struct vb2_context cached_ctx;
+	VbSharedDataHeader *sh = VbSharedDataGet();
+
+	if (nv_loaded)
+		return 0;
 
 	/* TODO: locking around NV access */
-	if (!vnc_read) {
-		memset(&cached_ctx, 0, sizeof(cached_ctx));
-		if (sh && sh->flags & VBSD_NVDATA_V2)
-			cached_ctx.flags |= VB2_CONTEXT_NVDATA_V2;
-		if (0 != vb2_read_nv_storage(&cached_ctx))
-			return -1;
-		vb2_nv_init(&cached_ctx);
+	memset(&nv_ctx, 0, sizeof(nv_ctx));
+	if (sh && sh->flags & VBSD_NVDATA_V2)
+		nv_ctx.flags |= VB2_CONTEXT_NVDATA_V2;
+	if (0 != vb2_read_nv_storage(&nv_ctx))
+		return -1;
+	vb2_nv_init(&nv_ctx);
+
+	/* TODO: If vnc.raw_changed, attempt to reopen NVRAM for write
+	 * and save the new defaults.  If we're able to, log. */
 
-		/* TODO: If vnc.raw_changed, attempt to reopen NVRAM for write
-		 * and save the new defaults.  If we're able to, log. */
+	nv_loaded = 1;
+	return 0;
+}
 
-		vnc_read = 1;
+/*
+ * Write nv_ctx back to NV storage if it has changed.
+ *
+ * Returns 0 if success, -1 if error.
+ */
+static int vb2_flush_nv_storage(void)
+{
+	if (!nv_loaded || !(nv_ctx.flags & VB2_CONTEXT_NVDATA_CHANGED))
+		return 0;
+
+	if (0 != vb2_write_nv_storage(&nv_ctx)) {
+		nv_loaded = 0;
+		return -1;
 	}
+	nv_ctx.flags &= ~VB2_CONTEXT_NVDATA_CHANGED;
+	return 0;
+}
+
+int vb2_get_nv_storage(enum vb2_nv_param param)
+{
+	if (0 != vb2_load_nv_storage())
+		return -1;
 
-	return (int)vb2_nv_get(&cached_ctx, param);
+	return (int)vb2_nv_get(&nv_ctx, param);
 }
 
 int vb2_set_nv_storage(enum vb2_nv_param param, int value)
 {
-	VbSharedDataHeader* sh = VbSharedDataRead();
+	int retval;
+
+	VbSetSystemPropertiesBegin();
+	retval = vb2_load_nv_storage();
+	if (!retval)
+		vb2_nv_set(&nv_ctx, param, (uint32_t)value);
+	if (0 != VbSetSystemPropertiesCommit())
+		retval = -1;
+
+	return retval;
+}
+
+int vb2_set_nv_storage_now(enum vb2_nv_param param, int value)
+{
 	struct vb2_context ctx;
 
-	/* TODO: locking around NV access */
-	memset(&ctx, 0, sizeof(ctx));
-	if (sh && sh->flags & VBSD_NVDATA_V2)
-		ctx.flags |= VB2_CONTEXT_NVDATA_V2;
-	if (0 != vb2_read_nv_storage(&ctx))
+	if (0 != vb2_load_nv_storage())
 		return -1;
-	vb2_nv_init(&ctx);
-	vb2_nv_set(&ctx, param, (uint32_t)value);
 
-	if (ctx.flags & VB2_CONTEXT_NVDATA_CHANGED) {
-		vnc_read = 0;
-		if (0 != vb2_write_nv_storage(&ctx))
-			return -1;
-	}
+	/*
+	 * Write a copy, so a failed write leaves the settings already pending
+	 * in nv_ctx for VbSetSystemPropertiesCommit().
+	 */
+	memcpy(&ctx, &nv_ctx, sizeof(ctx));
+	vb2_nv_set(&ctx, param, (uint32_t)value);
+	if ((ctx.flags & VB2_CONTEXT_NVDATA_CHANGED) &&
+	    0 != vb2_write_nv_storage(&ctx))
+		return -1;
 
-	/* Success */
+	ctx.flags &= ~VB2_CONTEXT_NVDATA_CHANGED;
+	memcpy(&nv_ctx, &ctx, sizeof(nv_ctx));
 	return 0;
 }
 
@@ -152,27 +405,42 @@ int vb2_set_nv_storage(enum vb2_nv_param param, int value)
 static int vb2_set_nv_storage_with_backup(enum vb2_nv_param param, int value)
 {
 	int retval;
+
+	VbSetSystemPropertiesBegin();
 	retval = vb2_set_nv_storage(param, value);
 	if (!retval)
 		vb2_set_nv_storage(VB2_NV_BACKUP_NVRAM_REQUEST, 1);
+	if (0 != VbSetSystemPropertiesCommit())
+		retval = -1;
+
 	return retval;
 }
 
+void VbSetSystemPropertiesBegin(void)
+{
+	/* Start from fresh NV data, in case someone else has changed it. */
+	if (!nv_transaction++)
+		nv_loaded = 0;
+}
+
+int VbSetSystemPropertiesCommit(void)
+{
+	if (!nv_transaction || --nv_transaction)
+		return 0;
+
+	return vb2_flush_nv_storage();
+}
+
 /* Find what build/debug status is specified on the kernel command
  * line, if any. */
 static VbBuildOption VbScanBuildOption(void)
 {
-	FILE* f = NULL;
 	char buf[4096] = "";
 	char *t, *saveptr;
 	const char *delimiters = " \r\n";
 
-	f = fopen(KERNEL_CMDLINE_PATH, "r");
-	if (NULL != f) {
-		if (NULL == fgets(buf, sizeof(buf), f))
-			buf[0] = 0;
-		fclose(f);
-	}
+	if (!VbReadPropertyString(buf, sizeof(buf), KERNEL_CMDLINE_PATH))
+		buf[0] = 0;
 	for (t = strtok_r(buf, delimiters, &saveptr); t;
 	     t = strtok_r(NULL, delimiters, &saveptr)) {
 		if (0 == strcmp(t, "cros_debug"))
@@ -326,7 +594,7 @@ LoadKernelDebugExit:
 
 char *GetVdatString(char *dest, int size, VdatStringField field)
 {
-	VbSharedDataHeader *sh = VbSharedDataRead();
+	VbSharedDataHeader *sh = VbSharedDataGet();
 	char *value = dest;
 
 	if (!sh)
@@ -375,13 +643,12 @@ char *GetVdatString(char *dest, int size, VdatStringField field)
 			break;
 	}
 
-	free(sh);
 	return value;
 }
 
 int GetVdatInt(VdatIntField field)
 {
-	VbSharedDataHeader* sh = VbSharedDataRead();
+	VbSharedDataHeader *sh = VbSharedDataGet();
 	int value = -1;
 
 	if (!sh)
@@ -444,7 +711,6 @@ int GetVdatInt(VdatIntField field)
 		}
 	}
 
-	free(sh);
 	return value;
 }
 
@@ -911,3 +1177,81 @@ int vb2_write_nv_storage_mosys(struct vb2_context *ctx)
 		return -1;
 	return 0;
 }
+
+/*
+ * Read or write the vboot context block through the EC_CMD_VBNV_CONTEXT host
+ * command, on the open cros_ec device fd.
+ *
+ * Returns 0 if success, -1 if error.
+ */
+static int VbnvContextEc(int fd, uint32_t op, uint8_t *block)
+{
+	uint32_t buf[(sizeof(struct cros_ec_command) + sizeof(op) +
+		      EC_VBNV_BLOCK_SIZE + 3) / 4];
+	struct cros_ec_command *cmd = (struct cros_ec_command *)buf;
+	int rv;
+
+	cmd->version = EC_VER_VBNV_CONTEXT;
+	cmd->command = EC_CMD_VBNV_CONTEXT;
+	cmd->outsize = sizeof(op) + EC_VBNV_BLOCK_SIZE;
+	cmd->insize = op == EC_VBNV_CONTEXT_OP_READ ? EC_VBNV_BLOCK_SIZE : 0;
+	cmd->result = 0xff;
+	memcpy(cmd->data, &op, sizeof(op));
+	memcpy(cmd->data + sizeof(op), block, EC_VBNV_BLOCK_SIZE);
+
+	rv = ioctl(fd, CROS_EC_DEV_IOCXCMD, cmd);
+	if (rv < 0 || rv < cmd->insize || cmd->result != EC_RES_SUCCESS)
+		return -1;
+
+	if (op == EC_VBNV_CONTEXT_OP_READ)
+		memcpy(block, cmd->data, EC_VBNV_BLOCK_SIZE);
+	return 0;
+}
+
+/*
+ * Read or write NV storage on the device at path: the cros_ec device, or a
+ * regular file holding the NV data.
+ *
+ * Returns 0 if success, -1 if error.
+ */
+static int vb2_access_nv_storage_direct(struct vb2_context *ctx,
+					const char *path, int write)
+{
+	const int nvsize = vb2_nv_get_size(ctx);
+	struct stat st;
+	int fd, rv = -1;
+
+	fd = open(path, write ? O_RDWR : O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) == 0) {
+		if (S_ISCHR(st.st_mode)) {
+			/* The EC only holds the 16-byte V1 records */
+			if (nvsize == EC_VBNV_BLOCK_SIZE)
+				rv = VbnvContextEc(fd, write ?
+						   EC_VBNV_CONTEXT_OP_WRITE :
+						   EC_VBNV_CONTEXT_OP_READ,
+						   ctx->nvdata);
+		} else if (S_ISREG(st.st_mode)) {
+			if (write)
+				rv = pwrite(fd, ctx->nvdata, nvsize, 0);
+			else
+				rv = pread(fd, ctx->nvdata, nvsize, 0);
+			rv = rv == nvsize ? 0 : -1;
+		}
+	}
+
+	close(fd);
+	return rv;
+}
+
+int vb2_read_nv_storage_direct(struct vb2_context *ctx, const char *path)
+{
+	return vb2_access_nv_storage_direct(ctx, path, 0);
+}
+
+int vb2_write_nv_storage_direct(struct vb2_context *ctx, const char *path)
+{
+	return vb2_access_nv_storage_direct(ctx, path, 1);
+}
@@ -9,8 +9,11 @@
 
 #include <openssl/rsa.h>
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -113,6 +116,270 @@ static int sign_external(uint32_t size,
 	return rv;
 }
 
+/* Write exactly [size] bytes to [fd]. Returns -1 on error, 0 on success. */
+static int write_all(int fd, const uint8_t *buf, uint32_t size)
+{
+	ssize_t n;
+
+	while (size) {
+		n = write(fd, buf, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		size -= n;
+	}
+	return 0;
+}
+
+/* Read exactly [size] bytes from [fd]. Returns -1 on error, 0 on success. */
+static int read_all(int fd, uint8_t *buf, uint32_t size)
+{
+	ssize_t n;
+
+	while (size) {
+		n = read(fd, buf, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		size -= n;
+	}
+	return 0;
+}
+
+struct vb2_external_signer {
+	char *external_signer;
+	char *pem_file;
+	pid_t pid;
+	int to_child;		/* Requests are written here */
+	int from_child;		/* Responses are read from here */
+	int in_flight;		/* Requests submitted but not yet collected */
+};
+
+struct vb2_external_signer *vb2_external_signer_start(
+		const char *external_signer, const char *pem_file)
+{
+	struct vb2_external_signer *signer;
+	int p_to_c[2], c_to_p[2];  /* pipe descriptors */
+	pid_t pid;
+
+	VB2_DEBUG("Starting \"%s " VB2_EXTERNAL_SIGNER_PERSISTENT_ARG
+		  " %s\" as a persistent signer.\n",
+		  external_signer, pem_file);
+
+	if (pipe(p_to_c) < 0)  {
+		VB2_DEBUG("pipe() error\n");
+		return NULL;
+	}
+	if (pipe(c_to_p) < 0) {
+		VB2_DEBUG("pipe() error\n");
+		close(p_to_c[0]);
+		close(p_to_c[1]);
+		return NULL;
+	}
+	/*
+	 * Signers started later must not inherit our ends of the pipes, or
+	 * closing them would not send EOF to this signer.
+	 */
+	if (fcntl(p_to_c[STDOUT_FILENO], F_SETFD, FD_CLOEXEC) < 0 ||
+	    fcntl(c_to_p[STDIN_FILENO], F_SETFD, FD_CLOEXEC) < 0) {
+		VB2_DEBUG("fcntl() error\n");
+		close(p_to_c[0]);
+		close(p_to_c[1]);
+		close(c_to_p[0]);
+		close(c_to_p[1]);
+		return NULL;
+	}
+
+	if ((pid = fork()) < 0) {
+		VB2_DEBUG("fork() error\n");
+		close(p_to_c[0]);
+		close(p_to_c[1]);
+		close(c_to_p[0]);
+		close(c_to_p[1]);
+		return NULL;
+	} else if (pid == 0) {  /* Child. */
+		close(p_to_c[STDOUT_FILENO]);
+		close(c_to_p[STDIN_FILENO]);
+		if (dup2(p_to_c[STDIN_FILENO], STDIN_FILENO) < 0 ||
+		    dup2(c_to_p[STDOUT_FILENO], STDOUT_FILENO) < 0)
+			_exit(1);
+		if (p_to_c[STDIN_FILENO] != STDIN_FILENO)
+			close(p_to_c[STDIN_FILENO]);
+		if (c_to_p[STDOUT_FILENO] != STDOUT_FILENO)
+			close(c_to_p[STDOUT_FILENO]);
+		execl(external_signer, external_signer,
+		      VB2_EXTERNAL_SIGNER_PERSISTENT_ARG, pem_file,
+		      (char *) 0);
+		_exit(1);
+	}
+
+	/* Parent. */
+	close(p_to_c[STDIN_FILENO]);
+	close(c_to_p[STDOUT_FILENO]);
+
+	signer = calloc(1, sizeof(*signer));
+	if (signer) {
+		signer->external_signer = strdup(external_signer);
+		signer->pem_file = strdup(pem_file);
+	}
+	if (!signer || !signer->external_signer || !signer->pem_file) {
+		close(p_to_c[STDOUT_FILENO]);
+		close(c_to_p[STDIN_FILENO]);
+		waitpid(pid, NULL, 0);
+		if (signer) {
+			free(signer->external_signer);
+			free(signer->pem_file);
+			free(signer);
+		}
+		return NULL;
+	}
+	signer->pid = pid;
+	signer->to_child = p_to_c[STDOUT_FILENO];
+	signer->from_child = c_to_p[STDIN_FILENO];
+	return signer;
+}
+
+int vb2_external_signer_submit(struct vb2_external_signer *signer,
+			       const uint8_t *inbuf, uint32_t size)
+{
+	uint8_t len[4];
+
+	if (signer->in_flight >= VB2_EXTERNAL_SIGNER_MAX_IN_FLIGHT) {
+		VB2_DEBUG("Too many signing requests in flight\n");
+		return -1;
+	}
+
+	len[0] = size >> 24;
+	len[1] = size >> 16;
+	len[2] = size >> 8;
+	len[3] = size;
+	if (write_all(signer->to_child, len, sizeof(len)) ||
+	    write_all(signer->to_child, inbuf, size)) {
+		VB2_DEBUG("write() error\n");
+		return -1;
+	}
+	signer->in_flight++;
+	return 0;
+}
+
+int vb2_external_signer_collect(struct vb2_external_signer *signer,
+				uint8_t *outbuf, uint32_t outbufsize)
+{
+	uint8_t len[4];
+	uint8_t discard[256];
+	uint32_t size, n;
+
+	if (!signer->in_flight) {
+		VB2_DEBUG("No signing request in flight\n");
+		return -1;
+	}
+	signer->in_flight--;
+
+	if (read_all(signer->from_child, len, sizeof(len))) {
+		VB2_DEBUG("read() error\n");
+		return -1;
+	}
+	size = ((uint32_t)len[0] << 24) | ((uint32_t)len[1] << 16) |
+		((uint32_t)len[2] << 8) | len[3];
+
+	/* Zero-length response means the signer could not sign it. */
+	if (!size) {
+		VB2_DEBUG("External signer reported an error\n");
+		return -1;
+	}
+
+	if (size <= outbufsize)
+		return read_all(signer->from_child, outbuf, size);
+
+	/* Keep the stream in sync for the requests after this one. */
+	VB2_DEBUG("Signature too large (%u > %u)\n", size, outbufsize);
+	while (size) {
+		n = size < sizeof(discard) ? size : sizeof(discard);
+		if (read_all(signer->from_child, discard, n))
+			break;
+		size -= n;
+	}
+	return -1;
+}
+
+int vb2_external_signer_stop(struct vb2_external_signer *signer)
+{
+	int status, rv = 0;
+
+	if (!signer)
+		return 0;
+
+	/* EOF on stdin tells the signer to exit. */
+	close(signer->to_child);
+	close(signer->from_child);
+	if (waitpid(signer->pid, &status, 0) < 0) {
+		VB2_DEBUG("waitpid() error\n");
+		rv = -1;
+	} else if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		VB2_DEBUG("External signer exited abnormally\n");
+		rv = -1;
+	}
+	free(signer->external_signer);
+	free(signer->pem_file);
+	free(signer);
+	return rv;
+}
+
+/* Signer reused by vb2_external_signature() in persistent mode. */
+static int external_signer_persistent;
+static struct vb2_external_signer *cached_signer;
+
+static void stop_cached_signer(void)
+{
+	vb2_external_signer_stop(cached_signer);
+	cached_signer = NULL;
+}
+
+void vb2_external_signer_set_persistent(int enable)
+{
+	external_signer_persistent = enable;
+	if (!enable)
+		stop_cached_signer();
+}
+
+/* Sign [inbuf] with the cached persistent signer, (re)starting it as needed.
+ * Returns -1 on error, 0 on success. */
+static int sign_persistent(uint32_t size,
+			   const uint8_t *inbuf,
+			   uint8_t *outbuf,
+			   uint32_t outbufsize,
+			   const char *pem_file,
+			   const char *external_signer)
+{
+	static int registered;
+
+	if (cached_signer &&
+	    (strcmp(cached_signer->external_signer, external_signer) ||
+	     strcmp(cached_signer->pem_file, pem_file)))
+		stop_cached_signer();
+
+	if (!cached_signer) {
+		cached_signer = vb2_external_signer_start(external_signer,
+							  pem_file);
+		if (!cached_signer)
+			return -1;
+		if (!registered && !atexit(stop_cached_signer))
+			registered = 1;
+	}
+
+	if (vb2_external_signer_submit(cached_signer, inbuf, size) ||
+	    vb2_external_signer_collect(cached_signer, outbuf, outbufsize)) {
+		/* The stream may be out of sync now; start over next time. */
+		stop_cached_signer();
+		return -1;
+	}
+	return 0;
+}
+
 struct vb2_signature *vb2_external_signature(const uint8_t *data,
 					     uint32_t size,
 					     const char *key_file,
@@ -158,12 +425,14 @@ struct vb2_signature *vb2_external_signature(const uint8_t *data,
 	}
 
 	/* Sign the signature_digest into our output buffer */
-	rv = sign_external(signature_digest_len,    /* Input length */
-			   signature_digest,        /* Input data */
-			   vb2_signature_data(sig), /* Output sig */
-			   sig_size,                /* Max Output sig size */
-			   key_file,                /* Key file to use */
-			   external_signer);        /* External cmd to invoke */
+	if (external_signer_persistent)
+		rv = sign_persistent(signature_digest_len, signature_digest,
+				     vb2_signature_data(sig), sig_size,
+				     key_file, external_signer);
+	else
+		rv = sign_external(signature_digest_len, signature_digest,
+				   vb2_signature_data(sig), sig_size,
+				   key_file, external_signer);
 	free(signature_digest);
 
 	if (-1 == rv) {
@@ -81,11 +81,10 @@ struct vb2_signature *vb2_sha512_signature(const uint8_t *data, uint32_t size)
 	return sig;
 }
 
-struct vb2_signature *vb2_calculate_signature(
-		const uint8_t *data, uint32_t size,
-		const struct vb2_private_key *key)
+struct vb2_signature *vb2_sign_digest(const uint8_t *digest,
+				     uint32_t data_size,
+				     const struct vb2_private_key *key)
 {
-	uint8_t digest[VB2_MAX_DIGEST_SIZE];
 	uint32_t digest_size = vb2_digest_size(key->hash_alg);
 
 	uint32_t digest_info_size = 0;
@@ -94,11 +93,6 @@ struct vb2_signature *vb2_calculate_signature(
 					   &digest_info, &digest_info_size))
 		return NULL;
 
-	/* Calculate the digest */
-	if (VB2_SUCCESS != vb2_digest_buffer(data, size, key->hash_alg,
-					     digest, digest_size))
-		return NULL;
-
 	/* Prepend the digest info to the digest */
 	int signature_digest_len = digest_size + digest_info_size;
 	uint8_t *signature_digest = malloc(signature_digest_len);
@@ -110,7 +104,7 @@ struct vb2_signature *vb2_calculate_signature(
 
 	/* Allocate output signature */
 	struct vb2_signature *sig = (struct vb2_signature *)
-		vb2_alloc_signature(vb2_rsa_sig_size(key->sig_alg), size);
+		vb2_alloc_signature(vb2_rsa_sig_size(key->sig_alg), data_size);
 	if (!sig) {
 		free(signature_digest);
 		return NULL;
@@ -133,3 +127,56 @@ struct vb2_signature *vb2_calculate_signature(
 	/* Return the signature */
 	return sig;
 }
+
+struct vb2_signature *vb2_calculate_signature(
+		const uint8_t *data, uint32_t size,
+		const struct vb2_private_key *key)
+{
+	uint8_t digest[VB2_MAX_DIGEST_SIZE];
+	uint32_t digest_size = vb2_digest_size(key->hash_alg);
+
+	/* Calculate the digest */
+	if (VB2_SUCCESS != vb2_digest_buffer(data, size, key->hash_alg,
+					     digest, digest_size))
+		return NULL;
+
+	return vb2_sign_digest(digest, size, key);
+}
+
+void vb2_init_body_digest(struct vb2_body_digest *bd,
+			  const uint8_t *data, uint32_t size)
+{
+	memset(bd, 0, sizeof(*bd));
+	bd->data = data;
+	bd->size = size;
+}
+
+const uint8_t *vb2_get_body_digest(struct vb2_body_digest *bd,
+				   enum vb2_hash_algorithm hash_alg)
+{
+	if (hash_alg <= VB2_HASH_INVALID || hash_alg >= VB2_HASH_ALG_COUNT)
+		return NULL;
+
+	if (!(bd->valid & (1 << hash_alg))) {
+		if (VB2_SUCCESS != vb2_digest_buffer(bd->data, bd->size,
+						     hash_alg,
+						     bd->digest[hash_alg],
+						     VB2_MAX_DIGEST_SIZE))
+			return NULL;
+		bd->valid |= 1 << hash_alg;
+	}
+
+	return bd->digest[hash_alg];
+}
+
+struct vb2_signature *vb2_calculate_body_signature(
+		struct vb2_body_digest *bd,
+		const struct vb2_private_key *key)
+{
+	const uint8_t *digest = vb2_get_body_digest(bd, key->hash_alg);
+
+	if (!digest)
+		return NULL;
+
+	return vb2_sign_digest(digest, bd->size, key);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef __CBFS_H__
+#define __CBFS_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/*
+ * CBFS (coreboot file system) structs. All fields are big-endian. A CBFS
+ * region (usually an FMAP area) is a sequence of files, each starting on a
+ * CBFS_ALIGNMENT boundary.
+ */
+#define CBFS_FILE_MAGIC "LARCHIVE"
+#define CBFS_FILE_MAGIC_SIZE 8
+#define CBFS_ALIGNMENT 64
+#define CBFS_FILE_ATTR_TAG_UNUSED 0
+#define CBFS_FILE_ATTR_TAG_UNUSED2 0xffffffff
+#define CBFS_FILE_ATTR_TAG_COMPRESSION 0x42435a4c
+#define CBFS_COMPRESS_NONE 0
+
+typedef struct _CbfsFileHeader {
+	char     magic[CBFS_FILE_MAGIC_SIZE];
+	uint32_t len;
+	uint32_t type;
+	uint32_t attributes_offset;
+	uint32_t offset;
+	/* Followed by the NUL-terminated file name. */
+} __attribute__((packed)) CbfsFileHeader;
+
+typedef struct _CbfsFileAttribute {
+	uint32_t tag;
+	uint32_t len;
+} __attribute__((packed)) CbfsFileAttribute;
+
+/*
+ * Search for a file by name in the CBFS region, return pointer to its
+ * contents and set *size. Returns NULL if the file is not found or can't be
+ * used in place (for example, it is compressed).
+ */
+uint8_t *cbfs_find_file(uint8_t *ptr, size_t size, const char *name,
+			uint32_t *file_size);
+
+#endif  /* __CBFS_H__ */
@@ -38,12 +38,33 @@ int vb2_get_nv_storage(enum vb2_nv_param param);
  * Returns 0 if success, -1 if error. */
 int vb2_set_nv_storage(enum vb2_nv_param param, int value);
 
+/* Write an integer property to VbNvStorage right away, even inside a
+ * VbSetSystemPropertiesBegin() block, so the caller can fall back to other
+ * storage if the write fails.
+ *
+ * Returns 0 if success, -1 if error. */
+int vb2_set_nv_storage_now(enum vb2_nv_param param, int value);
+
 /* Return true if the FWID starts with the specified string. */
 int FwidStartsWith(const char *start);
 
 /* Return version of VbSharedData struct or -1 if not found. */
 int VbSharedDataVersion(void);
 
+/* Read a file a property comes from.  Allocates a buffer holding the whole
+ * file plus a terminating 0, which must be freed by the caller using free(),
+ * and stores its size (not counting the terminator) in *size if size is not
+ * NULL.  Inside a snapshot, each file is read only once.
+ *
+ * Returns 0 if success, -1 if error. */
+int VbReadPropertyFile(const char* filename, void** data, size_t* size);
+
+/* Like ReadFileString(), ReadFileInt() and ReadFileBit(), but reading the
+ * file through VbReadPropertyFile(). */
+char* VbReadPropertyString(char* dest, int size, const char* filename);
+int VbReadPropertyInt(const char* filename, unsigned* value);
+int VbReadPropertyBit(const char* filename, int bitmask);
+
 /* Apis WITH ARCH-SPECIFIC IMPLEMENTATIONS */
 
 /* Read the non-volatile context from NVRAM.
@@ -8,6 +8,7 @@
 #ifndef VBOOT_REFERENCE_HOST_SIGNATURE_H_
 #define VBOOT_REFERENCE_HOST_SIGNATURE_H_
 
+#include "2sha.h"
 #include "host_key.h"
 #include "utility.h"
 #include "vboot_struct.h"
@@ -71,6 +72,66 @@ struct vb2_signature *vb2_calculate_signature(
 		const uint8_t *data, uint32_t size,
 		const struct vb2_private_key *key);
 
+/**
+ * Sign a precomputed digest using the specified key.
+ *
+ * @param digest	Digest of the data, using key->hash_alg
+ * @param data_size	Length of the data the digest was computed over
+ * @param key		Private key to use to sign data
+ *
+ * @return The signature, or NULL if error.  Caller must free() it.
+ */
+struct vb2_signature *vb2_sign_digest(const uint8_t *digest,
+				      uint32_t data_size,
+				      const struct vb2_private_key *key);
+
+/*
+ * Digests of a body, computed lazily and at most once per hash algorithm, so
+ * the same body can be signed with many keys without rehashing it.
+ */
+struct vb2_body_digest {
+	const uint8_t *data;
+	uint32_t size;
+	uint32_t valid;		/* Bitmask of (1 << hash_alg) computed */
+	uint8_t digest[VB2_HASH_ALG_COUNT][VB2_MAX_DIGEST_SIZE];
+};
+
+/**
+ * Initialize a body digest cache.  No hashing is done yet.
+ *
+ * @param bd		Cache to initialize
+ * @param data		Pointer to body data; must stay valid while bd is used
+ * @param size		Length of data in bytes
+ */
+void vb2_init_body_digest(struct vb2_body_digest *bd,
+			  const uint8_t *data, uint32_t size);
+
+/**
+ * Get the digest of a body, hashing it on first use of hash_alg.
+ *
+ * @param bd		Body digest cache
+ * @param hash_alg	Hash algorithm
+ *
+ * @return Pointer to the digest inside bd, or NULL if error.
+ */
+const uint8_t *vb2_get_body_digest(struct vb2_body_digest *bd,
+				   enum vb2_hash_algorithm hash_alg);
+
+/**
+ * Calculate a signature for a body using the specified key.
+ *
+ * Equivalent to vb2_calculate_signature(bd->data, bd->size, key), but the
+ * body is hashed only once no matter how many keys sign it.
+ *
+ * @param bd		Body digest cache
+ * @param key		Private key to use to sign data
+ *
+ * @return The signature, or NULL if error.  Caller must free() it.
+ */
+struct vb2_signature *vb2_calculate_body_signature(
+		struct vb2_body_digest *bd,
+		const struct vb2_private_key *key);
+
 /**
  * Calculate a signature for the data using an external signer.
  *
@@ -88,4 +149,79 @@ struct vb2_signature *vb2_external_signature(const uint8_t *data,
 					     uint32_t key_algorithm,
 					     const char *external_signer);
 
+/*
+ * Persistent external signer.
+ *
+ * Instead of spawning the external signer once per signature, the signer is
+ * started once as "<external_signer> --persistent <pem_file>" and then fed a
+ * stream of requests on its stdin.  Each request is a 4-byte big-endian
+ * length followed by that many bytes to sign.  For each request, in order,
+ * the signer writes a 4-byte big-endian length followed by the signature to
+ * its stdout.  A zero length response means that request failed.  The signer
+ * exits when its stdin is closed.
+ *
+ * Several requests may be submitted before collecting their responses, up to
+ * VB2_EXTERNAL_SIGNER_MAX_IN_FLIGHT at a time.
+ */
+#define VB2_EXTERNAL_SIGNER_PERSISTENT_ARG "--persistent"
+#define VB2_EXTERNAL_SIGNER_MAX_IN_FLIGHT 16
+
+struct vb2_external_signer;
+
+/**
+ * Start a persistent external signer.
+ *
+ * @param external_signer	Path to external signer program
+ * @param pem_file		Name of file containing private key
+ *
+ * @return The signer, or NULL if error.  Stop it with
+ * vb2_external_signer_stop().
+ */
+struct vb2_external_signer *vb2_external_signer_start(
+		const char *external_signer, const char *pem_file);
+
+/**
+ * Send a signing request to a persistent external signer.
+ *
+ * @param signer	Signer from vb2_external_signer_start()
+ * @param inbuf		Data to sign (typically a padded digest)
+ * @param size		Length of data in bytes
+ *
+ * @return 0 if success, -1 if error.
+ */
+int vb2_external_signer_submit(struct vb2_external_signer *signer,
+			       const uint8_t *inbuf, uint32_t size);
+
+/**
+ * Read the response to the oldest outstanding signing request.
+ *
+ * @param signer	Signer from vb2_external_signer_start()
+ * @param outbuf	Destination for the signature
+ * @param outbufsize	Size of outbuf in bytes
+ *
+ * @return 0 if success, -1 if error.
+ */
+int vb2_external_signer_collect(struct vb2_external_signer *signer,
+				uint8_t *outbuf, uint32_t outbufsize);
+
+/**
+ * Stop a persistent external signer and free it.
+ *
+ * @param signer	Signer from vb2_external_signer_start(), or NULL
+ *
+ * @return 0 if the signer exited cleanly, -1 if error.
+ */
+int vb2_external_signer_stop(struct vb2_external_signer *signer);
+
+/**
+ * Select how vb2_external_signature() invokes the external signer.
+ *
+ * By default each signature spawns the signer once (legacy one-shot mode).
+ * When enabled, a single persistent signer is started on first use and kept
+ * running until it is disabled again or the process exits.
+ *
+ * @param enable	Non-zero to use the persistent protocol
+ */
+void vb2_external_signer_set_persistent(int enable);
+
 #endif  /* VBOOT_REFERENCE_HOST_SIGNATURE_H_ */
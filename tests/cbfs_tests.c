@@ -0,0 +1,107 @@
+/* Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for the host CBFS reader.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cbfs.h"
+#include "test_common.h"
+
+static uint8_t region[1024];
+
+static void write_be32(uint8_t *ptr, uint32_t value)
+{
+	ptr[0] = value >> 24;
+	ptr[1] = value >> 16;
+	ptr[2] = value >> 8;
+	ptr[3] = value;
+}
+
+/*
+ * Adds a file at given position of the region, with an optional compression
+ * attribute. Returns the position of the next file.
+ */
+static size_t add_file(size_t pos, const char *name, const char *data,
+		       int compression)
+{
+	CbfsFileHeader *header = (CbfsFileHeader *)(region + pos);
+	uint32_t name_size = (strlen(name) + 1 + 15) / 16 * 16;
+	uint32_t offset = sizeof(*header) + name_size;
+	uint32_t len = strlen(data);
+
+	memcpy(header->magic, CBFS_FILE_MAGIC, CBFS_FILE_MAGIC_SIZE);
+	write_be32((uint8_t *)&header->len, len);
+	write_be32((uint8_t *)&header->type, 0x50);
+	strcpy((char *)(header + 1), name);
+	if (compression >= 0) {
+		uint8_t *attr = region + pos + offset;
+
+		write_be32((uint8_t *)&header->attributes_offset, offset);
+		write_be32(attr, CBFS_FILE_ATTR_TAG_COMPRESSION);
+		write_be32(attr + 4, 16);
+		write_be32(attr + 8, compression);
+		write_be32(attr + 12, len);
+		offset += 16;
+	}
+	write_be32((uint8_t *)&header->offset, offset);
+	memcpy(region + pos + offset, data, len);
+	pos += offset + len;
+	return (pos + CBFS_ALIGNMENT - 1) / CBFS_ALIGNMENT * CBFS_ALIGNMENT;
+}
+
+static void CbfsFindFileTest(void)
+{
+	uint8_t *ptr;
+	uint32_t size = 0;
+	size_t pos = 0;
+
+	memset(region, 0xff, sizeof(region));
+	pos = add_file(pos, "fallback/payload", "payload data", -1);
+	pos = add_file(pos, "smm store", "store", CBFS_COMPRESS_NONE);
+	/* A gap between files is skipped. */
+	pos += CBFS_ALIGNMENT;
+	pos = add_file(pos, "cros_allow_auto_update", "", -1);
+	pos = add_file(pos, "compressed", "lzma data", 1);
+
+	ptr = cbfs_find_file(region, sizeof(region), "fallback/payload",
+			     &size);
+	TEST_PTR_NEQ(ptr, NULL, "Find first file");
+	TEST_EQ(size, 12, "  size");
+	TEST_EQ(memcmp(ptr, "payload data", size), 0, "  data");
+
+	ptr = cbfs_find_file(region, sizeof(region), "smm store", &size);
+	TEST_PTR_NEQ(ptr, NULL, "Find file with attributes");
+	TEST_EQ(size, 5, "  size");
+	TEST_EQ(memcmp(ptr, "store", size), 0, "  data");
+
+	ptr = cbfs_find_file(region, sizeof(region), "cros_allow_auto_update",
+			     &size);
+	TEST_PTR_NEQ(ptr, NULL, "Find empty file after gap");
+	TEST_EQ(size, 0, "  size");
+
+	TEST_PTR_EQ(cbfs_find_file(region, sizeof(region), "compressed",
+				   &size), NULL, "Compressed file");
+	TEST_PTR_EQ(cbfs_find_file(region, sizeof(region), "smm", &size),
+		    NULL, "Prefix of name");
+	TEST_PTR_EQ(cbfs_find_file(region, sizeof(region), "missing", &size),
+		    NULL, "Missing file");
+	TEST_PTR_EQ(cbfs_find_file(region, 16, "fallback/payload", &size),
+		    NULL, "Region too small");
+
+	/* A file that claims to be larger than the region. */
+	write_be32((uint8_t *)&((CbfsFileHeader *)region)->len, 0x10000);
+	TEST_PTR_EQ(cbfs_find_file(region, sizeof(region), "smm store",
+				   &size), NULL, "Corrupted file");
+}
+
+int main(int argc, char *argv[])
+{
+	CbfsFindFileTest();
+
+	return gTestSuccess ? 0 : 255;
+}
@@ -0,0 +1,89 @@
+/* Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for direct access to crossystem NV storage, using a file in place
+ * of the device.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "2sysincludes.h"
+#include "2api.h"
+#include "2nvstorage.h"
+#include "crossystem_vbnv.h"
+#include "host_common.h"
+#include "host_misc.h"
+
+#include "test_common.h"
+
+static void direct_tests(const char *temp_dir)
+{
+	char *testfile;
+	struct vb2_context ctx, ctx2;
+	uint8_t short_data[VB2_NVDATA_SIZE - 1] = {0};
+	int i;
+
+	xasprintf(&testfile, "%s/crossystem_nv_tests.dat", temp_dir);
+	unlink(testfile);
+
+	memset(&ctx, 0, sizeof(ctx));
+	TEST_NEQ(vb2_read_nv_storage_direct(&ctx, testfile), 0,
+		 "Read missing file");
+	TEST_NEQ(vb2_write_nv_storage_direct(&ctx, testfile), 0,
+		 "Write missing file");
+	TEST_NEQ(vb2_read_nv_storage_direct(&ctx, temp_dir), 0,
+		 "Read directory");
+	/* A character device which is not the EC fails, so mosys is used */
+	TEST_NEQ(vb2_read_nv_storage_direct(&ctx, "/dev/null"), 0,
+		 "Read non-EC device");
+
+	/* V1 records */
+	TEST_SUCC(WriteFile(testfile, short_data, sizeof(short_data)),
+		  "Create short file");
+	TEST_NEQ(vb2_read_nv_storage_direct(&ctx, testfile), 0,
+		 "Read short file");
+
+	vb2_nv_init(&ctx);
+	vb2_nv_set(&ctx, VB2_NV_RECOVERY_REQUEST, 0x42);
+	vb2_nv_set(&ctx, VB2_NV_TRY_COUNT, 3);
+	TEST_SUCC(vb2_write_nv_storage_direct(&ctx, testfile), "Write V1");
+	memset(&ctx2, 0, sizeof(ctx2));
+	TEST_SUCC(vb2_read_nv_storage_direct(&ctx2, testfile), "Read V1");
+	TEST_EQ(memcmp(ctx2.nvdata, ctx.nvdata, VB2_NVDATA_SIZE), 0,
+		"  data");
+	vb2_nv_init(&ctx2);
+	TEST_EQ(vb2_nv_get(&ctx2, VB2_NV_RECOVERY_REQUEST), 0x42,
+		"  recovery request");
+	TEST_EQ(vb2_nv_get(&ctx2, VB2_NV_TRY_COUNT), 3, "  try count");
+
+	/* V2 records need more data than the file holds so far */
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.flags = VB2_CONTEXT_NVDATA_V2;
+	TEST_NEQ(vb2_read_nv_storage_direct(&ctx, testfile), 0,
+		 "Read V2 from V1 file");
+	for (i = 0; i < VB2_NVDATA_SIZE_V2; i++)
+		ctx.nvdata[i] = i;
+	TEST_SUCC(vb2_write_nv_storage_direct(&ctx, testfile), "Write V2");
+	memset(&ctx2, 0, sizeof(ctx2));
+	ctx2.flags = VB2_CONTEXT_NVDATA_V2;
+	TEST_SUCC(vb2_read_nv_storage_direct(&ctx2, testfile), "Read V2");
+	TEST_EQ(memcmp(ctx2.nvdata, ctx.nvdata, VB2_NVDATA_SIZE_V2), 0,
+		"  data");
+
+	unlink(testfile);
+	free(testfile);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <temp_dir>\n", argv[0]);
+		return -1;
+	}
+
+	direct_tests(argv[1]);
+
+	return gTestSuccess ? 0 : 255;
+}
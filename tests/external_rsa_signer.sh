@@ -1,7 +1,37 @@
 #!/bin/bash
 
+if [ $# -eq 2 ] && [ "$1" = "--persistent" ]; then
+  # Persistent protocol: each request on stdin is a 4-byte big-endian length
+  # followed by the data to sign. Each response on stdout is a 4-byte
+  # big-endian length followed by the signature (length 0 on error).
+  PEM=$2
+  tmp=$(mktemp -d)
+  trap 'rm -rf "${tmp}"' EXIT
+  put_len() {
+    local n=$1 i
+    for i in 24 16 8 0; do
+      printf "\\$(printf '%03o' $(( (n >> i) & 0xff )))"
+    done
+  }
+  while true; do
+    len=$(dd bs=1 count=4 2>/dev/null | od -An -tu1)
+    set -- ${len}
+    [ $# -eq 4 ] || break
+    len=$(( ($1 << 24) | ($2 << 16) | ($3 << 8) | $4 ))
+    dd bs=1 count=${len} of="${tmp}/in" 2>/dev/null
+    if openssl rsautl -sign -inkey "${PEM}" -in "${tmp}/in" \
+        -out "${tmp}/out"; then
+      put_len $(stat -c %s "${tmp}/out")
+      cat "${tmp}/out"
+    else
+      put_len 0
+    fi
+  done
+  exit 0
+fi
+
 if [ $# -ne 1 ]; then
-  echo "Usage: $0 <private_key_pem_file>"
+  echo "Usage: $0 [--persistent] <private_key_pem_file>"
   echo "Reads data to sign from stdin, encrypted data is output to stdout"
   exit 1
 fi
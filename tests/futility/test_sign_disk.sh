@@ -0,0 +1,79 @@
+#!/bin/bash -eux
+# Copyright 2018 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+me=${0##*/}
+TMP="$me.tmp"
+
+# Work in scratch directory
+cd "$OUTDIR"
+
+DEVKEYS=${SRCDIR}/tests/devkeys
+TESTKEYS=${SRCDIR}/tests/testkeys
+CGPT=${BUILD}/cgpt/cgpt
+
+# Dummy kernel data
+echo "hi there" > ${TMP}.config.txt
+dd if=/dev/urandom bs=16384 count=1 of=${TMP}.bootloader.bin
+dd if=/dev/urandom bs=32768 count=1 of=${TMP}.kernel.bin
+
+# A kernel partition signed with the dev keys
+${FUTILITY} vbutil_kernel \
+    --pack ${TMP}.kpart \
+    --keyblock ${DEVKEYS}/kernel.keyblock \
+    --signprivate ${DEVKEYS}/kernel_data_key.vbprivk \
+    --version 1 \
+    --arch arm \
+    --vmlinuz ${TMP}.kernel.bin \
+    --bootloader ${TMP}.bootloader.bin \
+    --config ${TMP}.config.txt
+
+# A sparse disk image too big to map in one piece, with the kernel partition
+# placed beyond the 4GiB boundary.
+truncate -s 5G ${TMP}.disk
+${CGPT} create ${TMP}.disk
+${CGPT} add -i 2 -t kernel -b 8650752 -s 32768 -l KERN-A ${TMP}.disk
+${CGPT} add -i 4 -t kernel -b 8716288 -s 32768 -l KERN-B ${TMP}.disk
+dd if=${TMP}.kpart of=${TMP}.disk bs=512 seek=8650752 conv=notrunc
+
+# It should be recognized from the first few sectors
+${FUTILITY} show -t ${TMP}.disk | grep -q 'disk_img'
+
+# The kernel in partition 2 verifies; the empty partition 4 is skipped
+${FUTILITY} verify --publickey ${DEVKEYS}/kernel_subkey.vbpubk ${TMP}.disk \
+  > ${TMP}.show.old
+grep -q 'partition 2' ${TMP}.show.old
+grep -q 'Kernel version:        1' ${TMP}.show.old
+! grep -q 'partition 4' ${TMP}.show.old
+
+# Resign it in place with a new keyblock and version
+${FUTILITY} vbutil_key --pack ${TMP}.datakey \
+    --key ${TESTKEYS}/key_rsa2048.keyb --algorithm 4
+${FUTILITY} vbutil_keyblock --pack ${TMP}.keyblock \
+    --datapubkey ${TMP}.datakey \
+    --flags 5 \
+    --signprivate ${DEVKEYS}/kernel_subkey.vbprivk
+${FUTILITY} sign \
+    --signprivate ${TESTKEYS}/key_rsa2048.sha256.vbprivk \
+    --keyblock ${TMP}.keyblock \
+    --version 2 \
+    ${TMP}.disk
+
+${FUTILITY} verify --publickey ${DEVKEYS}/kernel_subkey.vbpubk ${TMP}.disk \
+  > ${TMP}.show.new
+grep -q 'Kernel version:        2' ${TMP}.show.new
+
+# The partition itself should match resigning the original on its own
+${FUTILITY} sign \
+    --signprivate ${TESTKEYS}/key_rsa2048.sha256.vbprivk \
+    --keyblock ${TMP}.keyblock \
+    --version 2 \
+    ${TMP}.kpart ${TMP}.kpart.new
+dd if=${TMP}.disk of=${TMP}.kpart.disk bs=512 skip=8650752 \
+  count=$(( $(stat -c %s ${TMP}.kpart.new) / 512 ))
+cmp ${TMP}.kpart.new ${TMP}.kpart.disk
+
+# cleanup
+rm -rf ${TMP}*
+exit 0
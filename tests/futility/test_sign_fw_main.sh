@@ -41,6 +41,33 @@ ${FUTILITY} --debug sign \
 # They should match
 cmp ${TMP}.vblock.old ${TMP}.vblock.new
 
+# Sign with extra keysets in one pass
+LOEMDIR=${SRCDIR}/tests/loemkeys
+${FUTILITY} --debug sign \
+  --signprivate ${KEYDIR}/firmware_data_key.vbprivk \
+  --keyblock ${KEYDIR}/firmware.keyblock \
+  --kernelkey ${KEYDIR}/kernel_subkey.vbpubk \
+  --version 12 \
+  --fv ${TMP}.fw_main \
+  --flags 42 \
+  --keyset ${KEYDIR} \
+  --keyset ${LOEMDIR}:loem1 \
+  ${TMP}.vblock.multi
+
+# Each one should match signing with that keyset alone
+cmp ${TMP}.vblock.old ${TMP}.vblock.multi
+cmp ${TMP}.vblock.old ${TMP}.vblock.multi.devkeys
+
+${FUTILITY} --debug sign \
+  --signprivate ${LOEMDIR}/firmware_data_key.loem1.vbprivk \
+  --keyblock ${LOEMDIR}/firmware.loem1.keyblock \
+  --kernelkey ${LOEMDIR}/kernel_subkey.vbpubk \
+  --version 12 \
+  --fv ${TMP}.fw_main \
+  --flags 42 \
+  ${TMP}.vblock.loem1
+cmp ${TMP}.vblock.loem1 ${TMP}.vblock.multi.loem1
+
 # cleanup
 rm -rf ${TMP}*
 exit 0
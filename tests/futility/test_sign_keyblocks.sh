@@ -104,6 +104,31 @@ ${FUTILITY} --debug sign \
 
 cmp ${TMP}.keyblock4 ${TMP}.keyblock5
 
+# Same thing with the persistent external signer protocol
+
+# old way
+${FUTILITY} vbutil_keyblock --pack ${TMP}.keyblock6 \
+  --datapubkey ${DEVKEYS}/firmware_data_key.vbpubk \
+  --signprivate_pem ${TESTKEYS}/key_rsa4096.pem \
+  --pem_algorithm 8 \
+  --flags 19 \
+  --externalsigner ${SIGNER} \
+  --externalsigner_persistent
+
+cmp ${TMP}.keyblock4 ${TMP}.keyblock6
+
+# new way
+${FUTILITY} --debug sign \
+  --pem_signpriv ${TESTKEYS}/key_rsa4096.pem \
+  --pem_algo 8 \
+  --pem_external ${SIGNER} \
+  --pem_persistent \
+  --flags 19 \
+  ${DEVKEYS}/firmware_data_key.vbpubk \
+  ${TMP}.keyblock7
+
+cmp ${TMP}.keyblock4 ${TMP}.keyblock7
+
 
 # cleanup
 rm -rf ${TMP}*
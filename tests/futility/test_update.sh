@@ -258,6 +258,69 @@ test_update "Legacy update" \
 	"${FROM_IMAGE}" "${TMP}.expected.legacy" \
 	-i "${TO_IMAGE}" --mode=legacy
 
+# Test delta writing: only changed erase blocks are written.
+test_update_delta() {
+	local emu_src="$1"
+	local expected_msg="$2"
+	local msg
+
+	shift 2
+	cp -f "${emu_src}" "${TMP}.emu"
+	msg="$("${FUTILITY}" update --emulate "${TMP}.emu" "$@")"
+	echo "${msg}" | grep -qF -- "${expected_msg}"
+}
+echo "*** Test Item: Delta update"
+test_update_delta "${TMP}.expected.full" "whole image: 0 bytes changed" \
+	-i "${TO_IMAGE}" --wp=0 --sys_props 0,0x10001,1
+cmp "${TMP}.emu" "${TMP}.expected.full"
+test_update_delta "${TMP}.expected.b" "RW_SECTION_B: 0 bytes changed" \
+	-i "${TO_IMAGE}" --wp=1 --sys_props 0,0x10001,1
+cmp "${TMP}.emu" "${TMP}.expected.rw"
+
+# The emulated flash keeps a log of what was written.
+echo "*** Test Item: Write log"
+test_update_delta "${FROM_IMAGE}" "Total: 1 write(s)" \
+	-i "${TO_IMAGE}" --wp=0 --sys_props 0,0x10001,1
+cmp "${TMP}.emu" "${TMP}.expected.full"
+
+echo "*** Test Item: Timing report"
+test_update_delta "${FROM_IMAGE}" "flash_write" \
+	-i "${TO_IMAGE}" --wp=0 --sys_props 0,0x10001,1 --timing
+rm -f "${TMP}.timing.json"
+test_update_delta "${FROM_IMAGE}" ">> FULL UPDATE" \
+	-i "${TO_IMAGE}" --wp=0 --sys_props 0,0x10001,1 \
+	--json "${TMP}.timing.json"
+grep -qF '"flash_write": { "count": 1,' "${TMP}.timing.json"
+[ "$(head -c 1 "${TMP}.timing.json")" = "{" ]
+[ "$(tail -n 1 "${TMP}.timing.json")" = "}" ]
+
+# The verification cache should skip verifying the same contents again.
+echo "*** Test Item: Verification cache"
+rm -rf "${TMP}.cache"
+mkdir -p "${TMP}.cache"
+cp -f "${FROM_IMAGE}" "${TMP}.emu"
+"${FUTILITY}" update --emulate "${TMP}.emu" -i "${TO_IMAGE}" --wp=1 \
+	--sys_props 0,0x10001,1 --cache_dir "${TMP}.cache"
+cmp "${TMP}.emu" "${TMP}.expected.rw"
+cp -f "${FROM_IMAGE}" "${TMP}.emu"
+"${FUTILITY}" --debug update --emulate "${TMP}.emu" -i "${TO_IMAGE}" \
+	--wp=1 --sys_props 0,0x10001,1 --cache_dir "${TMP}.cache" 2>&1 |
+	grep -qF "Root key verified before"
+cmp "${TMP}.emu" "${TMP}.expected.rw"
+
+# Test reading only the needed sections from the system firmware.
+test_update "Full update (--sparse_read)" \
+	"${FROM_IMAGE}" "${TMP}.expected.full" \
+	-i "${TO_IMAGE}" --wp=0 --sys_props 0,0x10001,1 --sparse_read
+
+test_update "RW update (--sparse_read)" \
+	"${FROM_IMAGE}" "${TMP}.expected.rw" \
+	-i "${TO_IMAGE}" --wp=1 --sys_props 0,0x10001,1 --sparse_read
+
+test_update "RW update (A->B, --sparse_read)" \
+	"${FROM_IMAGE}" "${TMP}.expected.b" \
+	-i "${TO_IMAGE}" -t --wp=1 --sys_props 0,0x10001,1 --sparse_read
+
 # Test quirks
 test_update "Full update (wrong size)" \
 	"${FROM_IMAGE}.large" "!Image size is different" \
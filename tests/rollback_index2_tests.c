@@ -577,6 +577,97 @@ static void RollbackKernelTest(void)
 		    "tlcl calls");
 }
 
+/****************************************************************************/
+/* Tests for deferred writes */
+
+static void DeferredWriteTest(void)
+{
+	uint32_t version;
+
+	/* Several changes are written once, on commit */
+	ResetMocks(0, 0);
+	mock_rsk.uid = ROLLBACK_SPACE_KERNEL_UID;
+	mock_permissions = TPM_NV_PER_PPWRITE;
+	RollbackDeferWrites();
+	TEST_EQ(RollbackKernelWrite(0x1234), 0, "Deferred RollbackKernelWrite()");
+	TEST_EQ(RollbackKernelWrite(0x5678), 0, "  again");
+	TEST_EQ(SetVirtualDevMode(1), 0, "  SetVirtualDevMode()");
+	TEST_EQ(mock_rsk.kernel_versions, 0, "  not written");
+	TEST_EQ(mock_rsf.flags, 0, "  not written");
+	TEST_EQ(RollbackKernelRead(&version), 0, "  RollbackKernelRead()");
+	TEST_EQ(version, 0x5678, "  pending version");
+	TEST_STR_EQ(mock_calls,
+		    "TlclRead(0x1008, 13)\n"
+		    "TlclRead(0x1007, 10)\n"
+		    "TlclGetPermissions(0x1008)\n",
+		    "tlcl calls");
+
+	*mock_calls = 0;
+	mock_cnext = mock_calls;
+	TEST_EQ(RollbackCommitWrites(), 0, "RollbackCommitWrites()");
+	TEST_EQ(mock_rsk.kernel_versions, 0x5678, "  kernel version");
+	TEST_EQ(mock_rsf.flags, FLAG_VIRTUAL_DEV_MODE_ON, "  flags");
+	TEST_STR_EQ(mock_calls,
+		    "TlclWrite(0x1007, 10)\n"
+		    "TlclRead(0x1007, 10)\n"
+		    "TlclWrite(0x1008, 13)\n"
+		    "TlclRead(0x1008, 13)\n",
+		    "tlcl calls");
+
+	/* Nothing is written after commit, or for unchanged spaces */
+	ResetMocks(0, 0);
+	TEST_EQ(RollbackCommitWrites(), 0, "RollbackCommitWrites() again");
+	TEST_STR_EQ(mock_calls, "", "  no tlcl calls");
+	RollbackDeferWrites();
+	TEST_EQ(RollbackKernelWrite(0), 0, "Unchanged RollbackKernelWrite()");
+	TEST_EQ(SetVirtualDevMode(0), 0, "  SetVirtualDevMode()");
+	TEST_EQ(RollbackCommitWrites(), 0, "  RollbackCommitWrites()");
+	TEST_STR_EQ(mock_calls,
+		    "TlclRead(0x1008, 13)\n"
+		    "TlclRead(0x1007, 10)\n",
+		    "  no writes");
+
+	/* Lock commits pending writes first (PP was locked by earlier tests) */
+	ResetMocks(0, 0);
+	RollbackDeferWrites();
+	TEST_EQ(RollbackKernelWrite(0x1234), 0, "Deferred RollbackKernelWrite()");
+	TEST_EQ(RollbackKernelLock(0), 0, "  RollbackKernelLock()");
+	TEST_EQ(mock_rsk.kernel_versions, 0x1234, "  kernel version");
+	TEST_STR_EQ(mock_calls,
+		    "TlclRead(0x1008, 13)\n"
+		    "TlclWrite(0x1008, 13)\n"
+		    "TlclRead(0x1008, 13)\n",
+		    "tlcl calls");
+
+	/* Commit errors are returned and drop pending changes */
+	ResetMocks(2, TPM_E_IOERROR);
+	RollbackDeferWrites();
+	TEST_EQ(RollbackKernelWrite(0x1234), 0, "Deferred RollbackKernelWrite()");
+	TEST_EQ(RollbackCommitWrites(), TPM_E_IOERROR,
+		"  RollbackCommitWrites() error");
+	ResetMocks(0, 0);
+	TEST_EQ(RollbackCommitWrites(), 0, "  dropped");
+	TEST_STR_EQ(mock_calls, "", "  no tlcl calls");
+
+	/* The kernel space is written even if the firmware space write fails */
+	ResetMocks(3, TPM_E_IOERROR);
+	mock_rsk.uid = ROLLBACK_SPACE_KERNEL_UID;
+	mock_permissions = TPM_NV_PER_PPWRITE;
+	RollbackDeferWrites();
+	TEST_EQ(RollbackKernelWrite(0x1234), 0, "Deferred RollbackKernelWrite()");
+	TEST_EQ(SetVirtualDevMode(1), 0, "  SetVirtualDevMode()");
+	TEST_EQ(RollbackCommitWrites(), TPM_E_IOERROR,
+		"  RollbackCommitWrites() error");
+	TEST_EQ(mock_rsk.kernel_versions, 0x1234, "  kernel version");
+	TEST_STR_EQ(mock_calls,
+		    "TlclRead(0x1008, 13)\n"
+		    "TlclRead(0x1007, 10)\n"
+		    "TlclWrite(0x1007, 10)\n"
+		    "TlclWrite(0x1008, 13)\n"
+		    "TlclRead(0x1008, 13)\n",
+		    "  tlcl calls");
+}
+
 /****************************************************************************/
 /* Tests for RollbackFwmpRead() calls */
 
@@ -676,6 +767,7 @@ int main(int argc, char* argv[])
 	CrcTestKernel();
 	MiscTest();
 	RollbackKernelTest();
+	DeferredWriteTest();
 	RollbackFwmpTest();
 
 	return gTestSuccess ? 0 : 255;
@@ -0,0 +1,121 @@
+/* Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for rollback_index functions against the TPM simulator
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rollback_index.h"
+#include "test_common.h"
+#include "tlcl.h"
+#include "utility.h"
+#include "vboot_common.h"
+
+/* Not in the header file; see rollback_index.c */
+uint32_t ReadSpaceKernel(RollbackSpaceKernel *rsk);
+uint32_t WriteSpaceKernel(RollbackSpaceKernel *rsk);
+
+#ifdef TPM2_MODE
+#define KERNEL_SPACE_PERM (TPMA_NV_PPWRITE | TPMA_NV_PPREAD | \
+			   TPMA_NV_AUTHREAD | TPMA_NV_PLATFORMCREATE)
+#else
+#define KERNEL_SPACE_PERM TPM_NV_PER_PPWRITE
+#endif
+
+/**
+ * Power-cycle the simulated TPM, keeping its NV spaces.
+ */
+static void PowerCycle(void)
+{
+	setenv("TPM_SIMULATOR_RESET", "1", 1);
+	TEST_SUCC(TlclLibInit(), "LibInit");
+	unsetenv("TPM_SIMULATOR_RESET");
+	TEST_SUCC(TlclStartup(), "Startup");
+#ifndef TPM2_MODE
+	TEST_SUCC(TlclAssertPhysicalPresence(), "AssertPhysicalPresence");
+#endif
+}
+
+/**
+ * Return the kernel versions in the kernel space on the TPM.
+ */
+static uint32_t TpmKernelVersions(void)
+{
+	RollbackSpaceKernel rsk;
+
+	memset(&rsk, 0, sizeof(rsk));
+	TEST_SUCC(ReadSpaceKernel(&rsk), "ReadSpaceKernel");
+	return rsk.kernel_versions;
+}
+
+/**
+ * Test the kernel space against the simulator, through a power cycle
+ */
+static void KernelSpaceTest(void)
+{
+	RollbackSpaceKernel rsk;
+	uint32_t version;
+
+	PowerCycle();
+	TEST_SUCC(TlclDefineSpace(KERNEL_NV_INDEX, KERNEL_SPACE_PERM,
+				  sizeof(RollbackSpaceKernel)),
+		  "DefineSpace kernel");
+	memset(&rsk, 0, sizeof(rsk));
+	rsk.struct_version = ROLLBACK_SPACE_KERNEL_VERSION;
+	rsk.uid = ROLLBACK_SPACE_KERNEL_UID;
+	rsk.kernel_versions = 0x10001;
+	TEST_SUCC(WriteSpaceKernel(&rsk), "WriteSpaceKernel");
+
+	TEST_SUCC(RollbackKernelRead(&version), "RollbackKernelRead");
+	TEST_EQ(version, 0x10001, "  version");
+
+	/* Deferred writes reach the TPM when the kernel space is locked */
+	RollbackDeferWrites();
+	TEST_SUCC(RollbackKernelWrite(0x20001), "RollbackKernelWrite");
+	TEST_SUCC(RollbackKernelRead(&version), "RollbackKernelRead");
+	TEST_EQ(version, 0x20001, "  pending version");
+	TEST_EQ(TpmKernelVersions(), 0x10001, "  not written yet");
+	TEST_SUCC(RollbackKernelLock(0), "RollbackKernelLock");
+	TEST_EQ(TpmKernelVersions(), 0x20001, "  written by lock");
+
+	/* Once locked, the kernel space can't be written */
+	TEST_NEQ(RollbackKernelWrite(0x30001), TPM_SUCCESS,
+		 "RollbackKernelWrite locked");
+	TEST_SUCC(RollbackKernelRead(&version), "RollbackKernelRead");
+	TEST_EQ(version, 0x20001, "  version");
+
+	/* Until the next boot */
+	TEST_SUCC(TlclLibClose(), "LibClose");
+	PowerCycle();
+	TEST_SUCC(RollbackKernelRead(&version), "RollbackKernelRead");
+	TEST_EQ(version, 0x20001, "  version kept");
+	TEST_SUCC(RollbackKernelWrite(0x30001), "RollbackKernelWrite");
+	TEST_SUCC(RollbackKernelRead(&version), "RollbackKernelRead");
+	TEST_EQ(version, 0x30001, "  version");
+	TEST_SUCC(TlclLibClose(), "LibClose");
+}
+
+int main(int argc, char *argv[])
+{
+	char state_file[1024];
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <temp_dir>\n", argv[0]);
+		return 255;
+	}
+	snprintf(state_file, sizeof(state_file),
+		 "%s/rollback_index4_tests.state", argv[1]);
+	setenv("TPM_SIMULATOR", state_file, 1);
+	unlink(state_file);
+
+	KernelSpaceTest();
+
+	unlink(state_file);
+	return gTestSuccess ? 0 : 255;
+}
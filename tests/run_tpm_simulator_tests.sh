@@ -0,0 +1,120 @@
+#!/bin/bash -u
+#
+# Copyright 2018 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+#
+# Run the TPM tests (normally needing a real TPM 1.2) and tpmc against the
+# simulated TPM of the host TPM stub, which is a TPM 2.0 in TPM2_MODE builds.
+
+# Load common constants and variables.
+. "$(dirname "$0")/common.sh"
+
+TPM_TEST_DIR="${TEST_DIR}/tpm_lite"
+TPMC="${BUILD_DIR}/utility/tpmc"
+export TPM_SIMULATOR="${TEST_DIR}/tpm_simulator.state"
+
+return_code=0
+
+# args: [command and args...]
+function run_tpmc {
+    "${TPMC}" "$@" 2>/dev/null
+}
+
+rm -f "${TPM_SIMULATOR}"
+
+TPM_VERSION="$("${TPMC}" tpmversion)"
+if [ "${TPM_VERSION}" = "2.0" ]; then
+  # Platform-writable, and readable with platform auth or (once the platform
+  # hierarchy is disabled) the empty index auth.
+  KERNEL_SPACE_PERM=0x40050001
+  # The TPM 2.0 library reads the ST_CLEAR flags when it starts.
+  INIT_QUERIES=1
+  TPM_TESTS=
+else
+  KERNEL_SPACE_PERM=0x1
+  INIT_QUERIES=0
+  # testsetup defines the spaces the other tests use, so it goes first.
+  TPM_TESTS="testsetup earlyextend earlynvram earlynvram2 enable fastenable
+      globallock redefine_unowned spaceperm timing writelimit"
+fi
+
+# Each test starts with a power-cycled TPM.
+for test in ${TPM_TESTS}; do
+  if TPM_SIMULATOR_RESET=1 "${TPM_TEST_DIR}/tpmtest_${test}" \
+      >/dev/null 2>&1; then
+    happy "tpmtest_${test} passed"
+  else
+    error 0 "tpmtest_${test} failed"
+    return_code=255
+  fi
+done
+
+# The state of the TPM persists across processes until the next reset.
+rm -f "${TPM_SIMULATOR}"
+TPM_SIMULATOR_RESET=1 run_tpmc startup
+run_tpmc ppon
+run_tpmc def 0x1008 0x4 "${KERNEL_SPACE_PERM}"
+run_tpmc write 0x1008 0x12 0x34 >/dev/null
+if [ "$(run_tpmc read 0x1008 0x4)" != "12 34 ff ff" ]; then
+  error 0 "tpmc read does not return the written data"
+  return_code=255
+fi
+if run_tpmc startup; then
+  error 0 "second Startup without a reset succeeded"
+  return_code=255
+fi
+TPM_SIMULATOR_RESET=1 run_tpmc startup
+# A TPM 2.0 enables the platform hierarchy at startup; disable it.
+[ "${TPM_VERSION}" = "2.0" ] && run_tpmc pplock
+if run_tpmc write 0x1008 0x56 >/dev/null; then
+  error 0 "write without physical presence succeeded"
+  return_code=255
+fi
+if [ "$(run_tpmc read 0x1008 0x2)" != "12 34" ]; then
+  error 0 "NV data is not kept across a reset"
+  return_code=255
+fi
+
+# The command counts are reported at exit.
+if ! TPM_SIMULATOR_STATS=1 "${TPMC}" getpf 2>&1 >/dev/null |
+    grep -q "GetCapability  *$((INIT_QUERIES + 1))$"; then
+  error 0 "TPM simulator does not report command counts"
+  return_code=255
+fi
+
+# A batch runs on one TPM session, and stops at the first failure unless the
+# command is prefixed with '-'.
+rm -f "${TPM_SIMULATOR}"
+BATCH_FILE="${TEST_DIR}/tpmc_batch.txt"
+cat > "${BATCH_FILE}" <<EOF
+# Provision a space
+startup
+ppon
+def 0x1008 0x4 ${KERNEL_SPACE_PERM}
+write 0x1008 0x56 0x78
+-startup
+read 0x1008 0x2
+EOF
+output="$(TPM_SIMULATOR_RESET=1 run_tpmc batch < "${BATCH_FILE}")"
+if [ "$?" != 0 ] || [ "$(echo "${output}" | tail -1)" != "56 78" ]; then
+  error 0 "tpmc batch failed"
+  return_code=255
+fi
+printf "read 0x1009 0x4\nread 0x1008 0x2\n" > "${BATCH_FILE}"
+if [ -n "$(run_tpmc batch "${BATCH_FILE}")" ]; then
+  error 0 "tpmc batch did not stop at the failing command"
+  return_code=255
+fi
+
+# A batch asks the TPM for its state only once.
+printf "getpf\ngetpf\ngetvf\n" > "${BATCH_FILE}"
+if ! TPM_SIMULATOR_STATS=1 "${TPMC}" batch "${BATCH_FILE}" 2>&1 >/dev/null |
+    grep -q "GetCapability  *$((INIT_QUERIES + 2))$"; then
+  error 0 "tpmc batch does not cache TPM state queries"
+  return_code=255
+fi
+
+rm -f "${TPM_SIMULATOR}" "${BATCH_FILE}"
+[ "${return_code}" = 0 ] && happy "TPM simulator tests passed"
+exit $return_code
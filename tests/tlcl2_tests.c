@@ -0,0 +1,276 @@
+/* Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for TPM2 lite library
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_common.h"
+#include "test_common.h"
+#include "tlcl.h"
+#include "tpm2_tss_constants.h"
+#include "vboot_common.h"
+
+/* Mock data */
+static VbError_t mock_retval;
+static VbError_t mock_send_retval;
+static uint32_t mock_property_value;
+static uint32_t mock_nv_attributes;
+static uint32_t mock_response_code;
+
+/* Command codes of mocked VbExTpmSendReceive() calls */
+#define MAXCALLS 16
+static uint32_t calls[MAXCALLS];
+static int ncalls;
+
+/**
+ * Reset mock data (for use before each test)
+ */
+static void ResetMocks(void)
+{
+	mock_retval = VBERROR_SUCCESS;
+	mock_send_retval = VBERROR_SUCCESS;
+	mock_property_value = 0;
+	mock_nv_attributes = 0;
+	mock_response_code = TPM_SUCCESS;
+
+	memset(calls, 0, sizeof(calls));
+	ncalls = 0;
+}
+
+/**
+ * Return the number of mocked TPM calls with command code <command>.
+ */
+static int CountCalls(uint32_t command)
+{
+	int i, count = 0;
+
+	for (i = 0; i < ncalls; i++)
+		if (calls[i] == command)
+			count++;
+	return count;
+}
+
+static void PutBe16(uint8_t *buf, uint16_t value)
+{
+	buf[0] = value >> 8;
+	buf[1] = value;
+}
+
+static void PutBe32(uint8_t *buf, uint32_t value)
+{
+	buf[0] = value >> 24;
+	buf[1] = value >> 16;
+	buf[2] = value >> 8;
+	buf[3] = value;
+}
+
+static uint32_t GetBe32(const uint8_t *buf)
+{
+	return (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
+
+/* Mocks */
+
+VbError_t VbExTpmInit(void)
+{
+	return mock_retval;
+}
+
+VbError_t VbExTpmClose(void)
+{
+	return mock_retval;
+}
+
+/*
+ * Answers GetCapability with mock_property_value for the requested property,
+ * NV_ReadPublic with mock_nv_attributes for the requested index, NV_Read
+ * with no data, and any other command with a bare success header.  A
+ * non-zero mock_response_code fails every command with that code instead.
+ */
+VbError_t VbExTpmSendReceive(const uint8_t *request, uint32_t request_length,
+			     uint8_t *response, uint32_t *response_length)
+{
+	uint32_t command = GetBe32(request + 6);
+	uint8_t param[4];
+	uint32_t size = 10;
+
+	/* The library reuses the request buffer for the response */
+	switch (command) {
+	case TPM2_GetCapability:
+		memcpy(param, request + 14, 4);  /* property */
+		break;
+	case TPM2_NV_ReadPublic:
+		memcpy(param, request + 10, 4);  /* nvIndex */
+		break;
+	}
+
+	if (ncalls < MAXCALLS)
+		calls[ncalls] = command;
+	ncalls++;
+
+	memset(response, 0, *response_length);
+	switch (mock_response_code ? 0 : command) {
+	case TPM2_GetCapability:
+		response[size] = 0;  /* more_data */
+		PutBe32(response + size + 1, TPM_CAP_TPM_PROPERTIES);
+		PutBe32(response + size + 5, 1);  /* count */
+		memcpy(response + size + 9, param, 4);
+		PutBe32(response + size + 13, mock_property_value);
+		size += 17;
+		break;
+	case TPM2_NV_ReadPublic:
+		PutBe16(response + size, 14);  /* nvPublic size */
+		memcpy(response + size + 2, param, 4);
+		PutBe16(response + size + 6, TPM_ALG_SHA256);
+		PutBe32(response + size + 8, mock_nv_attributes);
+		/* Empty authPolicy, zero dataSize and empty nvName */
+		size += 18;
+		break;
+	case TPM2_NV_Read:
+		PutBe32(response + size, 2);  /* parameter size */
+		/* Empty data buffer */
+		size += 6;
+		break;
+	}
+
+	PutBe16(response, TPM_ST_NO_SESSIONS);
+	PutBe32(response + 2, size);
+	PutBe32(response + 6, mock_response_code);
+	*response_length = size;
+
+	return mock_send_retval;
+}
+
+VbError_t VbExTpmGetRandom(uint8_t *buf, uint32_t length)
+{
+	memset(buf, 0xa5, length);
+	return VBERROR_SUCCESS;
+}
+
+/**
+ * Test caching of TPM properties and NV space permissions
+ */
+static void CachingTest(void)
+{
+	TPM_PERMANENT_FLAGS pflags;
+	TPM_STCLEAR_FLAGS vflags;
+	uint32_t perm;
+	uint8_t digest[TPM_SHA256_DIGEST_SIZE];
+	uint8_t buf[32], buf2[32];
+
+	memset(digest, 0, sizeof(digest));
+
+	/* Without caching, every query goes to the TPM */
+	ResetMocks();
+	TlclSetCaching(0);
+	TEST_SUCC(TlclGetPermanentFlags(&pflags), "GetPermanentFlags");
+	TEST_SUCC(TlclGetPermanentFlags(&pflags), "  again");
+	TEST_SUCC(TlclGetPermissions(0x1007, &perm), "GetPermissions");
+	TEST_SUCC(TlclGetPermissions(0x1007, &perm), "  again");
+	TEST_EQ(CountCalls(TPM2_GetCapability), 2, "  no flags cached");
+	TEST_EQ(CountCalls(TPM2_NV_ReadPublic), 2, "  no permissions cached");
+
+	/* With caching, each answer is fetched once */
+	ResetMocks();
+	TlclSetCaching(1);
+	mock_property_value = 0x101;
+	mock_nv_attributes = TPMA_NV_PPWRITE | TPMA_NV_AUTHREAD;
+	TEST_SUCC(TlclGetPermanentFlags(&pflags), "GetPermanentFlags");
+	TEST_EQ(pflags.ownerAuthSet, 1, "  ownerAuthSet");
+	TEST_EQ(pflags.disableClear, 1, "  disableClear");
+	TEST_SUCC(TlclGetSTClearFlags(&vflags), "GetSTClearFlags");
+	TEST_SUCC(TlclGetPermissions(0x1007, &perm), "GetPermissions");
+	TEST_EQ(perm, TPMA_NV_PPWRITE | TPMA_NV_AUTHREAD, "  permissions");
+
+	mock_property_value = 0;
+	mock_nv_attributes = 0;
+	TEST_SUCC(TlclGetPermanentFlags(&pflags), "GetPermanentFlags cached");
+	TEST_EQ(pflags.ownerAuthSet, 1, "  ownerAuthSet");
+	TEST_EQ(pflags.disableClear, 1, "  disableClear");
+	TEST_SUCC(TlclGetSTClearFlags(&vflags), "GetSTClearFlags cached");
+	TEST_EQ(vflags.phEnable, 1, "  phEnable");
+	TEST_SUCC(TlclGetPermissions(0x1007, &perm), "GetPermissions cached");
+	TEST_EQ(perm, TPMA_NV_PPWRITE | TPMA_NV_AUTHREAD, "  permissions");
+	TEST_EQ(ncalls, 3, "  one TPM call each");
+
+	/* A different index is not answered from the cache */
+	TEST_SUCC(TlclGetPermissions(0x1008, &perm), "GetPermissions other");
+	TEST_EQ(perm, 0, "  permissions");
+	TEST_EQ(ncalls, 4, "  not cached");
+
+	/* Reads and PCR extends keep the cache */
+	TEST_SUCC(TlclRead(0x1007, buf, 0), "Read");
+	TEST_SUCC(TlclExtend(0, digest, buf), "Extend");
+	TEST_SUCC(TlclGetPermanentFlags(&pflags), "GetPermanentFlags");
+	TEST_SUCC(TlclGetPermissions(0x1007, &perm), "GetPermissions");
+	TEST_EQ(ncalls, 6, "  still cached");
+
+	/* Commands which may change the TPM state drop the cache */
+	TEST_SUCC(TlclForceClear(), "ForceClear");
+	TEST_SUCC(TlclGetPermanentFlags(&pflags), "GetPermanentFlags");
+	TEST_EQ(pflags.ownerAuthSet, 0, "  ownerAuthSet");
+	TEST_SUCC(TlclGetPermissions(0x1007, &perm), "GetPermissions");
+	TEST_EQ(perm, 0, "  permissions");
+	TEST_EQ(CountCalls(TPM2_GetCapability), 3, "  flags refetched");
+	TEST_EQ(CountCalls(TPM2_NV_ReadPublic), 3, "  permissions refetched");
+
+	/* So do raw commands */
+	ResetMocks();
+	PutBe32(buf + 2, 10);
+	TEST_SUCC(TlclSendReceive(buf, buf2, sizeof(buf2)), "SendReceive");
+	TEST_SUCC(TlclGetPermanentFlags(&pflags), "GetPermanentFlags");
+	TEST_EQ(ncalls, 2, "  refetched");
+
+	/* And library init */
+	ResetMocks();
+	mock_property_value = 1;
+	TEST_SUCC(TlclLibInit(), "Init");
+	TEST_EQ(CountCalls(TPM2_GetCapability), 1, "  reads ST_CLEAR flags");
+	TEST_SUCC(TlclGetSTClearFlags(&vflags), "GetSTClearFlags");
+	TEST_EQ(vflags.phEnable, 1, "  phEnable");
+	TEST_EQ(ncalls, 1, "  cached by init");
+	TEST_SUCC(TlclGetPermanentFlags(&pflags), "GetPermanentFlags");
+	TEST_EQ(pflags.ownerAuthSet, 1, "  ownerAuthSet");
+	TEST_EQ(ncalls, 2, "  refetched");
+
+	/* Init succeeds before TPM2_Startup, without caching the failure */
+	ResetMocks();
+	mock_response_code = TPM_RC_INITIALIZE;
+	TEST_SUCC(TlclLibInit(), "Init before startup");
+	mock_response_code = TPM_SUCCESS;
+	TEST_SUCC(TlclGetSTClearFlags(&vflags), "GetSTClearFlags");
+	TEST_EQ(ncalls, 2, "  refetched");
+
+	/* Failed queries are not cached */
+	ResetMocks();
+	TEST_SUCC(TlclForceClear(), "ForceClear");
+	mock_send_retval = VBERROR_SIMULATED;
+	TEST_EQ(TlclGetPermanentFlags(&pflags), VBERROR_SIMULATED,
+		"GetPermanentFlags error");
+	TEST_EQ(TlclGetPermissions(0x1007, &perm), VBERROR_SIMULATED,
+		"GetPermissions error");
+	mock_send_retval = VBERROR_SUCCESS;
+	TEST_SUCC(TlclGetPermanentFlags(&pflags), "GetPermanentFlags");
+	TEST_SUCC(TlclGetPermissions(0x1007, &perm), "GetPermissions");
+	TEST_EQ(ncalls, 5, "  not cached");
+
+	/* Disabling caching drops what was cached */
+	ResetMocks();
+	TlclSetCaching(0);
+	TEST_SUCC(TlclGetPermanentFlags(&pflags), "GetPermanentFlags");
+	TEST_SUCC(TlclGetPermissions(0x1007, &perm), "GetPermissions");
+	TEST_EQ(ncalls, 2, "  cache dropped");
+}
+
+int main(void)
+{
+	CachingTest();
+
+	return gTestSuccess ? 0 : 255;
+}
@@ -573,6 +573,87 @@ static void FlagsTest(void)
 	TEST_EQ(calls[0].req_cmd, TPM_ORD_GetCapability, "  cmd");
 }
 
+/**
+ * Test caching of state queries
+ */
+static void CachingTest(void)
+{
+	TPM_PERMANENT_FLAGS pflags;
+	TPM_STCLEAR_FLAGS vflags;
+	uint8_t response[64];
+	uint8_t disable = 0, digest[kPcrDigestLength];
+
+	memset(response, 0, sizeof(response));
+	response[kTpmResponseHeaderLength + sizeof(uint32_t) +
+		 offsetof(TPM_PERMANENT_FLAGS, disable)] = 1;
+
+	/* Not cached by default */
+	ResetMocks();
+	TEST_EQ(TlclGetPermanentFlags(&pflags), 0, "GetPermanentFlags");
+	TEST_EQ(TlclGetPermanentFlags(&pflags), 0, "GetPermanentFlags again");
+	TEST_EQ(ncalls, 2, "  not cached");
+
+	ResetMocks();
+	TlclSetCaching(1);
+	calls[0].rsp = response;
+	calls[0].rsp_size = sizeof(response);
+	TEST_EQ(TlclGetPermanentFlags(&pflags), 0, "Cached GetPermanentFlags");
+	memset(&pflags, 0, sizeof(pflags));
+	TEST_EQ(TlclGetPermanentFlags(&pflags), 0, "  again");
+	TEST_EQ(pflags.disable, 1, "  disable");
+	TEST_EQ(TlclGetFlags(&disable, NULL, NULL), 0, "  GetFlags");
+	TEST_EQ(disable, 1, "  disable");
+	TEST_EQ(ncalls, 1, "  cached");
+	TEST_EQ(TlclGetSTClearFlags(&vflags), 0, "Cached GetSTClearFlags");
+	TEST_EQ(TlclGetSTClearFlags(&vflags), 0, "  again");
+	TEST_EQ(ncalls, 2, "  cached");
+	TEST_EQ(TlclIsOwned(), 0, "Cached IsOwned");
+	TEST_EQ(TlclIsOwned(), 0, "  again");
+	TEST_EQ(ncalls, 3, "  cached");
+
+	/* Commands that do not change the state keep the cache */
+	ResetMocks();
+	TEST_EQ(TlclExtend(1, digest, digest), 0, "Extend");
+	TEST_EQ(TlclGetPermanentFlags(&pflags), 0, "  GetPermanentFlags");
+	TEST_EQ(TlclIsOwned(), 0, "  IsOwned");
+	TEST_EQ(ncalls, 1, "  cached");
+
+	/* Other commands drop the cache */
+	ResetMocks();
+	TEST_EQ(TlclForceClear(), 0, "ForceClear");
+	TEST_EQ(TlclGetPermanentFlags(&pflags), 0, "  GetPermanentFlags");
+	TEST_EQ(calls[1].req_cmd, TPM_ORD_GetCapability, "  not cached");
+	TEST_EQ(TlclIsOwned(), 0, "  IsOwned");
+	TEST_EQ(calls[2].req_cmd, TPM_ORD_ReadPubek, "  not cached");
+
+	/* Only the answers of an unowned or owned TPM are cached */
+	ResetMocks();
+	TEST_EQ(TlclForceClear(), 0, "ForceClear");
+	calls[1].retval = VBERROR_SIMULATED;
+	TEST_EQ(TlclIsOwned(), 1, "IsOwned I/O error");
+	TEST_EQ(TlclIsOwned(), 0, "  again");
+	TEST_EQ(ncalls, 3, "  not cached");
+
+	ResetMocks();
+	TEST_EQ(TlclForceClear(), 0, "ForceClear");
+	SetResponse(1, TPM_E_DISABLED_CMD, 10);
+	TEST_EQ(TlclIsOwned(), 1, "IsOwned disabled");
+	TEST_EQ(TlclIsOwned(), 1, "  again");
+	TEST_EQ(ncalls, 2, "  cached");
+	TEST_EQ(TlclForceClear(), 0, "ForceClear");
+
+	ResetMocks();
+	TEST_EQ(TlclLibInit(), 0, "Init");
+	TEST_EQ(TlclGetSTClearFlags(&vflags), 0, "  GetSTClearFlags");
+	TEST_EQ(ncalls, 1, "  not cached");
+
+	ResetMocks();
+	TlclSetCaching(0);
+	TEST_EQ(TlclGetSTClearFlags(&vflags), 0, "Disabled GetSTClearFlags");
+	TEST_EQ(TlclGetSTClearFlags(&vflags), 0, "  again");
+	TEST_EQ(ncalls, 2, "  not cached");
+}
+
 /**
  * Test random
  *
@@ -1158,6 +1239,7 @@ int main(void)
 	PcrTest();
 	GetSpaceInfoTest();
 	FlagsTest();
+	CachingTest();
 	RandomTest();
 	GetVersionTest();
 	IFXFieldUpgradeInfoTest();
@@ -0,0 +1,482 @@
+/* Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for TPM2 command and response marshaling
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "2sysincludes.h"
+#include "2common.h"
+
+#include "test_common.h"
+#include "tpm2_marshaling.h"
+
+/* Empty password authorization session, as sent in commands */
+#define PW_SESSION \
+	0x00, 0x00, 0x00, 0x09, \
+	0x40, 0x00, 0x00, 0x09, \
+	0x00, 0x00, \
+	0x00, \
+	0x00, 0x00
+
+/* Authorization section of a response to a command with a session */
+#define RSP_SESSION 0x00, 0x00, 0x01, 0x00, 0x00
+
+static uint8_t buf[TPM_BUFFER_SIZE];
+static struct tpm2_response response;
+
+/**
+ * Marshal <command> and compare it with <expect>. Every buffer too short
+ * for the command must be rejected.
+ */
+static void MarshalTest(TPM_CC command, void *body,
+			const uint8_t *expect, int expect_size,
+			const char *name)
+{
+	char comment[64];
+	int size, i;
+
+	memset(buf, 0, sizeof(buf));
+	size = tpm_marshal_command(command, body, buf, sizeof(buf));
+	snprintf(comment, sizeof(comment), "%s size", name);
+	TEST_EQ(size, expect_size, comment);
+	snprintf(comment, sizeof(comment), "%s bytes", name);
+	TEST_SUCC(memcmp(buf, expect, expect_size), comment);
+	snprintf(comment, sizeof(comment), "%s packet size", name);
+	TEST_EQ(tpm_get_packet_size(buf), expect_size, comment);
+
+	/* Stops at the first buffer size which is wrongly accepted */
+	for (i = 0; i < expect_size; i++) {
+		if (tpm_marshal_command(command, body, buf, i) != -1)
+			break;
+	}
+	snprintf(comment, sizeof(comment), "%s short buffers", name);
+	TEST_EQ(i, expect_size, comment);
+}
+
+/**
+ * Unmarshal <size> bytes of <rsp> in response to <command>.
+ */
+static int Unmarshal(TPM_CC command, const uint8_t *rsp, int size)
+{
+	memset(&response, 0, sizeof(response));
+	memcpy(buf, rsp, size);
+	return tpm_unmarshal_response(command, buf, size, &response);
+}
+
+/**
+ * Every truncation of <rsp> which cuts into the response parameters must
+ * be rejected. Truncations to the bare header or to at least <min_size>
+ * bytes are accepted.
+ */
+static void TruncateTest(TPM_CC command, const uint8_t *rsp, int size,
+			 int min_size, const char *name)
+{
+	char comment[64];
+	int i;
+
+	/* Stops at the first truncation with an unexpected result */
+	for (i = 0; i < size; i++) {
+		int expect = (i == sizeof(struct tpm_header) ||
+			      i >= min_size) ? 0 : -1;
+
+		if (Unmarshal(command, rsp, i) != expect)
+			break;
+	}
+	snprintf(comment, sizeof(comment), "%s truncated", name);
+	TEST_EQ(i, size, comment);
+}
+
+/**
+ * Test command marshaling against known good encodings
+ */
+static void CommandTest(void)
+{
+	struct tpm2_nv_define_space_cmd define_space;
+	struct tpm2_nv_read_cmd nv_read;
+	struct tpm2_nv_write_cmd nv_write;
+	struct tpm2_nv_read_lock_cmd read_lock;
+	struct tpm2_nv_write_lock_cmd write_lock;
+	struct tpm2_nv_read_public_cmd read_public;
+	struct tpm2_hierarchy_control_cmd hierarchy;
+	struct tpm2_get_capability_cmd getcap;
+	struct tpm2_pcr_extend_cmd pcr_extend;
+	struct tpm2_self_test_cmd self_test;
+	struct tpm2_startup_cmd startup;
+	struct tpm2_shutdown_cmd shutdown;
+	uint8_t policy[] = {0xaa, 0xbb};
+	uint8_t data[] = {0x01, 0x02, 0x03};
+	int i;
+
+	static const uint8_t define_platform[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x2f, 0x00, 0x00, 0x01, 0x2a,
+		0x40, 0x00, 0x00, 0x0c,
+		PW_SESSION,
+		0x00, 0x00,
+		0x00, 0x10,
+		0x01, 0x00, 0x10, 0x07,
+		0x00, 0x0b,
+		0x40, 0x01, 0x00, 0x01,
+		0x00, 0x02, 0xaa, 0xbb,
+		0x00, 0x0d,
+	};
+	static const uint8_t define_owner[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x2f, 0x00, 0x00, 0x01, 0x2a,
+		0x40, 0x00, 0x00, 0x01,
+		PW_SESSION,
+		0x00, 0x02, 0xaa, 0xbb,
+		0x00, 0x0e,
+		0x01, 0x80, 0x00, 0x01,
+		0x00, 0x0b,
+		0x00, 0x04, 0x00, 0x04,
+		0x00, 0x00,
+		0x00, 0x04,
+	};
+	static const uint8_t read_platform[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x23, 0x00, 0x00, 0x01, 0x4e,
+		0x40, 0x00, 0x00, 0x0c,
+		0x01, 0x00, 0x10, 0x07,
+		PW_SESSION,
+		0x00, 0x0d,
+		0x00, 0x02,
+	};
+	static const uint8_t read_ph_disabled[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x23, 0x00, 0x00, 0x01, 0x4e,
+		0x01, 0x00, 0x10, 0x07,
+		0x01, 0x00, 0x10, 0x07,
+		PW_SESSION,
+		0x00, 0x0d,
+		0x00, 0x02,
+	};
+	static const uint8_t write_platform[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x26, 0x00, 0x00, 0x01, 0x37,
+		0x40, 0x00, 0x00, 0x0c,
+		0x01, 0x00, 0x10, 0x07,
+		PW_SESSION,
+		0x00, 0x03, 0x01, 0x02, 0x03,
+		0x00, 0x00,
+	};
+	static const uint8_t write_owner[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x26, 0x00, 0x00, 0x01, 0x37,
+		0x01, 0x80, 0x00, 0x01,
+		0x01, 0x80, 0x00, 0x01,
+		PW_SESSION,
+		0x00, 0x03, 0x01, 0x02, 0x03,
+		0x00, 0x04,
+	};
+	static const uint8_t read_lock_bytes[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x01, 0x4f,
+		0x01, 0x00, 0x10, 0x07,
+		0x01, 0x00, 0x10, 0x07,
+		PW_SESSION,
+	};
+	static const uint8_t write_lock_bytes[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x01, 0x38,
+		0x40, 0x00, 0x00, 0x0c,
+		0x01, 0x00, 0x10, 0x07,
+		PW_SESSION,
+	};
+	static const uint8_t read_public_bytes[] = {
+		0x80, 0x01, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x00, 0x01, 0x69,
+		0x01, 0x00, 0x10, 0x07,
+	};
+	static const uint8_t hierarchy_bytes[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x01, 0x21,
+		0x40, 0x00, 0x00, 0x0c,
+		PW_SESSION,
+		0x40, 0x00, 0x00, 0x0c,
+		0x00,
+	};
+	static const uint8_t getcap_bytes[] = {
+		0x80, 0x01, 0x00, 0x00, 0x00, 0x16, 0x00, 0x00, 0x01, 0x7a,
+		0x00, 0x00, 0x00, 0x06,
+		0x00, 0x00, 0x02, 0x00,
+		0x00, 0x00, 0x00, 0x01,
+	};
+	static const uint8_t clear_bytes[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x1b, 0x00, 0x00, 0x01, 0x26,
+		0x40, 0x00, 0x00, 0x0c,
+		PW_SESSION,
+	};
+	static const uint8_t pcr_extend_bytes[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x41, 0x00, 0x00, 0x01, 0x82,
+		0x00, 0x00, 0x00, 0x02,
+		PW_SESSION,
+		0x00, 0x00, 0x00, 0x01,
+		0x00, 0x0b,
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+		0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	};
+	static const uint8_t self_test_bytes[] = {
+		0x80, 0x01, 0x00, 0x00, 0x00, 0x0b, 0x00, 0x00, 0x01, 0x43,
+		0x01,
+	};
+	static const uint8_t startup_bytes[] = {
+		0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x44,
+		0x00, 0x00,
+	};
+	static const uint8_t shutdown_bytes[] = {
+		0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x45,
+		0x00, 0x01,
+	};
+
+	memset(&define_space, 0, sizeof(define_space));
+	define_space.publicInfo.nvIndex = HR_NV_INDEX + 0x1007;
+	define_space.publicInfo.nameAlg = TPM_ALG_SHA256;
+	define_space.publicInfo.attributes =
+		TPMA_NV_PLATFORMCREATE | TPMA_NV_PPREAD | TPMA_NV_PPWRITE;
+	define_space.publicInfo.authPolicy.size = sizeof(policy);
+	define_space.publicInfo.authPolicy.buffer = policy;
+	define_space.publicInfo.dataSize = 13;
+	MarshalTest(TPM2_NV_DefineSpace, &define_space, define_platform,
+		    sizeof(define_platform), "NV_DefineSpace platform");
+
+	memset(&define_space, 0, sizeof(define_space));
+	define_space.auth.size = sizeof(policy);
+	define_space.auth.buffer = policy;
+	define_space.publicInfo.nvIndex = TPMI_RH_NV_INDEX_OWNER_START + 1;
+	define_space.publicInfo.nameAlg = TPM_ALG_SHA256;
+	define_space.publicInfo.attributes =
+		TPMA_NV_AUTHREAD | TPMA_NV_AUTHWRITE;
+	define_space.publicInfo.dataSize = 4;
+	MarshalTest(TPM2_NV_DefineSpace, &define_space, define_owner,
+		    sizeof(define_owner), "NV_DefineSpace owner");
+
+	memset(&nv_read, 0, sizeof(nv_read));
+	nv_read.nvIndex = HR_NV_INDEX + 0x1007;
+	nv_read.size = 13;
+	nv_read.offset = 2;
+	MarshalTest(TPM2_NV_Read, &nv_read, read_platform,
+		    sizeof(read_platform), "NV_Read");
+	tpm_set_ph_disabled(1);
+	MarshalTest(TPM2_NV_Read, &nv_read, read_ph_disabled,
+		    sizeof(read_ph_disabled), "NV_Read ph disabled");
+	tpm_set_ph_disabled(0);
+
+	memset(&nv_write, 0, sizeof(nv_write));
+	nv_write.nvIndex = HR_NV_INDEX + 0x1007;
+	nv_write.data.t.size = sizeof(data);
+	nv_write.data.t.buffer = data;
+	MarshalTest(TPM2_NV_Write, &nv_write, write_platform,
+		    sizeof(write_platform), "NV_Write platform");
+	nv_write.nvIndex = TPMI_RH_NV_INDEX_OWNER_START + 1;
+	nv_write.offset = 4;
+	MarshalTest(TPM2_NV_Write, &nv_write, write_owner,
+		    sizeof(write_owner), "NV_Write owner");
+
+	read_lock.nvIndex = HR_NV_INDEX + 0x1007;
+	MarshalTest(TPM2_NV_ReadLock, &read_lock, read_lock_bytes,
+		    sizeof(read_lock_bytes), "NV_ReadLock");
+
+	write_lock.nvIndex = HR_NV_INDEX + 0x1007;
+	MarshalTest(TPM2_NV_WriteLock, &write_lock, write_lock_bytes,
+		    sizeof(write_lock_bytes), "NV_WriteLock");
+
+	read_public.nvIndex = HR_NV_INDEX + 0x1007;
+	MarshalTest(TPM2_NV_ReadPublic, &read_public, read_public_bytes,
+		    sizeof(read_public_bytes), "NV_ReadPublic");
+
+	hierarchy.enable = TPM_RH_PLATFORM;
+	hierarchy.state = 0;
+	MarshalTest(TPM2_Hierarchy_Control, &hierarchy, hierarchy_bytes,
+		    sizeof(hierarchy_bytes), "Hierarchy_Control");
+
+	getcap.capability = TPM_CAP_TPM_PROPERTIES;
+	getcap.property = TPM_PT_PERMANENT;
+	getcap.property_count = 1;
+	MarshalTest(TPM2_GetCapability, &getcap, getcap_bytes,
+		    sizeof(getcap_bytes), "GetCapability");
+
+	MarshalTest(TPM2_Clear, NULL, clear_bytes, sizeof(clear_bytes),
+		    "Clear");
+
+	pcr_extend.pcrHandle = HR_PCR + 2;
+	pcr_extend.digests.count = 1;
+	pcr_extend.digests.digests[0].hashAlg = TPM_ALG_SHA256;
+	for (i = 0; i < TPM_SHA256_DIGEST_SIZE; i++)
+		pcr_extend.digests.digests[0].digest[i] = i;
+	MarshalTest(TPM2_PCR_Extend, &pcr_extend, pcr_extend_bytes,
+		    sizeof(pcr_extend_bytes), "PCR_Extend");
+
+	self_test.full_test = 1;
+	MarshalTest(TPM2_SelfTest, &self_test, self_test_bytes,
+		    sizeof(self_test_bytes), "SelfTest");
+
+	startup.startup_type = TPM_SU_CLEAR;
+	MarshalTest(TPM2_Startup, &startup, startup_bytes,
+		    sizeof(startup_bytes), "Startup");
+
+	shutdown.shutdown_type = TPM_SU_STATE;
+	MarshalTest(TPM2_Shutdown, &shutdown, shutdown_bytes,
+		    sizeof(shutdown_bytes), "Shutdown");
+
+	TEST_EQ(tpm_marshal_command(0x12345678, &startup, buf, sizeof(buf)),
+		-1, "Unknown command");
+}
+
+/**
+ * Test response unmarshaling against known good encodings
+ */
+static void ResponseTest(void)
+{
+	uint8_t rsp[TPM_BUFFER_SIZE];
+	TPM_CC skip_rest[] = {
+		TPM2_Hierarchy_Control, TPM2_NV_Write, TPM2_NV_WriteLock,
+		TPM2_NV_ReadLock, TPM2_Clear, TPM2_PCR_Extend, TPM2_SelfTest,
+		TPM2_Startup, TPM2_Shutdown, TPM2_NV_DefineSpace,
+	};
+	int i;
+
+	static const uint8_t nv_read_bytes[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x05,
+		0x00, 0x03, 0xaa, 0xbb, 0xcc,
+		RSP_SESSION,
+	};
+	static const uint8_t read_public_bytes[] = {
+		0x80, 0x01, 0x00, 0x00, 0x00, 0x22, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x10,
+		0x01, 0x00, 0x10, 0x07,
+		0x00, 0x0b,
+		0x00, 0x04, 0x00, 0x04,
+		0x00, 0x02, 0xcc, 0xdd,
+		0x00, 0x0d,
+		0x00, 0x04, 0x00, 0x0b, 0x12, 0x34,
+	};
+	static const uint8_t getcap_bytes[] = {
+		0x80, 0x01, 0x00, 0x00, 0x00, 0x1b, 0x00, 0x00, 0x00, 0x00,
+		0x00,
+		0x00, 0x00, 0x00, 0x06,
+		0x00, 0x00, 0x00, 0x01,
+		0x00, 0x00, 0x02, 0x00,
+		0x00, 0x00, 0x01, 0x01,
+	};
+	static const uint8_t session_only_bytes[] = {
+		0x80, 0x02, 0x00, 0x00, 0x00, 0x13, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00,
+		RSP_SESSION,
+	};
+	static const uint8_t error_bytes[] = {
+		0x80, 0x01, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x02, 0x8b,
+	};
+
+	/* Header */
+	TEST_SUCC(Unmarshal(TPM2_NV_Read, error_bytes, sizeof(error_bytes)),
+		  "Header only");
+	TEST_EQ(response.hdr.tpm_tag, TPM_ST_NO_SESSIONS, "  tag");
+	TEST_EQ(response.hdr.tpm_size, 10, "  size");
+	TEST_EQ(response.hdr.tpm_code, 0x28b, "  code");
+	TEST_EQ(tpm_get_packet_response_code(error_bytes), 0x28b,
+		"Packet response code");
+	TEST_EQ(Unmarshal(TPM2_NV_Read, error_bytes, sizeof(error_bytes) - 1),
+		-1, "Short header");
+
+	/* NV_Read */
+	TEST_SUCC(Unmarshal(TPM2_NV_Read, nv_read_bytes,
+			    sizeof(nv_read_bytes)), "NV_Read");
+	TEST_EQ(response.hdr.tpm_tag, TPM_ST_SESSIONS, "  tag");
+	TEST_EQ(response.hdr.tpm_size, sizeof(nv_read_bytes), "  size");
+	TEST_EQ(response.hdr.tpm_code, TPM_SUCCESS, "  code");
+	TEST_EQ(response.nvr.params_size, 5, "  params size");
+	TEST_EQ(response.nvr.buffer.t.size, 3, "  data size");
+	TEST_PTR_EQ(response.nvr.buffer.t.buffer, buf + 16, "  data");
+	TruncateTest(TPM2_NV_Read, nv_read_bytes, sizeof(nv_read_bytes),
+		     19, "NV_Read");
+	memcpy(rsp, nv_read_bytes, sizeof(nv_read_bytes));
+	rsp[13] = 0x06;
+	TEST_EQ(Unmarshal(TPM2_NV_Read, rsp, sizeof(nv_read_bytes)), -1,
+		"NV_Read params size mismatch");
+	rsp[13] = 0x05;
+	rsp[15] = 0x04;
+	TEST_EQ(Unmarshal(TPM2_NV_Read, rsp, sizeof(nv_read_bytes)), -1,
+		"NV_Read data size mismatch");
+
+	/* NV_ReadPublic */
+	TEST_SUCC(Unmarshal(TPM2_NV_ReadPublic, read_public_bytes,
+			    sizeof(read_public_bytes)), "NV_ReadPublic");
+	TEST_EQ(response.nv_read_public.nvPublic.nvIndex,
+		HR_NV_INDEX + 0x1007, "  index");
+	TEST_EQ(response.nv_read_public.nvPublic.nameAlg, TPM_ALG_SHA256,
+		"  name alg");
+	TEST_EQ(response.nv_read_public.nvPublic.attributes,
+		TPMA_NV_AUTHREAD | TPMA_NV_AUTHWRITE, "  attributes");
+	TEST_EQ(response.nv_read_public.nvPublic.authPolicy.size, 2,
+		"  policy size");
+	TEST_PTR_EQ(response.nv_read_public.nvPublic.authPolicy.buffer,
+		    buf + 24, "  policy");
+	TEST_EQ(response.nv_read_public.nvPublic.dataSize, 13, "  data size");
+	TEST_EQ(response.nv_read_public.nvName.size, 4, "  name size");
+	TEST_PTR_EQ(response.nv_read_public.nvName.buffer, buf + 30,
+		    "  name");
+	TruncateTest(TPM2_NV_ReadPublic, read_public_bytes,
+		     sizeof(read_public_bytes), sizeof(read_public_bytes),
+		     "NV_ReadPublic");
+	memcpy(rsp, read_public_bytes, sizeof(read_public_bytes));
+	rsp[sizeof(read_public_bytes)] = 0;
+	TEST_EQ(Unmarshal(TPM2_NV_ReadPublic, rsp,
+			  sizeof(read_public_bytes) + 1), -1,
+		"NV_ReadPublic oversized");
+	rsp[11] = 0x11;
+	TEST_EQ(Unmarshal(TPM2_NV_ReadPublic, rsp, sizeof(read_public_bytes)),
+		-1, "NV_ReadPublic public size too large");
+	rsp[11] = 0x0f;
+	TEST_EQ(Unmarshal(TPM2_NV_ReadPublic, rsp, sizeof(read_public_bytes)),
+		-1, "NV_ReadPublic public size too small");
+
+	/* GetCapability */
+	TEST_SUCC(Unmarshal(TPM2_GetCapability, getcap_bytes,
+			    sizeof(getcap_bytes)), "GetCapability");
+	TEST_EQ(response.cap.more_data, 0, "  more data");
+	TEST_EQ(response.cap.capability_data.capability,
+		TPM_CAP_TPM_PROPERTIES, "  capability");
+	TEST_EQ(response.cap.capability_data.data.tpm_properties.count, 1,
+		"  count");
+	TEST_EQ(response.cap.capability_data.data.tpm_properties.
+		tpm_property[0].property, TPM_PT_PERMANENT, "  property");
+	TEST_EQ(response.cap.capability_data.data.tpm_properties.
+		tpm_property[0].value, 0x101, "  value");
+	TruncateTest(TPM2_GetCapability, getcap_bytes, sizeof(getcap_bytes),
+		     sizeof(getcap_bytes), "GetCapability");
+	memcpy(rsp, getcap_bytes, sizeof(getcap_bytes));
+	rsp[sizeof(getcap_bytes)] = 0;
+	TEST_EQ(Unmarshal(TPM2_GetCapability, rsp, sizeof(getcap_bytes) + 1),
+		-1, "GetCapability oversized");
+	rsp[14] = 0x05;
+	TEST_EQ(Unmarshal(TPM2_GetCapability, rsp, sizeof(getcap_bytes)), -1,
+		"GetCapability other capability");
+	rsp[14] = 0x06;
+	rsp[18] = 0x02;
+	TEST_EQ(Unmarshal(TPM2_GetCapability, rsp, sizeof(getcap_bytes)), -1,
+		"GetCapability several properties");
+
+	/* Responses without parameters, the session is ignored */
+	for (i = 0; i < ARRAY_SIZE(skip_rest); i++) {
+		char comment[64];
+
+		snprintf(comment, sizeof(comment), "Response to %#x",
+			 skip_rest[i]);
+		TEST_SUCC(Unmarshal(skip_rest[i], session_only_bytes,
+				    sizeof(session_only_bytes)), comment);
+	}
+
+	/* Unknown commands */
+	TEST_EQ(Unmarshal(0x12345678, session_only_bytes,
+			  sizeof(session_only_bytes)), -1,
+		"Response to unknown command");
+	TEST_SUCC(Unmarshal(0x12345678, error_bytes, sizeof(error_bytes)),
+		  "Header only response to unknown command");
+}
+
+int main(void)
+{
+	CommandTest();
+	ResponseTest();
+
+	return gTestSuccess ? 0 : 255;
+}
@@ -39,6 +39,10 @@ static int retval_vb2_fw_parse_gbb;
 static int retval_vb2_check_dev_switch;
 static int retval_vb2_check_tpm_clear;
 static int retval_vb2_select_fw_slot;
+static int retval_vb2ex_tpm_extend_pcrs;
+static int mock_extend_pcrs_calls;
+static struct vb2_pcr_extend mock_extends[2 + VB2_PCR_QUEUE_SIZE];
+static uint32_t mock_extends_count;
 
 /* Type of test to reset for */
 enum reset_type {
@@ -65,6 +69,9 @@ static void reset_common_data(enum reset_type t)
 	retval_vb2_check_dev_switch = VB2_SUCCESS;
 	retval_vb2_check_tpm_clear = VB2_SUCCESS;
 	retval_vb2_select_fw_slot = VB2_SUCCESS;
+	retval_vb2ex_tpm_extend_pcrs = VB2_SUCCESS;
+	mock_extend_pcrs_calls = 0;
+	mock_extends_count = 0;
 
 	memcpy(sd->gbb_hwid_digest, mock_hwid_digest,
 	       sizeof(sd->gbb_hwid_digest));
@@ -92,6 +99,17 @@ int vb2_select_fw_slot(struct vb2_context *ctx)
 	return retval_vb2_select_fw_slot;
 }
 
+int vb2ex_tpm_extend_pcrs(struct vb2_context *ctx,
+			  const struct vb2_pcr_extend *extends,
+			  uint32_t count)
+{
+	mock_extend_pcrs_calls++;
+	mock_extends_count = count;
+	if (count <= ARRAY_SIZE(mock_extends))
+		memcpy(mock_extends, extends, count * sizeof(*extends));
+	return retval_vb2ex_tpm_extend_pcrs;
+}
+
 /* Tests */
 
 static void misc_tests(void)
@@ -315,6 +333,95 @@ static void get_pcr_digest_tests(void)
 		"invalid enum vb2_pcr_digest");
 }
 
+static void extend_pcrs_tests(void)
+{
+	uint8_t digest[VB2_PCR_DIGEST_RECOMMENDED_SIZE];
+	uint32_t digest_size = sizeof(digest);
+	uint8_t tag_digest[VB2_SHA256_DIGEST_SIZE];
+	int i;
+
+	for (i = 0; i < sizeof(tag_digest); i++)
+		tag_digest[i] = 0x80 + i;
+
+	/* Boot mode and HWID are extended in one pass */
+	reset_common_data(FOR_MISC);
+	TEST_SUCC(vb2api_extend_pcrs(&cc), "extend pcrs");
+	TEST_EQ(mock_extend_pcrs_calls, 1, "  one call");
+	TEST_EQ(mock_extends_count, 2, "  count");
+	TEST_EQ(mock_extends[0].pcr, BOOT_MODE_PCR, "  boot mode pcr");
+	vb2api_get_pcr_digest(&cc, BOOT_MODE_PCR, digest, &digest_size);
+	TEST_EQ(mock_extends[0].digest_size, digest_size,
+		"  boot mode digest size");
+	TEST_SUCC(memcmp(mock_extends[0].digest, digest, digest_size),
+		  "  boot mode digest");
+	memset(digest, 0, sizeof(digest));
+	TEST_SUCC(memcmp(mock_extends[0].digest + digest_size, digest,
+			 VB2_PCR_EXTEND_DIGEST_SIZE - digest_size),
+		  "  boot mode digest padded");
+	TEST_EQ(mock_extends[1].pcr, HWID_DIGEST_PCR, "  hwid pcr");
+	TEST_EQ(mock_extends[1].digest_size, VB2_GBB_HWID_DIGEST_SIZE,
+		"  hwid digest size");
+	TEST_SUCC(memcmp(mock_extends[1].digest, mock_hwid_digest,
+			 VB2_GBB_HWID_DIGEST_SIZE), "  hwid digest");
+
+	/* They are only extended once */
+	TEST_SUCC(vb2api_extend_pcrs(&cc), "extend pcrs again");
+	TEST_EQ(mock_extend_pcrs_calls, 1, "  no call");
+
+	/* Queued extensions follow in the same pass */
+	reset_common_data(FOR_MISC);
+	TEST_SUCC(vb2api_queue_pcr_extend(&cc, 2, tag_digest,
+					  sizeof(tag_digest)), "queue");
+	TEST_SUCC(vb2api_queue_pcr_extend(&cc, 3, tag_digest, 20),
+		  "queue 2");
+	TEST_SUCC(vb2api_extend_pcrs(&cc), "extend queued");
+	TEST_EQ(mock_extend_pcrs_calls, 1, "  one call");
+	TEST_EQ(mock_extends_count, 4, "  count");
+	TEST_EQ(mock_extends[2].pcr, 2, "  queued pcr");
+	TEST_EQ(mock_extends[2].digest_size, sizeof(tag_digest),
+		"  queued digest size");
+	TEST_SUCC(memcmp(mock_extends[2].digest, tag_digest,
+			 sizeof(tag_digest)), "  queued digest");
+	TEST_EQ(mock_extends[3].pcr, 3, "  queued pcr 2");
+	TEST_EQ(mock_extends[3].digest_size, 20, "  queued digest size 2");
+	TEST_EQ(sd->pcr_queue_count, 0, "  queue emptied");
+
+	/* Extensions queued later are extended alone */
+	TEST_SUCC(vb2api_queue_pcr_extend(&cc, 2, tag_digest, 1), "queue 3");
+	TEST_SUCC(vb2api_extend_pcrs(&cc), "extend queued again");
+	TEST_EQ(mock_extend_pcrs_calls, 2, "  second call");
+	TEST_EQ(mock_extends_count, 1, "  count");
+	TEST_EQ(mock_extends[0].pcr, 2, "  queued pcr");
+	TEST_EQ(mock_extends[0].digest[0], tag_digest[0], "  queued digest");
+	memset(digest, 0, sizeof(digest));
+	TEST_SUCC(memcmp(mock_extends[0].digest + 1, digest,
+			 VB2_PCR_EXTEND_DIGEST_SIZE - 1),
+		  "  padded, though the slot held a longer digest");
+
+	/* Queue limits */
+	reset_common_data(FOR_MISC);
+	TEST_EQ(vb2api_queue_pcr_extend(&cc, 2, tag_digest, 0),
+		VB2_ERROR_API_PCR_QUEUE_DIGEST_SIZE, "queue empty digest");
+	TEST_EQ(vb2api_queue_pcr_extend(&cc, 2, tag_digest,
+					VB2_PCR_EXTEND_DIGEST_SIZE + 1),
+		VB2_ERROR_API_PCR_QUEUE_DIGEST_SIZE, "queue big digest");
+	for (i = 0; i < VB2_PCR_QUEUE_SIZE; i++)
+		vb2api_queue_pcr_extend(&cc, 2, tag_digest, 1);
+	TEST_EQ(vb2api_queue_pcr_extend(&cc, 2, tag_digest, 1),
+		VB2_ERROR_API_PCR_QUEUE_FULL, "queue full");
+	TEST_SUCC(vb2api_extend_pcrs(&cc), "extend full queue");
+	TEST_EQ(mock_extends_count, 2 + VB2_PCR_QUEUE_SIZE, "  count");
+
+	/* Failure leaves everything pending */
+	reset_common_data(FOR_MISC);
+	vb2api_queue_pcr_extend(&cc, 2, tag_digest, 1);
+	retval_vb2ex_tpm_extend_pcrs = VB2_ERROR_MOCK;
+	TEST_EQ(vb2api_extend_pcrs(&cc), VB2_ERROR_MOCK, "extend fails");
+	retval_vb2ex_tpm_extend_pcrs = VB2_SUCCESS;
+	TEST_SUCC(vb2api_extend_pcrs(&cc), "extend retried");
+	TEST_EQ(mock_extends_count, 3, "  count");
+}
+
 int main(int argc, char* argv[])
 {
 	misc_tests();
@@ -322,6 +429,7 @@ int main(int argc, char* argv[])
 	phase2_tests();
 
 	get_pcr_digest_tests();
+	extend_pcrs_tests();
 
 	return gTestSuccess ? 0 : 255;
 }
@@ -0,0 +1,76 @@
+/* Copyright 2018 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Tests for CRC-8.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "2sysincludes.h"
+#include "2crc8.h"
+
+#include "test_common.h"
+
+/* Bitwise CRC-8, as computed by the firmware build of vb2_crc8() */
+static uint8_t crc8_bitwise(const uint8_t *data, uint32_t size)
+{
+	uint8_t crc = 0;
+	int i;
+
+	for (; size; size--, data++) {
+		crc ^= *data;
+		for (i = 0; i < 8; i++)
+			crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+
+	return crc;
+}
+
+static void crc8_vector_tests(void)
+{
+	uint8_t buf[64];
+	int i;
+
+	memset(buf, 0, sizeof(buf));
+	TEST_EQ(vb2_crc8(buf, 0), 0x00, "Empty");
+	TEST_EQ(vb2_crc8("\x01", 1), 0x07, "One byte");
+	TEST_EQ(vb2_crc8("123456789", 9), 0xf4, "Check value");
+	TEST_EQ(vb2_crc8(buf, 7), 0x00, "Zeroes");
+	memset(buf, 0xff, sizeof(buf));
+	TEST_EQ(vb2_crc8(buf, 16), 0xfa, "Erased V1 NV data");
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i;
+	TEST_EQ(vb2_crc8(buf, 64), 0x8e, "Counting V2 NV data");
+}
+
+static void crc8_bitwise_tests(void)
+{
+	uint8_t buf[128];
+	uint32_t offset, size;
+	int mismatches = 0;
+	int i;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = (i * 167) ^ (i >> 3);
+
+	/* Every length, starting at every alignment */
+	for (offset = 0; offset < 4; offset++) {
+		for (size = 0; offset + size <= sizeof(buf); size++) {
+			if (vb2_crc8(buf + offset, size) !=
+			    crc8_bitwise(buf + offset, size))
+				mismatches++;
+		}
+	}
+	TEST_EQ(mismatches, 0, "Same as bitwise CRC-8");
+}
+
+int main(int argc, char* argv[])
+{
+	crc8_vector_tests();
+	crc8_bitwise_tests();
+
+	return gTestSuccess ? 0 : 255;
+}
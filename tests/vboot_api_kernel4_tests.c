@@ -37,7 +37,8 @@ static GoogleBinaryBlockHeader gbb;
 static uint32_t rkr_version;
 static uint32_t new_version;
 static struct RollbackSpaceFwmp rfr_fwmp;
-static int rkr_retval, rkw_retval, rkl_retval, rfr_retval;
+static int rkr_retval, rkw_retval, rkl_retval, rfr_retval, rcw_retval;
+static int rdw_deferring;
 static VbError_t vbboot_retval;
 
 /* Reset mock data (for use before each test) */
@@ -74,6 +75,8 @@ static void ResetMocks(void)
 
 	rkr_version = new_version = 0x10002;
 	rkr_retval = rkw_retval = rkl_retval = VBERROR_SUCCESS;
+	rcw_retval = TPM_SUCCESS;
+	rdw_deferring = 0;
 	vbboot_retval = VBERROR_SUCCESS;
 }
 
@@ -105,9 +108,23 @@ uint32_t RollbackKernelWrite(uint32_t version)
 
 uint32_t RollbackKernelLock(int recovery_mode)
 {
+	/* Pending writes must be committed before the lock */
+	if (rdw_deferring)
+		return VBERROR_SIMULATED;
 	return rkl_retval;
 }
 
+void RollbackDeferWrites(void)
+{
+	rdw_deferring = 1;
+}
+
+uint32_t RollbackCommitWrites(void)
+{
+	rdw_deferring = 0;
+	return rcw_retval;
+}
+
 uint32_t RollbackFwmpRead(struct RollbackSpaceFwmp *fwmp)
 {
 	memcpy(fwmp, &rfr_fwmp, sizeof(*fwmp));
@@ -216,6 +233,13 @@ static void VbSlkTest(void)
 	test_slk(VBERROR_TPM_WRITE_KERNEL,
 		 VB2_RECOVERY_RW_TPM_W_ERROR, "Write kernel rollback");
 
+	ResetMocks();
+	new_version = 0x20003;
+	rcw_retval = 123;
+	test_slk(VBERROR_TPM_WRITE_KERNEL,
+		 VB2_RECOVERY_RW_TPM_W_ERROR, "Commit kernel rollback");
+	TEST_EQ(rdw_deferring, 0, "  committed");
+
 	ResetMocks();
 	rkl_retval = 123;
 	test_slk(VBERROR_TPM_LOCK_KERNEL,
@@ -255,6 +279,12 @@ static void VbSlkTest(void)
 	rkr_retval = rkw_retval = rkl_retval = VBERROR_SIMULATED;
 	test_slk(0, 0, "Recovery ignore TPM errors");
 
+	ResetMocks();
+	shared->recovery_reason = 123;
+	rcw_retval = 123;
+	test_slk(VBERROR_TPM_SET_BOOT_MODE_STATE, 0,
+		 "Recovery commit boot mode");
+
 	ResetMocks();
 	shared->recovery_reason = VB2_RECOVERY_TRAIN_AND_REBOOT;
 	test_slk(VBERROR_REBOOT_REQUIRED, 0, "Recovery train and reboot");
@@ -223,6 +223,8 @@ int PrintAllParams(int force_all) {
   char buf[VB_MAX_STRING_PROPERTY];
   const char* value;
 
+  /* Read each source of the properties only once */
+  VbSystemPropertiesSnapshotBegin();
   for (p = sys_param_list; p->name; p++) {
     if (0 == force_all && (p->flags & NO_PRINT_ALL))
       continue;
@@ -243,6 +245,7 @@ int PrintAllParams(int force_all) {
            (p->flags & IS_STRING) ? "str" : "int",
            p->desc);
   }
+  VbSystemPropertiesSnapshotEnd();
   return retval;
 }
 
@@ -276,7 +279,9 @@ int main(int argc, char* argv[]) {
     return 0;
   }
 
-  /* Otherwise, loop through params and get/set them */
+  /* Otherwise, loop through params and get/set them.  All settings are
+   * written at once at the end. */
+  VbSetSystemPropertiesBegin();
   for (i = 1; i < argc && retval == 0; i++) {
     char* has_set = strchr(argv[i], '=');
     char* has_expect = strchr(argv[i], '?');
@@ -288,14 +293,16 @@ int main(int argc, char* argv[]) {
     if (!name || has_set == argv[i] || has_expect == argv[i]) {
       fprintf(stderr, "Poorly formed parameter\n");
       PrintHelp(progname);
-      return 1;
+      retval = 1;
+      break;
     }
     if (!value)
       value=""; /* Allow setting/checking an empty string ('foo=' or 'foo?') */
     if (has_set && has_expect) {
       fprintf(stderr, "Use either = or ? in a parameter, but not both.\n");
       PrintHelp(progname);
-      return 1;
+      retval = 1;
+      break;
     }
 
     /* Find the parameter */
@@ -303,7 +310,8 @@ int main(int argc, char* argv[]) {
     if (!p) {
       fprintf(stderr, "Invalid parameter name: %s\n", name);
       PrintHelp(progname);
-      return 1;
+      retval = 1;
+      break;
     }
 
     if (i > 1)
@@ -319,5 +327,10 @@ int main(int argc, char* argv[]) {
       retval = PrintParam(p);
   }
 
+  if (VbSetSystemPropertiesCommit()) {
+    fprintf(stderr, "Failed to write parameters\n");
+    retval = 1;
+  }
+
   return retval;
 }
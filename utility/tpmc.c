@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "tlcl.h"
 #include "tpm_error_messages.h"
@@ -609,6 +610,105 @@ command_record command_table[] = {
 
 static int n_commands = sizeof(command_table) / sizeof(command_table[0]);
 
+/* Returns the command with given name or abbreviation, or NULL.
+ */
+static command_record* FindCommand(const char* cmd) {
+  command_record* c;
+  for (c = command_table; c < command_table + n_commands; c++) {
+    if (strcmp(cmd, c->name) == 0 || strcmp(cmd, c->abbr) == 0) {
+      return c;
+    }
+  }
+  return NULL;
+}
+
+#define BATCH_MAX_LINE 4096
+#define BATCH_MAX_ARGS 512
+
+static uint64_t MonotonicUsecs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Runs commands read from |fp| on one TPM session, one command (with its
+ * arguments) per line.  Blank lines and lines starting with '#' are skipped.
+ * The batch stops at the first failing command, unless the command is
+ * prefixed with '-'.  Invalid arguments still exit the program, as they do for
+ * a single command.  The result and time of each command, and a summary, are
+ * printed to stderr.  Returns the exit code of the failing command, or 0.
+ */
+static int RunBatch(FILE* fp, char* progname) {
+  char line[BATCH_MAX_LINE];
+  char* batch_args[BATCH_MAX_ARGS];
+  int line_number = 0, num_commands = 0, num_failed = 0;
+  uint64_t start, usecs, total_usecs = 0;
+
+  while (fgets(line, sizeof(line), fp)) {
+    command_record* c;
+    uint32_t result;
+    int may_fail = 0;
+    char* token;
+    char* cmd;
+    uint8_t exit_code;
+
+    line_number++;
+    if (!strchr(line, '\n') && !feof(fp)) {
+      fprintf(stderr, "%s: line %d is too long\n", progname, line_number);
+      return OTHER_ERROR;
+    }
+    nargs = 0;
+    batch_args[nargs++] = progname;
+    for (token = strtok(line, " \t\r\n"); token;
+         token = strtok(NULL, " \t\r\n")) {
+      if (nargs == BATCH_MAX_ARGS) {
+        fprintf(stderr, "%s: too many arguments on line %d\n", progname,
+                line_number);
+        return OTHER_ERROR;
+      }
+      batch_args[nargs++] = token;
+    }
+    if (nargs == 1 || batch_args[1][0] == '#') {
+      continue;
+    }
+    if (batch_args[1][0] == '-') {
+      may_fail = 1;
+      batch_args[1]++;
+    }
+    cmd = batch_args[1];
+    args = batch_args;
+
+    c = FindCommand(cmd);
+    if (!c) {
+      fprintf(stderr, "%s: unknown command on line %d: %s\n", progname,
+              line_number, cmd);
+      return OTHER_ERROR;
+    }
+
+    start = MonotonicUsecs();
+    result = c->handler();
+    usecs = MonotonicUsecs() - start;
+    total_usecs += usecs;
+    num_commands++;
+    fflush(stdout);
+    fprintf(stderr, "batch: line %d: %s: 0x%x (%d.%03d ms)\n", line_number,
+            cmd, result, (int)(usecs / 1000), (int)(usecs % 1000));
+
+    exit_code = ErrorCheck(result, cmd);
+    if (exit_code) {
+      num_failed++;
+      if (!may_fail) {
+        fprintf(stderr, "batch: stopped at line %d\n", line_number);
+        return exit_code;
+      }
+    }
+  }
+  fprintf(stderr, "batch: %d commands, %d failed, %d.%03d ms\n",
+          num_commands, num_failed, (int)(total_usecs / 1000),
+          (int)(total_usecs % 1000));
+  return 0;
+}
+
 int main(int argc, char* argv[]) {
   char *progname;
   uint32_t result;
@@ -620,8 +720,8 @@ int main(int argc, char* argv[]) {
     progname = argv[0];
 
   if (argc < 2) {
-    fprintf(stderr, "usage: %s <TPM command> [args]\n   or: %s help\n",
-            progname, progname);
+    fprintf(stderr, "usage: %s <TPM command> [args]\n   or: %s help\n"
+            "   or: %s batch [<file>]\n", progname, progname, progname);
     return OTHER_ERROR;
   } else {
     command_record* c;
@@ -635,6 +735,8 @@ int main(int argc, char* argv[]) {
       for (c = command_table; c < command_table + n_commands; c++) {
         printf("%26s %7s  %s\n", c->name, c->abbr, c->description);
       }
+      printf("%26s %7s  %s\n", "batch", "",
+             "run commands from a file or stdin (batch [<file>])");
       return 0;
     }
     if (!strcmp(cmd, "tpmversion") || !strcmp(cmd, "tpmver")) {
@@ -647,10 +749,34 @@ int main(int argc, char* argv[]) {
       return result > OTHER_ERROR ? OTHER_ERROR : result;
     }
 
-    for (c = command_table; c < command_table + n_commands; c++) {
-      if (strcmp(cmd, c->name) == 0 || strcmp(cmd, c->abbr) == 0) {
-        return ErrorCheck(c->handler(), cmd);
+    if (strcmp(cmd, "batch") == 0) {
+      FILE* fp = stdin;
+      int exit_code;
+      if (argc > 3) {
+        fprintf(stderr, "usage: %s batch [<file>]\n", progname);
+        return OTHER_ERROR;
+      }
+      if (argc == 3 && strcmp(argv[2], "-") != 0) {
+        fp = fopen(argv[2], "r");
+        if (!fp) {
+          perror(argv[2]);
+          return OTHER_ERROR;
+        }
       }
+      /* The TPM state is only queried once per batch, until a command may
+       * change it. */
+      TlclSetCaching(1);
+      exit_code = RunBatch(fp, progname);
+      if (fp != stdin) {
+        fclose(fp);
+      }
+      TlclLibClose();
+      return exit_code;
+    }
+
+    c = FindCommand(cmd);
+    if (c) {
+      return ErrorCheck(c->handler(), cmd);
     }
 
     /* No command matched. */